@@ -0,0 +1,47 @@
+/* Copyright 2007-2010 Jozsef Kadlecsik (kadlec@netfilter.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef LIBIPSET_AGGREGATE_H
+#define LIBIPSET_AGGREGATE_H
+
+#include <stdbool.h>				/* bool */
+#include <stdint.h>				/* uintxx_t */
+
+#include <libipset/nf_inet_addr.h>		/* union nf_inet_addr */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The networks of a hash:net set collected at restore */
+struct ipset_aggr;
+
+/* Called for the networks to be added to the set */
+typedef int (*ipset_aggr_fn)(const union nf_inet_addr *ip, uint8_t cidr,
+			     void *p);
+
+extern struct ipset_aggr *ipset_aggr_init(uint8_t family);
+extern void ipset_aggr_fini(struct ipset_aggr *aggr);
+extern int ipset_aggr_add(struct ipset_aggr *aggr,
+			  const union nf_inet_addr *ip,
+			  const union nf_inet_addr *ip_to, uint8_t cidr,
+			  bool fixed);
+extern bool ipset_aggr_pending(const struct ipset_aggr *aggr);
+extern int ipset_aggr_stale(struct ipset_aggr *aggr, ipset_aggr_fn fn,
+			    void *p);
+extern int ipset_aggr_walk(struct ipset_aggr *aggr, bool merge,
+			   ipset_aggr_fn fn, void *p);
+extern unsigned int ipset_aggr_quantize_plan(const struct ipset_aggr *aggr,
+					     unsigned int max, uint8_t *cidrs,
+					     uint64_t *cost);
+extern int ipset_aggr_quantize(const struct ipset_aggr *aggr,
+			       unsigned int max, ipset_aggr_fn fn, void *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBIPSET_AGGREGATE_H */
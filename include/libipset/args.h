@@ -56,6 +56,12 @@ enum ipset_keywords {
 	IPSET_ARG_SKBMARK,			/* skbmark */
 	IPSET_ARG_SKBPRIO,			/* skbprio */
 	IPSET_ARG_SKBQUEUE,			/* skbqueue */
+	/* Memory limit */
+	IPSET_ARG_MEMLIMIT,			/* memlimit */
+	/* Statistics */
+	IPSET_ARG_STATS,			/* stats */
+	/* Prefix lengths */
+	IPSET_ARG_QUANTIZE,			/* cidr-quantize */
 	IPSET_ARG_MAX,
 };
 
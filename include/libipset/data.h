@@ -67,6 +67,9 @@ enum ipset_opt {
 	IPSET_OPT_SKBPRIO,
 	IPSET_OPT_SKBQUEUE,
 	IPSET_OPT_IFACE_WILDCARD,
+	/* Create-specific options, continued */
+	IPSET_OPT_MEMLIMIT,
+	IPSET_OPT_STATS,
 	/* Internal options */
 	IPSET_OPT_FLAGS = 48,	/* IPSET_FLAG_EXIST| */
 	IPSET_OPT_CADT_FLAGS,	/* IPSET_FLAG_BEFORE| */
@@ -76,6 +79,8 @@ enum ipset_opt {
 	IPSET_OPT_REVISION,
 	IPSET_OPT_REVISION_MIN,
 	IPSET_OPT_INDEX,
+	/* Create-specific options, continued */
+	IPSET_OPT_QUANTIZE,
 	IPSET_OPT_MAX,
 };
 
@@ -103,7 +108,10 @@ enum ipset_opt {
 	| IPSET_FLAG(IPSET_OPT_COUNTERS)\
 	| IPSET_FLAG(IPSET_OPT_CREATE_COMMENT)\
 	| IPSET_FLAG(IPSET_OPT_FORCEADD)\
-	| IPSET_FLAG(IPSET_OPT_SKBINFO))
+	| IPSET_FLAG(IPSET_OPT_SKBINFO)\
+	| IPSET_FLAG(IPSET_OPT_MEMLIMIT)\
+	| IPSET_FLAG(IPSET_OPT_STATS)	\
+	| IPSET_FLAG(IPSET_OPT_QUANTIZE))
 
 #define IPSET_ADT_FLAGS			\
 	(IPSET_FLAG(IPSET_OPT_IP)	\
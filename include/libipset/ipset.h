@@ -53,6 +53,8 @@ extern void ipset_port_usage(void);
 extern int ipset_parse_filename(struct ipset *ipset, int opt, const char *str);
 extern int ipset_parse_output(struct ipset *ipset,
 			      int opt, const char *str);
+extern int ipset_parse_jobs(struct ipset *ipset,
+			    int opt, const char *str);
 extern int ipset_envopt_parse(struct ipset *ipset,
 			      int env, const char *str);
 
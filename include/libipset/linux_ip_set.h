@@ -41,17 +41,19 @@ enum ipset_cmd {
 	IPSET_CMD_TYPE,		/* 13: Get set type */
 	IPSET_CMD_GET_BYNAME,	/* 14: Get set index by name */
 	IPSET_CMD_GET_BYINDEX,	/* 15: Get set name by index */
+	IPSET_CMD_ZERO,		/* 16: Zero the statistics of set(s) */
 	IPSET_MSG_MAX,		/* Netlink message commands */
 
 	/* Commands in userspace: */
-	IPSET_CMD_RESTORE = IPSET_MSG_MAX, /* 16: Enter restore mode */
-	IPSET_CMD_HELP,		/* 17: Get help */
-	IPSET_CMD_VERSION,	/* 18: Get program version */
-	IPSET_CMD_QUIT,		/* 19: Quit from interactive mode */
+	IPSET_CMD_RESTORE = IPSET_MSG_MAX, /* 17: Enter restore mode */
+	IPSET_CMD_HELP,		/* 18: Get help */
+	IPSET_CMD_VERSION,	/* 19: Get program version */
+	IPSET_CMD_QUIT,		/* 20: Quit from interactive mode */
+	IPSET_CMD_STATS,	/* 21: List the statistics of set(s) */
 
 	IPSET_CMD_MAX,
 
-	IPSET_CMD_COMMIT = IPSET_CMD_MAX, /* 20: Commit buffered commands */
+	IPSET_CMD_COMMIT = IPSET_CMD_MAX, /* 22: Commit buffered commands */
 };
 
 /* Attributes at command level */
@@ -70,6 +72,7 @@ enum {
 	IPSET_ATTR_PROTOCOL_MIN, /* 10: Minimal supported version number */
 	IPSET_ATTR_REVISION_MIN	= IPSET_ATTR_PROTOCOL_MIN, /* type rev min */
 	IPSET_ATTR_INDEX,	/* 11: Kernel index of set */
+	IPSET_ATTR_PACKED,	/* 12: Packed element records */
 	__IPSET_ATTR_CMD_MAX,
 };
 #define IPSET_ATTR_CMD_MAX	(__IPSET_ATTR_CMD_MAX - 1)
@@ -103,6 +106,14 @@ enum {
 	IPSET_ATTR_ELEMENTS,
 	IPSET_ATTR_REFERENCES,
 	IPSET_ATTR_MEMSIZE,
+	/* Create-only specific attributes, continued */
+	IPSET_ATTR_MEMLIMIT,
+	/* Kernel-only, continued */
+	IPSET_ATTR_STATS,
+	/* Create-only specific attributes, continued */
+	IPSET_ATTR_QUANTIZE,
+	/* Kernel-only, continued */
+	IPSET_ATTR_CIDRS,
 
 	__IPSET_ATTR_CREATE_MAX,
 };
@@ -128,6 +139,25 @@ enum {
 };
 #define IPSET_ATTR_ADT_MAX	(__IPSET_ATTR_ADT_MAX - 1)
 
+/* Statistics attributes, nested in IPSET_ATTR_STATS */
+enum {
+	IPSET_ATTR_STATS_UNSPEC,
+	IPSET_ATTR_STATS_TESTS,		/* 1: Lookups */
+	IPSET_ATTR_STATS_HITS,		/* 2: Matching lookups */
+	IPSET_ATTR_STATS_BUCKETS,	/* 3: Buckets visited by lookups */
+	IPSET_ATTR_STATS_PROBES,	/* 4: Bucket slots scanned by lookups */
+	IPSET_ATTR_STATS_KADDS,		/* 5: Adds from the kernel */
+	IPSET_ATTR_STATS_KDELS,		/* 6: Deletes from the kernel */
+	IPSET_ATTR_STATS_UADDS,		/* 7: Adds from userspace */
+	IPSET_ATTR_STATS_UDELS,		/* 8: Deletes from userspace */
+	IPSET_ATTR_STATS_RESIZES,	/* 9: Grown hash tables */
+	IPSET_ATTR_STATS_EXPIRED,	/* 10: Timed out elements */
+	IPSET_ATTR_STATS_FULL,		/* 11: Adds refused by a full set */
+	IPSET_ATTR_STATS_PAD,
+	__IPSET_ATTR_STATS_MAX,
+};
+#define IPSET_ATTR_STATS_MAX	(__IPSET_ATTR_STATS_MAX - 1)
+
 /* IP specific attributes */
 enum {
 	IPSET_ATTR_IPADDR_IPV4 = IPSET_ATTR_UNSPEC + 1,
@@ -157,6 +187,7 @@ enum ipset_errno {
 	IPSET_ERR_COMMENT,
 	IPSET_ERR_INVALID_MARKMASK,
 	IPSET_ERR_SKBINFO,
+	IPSET_ERR_MEMLIMIT,
 
 	/* Type specific error codes */
 	IPSET_ERR_TYPE_SPECIFIC = 4352,
@@ -186,6 +217,8 @@ enum ipset_cmd_flags {
 	IPSET_FLAG_MAP_SKBPRIO = (1 << IPSET_FLAG_BIT_MAP_SKBPRIO),
 	IPSET_FLAG_BIT_MAP_SKBQUEUE = 10,
 	IPSET_FLAG_MAP_SKBQUEUE = (1 << IPSET_FLAG_BIT_MAP_SKBQUEUE),
+	IPSET_FLAG_BIT_LIST_PACKED = 11,
+	IPSET_FLAG_LIST_PACKED	= (1 << IPSET_FLAG_BIT_LIST_PACKED),
 	IPSET_FLAG_CMD_MAX = 15,
 };
 
@@ -207,6 +240,8 @@ enum ipset_cadt_flags {
 	IPSET_FLAG_WITH_SKBINFO = (1 << IPSET_FLAG_BIT_WITH_SKBINFO),
 	IPSET_FLAG_BIT_IFACE_WILDCARD = 7,
 	IPSET_FLAG_IFACE_WILDCARD = (1 << IPSET_FLAG_BIT_IFACE_WILDCARD),
+	IPSET_FLAG_BIT_WITH_STATS = 8,
+	IPSET_FLAG_WITH_STATS = (1 << IPSET_FLAG_BIT_WITH_STATS),
 	IPSET_FLAG_CADT_MAX	= 15,
 };
 
@@ -276,6 +311,21 @@ struct ip_set_counter_match {
 	__u8 op;
 };
 
+/* Packed element records of the compact LIST/SAVE dump */
+struct ip_set_packed4 {
+	__be32 ip;
+	__u8 cidr;		/* zero when the type has got no prefix */
+	__u8 flags;		/* CADT flags of the element */
+	__u16 pad;
+};
+
+struct ip_set_packed6 {
+	__be32 ip6[4];
+	__u8 cidr;
+	__u8 flags;
+	__u16 pad;
+};
+
 /* Interface to iptables/ip6tables */
 
 #define SO_IP_SET		83
@@ -18,6 +18,8 @@ enum {
 	IPSET_ERR_HASH_RANGE_UNSUPPORTED,
 	/* Invalid range */
 	IPSET_ERR_HASH_RANGE,
+	/* Too many prefix lengths */
+	IPSET_ERR_HASH_CIDRS,
 };
 
 
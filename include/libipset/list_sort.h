@@ -94,7 +94,7 @@ static inline void list_splice(const struct list_head *list,
 	     pos = n, n = list_entry(n->member.next, typeof(*n), member))
 
 #ifndef unlikely
-#define unlikely(x)		(!!(x) == 0)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
 #endif
 
 extern void list_sort(void *priv, struct list_head *head,
@@ -27,7 +27,11 @@ extern "C" {
 #endif
 
 extern int ipset_get_nlmsg_type(const struct nlmsghdr *nlh);
+extern void ipset_mnl_fill_hdr(struct ipset_handle *handle,
+			       enum ipset_cmd cmd, void *buffer, size_t len,
+			       uint8_t envflags);
 extern const struct ipset_transport ipset_mnl_transport;
+extern const struct ipset_transport ipset_fake_transport;
 
 #ifdef __cplusplus
 }
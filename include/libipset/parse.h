@@ -92,6 +92,8 @@ extern int ipset_parse_uint8(struct ipset_session *session,
 			     enum ipset_opt opt, const char *str);
 extern int ipset_parse_netmask(struct ipset_session *session,
 			       enum ipset_opt opt, const char *str);
+extern int ipset_parse_quantize(struct ipset_session *session,
+				enum ipset_opt opt, const char *str);
 extern int ipset_parse_flag(struct ipset_session *session,
 			    enum ipset_opt opt, const char *str);
 extern int ipset_parse_typename(struct ipset_session *session,
@@ -118,6 +120,8 @@ extern int ipset_parse_iptimeout(struct ipset_session *session,
 extern int ipset_parse_name_compat(struct ipset_session *session,
 				   enum ipset_opt opt, const char *str);
 
+extern unsigned int ipset_parse_name_lookups(void);
+
 #ifdef __cplusplus
 }
 #endif
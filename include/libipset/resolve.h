@@ -0,0 +1,35 @@
+/* Copyright 2007-2010 Jozsef Kadlecsik (kadlec@netfilter.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef LIBIPSET_RESOLVE_H
+#define LIBIPSET_RESOLVE_H
+
+#include <stdint.h>				/* uintxx_t */
+
+#include <libipset/nf_inet_addr.h>		/* union nf_inet_addr */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Hostnames resolved ahead of parsing at restore */
+struct ipset_resolve;
+
+extern struct ipset_resolve *ipset_resolve_init(void);
+extern void ipset_resolve_fini(struct ipset_resolve *resolve);
+extern int ipset_resolve_add(struct ipset_resolve *resolve,
+			     const char *name, uint8_t family);
+extern unsigned int ipset_resolve_run(struct ipset_resolve *resolve,
+				      unsigned int timeout);
+extern int ipset_resolve_get(struct ipset_resolve *resolve,
+			     const char *name, uint8_t family,
+			     union nf_inet_addr *ip);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBIPSET_RESOLVE_H */
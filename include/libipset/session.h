@@ -16,9 +16,15 @@
 /* Report and output buffer sizes */
 #define IPSET_ERRORBUFLEN		1024
 #define IPSET_OUTBUFLEN			8192
+/* Max number of parallel jobs when saving sets */
+#define IPSET_JOBS_MAX			256
+/* Max number of sets with pending messages when grouping restore lines */
+#define IPSET_GROUP_MAX			256
 
 struct ipset_session;
 struct ipset_data;
+struct ipset_resolve;
+struct ipset_transport;
 
 #ifdef __cplusplus
 extern "C" {
@@ -84,6 +90,18 @@ enum ipset_envopt {
 	IPSET_ENV_LIST_SETNAME	= (1 << IPSET_ENV_BIT_LIST_SETNAME),
 	IPSET_ENV_BIT_LIST_HEADER = 5,
 	IPSET_ENV_LIST_HEADER	= (1 << IPSET_ENV_BIT_LIST_HEADER),
+	IPSET_ENV_BIT_GROUP	= 6,
+	IPSET_ENV_GROUP		= (1 << IPSET_ENV_BIT_GROUP),
+	IPSET_ENV_BIT_CACHE	= 7,
+	IPSET_ENV_CACHE		= (1 << IPSET_ENV_BIT_CACHE),
+	IPSET_ENV_BIT_PHASES	= 8,
+	IPSET_ENV_PHASES	= (1 << IPSET_ENV_BIT_PHASES),
+	IPSET_ENV_BIT_ZERO	= 9,
+	IPSET_ENV_ZERO		= (1 << IPSET_ENV_BIT_ZERO),
+	IPSET_ENV_BIT_AGGREGATE	= 10,
+	IPSET_ENV_AGGREGATE	= (1 << IPSET_ENV_BIT_AGGREGATE),
+	IPSET_ENV_BIT_TOTAL	= 11,
+	IPSET_ENV_TOTAL		= (1 << IPSET_ENV_BIT_TOTAL),
 };
 
 extern bool ipset_envopt_test(struct ipset_session *session,
@@ -98,15 +116,50 @@ enum ipset_output_mode {
 	IPSET_LIST_PLAIN,
 	IPSET_LIST_SAVE,
 	IPSET_LIST_XML,
+	IPSET_LIST_BINARY,
 };
 
+/* Binary snapshot of the sets, see lib/PROTOCOL */
+#define IPSET_SNAPSHOT_MAGIC		"\x89" "ipset\r\n"
+#define IPSET_SNAPSHOT_VERSION		1
+
 extern int ipset_session_output(struct ipset_session *session,
 				enum ipset_output_mode mode);
+extern int ipset_session_jobs(struct ipset_session *session,
+			      unsigned int jobs);
+extern int ipset_session_transport(struct ipset_session *session,
+				   const struct ipset_transport *transport);
 
 extern int ipset_commit(struct ipset_session *session);
+extern int ipset_snapshot_restore(struct ipset_session *session, FILE *f);
 extern int ipset_cmd(struct ipset_session *session, enum ipset_cmd cmd,
 		     uint32_t lineno);
 
+/* Non-blocking mode */
+typedef void (*ipset_async_fn)(struct ipset_session *session, int status,
+			       uint32_t lineno, const char *msg, void *p);
+
+extern int ipset_session_fd(struct ipset_session *session);
+extern int ipset_cmd_async(struct ipset_session *session, enum ipset_cmd cmd,
+			   uint32_t lineno, ipset_async_fn fn, void *p);
+extern int ipset_async_process(struct ipset_session *session);
+extern unsigned int ipset_async_pending(const struct ipset_session *session);
+extern int ipset_async_wait(struct ipset_session *session);
+
+/* Phases of the commands, timed with IPSET_ENV_PHASES */
+enum ipset_phase {
+	IPSET_PHASE_PARSE,		/* Reading and parsing the input */
+	IPSET_PHASE_ENCODE,		/* Building the netlink messages */
+	IPSET_PHASE_KERNEL,		/* Waiting for the kernel */
+	IPSET_PHASE_FORMAT,		/* Printing list/save output */
+	IPSET_PHASE_MAX,
+};
+
+extern uint64_t ipset_session_phase_time(const struct ipset_session *session,
+					 enum ipset_phase phase);
+extern struct ipset_resolve *
+	ipset_session_resolve(struct ipset_session *session);
+
 typedef int (*ipset_print_outfn)(struct ipset_session *session,
 	void *p, const char *fmt, ...)
 	__attribute__ ((format (printf, 3, 4)));
@@ -122,6 +122,7 @@ extern const char *ipset_typename_resolve(const char *str);
 extern bool ipset_match_typename(const char *str,
 				 const struct ipset_type *t);
 extern void ipset_load_types(void);
+extern uint64_t ipset_types_load_time(void);
 
 #ifdef __cplusplus
 }
@@ -9,9 +9,11 @@
 
 #include <linux/ip.h>
 #include <linux/ipv6.h>
+#include <linux/jump_label.h>
 #include <linux/netlink.h>
 #include <linux/netfilter.h>
 #include <linux/netfilter/x_tables.h>
+#include <linux/percpu.h>
 #include <linux/stringify.h>
 #include <linux/vmalloc.h>
 #include <net/netlink.h>
@@ -99,6 +101,9 @@ struct ip_set_counter {
 
 struct ip_set_comment_rcu {
 	struct rcu_head rcu;
+	struct hlist_node node;	/* in the intern table of the set */
+	u32 ref;		/* number of elements sharing the comment */
+	u32 hash;		/* hash of the comment string */
 	char str[0];
 };
 
@@ -160,6 +165,7 @@ struct ip_set_type_variant {
 
 	/* Userspace: test/add/del entries
 	 *		returns negative error code,
+	 *			-ERANGE when a range is to be continued,
 	 *			zero for no match/success to add/delete
 	 *			positive for matching element */
 	int (*uadt)(struct ip_set *set, struct nlattr *tb[],
@@ -184,6 +190,8 @@ struct ip_set_type_variant {
 	/* Keep listing private when resizing runs parallel */
 	void (*uref)(struct ip_set *set, struct netlink_callback *cb,
 		     bool start);
+	/* Calculate the actual memory size of the set */
+	size_t (*memsize)(const struct ip_set *set);
 
 	/* Return true if "b" set is the same as "a"
 	 * according to the create set parameters */
@@ -226,6 +234,21 @@ struct ip_set_type {
 extern int ip_set_type_register(struct ip_set_type *set_type);
 extern void ip_set_type_unregister(struct ip_set_type *set_type);
 
+/* Lookup and update statistics of a set, per CPU */
+struct ip_set_stats {
+	u64 tests;		/* Lookups */
+	u64 hits;		/* Matching lookups */
+	u64 buckets;		/* Buckets visited by lookups */
+	u64 probes;		/* Bucket slots scanned by lookups */
+	u64 kadds;		/* Adds from the kernel */
+	u64 kdels;		/* Deletes from the kernel */
+	u64 uadds;		/* Adds from userspace */
+	u64 udels;		/* Deletes from userspace */
+	u64 resizes;		/* Grown hash tables */
+	u64 expired;		/* Timed out elements */
+	u64 full;		/* Adds refused by a full set */
+};
+
 /* A generic IP set */
 struct ip_set {
 	/* The name of the set */
@@ -252,6 +275,8 @@ struct ip_set {
 	u8 flags;
 	/* Default timeout value, if enabled */
 	u32 timeout;
+	/* Max memory size of the set, if enabled */
+	u32 memlimit;
 	/* Number of elements (vs timeout) */
 	u32 elements;
 	/* Size of the dynamic extensions (vs timeout) */
@@ -260,10 +285,30 @@ struct ip_set {
 	size_t dsize;
 	/* Offsets to extensions in elements */
 	size_t offset[IPSET_EXT_ID_MAX];
+	/* Interned comments of the elements (vs comment) */
+	struct hlist_head *comments;
+	/* Statistics of the set, if enabled */
+	struct ip_set_stats __percpu *stats;
 	/* The type specific data */
 	void *data;
 };
 
+/* Enabled as long as there is a set with statistics, so the counting
+ * costs nothing to the other sets until the first one is created.
+ */
+DECLARE_STATIC_KEY_FALSE(ip_set_stats_key);
+
+#define SET_WITH_STATS(set)					\
+	(static_branch_unlikely(&ip_set_stats_key) && (set)->stats)
+
+#define ip_set_stats_add(set, field, n)				\
+do {								\
+	if (SET_WITH_STATS(set))				\
+		this_cpu_add((set)->stats->field, n);		\
+} while (0)
+
+#define ip_set_stats_inc(set, field)	ip_set_stats_add(set, field, 1)
+
 static inline void
 ip_set_ext_destroy(struct ip_set *set, void *data)
 {
@@ -277,7 +322,16 @@ ip_set_ext_destroy(struct ip_set *set, void *data)
 	}
 }
 
+/* Check whether the memory limit of the set is reached */
+static inline bool
+ip_set_memlimit_reached(const struct ip_set *set)
+{
+	return set->memlimit &&
+	       set->variant->memsize(set) >= set->memlimit;
+}
+
 int ip_set_put_flags(struct sk_buff *skb, struct ip_set *set);
+int ip_set_put_stats(struct sk_buff *skb, struct ip_set *set);
 
 /* Netlink CB args */
 enum {
@@ -417,6 +471,47 @@ static inline int nla_put_ipaddr6(struct sk_buff *skb, int type,
 	return ret;
 }
 
+/* Check whether the elements of the set can be dumped in packed records */
+static inline bool
+ip_set_dump_packed(const struct ip_set *set, const struct netlink_callback *cb)
+{
+	/* The dump flags are stored in the upper half of the dump type */
+	return !set->extensions &&
+	       (((u32)cb->args[IPSET_CB_DUMP] >> 16) & IPSET_FLAG_LIST_PACKED);
+}
+
+/* Append a packed element record to the dump, true if it does not fit */
+static inline bool
+ip_set_put_packed4(struct sk_buff *skb, __be32 ip, u8 cidr, u8 flags)
+{
+	struct ip_set_packed4 *rec;
+
+	if (skb_tailroom(skb) < sizeof(*rec))
+		return true;
+	rec = (struct ip_set_packed4 *)skb_put(skb, sizeof(*rec));
+	rec->ip = ip;
+	rec->cidr = cidr;
+	rec->flags = flags;
+	rec->pad = 0;
+	return false;
+}
+
+static inline bool
+ip_set_put_packed6(struct sk_buff *skb, const struct in6_addr *ip,
+		   u8 cidr, u8 flags)
+{
+	struct ip_set_packed6 *rec;
+
+	if (skb_tailroom(skb) < sizeof(*rec))
+		return true;
+	rec = (struct ip_set_packed6 *)skb_put(skb, sizeof(*rec));
+	memcpy(rec->ip6, ip, sizeof(rec->ip6));
+	rec->cidr = cidr;
+	rec->flags = flags;
+	rec->pad = 0;
+	return false;
+}
+
 /* Get address from skbuff */
 static inline __be32
 ip4addr(const struct sk_buff *skb, bool src)
@@ -460,6 +555,11 @@ bitmap_bytes(u32 a, u32 b)
 /* Max timeout value, see msecs_to_jiffies() in jiffies.h */
 #define IPSET_MAX_TIMEOUT	(UINT_MAX >> 1)/MSEC_PER_SEC
 
+/* Max number of elements of a range added/deleted with the set locked,
+ * the rest of the range is continued after releasing the lock
+ */
+#define IPSET_RANGE_CHUNK	4096
+
 #define ip_set_adt_opt_timeout(opt, set)	\
 ((opt)->ext.timeout != IPSET_NO_TIMEOUT ? (opt)->ext.timeout : (set)->timeout)
 
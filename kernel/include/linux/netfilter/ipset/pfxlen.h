@@ -36,6 +36,22 @@ ip_set_hostmask6(u8 pfxlen)
 
 extern u32 ip_set_range_to_cidr(u32 from, u32 to, u8 *cidr);
 
+/* Max number of networks an IPv4 range is split into */
+#define IPSET_RANGE_CIDRS	62
+
+extern u32 ip_set_range_to_cidrs(u32 from, u32 to, u8 *cidrs);
+
+/* The position of the network starting at ip in the split range */
+static inline u32
+ip_set_range_cidr_pos(u32 from, const u8 *cidrs, u32 n, u32 ip)
+{
+	u32 k;
+
+	for (k = 0; k < n && from != ip; k++)
+		from += ~ip_set_hostmask(cidrs[k]) + 1;
+	return k;
+}
+
 #define ip_set_mask_from_to(from, to, cidr)	\
 do {						\
 	from &= ip_set_hostmask(cidr);		\
@@ -12,6 +12,7 @@
 #define mtype_ext_cleanup	IPSET_TOKEN(MTYPE, _ext_cleanup)
 #define mtype_do_del		IPSET_TOKEN(MTYPE, _do_del)
 #define mtype_do_list		IPSET_TOKEN(MTYPE, _do_list)
+#define mtype_do_pack		IPSET_TOKEN(MTYPE, _do_pack)
 #define mtype_do_head		IPSET_TOKEN(MTYPE, _do_head)
 #define mtype_adt_elem		IPSET_TOKEN(MTYPE, _adt_elem)
 #define mtype_add_timeout	IPSET_TOKEN(MTYPE, _add_timeout)
@@ -83,11 +84,13 @@ mtype_flush(struct ip_set *set)
 
 /* Calculate the actual memory size of the set data */
 static size_t
-mtype_memsize(const struct mtype *map, size_t dsize)
+mtype_memsize(const struct ip_set *set)
 {
+	const struct mtype *map = set->data;
 	size_t memsize = sizeof(*map) +
 			 map->memsize +
-			 map->elements * dsize;
+			 map->elements * set->dsize +
+			 set->ext_size;
 	return memsize;
 }
 
@@ -96,7 +99,7 @@ mtype_head(struct ip_set *set, struct sk_buff *skb)
 {
 	const struct mtype *map = set->data;
 	struct nlattr *nested;
-	size_t memsize = mtype_memsize(map, set->dsize) + set->ext_size;
+	size_t memsize = mtype_memsize(set);
 
 	nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
 	if (!nested)
@@ -108,6 +111,8 @@ mtype_head(struct ip_set *set, struct sk_buff *skb)
 		goto nla_put_failure;
 	if (unlikely(ip_set_put_flags(skb, set)))
 		goto nla_put_failure;
+	if (unlikely(ip_set_put_stats(skb, set)))
+		goto nla_put_failure;
 	ipset_nest_end(skb, nested);
 
 	return 0;
@@ -136,7 +141,13 @@ mtype_add(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 	struct mtype *map = set->data;
 	const struct mtype_adt_elem *e = value;
 	void *x = get_ext(set, map, e->id);
-	int ret = mtype_do_add(e, map, flags, set->dsize);
+	int ret;
+
+	if (ip_set_memlimit_reached(set)) {
+		ip_set_stats_inc(set, full);
+		return -IPSET_ERR_MEMLIMIT;
+	}
+	ret = mtype_do_add(e, map, flags, set->dsize);
 
 	if (ret == IPSET_ADD_FAILED) {
 		if (SET_WITH_TIMEOUT(set) &&
@@ -207,7 +218,7 @@ mtype_list(const struct ip_set *set,
 	   struct sk_buff *skb, struct netlink_callback *cb)
 {
 	struct mtype *map = set->data;
-	struct nlattr *adt, *nested;
+	struct nlattr *adt, *nested, *packed = NULL;
 	void *x;
 	u32 id, first = cb->args[IPSET_CB_ARG0];
 	int ret = 0;
@@ -215,6 +226,16 @@ mtype_list(const struct ip_set *set,
 	adt = ipset_nest_start(skb, IPSET_ATTR_ADT);
 	if (!adt)
 		return -EMSGSIZE;
+#ifdef IP_SET_BITMAP_WITH_PACKED_DUMP
+	if (ip_set_dump_packed(set, cb)) {
+		/* Fixed size records follow in a single attribute */
+		packed = nla_reserve(skb, IPSET_ATTR_PACKED, 0);
+		if (!packed) {
+			nla_nest_cancel(skb, adt);
+			return -EMSGSIZE;
+		}
+	}
+#endif
 	/* Extensions may be replaced */
 	rcu_read_lock();
 	for (; cb->args[IPSET_CB_ARG0] < map->elements;
@@ -229,6 +250,13 @@ mtype_list(const struct ip_set *set,
 #endif
 		     ip_set_timeout_expired(ext_timeout(x, set))))
 			continue;
+#ifdef IP_SET_BITMAP_WITH_PACKED_DUMP
+		if (packed) {
+			if (mtype_do_pack(skb, map, id))
+				goto packed_full;
+			continue;
+		}
+#endif
 		nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
 		if (!nested) {
 			if (id == first) {
@@ -245,6 +273,8 @@ mtype_list(const struct ip_set *set,
 			goto nla_put_failure;
 		ipset_nest_end(skb, nested);
 	}
+	if (packed)
+		ipset_nest_end(skb, packed);
 	ipset_nest_end(skb, adt);
 
 	/* Set listing finished */
@@ -252,6 +282,18 @@ mtype_list(const struct ip_set *set,
 
 	goto out;
 
+#ifdef IP_SET_BITMAP_WITH_PACKED_DUMP
+packed_full:
+	if (unlikely(id == first)) {
+		nla_nest_cancel(skb, adt);
+		ret = -EMSGSIZE;
+	} else {
+		ipset_nest_end(skb, packed);
+		ipset_nest_end(skb, adt);
+	}
+	goto out;
+#endif
+
 nla_put_failure:
 	nla_nest_cancel(skb, nested);
 	if (unlikely(id == first)) {
@@ -282,6 +324,7 @@ mtype_gc(GC_ARG)
 				clear_bit(id, map->members);
 				ip_set_ext_destroy(set, x);
 				set->elements--;
+				ip_set_stats_inc(set, expired);
 			}
 		}
 	spin_unlock_bh(&set->lock);
@@ -302,6 +345,7 @@ static const struct ip_set_type_variant mtype = {
 	.flush	= mtype_flush,
 	.head	= mtype_head,
 	.list	= mtype_list,
+	.memsize = mtype_memsize,
 	.same_set = mtype_same_set,
 };
 
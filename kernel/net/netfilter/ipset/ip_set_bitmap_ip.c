@@ -25,7 +25,9 @@
 #define IPSET_TYPE_REV_MIN	0
 /*				1	   Counter support added */
 /*				2	   Comment support added */
-#define IPSET_TYPE_REV_MAX	3	/* skbinfo support added */
+/*				3	   skbinfo support added */
+/*				4	   memlimit support */
+#define IPSET_TYPE_REV_MAX	5	/* stats support */
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@netfilter.org>");
@@ -34,6 +36,7 @@ MODULE_ALIAS("ip_set_bitmap:ip");
 
 #define MTYPE		bitmap_ip
 #define HOST_MASK	32
+#define IP_SET_BITMAP_WITH_PACKED_DUMP
 
 /* Type structure */
 struct bitmap_ip {
@@ -99,6 +102,13 @@ bitmap_ip_do_list(struct sk_buff *skb, const struct bitmap_ip *map, u32 id,
 			htonl(map->first_ip + id * map->hosts));
 }
 
+static bool
+bitmap_ip_do_pack(struct sk_buff *skb, const struct bitmap_ip *map, u32 id)
+{
+	return ip_set_put_packed4(skb, htonl(map->first_ip + id * map->hosts),
+				  0, 0);
+}
+
 static int
 bitmap_ip_do_head(struct sk_buff *skb, const struct bitmap_ip *map)
 {
@@ -356,6 +366,7 @@ static struct ip_set_type bitmap_ip_type __read_mostly = {
 		[IPSET_ATTR_NETMASK]	= { .type = NLA_U8  },
 		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
 		[IPSET_ATTR_CADT_FLAGS]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MEMLIMIT]	= { .type = NLA_U32 },
 	},
 	.adt_policy	= {
 		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
@@ -12,6 +12,7 @@
 #include <linux/ip.h>
 #include <linux/skbuff.h>
 #include <linux/spinlock.h>
+#include <linux/jhash.h>
 #include <linux/rculist.h>
 #include <net/netlink.h>
 #include <net/net_namespace.h>
@@ -26,6 +27,9 @@ static LIST_HEAD(ip_set_type_list);		/* all registered set types */
 static DEFINE_MUTEX(ip_set_type_mutex);		/* protects ip_set_type_list */
 static DEFINE_RWLOCK(ip_set_ref_lock);		/* protects the set refs */
 
+DEFINE_STATIC_KEY_FALSE(ip_set_stats_key);	/* sets with statistics */
+EXPORT_SYMBOL_GPL(ip_set_stats_key);
+
 struct ip_set_net {
 	struct ip_set * __rcu *ip_set_list;	/* all individual sets */
 	ip_set_id_t	ip_set_max;	/* max number of sets */
@@ -346,6 +350,50 @@ ip_set_comment_uget(struct nlattr *tb)
 	return nla_data(tb);
 }
 
+/* Comments are interned per set: elements with identical comments
+ * share a single refcounted copy of the string. The intern table and
+ * the reference counters are protected by the set spinlock, readers
+ * (dumping) access the strings under rcu_read_lock() only.
+ */
+#define IPSET_COMMENT_HBITS	8
+#define IPSET_COMMENT_HSIZE	(1U << IPSET_COMMENT_HBITS)
+
+static struct ip_set_comment_rcu *
+ip_set_comment_get(struct ip_set *set, const char *str, size_t len)
+{
+	struct ip_set_comment_rcu *c;
+	u32 hash = jhash(str, len, 0);
+	struct hlist_head *head =
+		&set->comments[hash & (IPSET_COMMENT_HSIZE - 1)];
+
+	hlist_for_each_entry(c, head, node) {
+		if (c->hash == hash &&
+		    strncmp(c->str, str, len) == 0 && c->str[len] == '\0') {
+			c->ref++;
+			return c;
+		}
+	}
+	c = kmalloc(sizeof(*c) + len + 1, GFP_ATOMIC);
+	if (unlikely(!c))
+		return NULL;
+	strlcpy(c->str, str, len + 1);
+	c->hash = hash;
+	c->ref = 1;
+	hlist_add_head(&c->node, head);
+	set->ext_size += sizeof(*c) + len + 1;
+	return c;
+}
+
+static void
+ip_set_comment_put(struct ip_set *set, struct ip_set_comment_rcu *c)
+{
+	if (--c->ref)
+		return;
+	hlist_del(&c->node);
+	set->ext_size -= sizeof(*c) + strlen(c->str) + 1;
+	kfree_rcu(c, rcu);
+}
+
 /* Called from uadd only, protected by the set spinlock.
  * The kadt functions don't use the comment extensions in any way.
  */
@@ -356,20 +404,21 @@ ip_set_init_comment(struct ip_set *set, struct ip_set_comment *comment,
 	struct ip_set_comment_rcu *c = rcu_dereference_protected(comment->c, 1);
 	size_t len = ext->comment ? strlen(ext->comment) : 0;
 
+	if (unlikely(len > IPSET_MAX_COMMENT_SIZE))
+		len = IPSET_MAX_COMMENT_SIZE;
 	if (unlikely(c)) {
-		set->ext_size -= sizeof(*c) + strlen(c->str) + 1;
-		kfree_rcu(c, rcu);
+		/* Overwritten by the same comment: nothing to do */
+		if (len && strncmp(c->str, ext->comment, len) == 0 &&
+		    c->str[len] == '\0')
+			return;
 		rcu_assign_pointer(comment->c, NULL);
+		ip_set_comment_put(set, c);
 	}
 	if (!len)
 		return;
-	if (unlikely(len > IPSET_MAX_COMMENT_SIZE))
-		len = IPSET_MAX_COMMENT_SIZE;
-	c = kmalloc(sizeof(*c) + len + 1, GFP_ATOMIC);
+	c = ip_set_comment_get(set, ext->comment, len);
 	if (unlikely(!c))
 		return;
-	strlcpy(c->str, ext->comment, len + 1);
-	set->ext_size += sizeof(*c) + strlen(c->str) + 1;
 	rcu_assign_pointer(comment->c, c);
 }
 EXPORT_SYMBOL_GPL(ip_set_init_comment);
@@ -399,9 +448,8 @@ ip_set_comment_free(struct ip_set *set, void *ptr)
 	c = rcu_dereference_protected(comment->c, 1);
 	if (unlikely(!c))
 		return;
-	set->ext_size -= sizeof(*c) + strlen(c->str) + 1;
-	kfree_rcu(c, rcu);
 	rcu_assign_pointer(comment->c, NULL);
+	ip_set_comment_put(set, c);
 }
 
 typedef void (*destroyer)(struct ip_set *, void *);
@@ -740,6 +788,9 @@ ip_set_test(ip_set_id_t index, const struct sk_buff *skb,
 	rcu_read_lock_bh();
 	ret = set->variant->kadt(set, skb, par, IPSET_TEST, opt);
 	rcu_read_unlock_bh();
+	ip_set_stats_inc(set, tests);
+	if (ret > 0 || ret == -EAGAIN)
+		ip_set_stats_inc(set, hits);
 
 	if (ret == -EAGAIN) {
 		/* Type requests element to be completed */
@@ -778,6 +829,8 @@ ip_set_add(ip_set_id_t index, const struct sk_buff *skb,
 	spin_lock_bh(&set->lock);
 	ret = set->variant->kadt(set, skb, par, IPSET_ADD, opt);
 	spin_unlock_bh(&set->lock);
+	if (!ret)
+		ip_set_stats_inc(set, kadds);
 
 	return ret;
 }
@@ -800,6 +853,8 @@ ip_set_del(ip_set_id_t index, const struct sk_buff *skb,
 	spin_lock_bh(&set->lock);
 	ret = set->variant->kadt(set, skb, par, IPSET_DEL, opt);
 	spin_unlock_bh(&set->lock);
+	if (!ret)
+		ip_set_stats_inc(set, kdels);
 
 	return ret;
 }
@@ -1049,6 +1104,16 @@ IPSET_CBFN(ip_set_none, struct net *net, struct sock *ctnl,
 	return -EOPNOTSUPP;
 }
 
+static void
+ip_set_stats_free(struct ip_set *set)
+{
+	if (!set->stats)
+		return;
+	free_percpu(set->stats);
+	set->stats = NULL;
+	static_branch_dec(&ip_set_stats_key);
+}
+
 static int
 IPSET_CBFN(ip_set_create, struct net *n, struct sock *ctnl,
 	   struct sk_buff *skb, const struct nlmsghdr *nlh,
@@ -1114,6 +1179,28 @@ IPSET_CBFN(ip_set_create, struct net *n, struct sock *ctnl,
 	ret = set->type->create(net, set, tb, flags);
 	if (ret != 0)
 		goto put_out;
+	if (tb[IPSET_ATTR_MEMLIMIT])
+		set->memlimit = ip_set_get_h32(tb[IPSET_ATTR_MEMLIMIT]);
+	if (tb[IPSET_ATTR_CADT_FLAGS] &&
+	    (ip_set_get_h32(tb[IPSET_ATTR_CADT_FLAGS]) &
+	     IPSET_FLAG_WITH_STATS)) {
+		set->stats = alloc_percpu(struct ip_set_stats);
+		if (!set->stats) {
+			ret = -ENOMEM;
+			goto cleanup;
+		}
+		static_branch_inc(&ip_set_stats_key);
+	}
+
+	if (SET_WITH_COMMENT(set)) {
+		set->comments = kcalloc(IPSET_COMMENT_HSIZE,
+					sizeof(struct hlist_head),
+					GFP_KERNEL);
+		if (!set->comments) {
+			ret = -ENOMEM;
+			goto cleanup;
+		}
+	}
 
 	/* BTW, ret==0 here. */
 
@@ -1129,6 +1216,8 @@ IPSET_CBFN(ip_set_create, struct net *n, struct sock *ctnl,
 		    set->type->family == clash->type->family &&
 		    set->type->revision_min == clash->type->revision_min &&
 		    set->type->revision_max == clash->type->revision_max &&
+		    set->memlimit == clash->memlimit &&
+		    !set->stats == !clash->stats &&
 		    set->variant->same_set(set, clash))
 			ret = 0;
 		goto cleanup;
@@ -1166,6 +1255,8 @@ IPSET_CBFN(ip_set_create, struct net *n, struct sock *ctnl,
 
 cleanup:
 	set->variant->destroy(set);
+	kfree(set->comments);
+	ip_set_stats_free(set);
 put_out:
 	module_put(set->type->me);
 out:
@@ -1189,6 +1280,8 @@ ip_set_destroy_set(struct ip_set *set)
 
 	/* Must call it without holding any lock */
 	set->variant->destroy(set);
+	kfree(set->comments);
+	ip_set_stats_free(set);
 	module_put(set->type->me);
 	kfree(set);
 }
@@ -1303,6 +1396,50 @@ IPSET_CBFN(ip_set_flush, struct net *net, struct sock *ctnl,
 	return 0;
 }
 
+/* Zero the statistics of sets */
+
+static void
+ip_set_zero_set(struct ip_set *set)
+{
+	int cpu;
+
+	if (!set->stats)
+		return;
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(set->stats, cpu), 0,
+		       sizeof(struct ip_set_stats));
+}
+
+static int
+IPSET_CBFN(ip_set_zero, struct net *net, struct sock *ctnl,
+	   struct sk_buff *skb, const struct nlmsghdr *nlh,
+	   const struct nlattr * const attr[],
+	   struct netlink_ext_ack *extack)
+{
+	struct ip_set_net *inst = ip_set_pernet(IPSET_SOCK_NET(net, ctnl));
+	struct ip_set *s;
+	ip_set_id_t i;
+
+	if (unlikely(protocol_min_failed(attr)))
+		return -IPSET_ERR_PROTOCOL;
+
+	if (!attr[IPSET_ATTR_SETNAME]) {
+		for (i = 0; i < inst->ip_set_max; i++) {
+			s = ip_set(inst, i);
+			if (s)
+				ip_set_zero_set(s);
+		}
+	} else {
+		s = find_set(inst, nla_data(attr[IPSET_ATTR_SETNAME]));
+		if (!s)
+			return -ENOENT;
+
+		ip_set_zero_set(s);
+	}
+
+	return 0;
+}
+
 /* Rename a set */
 
 static const struct nla_policy
@@ -1437,6 +1574,10 @@ ip_set_put_flags(struct sk_buff *skb, struct ip_set *set)
 		if (unlikely(nla_put_net32(skb, IPSET_ATTR_TIMEOUT,
 					   htonl(set->timeout))))
 			return -EMSGSIZE;
+	if (set->memlimit)
+		if (unlikely(nla_put_net32(skb, IPSET_ATTR_MEMLIMIT,
+					   htonl(set->memlimit))))
+			return -EMSGSIZE;
 	if (SET_WITH_COUNTER(set))
 		cadt_flags |= IPSET_FLAG_WITH_COUNTERS;
 	if (SET_WITH_COMMENT(set))
@@ -1445,6 +1586,8 @@ ip_set_put_flags(struct sk_buff *skb, struct ip_set *set)
 		cadt_flags |= IPSET_FLAG_WITH_SKBINFO;
 	if (SET_WITH_FORCEADD(set))
 		cadt_flags |= IPSET_FLAG_WITH_FORCEADD;
+	if (set->stats)
+		cadt_flags |= IPSET_FLAG_WITH_STATS;
 
 	if (!cadt_flags)
 		return 0;
@@ -1452,6 +1595,53 @@ ip_set_put_flags(struct sk_buff *skb, struct ip_set *set)
 }
 EXPORT_SYMBOL_GPL(ip_set_put_flags);
 
+#define IPSET_PUT_STATS(skb, type, sum, field)			\
+	IPSET_NLA_PUT_NET64(skb, IPSET_ATTR_STATS_##type,	\
+			    cpu_to_be64((sum).field), IPSET_ATTR_STATS_PAD)
+
+int
+ip_set_put_stats(struct sk_buff *skb, struct ip_set *set)
+{
+	struct ip_set_stats sum = {}, *s;
+	struct nlattr *nested;
+	int cpu;
+
+	if (!set->stats)
+		return 0;
+	for_each_possible_cpu(cpu) {
+		s = per_cpu_ptr(set->stats, cpu);
+		sum.tests += s->tests;
+		sum.hits += s->hits;
+		sum.buckets += s->buckets;
+		sum.probes += s->probes;
+		sum.kadds += s->kadds;
+		sum.kdels += s->kdels;
+		sum.uadds += s->uadds;
+		sum.udels += s->udels;
+		sum.resizes += s->resizes;
+		sum.expired += s->expired;
+		sum.full += s->full;
+	}
+	nested = nla_nest_start(skb, IPSET_ATTR_STATS);
+	if (!nested)
+		return -EMSGSIZE;
+	if (IPSET_PUT_STATS(skb, TESTS, sum, tests) ||
+	    IPSET_PUT_STATS(skb, HITS, sum, hits) ||
+	    IPSET_PUT_STATS(skb, BUCKETS, sum, buckets) ||
+	    IPSET_PUT_STATS(skb, PROBES, sum, probes) ||
+	    IPSET_PUT_STATS(skb, KADDS, sum, kadds) ||
+	    IPSET_PUT_STATS(skb, KDELS, sum, kdels) ||
+	    IPSET_PUT_STATS(skb, UADDS, sum, uadds) ||
+	    IPSET_PUT_STATS(skb, UDELS, sum, udels) ||
+	    IPSET_PUT_STATS(skb, RESIZES, sum, resizes) ||
+	    IPSET_PUT_STATS(skb, EXPIRED, sum, expired) ||
+	    IPSET_PUT_STATS(skb, FULL, sum, full))
+		return -EMSGSIZE;
+	nla_nest_end(skb, nested);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ip_set_put_stats);
+
 static int
 ip_set_dump_done(struct netlink_callback *cb)
 {
@@ -1730,15 +1920,26 @@ call_ad(struct sock *ctnl, struct sk_buff *skb, struct ip_set *set,
 	bool eexist = flags & IPSET_FLAG_EXIST, retried = false;
 
 	do {
+		if (retried)
+			/* Long ranges are added in chunks, let others run */
+			cond_resched();
 		spin_lock_bh(&set->lock);
 		ret = set->variant->uadt(set, tb, adt, &lineno, flags, retried);
 		spin_unlock_bh(&set->lock);
 		retried = true;
-	} while (ret == -EAGAIN &&
-		 set->variant->resize &&
-		 (ret = set->variant->resize(set, retried)) == 0);
-
-	if (!ret || (ret == -IPSET_ERR_EXIST && eexist))
+	} while (ret == -ERANGE ||
+		 (ret == -EAGAIN &&
+		  set->variant->resize &&
+		  (ret = set->variant->resize(set, retried)) == 0));
+
+	if (!ret) {
+		if (adt == IPSET_ADD)
+			ip_set_stats_inc(set, uadds);
+		else if (adt == IPSET_DEL)
+			ip_set_stats_inc(set, udels);
+		return 0;
+	}
+	if (ret == -IPSET_ERR_EXIST && eexist)
 		return 0;
 	if (lineno && use_lineno) {
 		/* Error in restore/batch mode: send back lineno */
@@ -1892,11 +2093,48 @@ IPSET_CBFN(ip_set_utest, struct net *net, struct sock *ctnl,
 	/* Userspace can't trigger element to be re-added */
 	if (ret == -EAGAIN)
 		ret = 1;
+	ip_set_stats_inc(set, tests);
+	if (ret > 0)
+		ip_set_stats_inc(set, hits);
 
 	return ret > 0 ? 0 : -IPSET_ERR_EXIST;
 }
 
-/* Get headed data of a set */
+/* Sum up the memory size and the number of elements of all sets
+ * in the namespace. Called with the nfnl mutex held.
+ */
+static int
+ip_set_put_total(struct sk_buff *skb, struct ip_set_net *inst)
+{
+	struct nlattr *nested;
+	struct ip_set *set;
+	size_t memsize = 0;
+	u32 elements = 0;
+	ip_set_id_t i;
+
+	for (i = 0; i < inst->ip_set_max; i++) {
+		set = ip_set(inst, i);
+		if (!set)
+			continue;
+		memsize += set->variant->memsize(set);
+		elements += set->elements;
+	}
+	memsize = min_t(size_t, memsize, U32_MAX);
+
+	nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+	if (!nested)
+		return -EMSGSIZE;
+	if (nla_put_net32(skb, IPSET_ATTR_MEMSIZE, htonl(memsize)) ||
+	    nla_put_net32(skb, IPSET_ATTR_ELEMENTS, htonl(elements)))
+		return -EMSGSIZE;
+	ipset_nest_end(skb, nested);
+
+	return 0;
+}
+
+/* Get headed data of a set or, without setname, the total memory size
+ * of the sets in the namespace
+ */
 
 static int
 IPSET_CBFN(ip_set_header, struct net *net, struct sock *ctnl,
@@ -1905,18 +2143,19 @@ IPSET_CBFN(ip_set_header, struct net *net, struct sock *ctnl,
 	   struct netlink_ext_ack *extack)
 {
 	struct ip_set_net *inst = ip_set_pernet(IPSET_SOCK_NET(net, ctnl));
-	const struct ip_set *set;
+	const struct ip_set *set = NULL;
 	struct sk_buff *skb2;
 	struct nlmsghdr *nlh2;
 	int ret = 0;
 
-	if (unlikely(protocol_min_failed(attr) ||
-		     !attr[IPSET_ATTR_SETNAME]))
+	if (unlikely(protocol_min_failed(attr)))
 		return -IPSET_ERR_PROTOCOL;
 
-	set = find_set(inst, nla_data(attr[IPSET_ATTR_SETNAME]));
-	if (!set)
-		return -ENOENT;
+	if (attr[IPSET_ATTR_SETNAME]) {
+		set = find_set(inst, nla_data(attr[IPSET_ATTR_SETNAME]));
+		if (!set)
+			return -ENOENT;
+	}
 
 	skb2 = nlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
 	if (!skb2)
@@ -1926,12 +2165,17 @@ IPSET_CBFN(ip_set_header, struct net *net, struct sock *ctnl,
 			 IPSET_CMD_HEADER);
 	if (!nlh2)
 		goto nlmsg_failure;
-	if (nla_put_u8(skb2, IPSET_ATTR_PROTOCOL, protocol(attr)) ||
-	    nla_put_string(skb2, IPSET_ATTR_SETNAME, set->name) ||
-	    nla_put_string(skb2, IPSET_ATTR_TYPENAME, set->type->name) ||
-	    nla_put_u8(skb2, IPSET_ATTR_FAMILY, set->family) ||
-	    nla_put_u8(skb2, IPSET_ATTR_REVISION, set->revision))
+	if (nla_put_u8(skb2, IPSET_ATTR_PROTOCOL, protocol(attr)))
+		goto nla_put_failure;
+	if (!set) {
+		if (ip_set_put_total(skb2, inst))
+			goto nla_put_failure;
+	} else if (nla_put_string(skb2, IPSET_ATTR_SETNAME, set->name) ||
+		   nla_put_string(skb2, IPSET_ATTR_TYPENAME, set->type->name) ||
+		   nla_put_u8(skb2, IPSET_ATTR_FAMILY, set->family) ||
+		   nla_put_u8(skb2, IPSET_ATTR_REVISION, set->revision)) {
 		goto nla_put_failure;
+	}
 	nlmsg_end(skb2, nlh2);
 
 	ret = netlink_unicast(ctnl, skb2, NETLINK_PORTID(skb), MSG_DONTWAIT);
@@ -2241,6 +2485,11 @@ static const struct nfnl_callback ip_set_netlink_subsys_cb[IPSET_MSG_MAX] = {
 		.attr_count	= IPSET_ATTR_CMD_MAX,
 		.policy		= ip_set_index_policy,
 	},
+	[IPSET_CMD_ZERO]	= {
+		.call		= ip_set_zero,
+		.attr_count	= IPSET_ATTR_CMD_MAX,
+		.policy		= ip_set_setname_policy,
+	},
 };
 
 static struct nfnetlink_subsystem ip_set_netlink_subsys __read_mostly = {
@@ -27,6 +27,15 @@
  * are serialized by the nfnl mutex. During resizing the set is
  * read-locked, so the only possible concurrent operations are
  * the kernel side readers. Those must be protected by proper RCU locking.
+ *
+ * Dumping
+ *
+ * A dump resumes at the bucket which did not fit into the last message,
+ * or at the slot when a bucket alone does not fit. In order to keep the
+ * slots valid, deleting and expiring elements do not compact the buckets
+ * of a table while a dump holds it (uref). The emptied slots are freed by
+ * the next deletion from the bucket or garbage collection run after the
+ * dump, so a long running dump keeps the buckets at their full size.
  */
 
 /* Number of elements to store in an initial array block */
@@ -34,7 +43,16 @@
 /* Max number of elements to store in an array block */
 #define AHASH_MAX_SIZE			(3 * AHASH_INIT_SIZE)
 /* Max muber of elements in the array block when tuned */
-#define AHASH_MAX_TUNED			64
+#define AHASH_MAX_TUNED			128
+/* Dump cursor: the bucket and the slot in the bucket to resume listing.
+ * The slot field covers all the positions a bucket can have (u8 pos).
+ */
+#define AHASH_CURSOR_SLOT_BITS		8
+#define ahash_cursor(bucket, slot)	\
+	(((unsigned long)(bucket) << AHASH_CURSOR_SLOT_BITS) | (slot))
+#define ahash_cursor_bucket(c)		((c) >> AHASH_CURSOR_SLOT_BITS)
+#define ahash_cursor_slot(c)		\
+	((c) & ((1UL << AHASH_CURSOR_SLOT_BITS) - 1))
 
 /* Max number of elements can be tuned */
 #ifdef IP_SET_HASH_WITH_MULTI
@@ -49,24 +67,42 @@ tune_ahash_max(u8 curr, u32 multi)
 		return curr;
 
 	n = curr + AHASH_INIT_SIZE;
-	/* Currently, at listing one hash bucket must fit into a message.
-	 * Therefore we have a hard limit here.
-	 */
+	/* The used positions of a bucket are stored in a fixed size bitmap */
 	return n > curr && n <= AHASH_MAX_TUNED ? n : curr;
 }
 
 #define TUNE_AHASH_MAX(h, multi)	\
 	((h)->ahash_max = tune_ahash_max((h)->ahash_max, multi))
+#define AHASH_USED_BITS			AHASH_MAX_TUNED
 #else
 #define AHASH_MAX(h)			AHASH_MAX_SIZE
 #define TUNE_AHASH_MAX(h, multi)
+#define AHASH_USED_BITS			AHASH_MAX_SIZE
+#endif
+
+/* Wildcard elements are stored in an array of buckets of their own,
+ * after the buckets of the exact elements. It is searched only when
+ * the exact search of a value failed, so the exact buckets never hold
+ * wildcard elements.
+ */
+#ifdef IP_SET_HASH_WITH_WILDCARD
+#define AHASH_ARRAYS			2
+#define HKEY_WILDCARD(data, htable_bits)	\
+	((data)->wildcard ? jhash_size(htable_bits) : 0)
+#define WILDCARD_ADD(h, d)		((h)->wildcards += (d)->wildcard)
+#define WILDCARD_DEL(h, d)		((h)->wildcards -= (d)->wildcard)
+#else
+#define AHASH_ARRAYS			1
+#define HKEY_WILDCARD(data, htable_bits)	0
+#define WILDCARD_ADD(h, d)
+#define WILDCARD_DEL(h, d)
 #endif
 
 /* A hash bucket */
 struct hbucket {
 	struct rcu_head rcu;	/* for call_rcu_bh */
 	/* Which positions are used in the array */
-	DECLARE_BITMAP(used, AHASH_MAX_TUNED);
+	DECLARE_BITMAP(used, AHASH_USED_BITS);
 	u8 size;		/* size of the array */
 	u8 pos;			/* position of the first free entry */
 	unsigned char value[0]	/* the array of the values */
@@ -82,6 +118,8 @@ struct htable {
 };
 
 #define hbucket(h, i)		((h)->bucket[i])
+/* Number of the buckets of all the arrays */
+#define ahash_buckets(t)	(AHASH_ARRAYS * jhash_size((t)->htable_bits))
 #define ext_size(n, dsize)	\
 	(sizeof(struct hbucket) + (n) * (dsize))
 
@@ -106,10 +144,11 @@ htable_size(u8 hbits)
 		return 0;
 	hsize = jhash_size(hbits);
 	if ((((size_t)-1) - sizeof(struct htable)) / sizeof(struct hbucket *)
-	    < hsize)
+	    / AHASH_ARRAYS < hsize)
 		return 0;
 
-	return hsize * sizeof(struct hbucket *) + sizeof(struct htable);
+	return AHASH_ARRAYS * hsize * sizeof(struct hbucket *) +
+	       sizeof(struct htable);
 }
 
 /* Compute htable_bits from the user input parameter hashsize */
@@ -187,6 +226,7 @@ htable_bits(u32 hashsize)
 #undef mtype_data_reset_flags
 #undef mtype_data_netmask
 #undef mtype_data_list
+#undef mtype_data_pack
 #undef mtype_data_next
 #undef mtype_elem
 
@@ -194,7 +234,10 @@ htable_bits(u32 hashsize)
 #undef mtype_ext_cleanup
 #undef mtype_add_cidr
 #undef mtype_del_cidr
+#undef mtype_cidr_fits
+#undef mtype_put_cidrs
 #undef mtype_ahash_memsize
+#undef mtype_memsize
 #undef mtype_flush
 #undef mtype_destroy
 #undef mtype_same_set
@@ -203,11 +246,14 @@ htable_bits(u32 hashsize)
 
 #undef mtype_add
 #undef mtype_del
+#undef mtype_test_bucket
+#undef mtype_test_elem
 #undef mtype_test_cidrs
 #undef mtype_test
 #undef mtype_uref
 #undef mtype_expire
 #undef mtype_resize
+#undef mtype_presize
 #undef mtype_head
 #undef mtype_list
 #undef mtype_gc
@@ -229,6 +275,7 @@ htable_bits(u32 hashsize)
 #define mtype_data_reset_flags	IPSET_TOKEN(MTYPE, _data_reset_flags)
 #define mtype_data_netmask	IPSET_TOKEN(MTYPE, _data_netmask)
 #define mtype_data_list		IPSET_TOKEN(MTYPE, _data_list)
+#define mtype_data_pack		IPSET_TOKEN(MTYPE, _data_pack)
 #define mtype_data_next		IPSET_TOKEN(MTYPE, _data_next)
 #define mtype_elem		IPSET_TOKEN(MTYPE, _elem)
 
@@ -236,7 +283,10 @@ htable_bits(u32 hashsize)
 #define mtype_ext_cleanup	IPSET_TOKEN(MTYPE, _ext_cleanup)
 #define mtype_add_cidr		IPSET_TOKEN(MTYPE, _add_cidr)
 #define mtype_del_cidr		IPSET_TOKEN(MTYPE, _del_cidr)
+#define mtype_cidr_fits		IPSET_TOKEN(MTYPE, _cidr_fits)
+#define mtype_put_cidrs		IPSET_TOKEN(MTYPE, _put_cidrs)
 #define mtype_ahash_memsize	IPSET_TOKEN(MTYPE, _ahash_memsize)
+#define mtype_memsize		IPSET_TOKEN(MTYPE, _memsize)
 #define mtype_flush		IPSET_TOKEN(MTYPE, _flush)
 #define mtype_destroy		IPSET_TOKEN(MTYPE, _destroy)
 #define mtype_same_set		IPSET_TOKEN(MTYPE, _same_set)
@@ -245,11 +295,14 @@ htable_bits(u32 hashsize)
 
 #define mtype_add		IPSET_TOKEN(MTYPE, _add)
 #define mtype_del		IPSET_TOKEN(MTYPE, _del)
+#define mtype_test_bucket	IPSET_TOKEN(MTYPE, _test_bucket)
+#define mtype_test_elem		IPSET_TOKEN(MTYPE, _test_elem)
 #define mtype_test_cidrs	IPSET_TOKEN(MTYPE, _test_cidrs)
 #define mtype_test		IPSET_TOKEN(MTYPE, _test)
 #define mtype_uref		IPSET_TOKEN(MTYPE, _uref)
 #define mtype_expire		IPSET_TOKEN(MTYPE, _expire)
 #define mtype_resize		IPSET_TOKEN(MTYPE, _resize)
+#define mtype_presize		IPSET_TOKEN(MTYPE, _presize)
 #define mtype_head		IPSET_TOKEN(MTYPE, _head)
 #define mtype_list		IPSET_TOKEN(MTYPE, _list)
 #define mtype_gc		IPSET_TOKEN(MTYPE, _gc)
@@ -270,7 +323,8 @@ htable_bits(u32 hashsize)
 								\
 	BUILD_BUG_ON(HKEY_DATALEN % sizeof(u32) != 0);		\
 								\
-	jhash2(__k, __l, initval) & jhash_mask(htable_bits);	\
+	(jhash2(__k, __l, initval) & jhash_mask(htable_bits)) +	\
+	HKEY_WILDCARD(data, htable_bits);			\
 })
 
 /* The generic hash structure */
@@ -288,8 +342,17 @@ struct htype {
 #ifdef IP_SET_HASH_WITH_MULTI
 	u8 ahash_max;		/* max elements in an array block */
 #endif
+#ifdef IP_SET_HASH_WITH_WILDCARD
+	u32 wildcards;		/* number of wildcard elements */
+#endif
 #ifdef IP_SET_HASH_WITH_NETMASK
 	u8 netmask;		/* netmask value for subnets to store */
+#endif
+#ifdef IP_SET_HASH_WITH_QUANTIZE
+	u8 quantize;		/* max number of prefix lengths, 0: any */
+#endif
+#ifdef IP_SET_HASH_WITH_PRESIZE
+	u8 presize_bits;	/* htable_bits requested by mtype_presize */
 #endif
 	struct mtype_elem next; /* temporary storage for uadd */
 #ifdef IP_SET_HASH_WITH_NETS
@@ -342,13 +405,62 @@ mtype_del_cidr(struct htype *h, u8 cidr, u8 n)
 		return;
 	}
 }
+
+#ifdef IP_SET_HASH_WITH_QUANTIZE
+/* The set stores the prefix length already or it has got room for it.
+ * Lookups probe the hash once per prefix length, so the number of the
+ * lengths can be bounded at creating the set.
+ */
+static bool
+mtype_cidr_fits(const struct htype *h, u8 cidr)
+{
+	u8 i;
+
+	if (!h->quantize)
+		return true;
+	for (i = 0; i < NLEN && h->nets[i].cidr[0]; i++)
+		if (h->nets[i].cidr[0] == cidr)
+			return true;
+	return i < h->quantize;
+}
+
+/* The stored prefix lengths, in decreasing order */
+static int
+mtype_put_cidrs(struct sk_buff *skb, const struct htype *h)
+{
+	u8 cidrs[NLEN];
+	u8 i;
+
+	for (i = 0; i < NLEN && h->nets[i].cidr[0]; i++)
+		cidrs[i] = NCIDR_GET(h->nets[i].cidr[0]);
+	return nla_put(skb, IPSET_ATTR_CIDRS, i, cidrs);
+}
+#endif
 #endif
 
-/* Calculate the actual memory size of the set data */
+/* Calculate the actual memory size of the set data: the buckets,
+ * the extensions stored in them and the comments are accounted
+ * in set->ext_size.
+ */
 static size_t
 mtype_ahash_memsize(const struct htype *h, const struct htable *t)
 {
-	return sizeof(*h) + sizeof(*t);
+	return sizeof(*h) + htable_size(t->htable_bits);
+}
+
+static size_t
+mtype_memsize(const struct ip_set *set)
+{
+	const struct htype *h = set->data;
+	const struct htable *t;
+	size_t memsize;
+
+	rcu_read_lock_bh();
+	t = rcu_dereference_bh_nfnl(h->table);
+	memsize = mtype_ahash_memsize(h, t) + set->ext_size;
+	rcu_read_unlock_bh();
+
+	return memsize;
 }
 
 /* Get the ith element from the array block n */
@@ -375,7 +487,7 @@ mtype_flush(struct ip_set *set)
 	u32 i;
 
 	t = ipset_dereference_protected(h->table, set);
-	for (i = 0; i < jhash_size(t->htable_bits); i++) {
+	for (i = 0; i < ahash_buckets(t); i++) {
 		n = __ipset_dereference_protected(hbucket(t, i), 1);
 		if (!n)
 			continue;
@@ -387,6 +499,9 @@ mtype_flush(struct ip_set *set)
 	}
 #ifdef IP_SET_HASH_WITH_NETS
 	memset(h->nets, 0, sizeof(h->nets));
+#endif
+#ifdef IP_SET_HASH_WITH_WILDCARD
+	h->wildcards = 0;
 #endif
 	set->elements = 0;
 	set->ext_size = 0;
@@ -399,7 +514,7 @@ mtype_ahash_destroy(struct ip_set *set, struct htable *t, bool ext_destroy)
 	struct hbucket *n;
 	u32 i;
 
-	for (i = 0; i < jhash_size(t->htable_bits); i++) {
+	for (i = 0; i < ahash_buckets(t); i++) {
 		n = __ipset_dereference_protected(hbucket(t, i), 1);
 		if (!n)
 			continue;
@@ -453,6 +568,9 @@ mtype_same_set(const struct ip_set *a, const struct ip_set *b)
 #endif
 #ifdef IP_SET_HASH_WITH_MARKMASK
 	       x->markmask == y->markmask &&
+#endif
+#ifdef IP_SET_HASH_WITH_QUANTIZE
+	       x->quantize == y->quantize &&
 #endif
 	       a->extensions == b->extensions;
 }
@@ -471,7 +589,7 @@ mtype_expire(struct ip_set *set, struct htype *h)
 #endif
 
 	t = ipset_dereference_protected(h->table, set);
-	for (i = 0; i < jhash_size(t->htable_bits); i++) {
+	for (i = 0; i < ahash_buckets(t); i++) {
 		n = __ipset_dereference_protected(hbucket(t, i), 1);
 		if (!n)
 			continue;
@@ -492,8 +610,10 @@ mtype_expire(struct ip_set *set, struct htype *h)
 					NCIDR_PUT(DCIDR_GET(data->cidr, k)),
 					k);
 #endif
+			WILDCARD_DEL(h, data);
 			ip_set_ext_destroy(set, data);
 			set->elements--;
+			ip_set_stats_inc(set, expired);
 			d++;
 		}
 		if (d >= AHASH_INIT_SIZE) {
@@ -503,6 +623,9 @@ mtype_expire(struct ip_set *set, struct htype *h)
 				kfree_rcu(n, rcu);
 				continue;
 			}
+			/* A dump may resume in the middle of the bucket */
+			if (atomic_read(&t->uref))
+				continue;
 			tmp = kzalloc(sizeof(*tmp) +
 				      (n->size - AHASH_INIT_SIZE) * dsize,
 				      GFP_ATOMIC);
@@ -541,8 +664,8 @@ mtype_gc(GC_ARG)
 }
 
 /* Resize a hash: create a new hash table with doubling the hashsize
- * and inserting the elements to it. Repeat until we succeed or
- * fail due to memory pressures.
+ * (or with the size requested by mtype_presize) and inserting the
+ * elements to it. Repeat until we succeed or fail due to memory pressures.
  */
 static int
 mtype_resize(struct ip_set *set, bool retried)
@@ -559,6 +682,8 @@ mtype_resize(struct ip_set *set, bool retried)
 	struct mtype_elem *d;
 	struct hbucket *n, *m;
 	u32 i, j, key;
+	size_t oldsize;
+	bool presize = false;
 	int ret;
 
 #ifdef IP_SET_HASH_WITH_NETS
@@ -570,6 +695,14 @@ mtype_resize(struct ip_set *set, bool retried)
 	orig = rcu_dereference_bh_nfnl(h->table);
 	htable_bits = orig->htable_bits;
 	rcu_read_unlock_bh();
+#ifdef IP_SET_HASH_WITH_PRESIZE
+	if (h->presize_bits > htable_bits) {
+		/* Grow to the requested size at once */
+		htable_bits = h->presize_bits - 1;
+		presize = true;
+	}
+	h->presize_bits = 0;
+#endif
 
 retry:
 	ret = 0;
@@ -581,6 +714,12 @@ retry:
 		ret = -IPSET_ERR_HASH_FULL;
 		goto out;
 	}
+	if (set->memlimit &&
+	    mtype_memsize(set) - htable_size(orig->htable_bits) +
+	    htable_size(htable_bits) > set->memlimit) {
+		ret = -IPSET_ERR_MEMLIMIT;
+		goto out;
+	}
 	t = ip_set_alloc(htable_size(htable_bits));
 	if (!t) {
 		ret = -ENOMEM;
@@ -594,12 +733,14 @@ retry:
 	atomic_set(&orig->ref, 1);
 	atomic_inc(&orig->uref);
 	extsize = 0;
+	oldsize = 0;
 	pr_debug("attempt to resize set %s from %u to %u, t %p\n",
 		 set->name, orig->htable_bits, htable_bits, orig);
-	for (i = 0; i < jhash_size(orig->htable_bits); i++) {
+	for (i = 0; i < ahash_buckets(orig); i++) {
 		n = __ipset_dereference_protected(hbucket(orig, i), 1);
 		if (!n)
 			continue;
+		oldsize += ext_size(n->size, dsize);
 		for (j = 0; j < n->pos; j++) {
 			if (!test_bit(j, n->used))
 				continue;
@@ -658,7 +799,9 @@ retry:
 		}
 	}
 	rcu_assign_pointer(h->table, t);
-	set->ext_size = extsize;
+	ip_set_stats_inc(set, resizes);
+	/* Replace the size of the old buckets, keep the comments */
+	set->ext_size += extsize - oldsize;
 
 	spin_unlock_bh(&set->lock);
 
@@ -677,7 +820,8 @@ out:
 #ifdef IP_SET_HASH_WITH_NETS
 	kfree(tmp);
 #endif
-	return ret;
+	/* Presizing is best effort, the elements still fit into the buckets */
+	return presize ? 0 : ret;
 
 cleanup:
 	atomic_set(&orig->ref, 0);
@@ -689,6 +833,32 @@ cleanup:
 	goto out;
 }
 
+#ifdef IP_SET_HASH_WITH_PRESIZE
+/* Make room for the elements of a range before adding them: if the hash
+ * table is too small, request a resize to the needed size at once and
+ * restart the range from the element. Called with the set locked.
+ */
+static int
+mtype_presize(struct ip_set *set, const struct mtype_elem *d, u32 elements)
+{
+	struct htype *h = set->data;
+	struct htable *t = ipset_dereference_protected(h->table, set);
+	u8 bits;
+
+	if (set->elements >= h->maxelem)
+		return 0;
+	elements = min(elements, h->maxelem - set->elements);
+	/* Half filled initial array blocks rarely overflow */
+	bits = htable_bits(DIV_ROUND_UP(set->elements + elements,
+					AHASH_INIT_SIZE / 2));
+	if (bits <= t->htable_bits || !htable_size(bits))
+		return 0;
+	h->presize_bits = bits;
+	mtype_data_next(&h->next, d);
+	return -EAGAIN;
+}
+#endif
+
 /* Add an element to a hash and update the internal counters when succeeded,
  * otherwise report the proper error code.
  */
@@ -706,20 +876,28 @@ mtype_add(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 	bool deleted = false, forceadd = false, reuse = false;
 	u32 key, multi = 0;
 
+#ifdef IP_SET_HASH_WITH_QUANTIZE
+	if (!mtype_cidr_fits(h, NCIDR_PUT(DCIDR_GET(d->cidr, 0))))
+		return -IPSET_ERR_HASH_CIDRS;
+#endif
 	if (set->elements >= h->maxelem) {
 		if (SET_WITH_TIMEOUT(set))
 			/* FIXME: when set is full, we slow down here */
 			mtype_expire(set, h);
-		if (set->elements >= h->maxelem && SET_WITH_FORCEADD(set))
+		if (set->elements >= h->maxelem && SET_WITH_FORCEADD(set)) {
+			ip_set_stats_inc(set, full);
 			forceadd = true;
+		}
 	}
 
 	t = ipset_dereference_protected(h->table, set);
-	key = HKEY(value, h->initval, t->htable_bits);
+	key = HKEY(d, h->initval, t->htable_bits);
 	n = __ipset_dereference_protected(hbucket(t, key), 1);
 	if (!n) {
 		if (forceadd || set->elements >= h->maxelem)
 			goto set_full;
+		if (ip_set_memlimit_reached(set))
+			goto mem_full;
 		old = NULL;
 		n = kzalloc(sizeof(*n) + AHASH_INIT_SIZE * set->dsize,
 			    GFP_ATOMIC);
@@ -766,6 +944,7 @@ mtype_add(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 					NCIDR_PUT(DCIDR_GET(data->cidr, i)),
 					i);
 #endif
+			WILDCARD_DEL(h, data);
 			ip_set_ext_destroy(set, data);
 			set->elements--;
 		}
@@ -773,6 +952,8 @@ mtype_add(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 	}
 	if (set->elements >= h->maxelem)
 		goto set_full;
+	if (ip_set_memlimit_reached(set))
+		goto mem_full;
 	/* Create a new slot */
 	if (n->pos >= n->size) {
 		TUNE_AHASH_MAX(h, multi);
@@ -802,6 +983,7 @@ copy_data:
 	for (i = 0; i < IPSET_NET_COUNT; i++)
 		mtype_add_cidr(h, NCIDR_PUT(DCIDR_GET(d->cidr, i)), i);
 #endif
+	WILDCARD_ADD(h, d);
 	memcpy(data, d, sizeof(struct mtype_elem));
 overwrite_extensions:
 #ifdef IP_SET_HASH_WITH_NETS
@@ -826,10 +1008,17 @@ overwrite_extensions:
 
 	return 0;
 set_full:
+	ip_set_stats_inc(set, full);
 	if (net_ratelimit())
 		pr_warn("Set %s is full, maxelem %u reached\n",
 			set->name, h->maxelem);
 	return -IPSET_ERR_HASH_FULL;
+mem_full:
+	ip_set_stats_inc(set, full);
+	if (net_ratelimit())
+		pr_warn("Set %s is full, memlimit %u reached\n",
+			set->name, set->memlimit);
+	return -IPSET_ERR_MEMLIMIT;
 }
 
 /* Delete an element from the hash and free up space if possible.
@@ -848,7 +1037,7 @@ mtype_del(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 	size_t dsize = set->dsize;
 
 	t = ipset_dereference_protected(h->table, set);
-	key = HKEY(value, h->initval, t->htable_bits);
+	key = HKEY(d, h->initval, t->htable_bits);
 	n = __ipset_dereference_protected(hbucket(t, key), 1);
 	if (!n)
 		goto out;
@@ -875,6 +1064,7 @@ mtype_del(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 			mtype_del_cidr(h, NCIDR_PUT(DCIDR_GET(d->cidr, j)),
 				       j);
 #endif
+		WILDCARD_DEL(h, data);
 		ip_set_ext_destroy(set, data);
 
 		for (; i < n->pos; i++) {
@@ -885,7 +1075,10 @@ mtype_del(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 			set->ext_size -= ext_size(n->size, dsize);
 			rcu_assign_pointer(hbucket(t, key), NULL);
 			kfree_rcu(n, rcu);
-		} else if (k >= AHASH_INIT_SIZE) {
+		} else if (k >= AHASH_INIT_SIZE && !atomic_read(&t->uref)) {
+			/* Not shrunk while dumped: the dump may resume in
+			 * the middle of the bucket
+			 */
 			struct hbucket *tmp = kzalloc(sizeof(*tmp) +
 					(n->size - AHASH_INIT_SIZE) * dsize,
 					GFP_ATOMIC);
@@ -922,6 +1115,64 @@ mtype_data_match(struct mtype_elem *data, const struct ip_set_ext *ext,
 	return mtype_do_data_match(data);
 }
 
+/* Search the value in the bucket */
+static int
+mtype_test_bucket(struct ip_set *set, const struct htable *t, u32 key,
+		  struct mtype_elem *d, const struct ip_set_ext *ext,
+		  struct ip_set_ext *mext, u32 flags, u32 *multi)
+{
+	struct hbucket *n;
+	struct mtype_elem *data;
+	int i, ret;
+
+	n = rcu_dereference_bh(hbucket(t, key));
+	if (!n)
+		return 0;
+	ip_set_stats_inc(set, buckets);
+	for (i = 0; i < n->pos; i++) {
+		if (!test_bit(i, n->used))
+			continue;
+		data = ahash_data(n, i, set->dsize);
+		if (!mtype_data_equal(data, d, multi))
+			continue;
+		ret = mtype_data_match(data, ext, mext, set, flags);
+		if (ret != 0) {
+			ip_set_stats_add(set, probes, i + 1);
+			return ret;
+		}
+#ifdef IP_SET_HASH_WITH_MULTI
+		/* No match, reset multiple match flag */
+		*multi = 0;
+#endif
+	}
+	ip_set_stats_add(set, probes, n->pos);
+	return 0;
+}
+
+/* Search the value in its bucket, then in the wildcard bucket */
+static int
+mtype_test_elem(struct ip_set *set, const struct htable *t,
+		struct mtype_elem *d, const struct ip_set_ext *ext,
+		struct ip_set_ext *mext, u32 flags, u32 *multi)
+{
+	struct htype *h = set->data;
+	u32 key = HKEY(d, h->initval, t->htable_bits);
+	int ret;
+
+	ret = mtype_test_bucket(set, t, key, d, ext, mext, flags, multi);
+#ifdef IP_SET_HASH_WITH_WILDCARD
+	if (ret == 0 && !d->wildcard && h->wildcards) {
+		/* The bucket in the wildcard array, as HKEY() computes it */
+		d->wildcard = 1;
+		ret = mtype_test_bucket(set, t,
+					key + jhash_size(t->htable_bits),
+					d, ext, mext, flags, multi);
+		d->wildcard = 0;
+	}
+#endif
+	return ret;
+}
+
 #ifdef IP_SET_HASH_WITH_NETS
 /* Special test function which takes into account the different network
  * sizes added to the set
@@ -933,15 +1184,13 @@ mtype_test_cidrs(struct ip_set *set, struct mtype_elem *d,
 {
 	struct htype *h = set->data;
 	struct htable *t = rcu_dereference_bh(h->table);
-	struct hbucket *n;
-	struct mtype_elem *data;
 #if IPSET_NET_COUNT == 2
 	struct mtype_elem orig = *d;
-	int ret, i, j = 0, k;
+	int ret, j = 0, k;
 #else
-	int ret, i, j = 0;
+	int ret, j = 0;
 #endif
-	u32 key, multi = 0;
+	u32 multi = 0;
 
 	pr_debug("test by nets\n");
 	for (; j < NLEN && h->nets[j].cidr[0] && !multi; j++) {
@@ -955,24 +1204,9 @@ mtype_test_cidrs(struct ip_set *set, struct mtype_elem *d,
 #else
 		mtype_data_netmask(d, NCIDR_GET(h->nets[j].cidr[0]));
 #endif
-		key = HKEY(d, h->initval, t->htable_bits);
-		n = rcu_dereference_bh(hbucket(t, key));
-		if (!n)
-			continue;
-		for (i = 0; i < n->pos; i++) {
-			if (!test_bit(i, n->used))
-				continue;
-			data = ahash_data(n, i, set->dsize);
-			if (!mtype_data_equal(data, d, &multi))
-				continue;
-			ret = mtype_data_match(data, ext, mext, set, flags);
-			if (ret != 0)
-				return ret;
-#ifdef IP_SET_HASH_WITH_MULTI
-			/* No match, reset multiple match flag */
-			multi = 0;
-#endif
-		}
+		ret = mtype_test_elem(set, t, d, ext, mext, flags, &multi);
+		if (ret != 0)
+			return ret;
 #if IPSET_NET_COUNT == 2
 		}
 #endif
@@ -989,10 +1223,10 @@ mtype_test(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 	struct htype *h = set->data;
 	struct htable *t;
 	struct mtype_elem *d = value;
-	struct hbucket *n;
-	struct mtype_elem *data;
-	int i, ret = 0;
-	u32 key, multi = 0;
+	u32 multi = 0;
+#ifdef IP_SET_HASH_WITH_NETS
+	int i;
+#endif
 
 	t = rcu_dereference_bh(h->table);
 #ifdef IP_SET_HASH_WITH_NETS
@@ -1002,30 +1236,11 @@ mtype_test(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 	for (i = 0; i < IPSET_NET_COUNT; i++)
 		if (DCIDR_GET(d->cidr, i) != HOST_MASK)
 			break;
-	if (i == IPSET_NET_COUNT) {
-		ret = mtype_test_cidrs(set, d, ext, mext, flags);
-		goto out;
-	}
+	if (i == IPSET_NET_COUNT)
+		return mtype_test_cidrs(set, d, ext, mext, flags);
 #endif
 
-	key = HKEY(d, h->initval, t->htable_bits);
-	n = rcu_dereference_bh(hbucket(t, key));
-	if (!n) {
-		ret = 0;
-		goto out;
-	}
-	for (i = 0; i < n->pos; i++) {
-		if (!test_bit(i, n->used))
-			continue;
-		data = ahash_data(n, i, set->dsize);
-		if (!mtype_data_equal(data, d, &multi))
-			continue;
-		ret = mtype_data_match(data, ext, mext, set, flags);
-		if (ret != 0)
-			goto out;
-	}
-out:
-	return ret;
+	return mtype_test_elem(set, t, d, ext, mext, flags, &multi);
 }
 
 /* Reply a HEADER request: fill out the header part of the set */
@@ -1052,9 +1267,9 @@ mtype_head(struct ip_set *set, struct sk_buff *skb)
 
 	rcu_read_lock_bh();
 	t = rcu_dereference_bh_nfnl(h->table);
-	memsize = mtype_ahash_memsize(h, t) + set->ext_size;
 	htable_bits = t->htable_bits;
 	rcu_read_unlock_bh();
+	memsize = mtype_memsize(set);
 
 	nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
 	if (!nested)
@@ -1071,6 +1286,12 @@ mtype_head(struct ip_set *set, struct sk_buff *skb)
 #ifdef IP_SET_HASH_WITH_MARKMASK
 	if (nla_put_u32(skb, IPSET_ATTR_MARKMASK, h->markmask))
 		goto nla_put_failure;
+#endif
+#ifdef IP_SET_HASH_WITH_QUANTIZE
+	if (h->quantize &&
+	    (nla_put_u8(skb, IPSET_ATTR_QUANTIZE, h->quantize) ||
+	     mtype_put_cidrs(skb, h)))
+		goto nla_put_failure;
 #endif
 	if (nla_put_net32(skb, IPSET_ATTR_REFERENCES, htonl(set->ref)) ||
 	    nla_put_net32(skb, IPSET_ATTR_MEMSIZE, htonl(memsize)) ||
@@ -1078,6 +1299,8 @@ mtype_head(struct ip_set *set, struct sk_buff *skb)
 		goto nla_put_failure;
 	if (unlikely(ip_set_put_flags(skb, set)))
 		goto nla_put_failure;
+	if (unlikely(ip_set_put_stats(skb, set)))
+		goto nla_put_failure;
 	ipset_nest_end(skb, nested);
 
 	return 0;
@@ -1115,49 +1338,66 @@ mtype_list(const struct ip_set *set,
 	   struct sk_buff *skb, struct netlink_callback *cb)
 {
 	const struct htable *t;
-	struct nlattr *atd, *nested;
+	struct nlattr *atd, *nested, *packed = NULL;
 	const struct hbucket *n;
 	const struct mtype_elem *e;
-	u32 first = cb->args[IPSET_CB_ARG0];
-	/* We assume that one hash bucket fills into one page */
-	void *incomplete;
-	int i, ret = 0;
+	/* Resume from the bucket where the last message stopped and from
+	 * the slot when the bucket did not fit into a single message
+	 */
+	unsigned long cursor = cb->args[IPSET_CB_ARG0];
+	u32 bucket = ahash_cursor_bucket(cursor);
+	u32 i = ahash_cursor_slot(cursor);
+	void *head, *incomplete, *elem;
+	int ret = 0;
 
+	BUILD_BUG_ON(AHASH_MAX_TUNED > (1 << AHASH_CURSOR_SLOT_BITS));
 	atd = ipset_nest_start(skb, IPSET_ATTR_ADT);
 	if (!atd)
 		return -EMSGSIZE;
+#ifdef IP_SET_HASH_WITH_PACKED_DUMP
+	if (ip_set_dump_packed(set, cb)) {
+		/* Fixed size records follow in a single attribute */
+		packed = nla_reserve(skb, IPSET_ATTR_PACKED, 0);
+		if (!packed) {
+			nla_nest_cancel(skb, atd);
+			return -EMSGSIZE;
+		}
+	}
+#endif
+	head = skb_tail_pointer(skb);
 
 	pr_debug("list hash set %s\n", set->name);
 	t = (const struct htable *)cb->args[IPSET_CB_PRIVATE];
 	/* Expire may replace a hbucket with another one */
 	rcu_read_lock();
-	for (; cb->args[IPSET_CB_ARG0] < jhash_size(t->htable_bits);
-	     cb->args[IPSET_CB_ARG0]++) {
+	for (; bucket < ahash_buckets(t); bucket++, i = 0) {
 		cond_resched_rcu();
 		incomplete = skb_tail_pointer(skb);
-		n = rcu_dereference(hbucket(t, cb->args[IPSET_CB_ARG0]));
-		pr_debug("cb->arg bucket: %lu, t %p n %p\n",
-			 cb->args[IPSET_CB_ARG0], t, n);
+		n = rcu_dereference(hbucket(t, bucket));
+		pr_debug("cb->arg bucket: %u, slot %u, t %p n %p\n",
+			 bucket, i, t, n);
 		if (!n)
 			continue;
-		for (i = 0; i < n->pos; i++) {
+		for (; i < n->pos; i++) {
 			if (!test_bit(i, n->used))
 				continue;
 			e = ahash_data(n, i, set->dsize);
 			if (SET_WITH_TIMEOUT(set) &&
 			    ip_set_timeout_expired(ext_timeout(e, set)))
 				continue;
-			pr_debug("list hash %lu hbucket %p i %u, data %p\n",
-				 cb->args[IPSET_CB_ARG0], n, i, e);
-			nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
-			if (!nested) {
-				if (cb->args[IPSET_CB_ARG0] == first) {
-					nla_nest_cancel(skb, atd);
-					ret = -EMSGSIZE;
-					goto out;
-				}
-				goto nla_put_failure;
+			pr_debug("list hash %u hbucket %p i %u, data %p\n",
+				 bucket, n, i, e);
+			elem = skb_tail_pointer(skb);
+#ifdef IP_SET_HASH_WITH_PACKED_DUMP
+			if (packed) {
+				if (mtype_data_pack(skb, e))
+					goto message_full;
+				continue;
 			}
+#endif
+			nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+			if (!nested)
+				goto message_full;
 			if (mtype_data_list(skb, e))
 				goto nla_put_failure;
 			if (ip_set_put_extensions(skb, set, e, true))
@@ -1165,22 +1405,44 @@ mtype_list(const struct ip_set *set,
 			ipset_nest_end(skb, nested);
 		}
 	}
+	if (packed)
+		ipset_nest_end(skb, packed);
 	ipset_nest_end(skb, atd);
 	/* Set listing finished */
 	cb->args[IPSET_CB_ARG0] = 0;
 
 	goto out;
 
+message_full:
+	if (elem == head) {
+		nla_nest_cancel(skb, atd);
+		ret = -EMSGSIZE;
+		goto out;
+	}
+	/* fall through */
 nla_put_failure:
-	nlmsg_trim(skb, incomplete);
-	if (unlikely(first == cb->args[IPSET_CB_ARG0])) {
-		pr_warn("Can't list set %s: one bucket does not fit into a message. Please report it!\n",
+	if (incomplete != head) {
+		/* Continue with the bucket which did not fit */
+		nlmsg_trim(skb, incomplete);
+		cb->args[IPSET_CB_ARG0] = ahash_cursor(bucket, 0);
+	} else if (elem != head) {
+		/* The bucket does not fit into a message: continue with the
+		 * element which did not fit. Buckets are not compacted while
+		 * the table is dumped, so the slot remains valid.
+		 */
+		nlmsg_trim(skb, elem);
+		cb->args[IPSET_CB_ARG0] = ahash_cursor(bucket, i);
+	} else {
+		nlmsg_trim(skb, elem);
+		pr_warn("Can't list set %s: one element does not fit into a message. Please report it!\n",
 			set->name);
 		cb->args[IPSET_CB_ARG0] = 0;
 		ret = -EMSGSIZE;
-	} else {
-		ipset_nest_end(skb, atd);
+		goto out;
 	}
+	if (packed)
+		ipset_nest_end(skb, packed);
+	ipset_nest_end(skb, atd);
 out:
 	rcu_read_unlock();
 	return ret;
@@ -1210,6 +1472,7 @@ static const struct ip_set_type_variant mtype_variant = {
 	.list	= mtype_list,
 	.uref	= mtype_uref,
 	.resize	= mtype_resize,
+	.memsize = mtype_memsize,
 	.same_set = mtype_same_set,
 };
 
@@ -1225,6 +1488,9 @@ IPSET_TOKEN(HTYPE, _create)(struct net *net, struct ip_set *set,
 	u8 hbits;
 #ifdef IP_SET_HASH_WITH_NETMASK
 	u8 netmask;
+#endif
+#ifdef IP_SET_HASH_WITH_QUANTIZE
+	u8 quantize = 0;
 #endif
 	size_t hsize;
 	struct htype *h;
@@ -1272,6 +1538,14 @@ IPSET_TOKEN(HTYPE, _create)(struct net *net, struct ip_set *set,
 	}
 #endif
 
+#ifdef IP_SET_HASH_WITH_QUANTIZE
+	if (tb[IPSET_ATTR_QUANTIZE]) {
+		quantize = nla_get_u8(tb[IPSET_ATTR_QUANTIZE]);
+		if (quantize == 0)
+			return -IPSET_ERR_PROTOCOL;
+	}
+#endif
+
 	if (tb[IPSET_ATTR_HASHSIZE]) {
 		hashsize = ip_set_get_h32(tb[IPSET_ATTR_HASHSIZE]);
 		if (hashsize < IPSET_MIMINAL_HASHSIZE)
@@ -1303,6 +1577,9 @@ IPSET_TOKEN(HTYPE, _create)(struct net *net, struct ip_set *set,
 #endif
 #ifdef IP_SET_HASH_WITH_MARKMASK
 	h->markmask = markmask;
+#endif
+#ifdef IP_SET_HASH_WITH_QUANTIZE
+	h->quantize = quantize;
 #endif
 	get_random_bytes(&h->initval, sizeof(h->initval));
 
@@ -24,7 +24,9 @@
 /*				1	   Counters support */
 /*				2	   Comments support */
 /*				3	   Forceadd support */
-#define IPSET_TYPE_REV_MAX	4	/* skbinfo support  */
+/*				4	   skbinfo support */
+/*				5	   memlimit support */
+#define IPSET_TYPE_REV_MAX	6	/* stats support */
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@netfilter.org>");
@@ -34,6 +36,7 @@ MODULE_ALIAS("ip_set_hash:ip");
 /* Type specific function prefix */
 #define HTYPE		hash_ip
 #define IP_SET_HASH_WITH_NETMASK
+#define IP_SET_HASH_WITH_PACKED_DUMP
 
 /* IPv4 variant */
 
@@ -64,6 +67,12 @@ nla_put_failure:
 	return true;
 }
 
+static bool
+hash_ip4_data_pack(struct sk_buff *skb, const struct hash_ip4_elem *e)
+{
+	return ip_set_put_packed4(skb, e->ip, 0, 0);
+}
+
 static void
 hash_ip4_data_next(struct hash_ip4_elem *next, const struct hash_ip4_elem *e)
 {
@@ -197,6 +206,12 @@ nla_put_failure:
 	return true;
 }
 
+static bool
+hash_ip6_data_pack(struct sk_buff *skb, const struct hash_ip6_elem *e)
+{
+	return ip_set_put_packed6(skb, &e->ip.in6, 0, 0);
+}
+
 static void
 hash_ip6_data_next(struct hash_ip6_elem *next, const struct hash_ip6_elem *e)
 {
@@ -287,6 +302,7 @@ static struct ip_set_type hash_ip_type __read_mostly = {
 		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
 		[IPSET_ATTR_NETMASK]	= { .type = NLA_U8  },
 		[IPSET_ATTR_CADT_FLAGS]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MEMLIMIT]	= { .type = NLA_U32 },
 	},
 	.adt_policy	= {
 		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
@@ -28,7 +28,9 @@
 /*				4    Counters support added */
 /*				5    Comments support added */
 /*				6    Forceadd support added */
-#define IPSET_TYPE_REV_MAX	7 /* skbinfo support added */
+/*				7    skbinfo support added */
+/*				8    memlimit support */
+#define IPSET_TYPE_REV_MAX	9 /* stats support */
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@netfilter.org>");
@@ -45,6 +47,7 @@ MODULE_ALIAS("ip_set_hash:ip,port,net");
 #define IP_SET_HASH_WITH_NETS_PACKED
 #define IP_SET_HASH_WITH_PROTO
 #define IP_SET_HASH_WITH_NETS
+#define IP_SET_HASH_WITH_PRESIZE
 
 /* IPv4 variant */
 
@@ -160,14 +163,14 @@ static int
 hash_ipportnet4_uadt(struct ip_set *set, struct nlattr *tb[],
 		     enum ipset_adt adt, u32 *lineno, u32 flags, bool retried)
 {
-	const struct hash_ipportnet4 *h = set->data;
+	struct hash_ipportnet4 *h = set->data;
 	ipset_adtfn adtfn = set->variant->adt[adt];
 	struct hash_ipportnet4_elem e = { .cidr = HOST_MASK - 1 };
 	struct ip_set_ext ext = IP_SET_INIT_UEXT(set);
 	u32 ip = 0, ip_to = 0, p = 0, port, port_to;
-	u32 ip2_from = 0, ip2_to = 0, ip2;
+	u32 ip2_from = 0, ip2_to = 0, ip2, n2, k, i = 0;
+	u8 cidr, cidrs2[IPSET_RANGE_CIDRS];
 	bool with_ports = false;
-	u8 cidr;
 	int ret;
 
 	if (tb[IPSET_ATTR_LINENO])
@@ -266,6 +269,9 @@ hash_ipportnet4_uadt(struct ip_set *set, struct nlattr *tb[],
 		ip_set_mask_from_to(ip2_from, ip2_to, e.cidr + 1);
 	}
 
+	/* The networks of the second dimension, for all ip and port */
+	n2 = ip_set_range_to_cidrs(ip2_from, ip2_to, cidrs2);
+
 	if (retried) {
 		ip = ntohl(h->next.ip);
 		p = ntohs(h->next.port);
@@ -273,22 +279,40 @@ hash_ipportnet4_uadt(struct ip_set *set, struct nlattr *tb[],
 	} else {
 		p = port;
 		ip2 = ip2_from;
+		if (adt == IPSET_ADD) {
+			e.ip = htonl(ip);
+			e.port = htons(p);
+			e.ip2 = htonl(ip2);
+			ret = hash_ipportnet4_presize(set, &e,
+				min_t(u64, ((u64)ip_to - ip + 1) *
+					   (port_to - port + 1) * n2,
+				      UINT_MAX));
+			if (ret)
+				return ret;
+		}
 	}
+	k = ip_set_range_cidr_pos(ip2_from, cidrs2, n2, ip2);
 	for (; ip <= ip_to; ip++) {
 		e.ip = htonl(ip);
 		for (; p <= port_to; p++) {
 			e.port = htons(p);
-			do {
+			for (; k < n2; k++) {
 				e.ip2 = htonl(ip2);
-				ip2 = ip_set_range_to_cidr(ip2, ip2_to, &cidr);
-				e.cidr = cidr - 1;
+				e.cidr = cidrs2[k] - 1;
+				if (i++ == IPSET_RANGE_CHUNK) {
+					/* Continue without holding the lock */
+					hash_ipportnet4_data_next(&h->next, &e);
+					return -ERANGE;
+				}
 				ret = adtfn(set, &e, &ext, &ext, flags);
 
 				if (ret && !ip_set_eexist(ret, flags))
 					return ret;
 
 				ret = 0;
-			} while (ip2++ < ip2_to);
+				ip2 += ~ip_set_hostmask(cidrs2[k]) + 1;
+			}
+			k = 0;
 			ip2 = ip2_from;
 		}
 		p = port;
@@ -375,6 +399,8 @@ hash_ipportnet6_data_next(struct hash_ipportnet6_elem *next,
 
 #undef MTYPE
 #undef HOST_MASK
+/* The IPv4 address ranges only are presized */
+#undef IP_SET_HASH_WITH_PRESIZE
 
 #define MTYPE		hash_ipportnet6
 #define HOST_MASK	128
@@ -522,6 +548,7 @@ static struct ip_set_type hash_ipportnet_type __read_mostly = {
 		[IPSET_ATTR_RESIZE]	= { .type = NLA_U8  },
 		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
 		[IPSET_ATTR_CADT_FLAGS]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MEMLIMIT]	= { .type = NLA_U32 },
 	},
 	.adt_policy	= {
 		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
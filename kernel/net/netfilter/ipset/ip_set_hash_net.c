@@ -25,7 +25,10 @@
 /*				3    Counters support added */
 /*				4    Comments support added */
 /*				5    Forceadd support added */
-#define IPSET_TYPE_REV_MAX	6 /* skbinfo mapping support added */
+/*				6    skbinfo mapping support added */
+/*				7    memlimit support */
+/*				8    stats support */
+#define IPSET_TYPE_REV_MAX	9 /* cidr-quantize support */
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@netfilter.org>");
@@ -35,6 +38,8 @@ MODULE_ALIAS("ip_set_hash:net");
 /* Type specific function prefix */
 #define HTYPE		hash_net
 #define IP_SET_HASH_WITH_NETS
+#define IP_SET_HASH_WITH_PACKED_DUMP
+#define IP_SET_HASH_WITH_QUANTIZE
 
 /* IPv4 variant */
 
@@ -98,6 +103,13 @@ nla_put_failure:
 	return true;
 }
 
+static bool
+hash_net4_data_pack(struct sk_buff *skb, const struct hash_net4_elem *data)
+{
+	return ip_set_put_packed4(skb, data->ip, data->cidr,
+				  data->nomatch ? IPSET_FLAG_NOMATCH : 0);
+}
+
 static void
 hash_net4_data_next(struct hash_net4_elem *next,
 		    const struct hash_net4_elem *d)
@@ -263,6 +275,13 @@ nla_put_failure:
 	return true;
 }
 
+static bool
+hash_net6_data_pack(struct sk_buff *skb, const struct hash_net6_elem *data)
+{
+	return ip_set_put_packed6(skb, &data->ip.in6, data->cidr,
+				  data->nomatch ? IPSET_FLAG_NOMATCH : 0);
+}
+
 static void
 hash_net6_data_next(struct hash_net6_elem *next,
 		    const struct hash_net6_elem *d)
@@ -363,6 +382,8 @@ static struct ip_set_type hash_net_type __read_mostly = {
 		[IPSET_ATTR_RESIZE]	= { .type = NLA_U8  },
 		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
 		[IPSET_ATTR_CADT_FLAGS]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MEMLIMIT]	= { .type = NLA_U32 },
+		[IPSET_ATTR_QUANTIZE]	= { .type = NLA_U8 },
 	},
 	.adt_policy	= {
 		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
@@ -27,7 +27,9 @@
 /*				4    Comments support added */
 /*				5    Forceadd support added */
 /*				6    skbinfo support added */
-#define IPSET_TYPE_REV_MAX	7 /* interface wildcard support added */
+/*				7    interface wildcard support added */
+/*				8    memlimit support */
+#define IPSET_TYPE_REV_MAX	9 /* stats support */
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@netfilter.org>");
@@ -39,8 +41,48 @@ MODULE_ALIAS("ip_set_hash:net,iface");
 #define IP_SET_HASH_WITH_NETS
 #define IP_SET_HASH_WITH_MULTI
 #define IP_SET_HASH_WITH_NET0
+#define IP_SET_HASH_WITH_WILDCARD
 
-#define STRLCPY(a, b)	strlcpy(a, b, IFNAMSIZ)
+/* The interface names are stored zero padded and compared as words,
+ * masked by the length of the prefix for the wildcard elements
+ */
+#define IFACE_WORDS	(IFNAMSIZ / sizeof(u32))
+
+union iface_mask {
+	char b[IFNAMSIZ];
+	u32 w[IFACE_WORDS];
+};
+
+/* The masks of the prefix lengths, set up at module load */
+static union iface_mask iface_masks[IFNAMSIZ + 1] __read_mostly;
+
+static bool
+iface_equal(const u32 *a, const u32 *b, u8 len)
+{
+	const u32 *m = iface_masks[len].w;
+
+	return (((a[0] ^ b[0]) & m[0]) | ((a[1] ^ b[1]) & m[1]) |
+		((a[2] ^ b[2]) & m[2]) | ((a[3] ^ b[3]) & m[3])) == 0;
+}
+
+/* Copy the name of a device zero padded and return its length */
+static u8
+iface_load(u32 *w, const char *name)
+{
+	u8 len = strnlen(name, IFNAMSIZ - 1);
+	const u32 *m = iface_masks[len].w;
+
+	memcpy(w, name, IFNAMSIZ);
+	w[0] &= m[0];
+	w[1] &= m[1];
+	w[2] &= m[2];
+	w[3] &= m[3];
+	return len;
+}
+
+/* The compared length of the name of an element */
+#define IFACE_LEN(e)	\
+	((e)->wildcard ? strlen((e)->iface) : IFNAMSIZ)
 
 /* IPv4 variant */
 
@@ -60,7 +102,11 @@ struct hash_netiface4_elem {
 	u8 nomatch;
 	u8 elem;
 	u8 wildcard;
-	char iface[IFNAMSIZ];
+	u8 iflen;
+	union {
+		char iface[IFNAMSIZ];
+		u32 iface_w[IFACE_WORDS];
+	};
 };
 
 /* Common functions */
@@ -74,9 +120,8 @@ hash_netiface4_data_equal(const struct hash_netiface4_elem *ip1,
 	       ip1->cidr == ip2->cidr &&
 	       (++*multi) &&
 	       ip1->physdev == ip2->physdev &&
-	       (ip1->wildcard ?
-		strncmp(ip1->iface, ip2->iface, strlen(ip1->iface)) == 0 :
-		strcmp(ip1->iface, ip2->iface) == 0);
+	       ip1->wildcard == ip2->wildcard &&
+	       iface_equal(ip1->iface_w, ip2->iface_w, ip1->iflen);
 }
 
 static int
@@ -137,21 +182,23 @@ hash_netiface4_data_next(struct hash_netiface4_elem *next,
 #define HKEY_DATALEN	sizeof(struct hash_netiface4_elem_hashed)
 #include "ip_set_hash_gen.h"
 
-#if IS_ENABLED(CONFIG_BRIDGE_NETFILTER)
-static const char *get_physindev_name(const struct sk_buff *skb)
-{
-	struct net_device *dev = nf_bridge_get_physindev(skb);
-
-	return dev ? dev->name : NULL;
-}
-
-static const char *get_physoutdev_name(const struct sk_buff *skb)
+/* The device of the packet in the direction of the dimension */
+static const struct net_device *
+get_iface(const struct sk_buff *skb, const struct xt_action_param *par,
+	  const struct ip_set_adt_opt *opt)
 {
-	struct net_device *dev = nf_bridge_get_physoutdev(skb);
+	bool src = opt->flags & IPSET_DIM_TWO_SRC;
 
-	return dev ? dev->name : NULL;
-}
+	if (opt->cmdflags & IPSET_FLAG_PHYSDEV) {
+#if IS_ENABLED(CONFIG_BRIDGE_NETFILTER)
+		return src ? nf_bridge_get_physindev(skb) :
+			     nf_bridge_get_physoutdev(skb);
+#else
+		return NULL;
 #endif
+	}
+	return src ? XAP_STATE(par)->in : XAP_STATE(par)->out;
+}
 
 static int
 hash_netiface4_kadt(struct ip_set *set, const struct sk_buff *skb,
@@ -163,8 +210,10 @@ hash_netiface4_kadt(struct ip_set *set, const struct sk_buff *skb,
 	struct hash_netiface4_elem e = {
 		.cidr = INIT_CIDR(h->nets[0].cidr[0], HOST_MASK),
 		.elem = 1,
+		.iflen = IFNAMSIZ,
 	};
 	struct ip_set_ext ext = IP_SET_INIT_KEXT(skb, opt, set);
+	const struct net_device *dev;
 
 	if (adt == IPSET_TEST)
 		e.cidr = HOST_MASK;
@@ -172,25 +221,11 @@ hash_netiface4_kadt(struct ip_set *set, const struct sk_buff *skb,
 	ip4addrptr(skb, opt->flags & IPSET_DIM_ONE_SRC, &e.ip);
 	e.ip &= ip_set_netmask(e.cidr);
 
-#define IFACE(dir)	(XAP_STATE(par)->dir ? XAP_STATE(par)->dir->name : "")
-#define SRCDIR		(opt->flags & IPSET_DIM_TWO_SRC)
-
-	if (opt->cmdflags & IPSET_FLAG_PHYSDEV) {
-#if IS_ENABLED(CONFIG_BRIDGE_NETFILTER)
-		const char *eiface = SRCDIR ? get_physindev_name(skb) :
-					      get_physoutdev_name(skb);
-
-		if (!eiface)
-			return -EINVAL;
-		STRLCPY(e.iface, eiface);
-		e.physdev = 1;
-#endif
-	} else {
-		STRLCPY(e.iface, SRCDIR ? IFACE(in) : IFACE(out));
-	}
-
-	if (strlen(e.iface) == 0)
+	dev = get_iface(skb, par, opt);
+	if (!dev || iface_load(e.iface_w, dev->name) == 0)
 		return -EINVAL;
+	e.physdev = !!(opt->cmdflags & IPSET_FLAG_PHYSDEV);
+
 	return adtfn(set, &e, &ext, &opt->ext, opt->cmdflags);
 }
 
@@ -238,6 +273,7 @@ hash_netiface4_uadt(struct ip_set *set, struct nlattr *tb[],
 		if (cadt_flags & IPSET_FLAG_IFACE_WILDCARD)
 			e.wildcard = 1;
 	}
+	e.iflen = IFACE_LEN(&e);
 	if (adt == IPSET_TEST || !tb[IPSET_ATTR_IP_TO]) {
 		e.ip = htonl(ip & ip_set_hostmask(e.cidr));
 		ret = adtfn(set, &e, &ext, &ext, flags);
@@ -289,7 +325,11 @@ struct hash_netiface6_elem {
 	u8 nomatch;
 	u8 elem;
 	u8 wildcard;
-	char iface[IFNAMSIZ];
+	u8 iflen;
+	union {
+		char iface[IFNAMSIZ];
+		u32 iface_w[IFACE_WORDS];
+	};
 };
 
 /* Common functions */
@@ -303,9 +343,8 @@ hash_netiface6_data_equal(const struct hash_netiface6_elem *ip1,
 	       ip1->cidr == ip2->cidr &&
 	       (++*multi) &&
 	       ip1->physdev == ip2->physdev &&
-	       (ip1->wildcard ?
-		strncmp(ip1->iface, ip2->iface, strlen(ip1->iface)) == 0 :
-		strcmp(ip1->iface, ip2->iface) == 0);
+	       ip1->wildcard == ip2->wildcard &&
+	       iface_equal(ip1->iface_w, ip2->iface_w, ip1->iflen);
 }
 
 static int
@@ -379,8 +418,10 @@ hash_netiface6_kadt(struct ip_set *set, const struct sk_buff *skb,
 	struct hash_netiface6_elem e = {
 		.cidr = INIT_CIDR(h->nets[0].cidr[0], HOST_MASK),
 		.elem = 1,
+		.iflen = IFNAMSIZ,
 	};
 	struct ip_set_ext ext = IP_SET_INIT_KEXT(skb, opt, set);
+	const struct net_device *dev;
 
 	if (adt == IPSET_TEST)
 		e.cidr = HOST_MASK;
@@ -388,22 +429,10 @@ hash_netiface6_kadt(struct ip_set *set, const struct sk_buff *skb,
 	ip6addrptr(skb, opt->flags & IPSET_DIM_ONE_SRC, &e.ip.in6);
 	ip6_netmask(&e.ip, e.cidr);
 
-	if (opt->cmdflags & IPSET_FLAG_PHYSDEV) {
-#if IS_ENABLED(CONFIG_BRIDGE_NETFILTER)
-		const char *eiface = SRCDIR ? get_physindev_name(skb) :
-					      get_physoutdev_name(skb);
-
-		if (!eiface)
-			return -EINVAL;
-		STRLCPY(e.iface, eiface);
-		e.physdev = 1;
-#endif
-	} else {
-		STRLCPY(e.iface, SRCDIR ? IFACE(in) : IFACE(out));
-	}
-
-	if (strlen(e.iface) == 0)
+	dev = get_iface(skb, par, opt);
+	if (!dev || iface_load(e.iface_w, dev->name) == 0)
 		return -EINVAL;
+	e.physdev = !!(opt->cmdflags & IPSET_FLAG_PHYSDEV);
 
 	return adtfn(set, &e, &ext, &opt->ext, opt->cmdflags);
 }
@@ -455,6 +484,7 @@ hash_netiface6_uadt(struct ip_set *set, struct nlattr *tb[],
 		if (cadt_flags & IPSET_FLAG_IFACE_WILDCARD)
 			e.wildcard = 1;
 	}
+	e.iflen = IFACE_LEN(&e);
 
 	ret = adtfn(set, &e, &ext, &ext, flags);
 
@@ -480,6 +510,7 @@ static struct ip_set_type hash_netiface_type __read_mostly = {
 		[IPSET_ATTR_PROTO]	= { .type = NLA_U8 },
 		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
 		[IPSET_ATTR_CADT_FLAGS]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MEMLIMIT]	= { .type = NLA_U32 },
 	},
 	.adt_policy	= {
 		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
@@ -504,6 +535,10 @@ static struct ip_set_type hash_netiface_type __read_mostly = {
 static int __init
 hash_netiface_init(void)
 {
+	int i;
+
+	for (i = 0; i <= IFNAMSIZ; i++)
+		memset(iface_masks[i].b, 0xff, i);
 	return ip_set_type_register(&hash_netiface_type);
 }
 
@@ -24,7 +24,9 @@
 #define IPSET_TYPE_REV_MIN	0
 /*				0    Comments support added */
 /*				1    Forceadd support added */
-#define IPSET_TYPE_REV_MAX	2 /* skbinfo support added */
+/*				2    skbinfo support added */
+/*				3    memlimit support */
+#define IPSET_TYPE_REV_MAX	4 /* stats support */
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Oliver Smith <oliver@8.c.9.b.0.7.4.0.1.0.0.2.ip6.arpa>");
@@ -35,6 +37,7 @@ MODULE_ALIAS("ip_set_hash:net,port,net");
 #define HTYPE		hash_netportnet
 #define IP_SET_HASH_WITH_PROTO
 #define IP_SET_HASH_WITH_NETS
+#define IP_SET_HASH_WITH_PRESIZE
 #define IPSET_NET_COUNT 2
 
 /* IPv4 variant */
@@ -177,12 +180,13 @@ static int
 hash_netportnet4_uadt(struct ip_set *set, struct nlattr *tb[],
 		      enum ipset_adt adt, u32 *lineno, u32 flags, bool retried)
 {
-	const struct hash_netportnet4 *h = set->data;
+	struct hash_netportnet4 *h = set->data;
 	ipset_adtfn adtfn = set->variant->adt[adt];
 	struct hash_netportnet4_elem e = { };
 	struct ip_set_ext ext = IP_SET_INIT_UEXT(set);
-	u32 ip = 0, ip_to = 0, p = 0, port, port_to;
-	u32 ip2_from = 0, ip2_to = 0, ip2;
+	u32 ip = 0, ip_to = 0, p = 0, port, port_to, ip_from;
+	u32 ip2_from = 0, ip2_to = 0, ip2, n, n2, k, k2, i = 0;
+	u8 cidrs[IPSET_RANGE_CIDRS], cidrs2[IPSET_RANGE_CIDRS];
 	bool with_ports = false;
 	int ret;
 
@@ -285,6 +289,11 @@ hash_netportnet4_uadt(struct ip_set *set, struct nlattr *tb[],
 		ip_set_mask_from_to(ip2_from, ip2_to, e.cidr[1]);
 	}
 
+	/* The networks of both dimensions */
+	ip_from = ip;
+	n = ip_set_range_to_cidrs(ip, ip_to, cidrs);
+	n2 = ip_set_range_to_cidrs(ip2_from, ip2_to, cidrs2);
+
 	if (retried) {
 		ip = ntohl(h->next.ip[0]);
 		p = ntohs(h->next.port);
@@ -292,27 +301,46 @@ hash_netportnet4_uadt(struct ip_set *set, struct nlattr *tb[],
 	} else {
 		p = port;
 		ip2 = ip2_from;
+		if (adt == IPSET_ADD) {
+			e.ip[0] = htonl(ip);
+			e.port = htons(p);
+			e.ip[1] = htonl(ip2);
+			ret = hash_netportnet4_presize(set, &e,
+				min_t(u64, (u64)n * (port_to - port + 1) * n2,
+				      UINT_MAX));
+			if (ret)
+				return ret;
+		}
 	}
-
-	do {
+	k = ip_set_range_cidr_pos(ip_from, cidrs, n, ip);
+	k2 = ip_set_range_cidr_pos(ip2_from, cidrs2, n2, ip2);
+	for (; k < n; k++) {
 		e.ip[0] = htonl(ip);
-		ip = ip_set_range_to_cidr(ip, ip_to, &e.cidr[0]);
+		e.cidr[0] = cidrs[k];
 		for (; p <= port_to; p++) {
 			e.port = htons(p);
-			do {
+			for (; k2 < n2; k2++) {
 				e.ip[1] = htonl(ip2);
-				ip2 = ip_set_range_to_cidr(ip2, ip2_to,
-							   &e.cidr[1]);
+				e.cidr[1] = cidrs2[k2];
+				if (i++ == IPSET_RANGE_CHUNK) {
+					/* Continue without holding the lock */
+					hash_netportnet4_data_next(&h->next,
+								   &e);
+					return -ERANGE;
+				}
 				ret = adtfn(set, &e, &ext, &ext, flags);
 				if (ret && !ip_set_eexist(ret, flags))
 					return ret;
 
 				ret = 0;
-			} while (ip2++ < ip2_to);
+				ip2 += ~ip_set_hostmask(cidrs2[k2]) + 1;
+			}
+			k2 = 0;
 			ip2 = ip2_from;
 		}
 		p = port;
-	} while (ip++ < ip_to);
+		ip += ~ip_set_hostmask(cidrs[k]) + 1;
+	}
 	return ret;
 }
 
@@ -412,6 +440,8 @@ hash_netportnet6_data_next(struct hash_netportnet6_elem *next,
 
 #undef MTYPE
 #undef HOST_MASK
+/* The IPv4 address ranges only are presized */
+#undef IP_SET_HASH_WITH_PRESIZE
 
 #define MTYPE		hash_netportnet6
 #define HOST_MASK	128
@@ -567,6 +597,7 @@ static struct ip_set_type hash_netportnet_type __read_mostly = {
 		[IPSET_ATTR_RESIZE]	= { .type = NLA_U8  },
 		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
 		[IPSET_ATTR_CADT_FLAGS]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MEMLIMIT]	= { .type = NLA_U32 },
 	},
 	.adt_policy	= {
 		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
@@ -16,7 +16,9 @@
 #define IPSET_TYPE_REV_MIN	0
 /*				1    Counters support added */
 /*				2    Comments support added */
-#define IPSET_TYPE_REV_MAX	3 /* skbinfo support added */
+/*				3    skbinfo support added */
+/*				4    memlimit support */
+#define IPSET_TYPE_REV_MAX	5 /* stats support */
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@netfilter.org>");
@@ -180,8 +182,10 @@ set_cleanup_entries(struct ip_set *set)
 	struct set_elem *e, *n;
 
 	list_for_each_entry_safe(e, n, &map->members, list)
-		if (ip_set_timeout_expired(ext_timeout(e, set)))
+		if (ip_set_timeout_expired(ext_timeout(e, set))) {
 			list_set_del(set, e);
+			ip_set_stats_inc(set, expired);
+		}
 }
 
 static int
@@ -292,6 +296,10 @@ list_set_uadd(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 	    !(SET_WITH_TIMEOUT(set) &&
 	      ip_set_timeout_expired(ext_timeout(n, set))))
 		n = NULL;
+	if (!n && ip_set_memlimit_reached(set)) {
+		ip_set_stats_inc(set, full);
+		return -IPSET_ERR_MEMLIMIT;
+	}
 
 	e = kzalloc(set->dsize, GFP_ATOMIC);
 	if (!e)
@@ -445,8 +453,9 @@ list_set_destroy(struct ip_set *set)
 
 /* Calculate the actual memory size of the set data */
 static size_t
-list_set_memsize(const struct list_set *map, size_t dsize)
+list_set_memsize(const struct ip_set *set)
 {
+	const struct list_set *map = set->data;
 	struct set_elem *e;
 	u32 n = 0;
 
@@ -455,7 +464,7 @@ list_set_memsize(const struct list_set *map, size_t dsize)
 		n++;
 	rcu_read_unlock();
 
-	return (sizeof(*map) + n * dsize);
+	return (sizeof(*map) + n * set->dsize + set->ext_size);
 }
 
 static int
@@ -463,7 +472,7 @@ list_set_head(struct ip_set *set, struct sk_buff *skb)
 {
 	const struct list_set *map = set->data;
 	struct nlattr *nested;
-	size_t memsize = list_set_memsize(map, set->dsize) + set->ext_size;
+	size_t memsize = list_set_memsize(set);
 
 	nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
 	if (!nested)
@@ -475,6 +484,8 @@ list_set_head(struct ip_set *set, struct sk_buff *skb)
 		goto nla_put_failure;
 	if (unlikely(ip_set_put_flags(skb, set)))
 		goto nla_put_failure;
+	if (unlikely(ip_set_put_stats(skb, set)))
+		goto nla_put_failure;
 	ipset_nest_end(skb, nested);
 
 	return 0;
@@ -560,6 +571,7 @@ static const struct ip_set_type_variant set_variant = {
 	.flush	= list_set_flush,
 	.head	= list_set_head,
 	.list	= list_set_list,
+	.memsize = list_set_memsize,
 	.same_set = list_set_same_set,
 };
 
@@ -648,6 +660,7 @@ static struct ip_set_type list_set_type __read_mostly = {
 		[IPSET_ATTR_SIZE]	= { .type = NLA_U32 },
 		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
 		[IPSET_ATTR_CADT_FLAGS]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MEMLIMIT]	= { .type = NLA_U32 },
 	},
 	.adt_policy	= {
 		[IPSET_ATTR_NAME]	= { .type = NLA_STRING,
@@ -188,3 +188,32 @@ ip_set_range_to_cidr(u32 from, u32 to, u8 *cidr)
 	return from;
 }
 EXPORT_SYMBOL_GPL(ip_set_range_to_cidr);
+
+/* Split the range into networks, in host order: store the prefix lengths
+ * of the networks into cidrs, which must have room for IPSET_RANGE_CIDRS
+ * values, and return the number of the networks. As opposed to
+ * ip_set_range_to_cidr(), the networks are compared without wrapping
+ * around, so ranges over half of the address space are split minimally too.
+ */
+u32
+ip_set_range_to_cidrs(u32 from, u32 to, u8 *cidrs)
+{
+	u32 n = 0, last;
+	u8 i;
+
+	do {
+		for (i = 1; i < 32; i++) {
+			if ((from & ip_set_hostmask(i)) != from)
+				continue;
+			last = from | ~ip_set_hostmask(i);
+			if (last <= to)
+				break;
+		}
+		if (i == 32)
+			last = from;
+		cidrs[n++] = i;
+		from = last + 1;
+	} while (last < to);
+	return n;
+}
+EXPORT_SYMBOL_GPL(ip_set_range_to_cidrs);
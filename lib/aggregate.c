@@ -0,0 +1,923 @@
+/* Copyright 2007-2010 Jozsef Kadlecsik (kadlec@netfilter.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <arpa/inet.h>				/* ntohl, htonl */
+#include <errno.h>				/* errno */
+#include <stdlib.h>				/* malloc, free */
+#include <string.h>				/* memset */
+
+#include <libipset/nfproto.h>			/* NFPROTO_* */
+#include <libipset/aggregate.h>			/* prototypes */
+
+/* The networks of a hash:net set are stored in a radix tree: every node
+ * is a network, the children are the more specific networks in the lower
+ * and upper halves of it. Besides the elements, the nodes where the
+ * elements branch off are in the tree too.
+ *
+ * The kernel matches an address by the most specific element containing
+ * it, so the set decides "match" for an address when that element is
+ * a plain one and "no match" when it is a nomatch element or when there
+ * is no element at all. Elements with extensions are not aggregated,
+ * they are added as they are and bound the aggregated networks just as
+ * the nomatch elements. The networks to add are computed by a dynamic
+ * programming over the tree: the minimal number of plain networks which
+ * give the same decision for every address as the collected elements.
+ */
+
+/* Flags of the nodes */
+enum {
+	AGGR_ELEM	= (1 << 0),	/* Plain element */
+	AGGR_PENDING	= (1 << 1),	/* Plain element not walked yet */
+	AGGR_SENT	= (1 << 2),	/* Network added to the set */
+	AGGR_FIXED	= (1 << 3),	/* Element with extensions or nomatch */
+	AGGR_STALE	= (1 << 4),	/* Merged network to delete */
+	AGGR_PLAIN	= AGGR_ELEM | AGGR_SENT,
+};
+
+/* Cost of the impossible solutions, sums of a few do not overflow */
+#define AGGR_INF	(UINT32_MAX / 4)
+
+struct aggr_node {
+	uint32_t addr[4];		/* Network in host order */
+	uint32_t child[2];		/* Lower and upper half, 0: none */
+	uint32_t cost[2];		/* Networks to add below when the
+					 * inherited decision is no/match */
+	uint8_t cidr;
+	uint8_t flags;
+};
+
+struct aggr_net {
+	uint32_t addr[4];
+	uint8_t cidr;
+};
+
+struct ipset_aggr {
+	struct aggr_node *node;		/* The tree, node[0] is the root */
+	uint32_t nodes, size;
+	uint8_t family;
+	uint8_t bits;			/* Address length */
+	bool pending;			/* There are pending elements */
+	bool merged;			/* Networks are merged already */
+	bool stale;			/* There are stale networks */
+	/* Networks added at the walk, which are not nodes yet */
+	struct aggr_net *added;
+	uint32_t nadded, added_size;
+};
+
+static inline unsigned int
+addr_bit(const uint32_t *addr, uint8_t i)
+{
+	return (addr[i / 32] >> (31 - i % 32)) & 1;
+}
+
+static void
+addr_mask(uint32_t *addr, uint8_t cidr)
+{
+	unsigned int i;
+
+	for (i = 0; i < 4; i++) {
+		if (cidr <= 32 * i)
+			addr[i] = 0;
+		else if (cidr < 32 * (i + 1))
+			addr[i] &= ~0U << (32 * (i + 1) - cidr);
+	}
+}
+
+/* Length of the common prefix of the addresses, at most max */
+static uint8_t
+addr_common(const uint32_t *a, const uint32_t *b, uint8_t max)
+{
+	unsigned int i, len;
+
+	for (i = 0; i < 4 && 32 * i < max; i++) {
+		if (a[i] != b[i]) {
+			len = 32 * i + __builtin_clz(a[i] ^ b[i]);
+			return len < max ? len : max;
+		}
+	}
+	return max;
+}
+
+static inline uint32_t
+cost_add(uint32_t a, uint32_t b)
+{
+	return a + b > AGGR_INF ? AGGR_INF : a + b;
+}
+
+/* Cost of a region without nodes, where the elements decide d */
+static inline uint32_t
+empty_cost(unsigned int d, unsigned int c)
+{
+	return c == d ? 0 : d ? 1 : AGGR_INF;
+}
+
+static uint32_t
+node_new(struct ipset_aggr *aggr, const uint32_t *addr, uint8_t cidr)
+{
+	struct aggr_node *n;
+
+	if (aggr->nodes == aggr->size) {
+		uint32_t size = aggr->size ? 2 * aggr->size : 1024;
+
+		n = realloc(aggr->node, size * sizeof(*n));
+		if (n == NULL)
+			return 0;
+		aggr->node = n;
+		aggr->size = size;
+	}
+	n = &aggr->node[aggr->nodes];
+	memset(n, 0, sizeof(*n));
+	memcpy(n->addr, addr, sizeof(n->addr));
+	addr_mask(n->addr, cidr);
+	n->cidr = cidr;
+	return aggr->nodes++;
+}
+
+/* Find the node of the network, create it when asked so.
+ * Returns 0 when the node does not exist or cannot be allocated. */
+static uint32_t
+node_get(struct ipset_aggr *aggr, const uint32_t *addr, uint8_t cidr,
+	 bool create)
+{
+	uint32_t v = 0, u, n, m;
+	unsigned int b;
+	uint8_t len;
+
+	for (;;) {
+		b = addr_bit(addr, aggr->node[v].cidr);
+		u = aggr->node[v].child[b];
+		if (u == 0) {
+			if (!create)
+				return 0;
+			n = node_new(aggr, addr, cidr);
+			if (n)
+				aggr->node[v].child[b] = n;
+			return n;
+		}
+		len = addr_common(addr, aggr->node[u].addr,
+				  cidr < aggr->node[u].cidr ?
+				  cidr : aggr->node[u].cidr);
+		if (len == aggr->node[u].cidr) {
+			if (len == cidr)
+				return u;
+			v = u;
+			continue;
+		}
+		if (!create)
+			return 0;
+		if (len == cidr) {
+			/* The network contains the child */
+			n = node_new(aggr, addr, cidr);
+			if (n == 0)
+				return 0;
+			aggr->node[n].child[addr_bit(aggr->node[u].addr,
+						     cidr)] = u;
+			aggr->node[v].child[b] = n;
+			return n;
+		}
+		/* Branch off at the common prefix */
+		m = node_new(aggr, addr, len);
+		if (m == 0)
+			return 0;
+		n = node_new(aggr, addr, cidr);
+		if (n == 0)
+			return 0;
+		aggr->node[m].child[addr_bit(addr, len)] = n;
+		aggr->node[m].child[addr_bit(aggr->node[u].addr, len)] = u;
+		aggr->node[v].child[b] = m;
+		return n;
+	}
+}
+
+/* Split the IPv4 range into networks */
+static int
+range_to_nets(uint32_t from, uint32_t to, struct aggr_net *nets)
+{
+	int n = 0;
+	uint8_t cidr;
+
+	for (;;) {
+		for (cidr = 1; cidr < 32; cidr++) {
+			uint32_t mask = ~0U << (32 - cidr);
+
+			if ((from & mask) == from && (from | ~mask) <= to)
+				break;
+		}
+		memset(&nets[n], 0, sizeof(nets[n]));
+		nets[n].addr[0] = from;
+		nets[n++].cidr = cidr;
+		from |= cidr < 32 ? ~(~0U << (32 - cidr)) : 0;
+		if (from >= to)
+			return n;
+		from++;
+	}
+}
+
+/* The merged networks below a new fixed element may cover addresses
+ * which are not matched anymore */
+static void
+tree_stale(struct ipset_aggr *aggr, uint32_t v)
+{
+	struct aggr_node *n = &aggr->node[v];
+
+	if ((n->flags & (AGGR_SENT | AGGR_ELEM)) == AGGR_SENT) {
+		n->flags |= AGGR_STALE;
+		aggr->stale = true;
+	}
+	if (n->child[0])
+		tree_stale(aggr, n->child[0]);
+	if (n->child[1])
+		tree_stale(aggr, n->child[1]);
+}
+
+/**
+ * ipset_aggr_add - add an element to the aggregated networks
+ * @aggr: aggregated networks of the set
+ * @ip: address of the element, in network order
+ * @ip_to: end of the IPv4 range of the element or NULL
+ * @cidr: prefix length of the element, when it is not a range
+ * @fixed: the element has got extensions or it is a nomatch one
+ *
+ * The plain elements are collected, the fixed ones are recorded only
+ * and must be added to the set by the caller. A plain element which
+ * replaces a fixed one, as with the -exist option, must be added by the
+ * caller too. Before adding a fixed element, the merged networks which
+ * it makes stale must be deleted by ipset_aggr_stale().
+ *
+ * Returns 0 when the element is collected, 1 when it must be added
+ * or a negative error code.
+ */
+int
+ipset_aggr_add(struct ipset_aggr *aggr, const union nf_inet_addr *ip,
+	       const union nf_inet_addr *ip_to, uint8_t cidr, bool fixed)
+{
+	struct aggr_net nets[64];
+	int i, n = 1, ret = fixed;
+	uint32_t v;
+
+	if (ip_to != NULL) {
+		uint32_t from = ntohl(ip->ip), to = ntohl(ip_to->ip);
+
+		n = from <= to ? range_to_nets(from, to, nets)
+			       : range_to_nets(to, from, nets);
+	} else {
+		for (i = 0; i < 4; i++)
+			nets[0].addr[i] = ntohl(ip->all[i]);
+		if (aggr->family == NFPROTO_IPV4)
+			nets[0].addr[1] = nets[0].addr[2] = nets[0].addr[3] = 0;
+		nets[0].cidr = cidr ? cidr : aggr->bits;
+	}
+
+	for (i = 0; i < n; i++) {
+		addr_mask(nets[i].addr, nets[i].cidr);
+		v = node_get(aggr, nets[i].addr, nets[i].cidr, false);
+		if (v != 0 && (aggr->node[v].flags & AGGR_FIXED))
+			ret = 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		v = node_get(aggr, nets[i].addr, nets[i].cidr, true);
+		if (v == 0)
+			return -ENOMEM;
+		if (fixed) {
+			tree_stale(aggr, v);
+			aggr->node[v].flags = AGGR_FIXED |
+					      (aggr->node[v].flags & AGGR_STALE);
+			/* The merged networks may have to be split */
+			if (aggr->merged)
+				aggr->pending = true;
+		} else if (ret) {
+			/* The element replaces the same network */
+			aggr->node[v].flags = AGGR_ELEM | AGGR_SENT;
+			/* The merged networks may have to be split */
+			if (aggr->merged)
+				aggr->pending = true;
+		} else if (!(aggr->node[v].flags & AGGR_PLAIN)) {
+			aggr->node[v].flags |= AGGR_ELEM | AGGR_PENDING;
+			aggr->pending = true;
+		} else {
+			/* Duplicates and merged networks are collapsed */
+			aggr->node[v].flags |= AGGR_ELEM;
+		}
+	}
+	return ret;
+}
+
+/**
+ * ipset_aggr_pending - test for pending elements
+ * @aggr: aggregated networks of the set
+ *
+ * Returns true if there are collected elements not added yet.
+ */
+bool
+ipset_aggr_pending(const struct ipset_aggr *aggr)
+{
+	return aggr->pending;
+}
+
+/* The possible choices at a node: add the network or not, and the
+ * decision inherited by the subtree from the added networks */
+static int
+node_choices(const struct aggr_node *n, unsigned int c, unsigned int ch[][2])
+{
+	if (n->flags & AGGR_FIXED) {
+		ch[0][0] = 0, ch[0][1] = 0;
+		return 1;
+	}
+	if (n->flags & AGGR_SENT) {
+		ch[0][0] = 0, ch[0][1] = 1;
+		return 1;
+	}
+	ch[0][0] = 0, ch[0][1] = c;
+	if (n->cidr == 0)
+		return 1;
+	ch[1][0] = 1, ch[1][1] = 1;
+	return 2;
+}
+
+static inline unsigned int
+node_decision(const struct aggr_node *n, unsigned int d)
+{
+	return n->flags & AGGR_PLAIN ? 1 : n->flags & AGGR_FIXED ? 0 : d;
+}
+
+/* The costs of the networks between the node and its child, where the
+ * other halves are empty regions, stored into cost[k - cidr - 1][c] */
+static void
+chain_costs(const struct ipset_aggr *aggr, uint32_t v, uint32_t u,
+	    unsigned int d, uint32_t cost[][2])
+{
+	const struct aggr_node *child = &aggr->node[u];
+	int k, top = aggr->node[v].cidr + 1;
+
+	cost[child->cidr - top][0] = child->cost[0];
+	cost[child->cidr - top][1] = child->cost[1];
+	for (k = child->cidr - 1; k >= top; k--) {
+		uint32_t *below = cost[k + 1 - top];
+		uint32_t add = cost_add(1, cost_add(empty_cost(d, 1),
+						    below[1]));
+
+		cost[k - top][0] = cost_add(empty_cost(d, 0), below[0]);
+		if (add < cost[k - top][0])
+			cost[k - top][0] = add;
+		cost[k - top][1] = cost_add(empty_cost(d, 1), below[1]);
+	}
+}
+
+static uint32_t
+half_cost(const struct ipset_aggr *aggr, uint32_t v, unsigned int b,
+	  unsigned int d, unsigned int c)
+{
+	uint32_t u = aggr->node[v].child[b];
+	uint32_t cost[129][2];
+
+	if (u == 0)
+		return empty_cost(d, c);
+	chain_costs(aggr, v, u, d, cost);
+	return cost[0][c];
+}
+
+static uint32_t
+choice_cost(const struct ipset_aggr *aggr, uint32_t v, unsigned int d,
+	    const unsigned int *ch)
+{
+	if (aggr->node[v].cidr == aggr->bits)
+		return cost_add(ch[0], ch[1] == d ? 0 : AGGR_INF);
+	return cost_add(ch[0], cost_add(half_cost(aggr, v, 0, d, ch[1]),
+					half_cost(aggr, v, 1, d, ch[1])));
+}
+
+static void
+tree_cost(struct ipset_aggr *aggr, uint32_t v, unsigned int d)
+{
+	unsigned int ch[2][2], c, i, n, b;
+	uint32_t cost;
+
+	d = node_decision(&aggr->node[v], d);
+	for (b = 0; b < 2; b++)
+		if (aggr->node[v].child[b])
+			tree_cost(aggr, aggr->node[v].child[b], d);
+	for (c = 0; c < 2; c++) {
+		aggr->node[v].cost[c] = AGGR_INF;
+		n = node_choices(&aggr->node[v], c, ch);
+		for (i = 0; i < n; i++) {
+			cost = choice_cost(aggr, v, d, ch[i]);
+			if (cost < aggr->node[v].cost[c])
+				aggr->node[v].cost[c] = cost;
+		}
+	}
+}
+
+static int
+net_add(struct ipset_aggr *aggr, const uint32_t *addr, uint8_t cidr,
+	ipset_aggr_fn fn, void *p)
+{
+	union nf_inet_addr ip = {};
+	unsigned int i;
+
+	for (i = 0; i < 4; i++)
+		ip.all[i] = htonl(addr[i]);
+	if (aggr->nadded == aggr->added_size) {
+		uint32_t size = aggr->added_size ? 2 * aggr->added_size : 64;
+		struct aggr_net *added;
+
+		added = realloc(aggr->added, size * sizeof(*added));
+		if (added == NULL)
+			return -ENOMEM;
+		aggr->added = added;
+		aggr->added_size = size;
+	}
+	memcpy(aggr->added[aggr->nadded].addr, addr, sizeof(ip.all));
+	aggr->added[aggr->nadded++].cidr = cidr;
+	return fn(&ip, cidr, p);
+}
+
+/* Add the empty half of a network when the decision must change there */
+static int
+half_add(struct ipset_aggr *aggr, const uint32_t *addr, uint8_t cidr,
+	 unsigned int b, unsigned int d, unsigned int c,
+	 ipset_aggr_fn fn, void *p)
+{
+	uint32_t half[4];
+
+	if (c == d)
+		return 0;
+	memcpy(half, addr, sizeof(half));
+	addr_mask(half, cidr);
+	if (b)
+		half[cidr / 32] |= 1U << (31 - cidr % 32);
+	return net_add(aggr, half, cidr + 1, fn, p);
+}
+
+static int tree_walk(struct ipset_aggr *aggr, uint32_t v, unsigned int d,
+		     unsigned int c, ipset_aggr_fn fn, void *p);
+
+/* Walk down from the node to its child: returns the decision inherited
+ * by the child or a negative error code */
+static int
+chain_walk(struct ipset_aggr *aggr, uint32_t v, unsigned int b,
+	   unsigned int d, unsigned int c, ipset_aggr_fn fn, void *p)
+{
+	uint32_t u = aggr->node[v].child[b], addr[4];
+	int k, top = aggr->node[v].cidr + 1, ret;
+	uint32_t cost[129][2];
+
+	chain_costs(aggr, v, u, d, cost);
+	memcpy(addr, aggr->node[u].addr, sizeof(addr));
+	for (k = top; k < aggr->node[u].cidr; k++) {
+		const uint32_t *below = cost[k + 1 - top];
+
+		if (cost_add(empty_cost(d, c), below[c]) != cost[k - top][c]) {
+			/* Add the network here */
+			uint32_t net[4];
+
+			memcpy(net, addr, sizeof(net));
+			addr_mask(net, k);
+			ret = net_add(aggr, net, k, fn, p);
+			if (ret < 0)
+				return ret;
+			c = 1;
+		}
+		ret = half_add(aggr, addr, k, !addr_bit(addr, k), d, c, fn, p);
+		if (ret < 0)
+			return ret;
+	}
+	return c;
+}
+
+static int
+tree_walk(struct ipset_aggr *aggr, uint32_t v, unsigned int d,
+	  unsigned int c, ipset_aggr_fn fn, void *p)
+{
+	unsigned int ch[2][2], i, n, b;
+	int ret = 0;
+
+	d = node_decision(&aggr->node[v], d);
+	n = node_choices(&aggr->node[v], c, ch);
+	for (i = 0; i < n - 1; i++)
+		if (choice_cost(aggr, v, d, ch[i]) == aggr->node[v].cost[c])
+			break;
+	if (ch[i][0] && !(aggr->node[v].flags & AGGR_SENT)) {
+		ret = fn(&(union nf_inet_addr) {
+				.all = { htonl(aggr->node[v].addr[0]),
+					 htonl(aggr->node[v].addr[1]),
+					 htonl(aggr->node[v].addr[2]),
+					 htonl(aggr->node[v].addr[3]) } },
+			 aggr->node[v].cidr, p);
+		if (ret < 0)
+			return ret;
+		aggr->node[v].flags |= AGGR_SENT;
+	}
+	aggr->node[v].flags &= ~AGGR_PENDING;
+	c = ch[i][1];
+	if (aggr->node[v].cidr == aggr->bits)
+		return 0;
+
+	for (b = 0; b < 2 && ret >= 0; b++) {
+		if (aggr->node[v].child[b] == 0) {
+			ret = half_add(aggr, aggr->node[v].addr,
+				       aggr->node[v].cidr, b, d, c, fn, p);
+			continue;
+		}
+		ret = chain_walk(aggr, v, b, d, c, fn, p);
+		if (ret >= 0)
+			ret = tree_walk(aggr, aggr->node[v].child[b], d, ret,
+					fn, p);
+	}
+	return ret;
+}
+
+/* Call the function for the nodes with the flag: the pending elements
+ * are added as they are, the stale networks are deleted */
+static int
+tree_flagged(struct ipset_aggr *aggr, uint32_t v, uint8_t flag,
+	     ipset_aggr_fn fn, void *p)
+{
+	struct aggr_node *n = &aggr->node[v];
+	unsigned int b;
+	int ret;
+
+	if (n->flags & flag) {
+		ret = fn(&(union nf_inet_addr) {
+				.all = { htonl(n->addr[0]), htonl(n->addr[1]),
+					 htonl(n->addr[2]), htonl(n->addr[3]) } },
+			 n->cidr, p);
+		if (ret < 0)
+			return ret;
+		if (flag == AGGR_PENDING)
+			n->flags = (n->flags & ~AGGR_PENDING) | AGGR_SENT;
+		else
+			n->flags &= ~(AGGR_STALE | AGGR_SENT);
+	}
+	for (b = 0; b < 2; b++) {
+		if (n->child[b] == 0)
+			continue;
+		ret = tree_flagged(aggr, n->child[b], flag, fn, p);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * ipset_aggr_stale - delete the stale merged networks
+ * @aggr: aggregated networks of the set
+ * @fn: function called for the networks to delete
+ * @p: private data of the function
+ *
+ * Returns 0 on success or the first negative value returned by @fn.
+ */
+int
+ipset_aggr_stale(struct ipset_aggr *aggr, ipset_aggr_fn fn, void *p)
+{
+	if (!aggr->stale)
+		return 0;
+	aggr->stale = false;
+	return tree_flagged(aggr, 0, AGGR_STALE, fn, p);
+}
+
+/**
+ * ipset_aggr_walk - add the pending elements
+ * @aggr: aggregated networks of the set
+ * @merge: aggregate the elements
+ * @fn: function called for the networks to add
+ * @p: private data of the function
+ *
+ * Call the function for the minimal number of networks which keeps
+ * the decisions of the set for all addresses or, when @merge is false
+ * and no networks were merged before, for the pending elements as they
+ * are. The networks are recorded as added ones for the next walks.
+ *
+ * Returns 0 on success or the first negative value returned by @fn.
+ */
+int
+ipset_aggr_walk(struct ipset_aggr *aggr, bool merge, ipset_aggr_fn fn,
+		void *p)
+{
+	uint32_t i;
+	int ret;
+
+	if (!aggr->pending)
+		return 0;
+	aggr->pending = false;
+	if (!merge && !aggr->merged)
+		return tree_flagged(aggr, 0, AGGR_PENDING, fn, p);
+	aggr->merged = true;
+	aggr->nadded = 0;
+	tree_cost(aggr, 0, 0);
+	ret = tree_walk(aggr, 0, 0, 0, fn, p);
+
+	/* The added networks between the nodes become nodes too */
+	for (i = 0; i < aggr->nadded; i++) {
+		uint32_t v = node_get(aggr, aggr->added[i].addr,
+				      aggr->added[i].cidr, true);
+
+		if (v == 0)
+			return -ENOMEM;
+		aggr->node[v].flags |= AGGR_SENT;
+	}
+	return ret;
+}
+
+/* Quantizing: the networks are expanded into a few prefix lengths. The
+ * cost of mapping the length l to q is count[l] * 2^(q - l) networks,
+ * the sums are saturated. */
+#define AGGR_QMAX	(UINT64_MAX / 4)
+
+static inline uint64_t
+qcost_add(uint64_t a, uint64_t b)
+{
+	return a + b > AGGR_QMAX ? AGGR_QMAX : a + b;
+}
+
+static inline uint64_t
+qcost_expand(uint64_t count, uint8_t bits)
+{
+	return bits >= 62 || count > AGGR_QMAX >> bits ? AGGR_QMAX
+						       : count << bits;
+}
+
+/* Count the pending elements by prefix lengths, the lengths of the
+ * elements in the set already cannot be changed */
+static void
+tree_lengths(const struct ipset_aggr *aggr, uint32_t v, uint64_t *count,
+	     bool *fixed)
+{
+	const struct aggr_node *n = &aggr->node[v];
+	unsigned int b;
+
+	if (n->flags & AGGR_FIXED || (n->flags & AGGR_PLAIN) == AGGR_PLAIN)
+		fixed[n->cidr] = true;
+	else if (n->flags & AGGR_ELEM)
+		count[n->cidr]++;
+	for (b = 0; b < 2; b++)
+		if (n->child[b])
+			tree_lengths(aggr, n->child[b], count, fixed);
+}
+
+/**
+ * ipset_aggr_quantize_plan - choose the prefix lengths of the networks
+ * @aggr: aggregated networks of the set
+ * @max: max number of the prefix lengths
+ * @cidrs: the chosen prefix lengths in increasing order
+ * @cost: the number of the networks to add, at most
+ *
+ * The elements are mapped to the shortest chosen prefix length which
+ * is not shorter than theirs. The lengths are chosen so that the least
+ * networks are added, the lengths of the elements with extensions,
+ * nomatch ones and the longest length are always chosen. Thus more
+ * than @max lengths are chosen when those are more than @max.
+ *
+ * Returns the number of the chosen prefix lengths.
+ */
+unsigned int
+ipset_aggr_quantize_plan(const struct ipset_aggr *aggr, unsigned int max,
+			 uint8_t *cidrs, uint64_t *cost)
+{
+	uint64_t count[129] = {}, f[130][130], c, v;
+	unsigned int m = 0, k, need = 0, i, j, t, best;
+	uint8_t len[130], from[130][130];
+	bool fixed[129] = {};
+
+	tree_lengths(aggr, 0, count, fixed);
+	for (i = 0; i <= aggr->bits; i++) {
+		if (!count[i] && !fixed[i])
+			continue;
+		len[++m] = i;
+		need += fixed[i];
+	}
+	*cost = 0;
+	if (m == 0)
+		return 0;
+	if (!fixed[len[m]])
+		need++;
+	k = max < need ? need : max < m ? max : m;
+
+	/* f[t][j]: the cost of the lengths up to len[j] with t lengths
+	 * chosen, the last one is len[j]. UINT64_MAX: not possible. */
+	for (t = 0; t <= k; t++)
+		for (j = 0; j <= m; j++)
+			f[t][j] = UINT64_MAX;
+	f[0][0] = 0;
+	for (t = 1; t <= k; t++) {
+		for (j = t; j <= m; j++) {
+			c = 0;
+			for (i = j; i-- > 0;) {
+				/* len[i + 1]..len[j] are mapped to len[j] */
+				c = qcost_add(c, qcost_expand(count[len[i + 1]],
+						len[j] - len[i + 1]));
+				v = f[t - 1][i] == UINT64_MAX ? UINT64_MAX
+					: qcost_add(f[t - 1][i], c);
+				if (v < f[t][j]) {
+					f[t][j] = v;
+					from[t][j] = i;
+				}
+				/* The fixed lengths cannot be mapped */
+				if (i && fixed[len[i]])
+					break;
+			}
+		}
+	}
+	/* Prefer less lengths at the same cost */
+	for (best = 0, t = 1; t <= k; t++)
+		if (f[t][m] != UINT64_MAX &&
+		    (best == 0 || f[t][m] < f[best][m]))
+			best = t;
+	*cost = f[best][m];
+	for (t = best, j = m; t > 0; j = from[t--][j])
+		cidrs[t - 1] = len[j];
+	return best;
+}
+
+/* Step to the next network of the prefix length */
+static void
+addr_next(uint32_t *addr, uint8_t cidr)
+{
+	unsigned int shift = 128 - cidr;
+	uint64_t carry = 1ULL << (shift % 32);
+	int i;
+
+	for (i = 3 - shift / 32; i >= 0 && carry; i--) {
+		carry += addr[i];
+		addr[i] = (uint32_t) carry;
+		carry >>= 32;
+	}
+}
+
+/* Call the function for the networks of length q in the region,
+ * at most 2^31 networks */
+static int
+region_expand(const uint32_t *addr, uint8_t cidr, uint8_t q,
+	      ipset_aggr_fn fn, void *p)
+{
+	union nf_inet_addr ip;
+	uint32_t net[4], i;
+	unsigned int j;
+	int ret;
+
+	if (q - cidr > 31)
+		return -ERANGE;
+	memcpy(net, addr, sizeof(net));
+	addr_mask(net, cidr);
+	for (i = 0; i < 1U << (q - cidr); i++) {
+		for (j = 0; j < 4; j++)
+			ip.all[j] = htonl(net[j]);
+		ret = fn(&ip, q, p);
+		if (ret < 0)
+			return ret;
+		addr_next(net, q);
+	}
+	return 0;
+}
+
+/* Expand the region, skipping the elements of length q at most which
+ * decide for the addresses they cover. The nodes in the region are in
+ * the subtree of u. */
+static int
+region_quantize(const struct ipset_aggr *aggr, const uint32_t *addr,
+		uint8_t cidr, uint32_t u, uint8_t q, ipset_aggr_fn fn, void *p)
+{
+	const struct aggr_node *n = &aggr->node[u];
+	uint32_t half[4];
+	unsigned int b;
+	uint8_t k;
+	int ret;
+
+	if (u == 0 || n->cidr > q)
+		return region_expand(addr, cidr, q, fn, p);
+	/* The empty halves between the region and the node */
+	for (k = cidr; k < n->cidr; k++) {
+		memcpy(half, n->addr, sizeof(half));
+		addr_mask(half, k + 1);
+		half[k / 32] ^= 1U << (31 - k % 32);
+		ret = region_expand(half, k + 1, q, fn, p);
+		if (ret < 0)
+			return ret;
+	}
+	if (n->flags & (AGGR_ELEM | AGGR_FIXED))
+		return 0;
+	if (n->cidr == q)
+		return region_expand(n->addr, q, q, fn, p);
+	for (b = 0; b < 2; b++) {
+		memcpy(half, n->addr, sizeof(half));
+		if (b)
+			half[n->cidr / 32] |= 1U << (31 - n->cidr % 32);
+		ret = region_quantize(aggr, half, n->cidr + 1, n->child[b], q,
+				      fn, p);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+static int
+tree_quantize(const struct ipset_aggr *aggr, uint32_t v, const uint8_t *q,
+	      ipset_aggr_fn fn, void *p)
+{
+	const struct aggr_node *n = &aggr->node[v];
+	uint32_t half[4];
+	unsigned int b;
+	int ret;
+
+	if ((n->flags & (AGGR_ELEM | AGGR_SENT | AGGR_FIXED)) == AGGR_ELEM) {
+		for (b = 0; b < 2 && n->cidr < q[n->cidr]; b++) {
+			memcpy(half, n->addr, sizeof(half));
+			if (b)
+				half[n->cidr / 32] |= 1U << (31 - n->cidr % 32);
+			ret = region_quantize(aggr, half, n->cidr + 1,
+					      n->child[b], q[n->cidr], fn, p);
+			if (ret < 0)
+				return ret;
+		}
+		if (n->cidr == q[n->cidr]) {
+			ret = region_expand(n->addr, n->cidr, n->cidr,
+					    fn, p);
+			if (ret < 0)
+				return ret;
+		}
+	}
+	for (b = 0; b < 2; b++) {
+		if (n->child[b] == 0)
+			continue;
+		ret = tree_quantize(aggr, n->child[b], q, fn, p);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * ipset_aggr_quantize - add the elements expanded into a few lengths
+ * @aggr: aggregated networks of the set
+ * @max: max number of the prefix lengths
+ * @fn: function called for the networks to add
+ * @p: private data of the function
+ *
+ * Call the function for the networks which keep the decisions of the
+ * set for all addresses, with the prefix lengths chosen by
+ * ipset_aggr_quantize_plan(). The networks of the pending elements are
+ * added only, the networks are not recorded: the aggregation must not
+ * be walked after it.
+ *
+ * Returns 0 on success, -ERANGE when an element cannot be expanded
+ * or the first negative value returned by @fn.
+ */
+int
+ipset_aggr_quantize(const struct ipset_aggr *aggr, unsigned int max,
+		    ipset_aggr_fn fn, void *p)
+{
+	uint8_t cidrs[129], q[129];
+	unsigned int n, i, l;
+	uint64_t cost;
+
+	n = ipset_aggr_quantize_plan(aggr, max, cidrs, &cost);
+	if (n == 0)
+		return 0;
+	/* The chosen length of the elements by their lengths */
+	for (i = 0, l = 0; l <= aggr->bits; l++) {
+		while (i < n - 1 && cidrs[i] < l)
+			i++;
+		q[l] = cidrs[i];
+	}
+	return tree_quantize(aggr, 0, q, fn, p);
+}
+
+/**
+ * ipset_aggr_init - create an empty aggregation of networks
+ * @family: family of the set
+ *
+ * Returns the new structure or NULL.
+ */
+struct ipset_aggr *
+ipset_aggr_init(uint8_t family)
+{
+	struct ipset_aggr *aggr = calloc(1, sizeof(*aggr));
+	uint32_t root[4] = {};
+
+	if (aggr == NULL)
+		return NULL;
+	aggr->family = family;
+	aggr->bits = family == NFPROTO_IPV4 ? 32 : 128;
+	/* The root is the node 0 */
+	node_new(aggr, root, 0);
+	if (aggr->node == NULL) {
+		free(aggr);
+		return NULL;
+	}
+	return aggr;
+}
+
+/**
+ * ipset_aggr_fini - release an aggregation of networks
+ * @aggr: aggregated networks of the set
+ */
+void
+ipset_aggr_fini(struct ipset_aggr *aggr)
+{
+	free(aggr->node);
+	free(aggr->added);
+	free(aggr);
+}
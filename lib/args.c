@@ -284,6 +284,33 @@ static const struct ipset_arg ipset_args[] = {
 		.print = ipset_print_number,
 		.help = "[skbqueue VALUE]",
 	},
+	/* Memory limit */
+	[IPSET_ARG_MEMLIMIT] = {
+		.name = { "memlimit", NULL },
+		.has_arg = IPSET_MANDATORY_ARG,
+		.opt = IPSET_OPT_MEMLIMIT,
+		.parse = ipset_parse_uint32,
+		.print = ipset_print_number,
+		.help = "[memlimit VALUE]",
+	},
+	/* Statistics */
+	[IPSET_ARG_STATS] = {
+		.name = { "stats", NULL },
+		.has_arg = IPSET_NO_ARG,
+		.opt = IPSET_OPT_STATS,
+		.parse = ipset_parse_flag,
+		.print = ipset_print_flag,
+		.help = "[stats]",
+	},
+	/* Prefix lengths */
+	[IPSET_ARG_QUANTIZE] = {
+		.name = { "cidr-quantize", NULL },
+		.has_arg = IPSET_MANDATORY_ARG,
+		.opt = IPSET_OPT_QUANTIZE,
+		.parse = ipset_parse_quantize,
+		.print = ipset_print_number,
+		.help = "[cidr-quantize VALUE]",
+	},
 };
 
 const struct ipset_arg *
@@ -8,6 +8,7 @@
 #include <arpa/inet.h>				/* ntoh* */
 #include <net/ethernet.h>			/* ETH_ALEN */
 #include <net/if.h>				/* IFNAMSIZ */
+#include <stddef.h>				/* offsetof */
 #include <stdlib.h>				/* malloc, free */
 #include <string.h>				/* memset */
 
@@ -29,6 +30,8 @@ struct ipset_data {
 	uint64_t bits;
 	/* Option bits: which options are ignored */
 	uint64_t ignored;
+	/* Option bits: which fields are written since the last reset */
+	uint64_t touched;
 	/* Setname  */
 	char setname[IPSET_MAXNAMELEN];
 	/* Set type */
@@ -58,6 +61,8 @@ struct ipset_data {
 			uint32_t markmask;
 			uint32_t gc;
 			uint32_t size;
+			uint32_t memlimit;
+			uint8_t quantize;
 			/* Filled out by kernel */
 			uint32_t references;
 			uint32_t elements;
@@ -86,6 +91,79 @@ struct ipset_data {
 	};
 };
 
+/* The fields of the options, cleared at reset when they were written */
+struct data_field {
+	uint16_t offset;
+	uint16_t size;
+};
+
+#define DATA_FIELD(f)					\
+	{ offsetof(struct ipset_data, f),		\
+	  sizeof(((struct ipset_data *)0)->f) }
+
+static const struct data_field data_field[IPSET_OPT_MAX] = {
+	[IPSET_SETNAME]			= DATA_FIELD(setname),
+	[IPSET_OPT_TYPENAME]		= DATA_FIELD(create.typename),
+	[IPSET_OPT_FAMILY]		= DATA_FIELD(family),
+	[IPSET_OPT_IP]			= DATA_FIELD(ip),
+	[IPSET_OPT_IP_TO]		= DATA_FIELD(ip_to),
+	[IPSET_OPT_CIDR]		= DATA_FIELD(cidr),
+	[IPSET_OPT_MARK]		= DATA_FIELD(mark),
+	[IPSET_OPT_PORT]		= DATA_FIELD(port),
+	[IPSET_OPT_PORT_TO]		= DATA_FIELD(port_to),
+	[IPSET_OPT_TIMEOUT]		= DATA_FIELD(timeout),
+	[IPSET_OPT_GC]			= DATA_FIELD(create.gc),
+	[IPSET_OPT_HASHSIZE]		= DATA_FIELD(create.hashsize),
+	[IPSET_OPT_MAXELEM]		= DATA_FIELD(create.maxelem),
+	[IPSET_OPT_MARKMASK]		= DATA_FIELD(create.markmask),
+	[IPSET_OPT_NETMASK]		= DATA_FIELD(create.netmask),
+	[IPSET_OPT_PROBES]		= DATA_FIELD(create.probes),
+	[IPSET_OPT_RESIZE]		= DATA_FIELD(create.resize),
+	[IPSET_OPT_SIZE]		= DATA_FIELD(create.size),
+	[IPSET_OPT_ELEMENTS]		= DATA_FIELD(create.elements),
+	[IPSET_OPT_REFERENCES]		= DATA_FIELD(create.references),
+	[IPSET_OPT_MEMSIZE]		= DATA_FIELD(create.memsize),
+	[IPSET_OPT_ETHER]		= DATA_FIELD(adt.ether),
+	[IPSET_OPT_NAME]		= DATA_FIELD(adt.name),
+	[IPSET_OPT_NAMEREF]		= DATA_FIELD(adt.nameref),
+	[IPSET_OPT_IP2]			= DATA_FIELD(adt.ip2),
+	[IPSET_OPT_CIDR2]		= DATA_FIELD(adt.cidr2),
+	[IPSET_OPT_IP2_TO]		= DATA_FIELD(adt.ip2_to),
+	[IPSET_OPT_PROTO]		= DATA_FIELD(adt.proto),
+	[IPSET_OPT_IFACE]		= DATA_FIELD(adt.iface),
+	[IPSET_OPT_SETNAME2]		= DATA_FIELD(setname2),
+	[IPSET_OPT_PACKETS]		= DATA_FIELD(adt.packets),
+	[IPSET_OPT_BYTES]		= DATA_FIELD(adt.bytes),
+	[IPSET_OPT_ADT_COMMENT]		= DATA_FIELD(adt.comment),
+	[IPSET_OPT_SKBMARK]		= DATA_FIELD(adt.skbmark),
+	[IPSET_OPT_SKBPRIO]		= DATA_FIELD(adt.skbprio),
+	[IPSET_OPT_SKBQUEUE]		= DATA_FIELD(adt.skbqueue),
+	[IPSET_OPT_MEMLIMIT]		= DATA_FIELD(create.memlimit),
+	[IPSET_OPT_FLAGS]		= DATA_FIELD(flags),
+	[IPSET_OPT_CADT_FLAGS]		= DATA_FIELD(cadt_flags),
+	[IPSET_OPT_TYPE]		= DATA_FIELD(type),
+	[IPSET_OPT_REVISION]		= DATA_FIELD(create.revision),
+	[IPSET_OPT_REVISION_MIN]	= DATA_FIELD(create.revision_min),
+	[IPSET_OPT_INDEX]		= DATA_FIELD(index),
+	[IPSET_OPT_QUANTIZE]		= DATA_FIELD(create.quantize),
+};
+
+/* The options with fields outside of the union */
+#define DATA_FIXED_FLAGS				\
+	(IPSET_FLAG(IPSET_SETNAME)			\
+	 | IPSET_FLAG(IPSET_OPT_FAMILY)			\
+	 | IPSET_FLAG(IPSET_OPT_IP)			\
+	 | IPSET_FLAG(IPSET_OPT_IP_TO)			\
+	 | IPSET_FLAG(IPSET_OPT_CIDR)			\
+	 | IPSET_FLAG(IPSET_OPT_MARK)			\
+	 | IPSET_FLAG(IPSET_OPT_PORT)			\
+	 | IPSET_FLAG(IPSET_OPT_PORT_TO)		\
+	 | IPSET_FLAG(IPSET_OPT_TIMEOUT)		\
+	 | IPSET_FLAG(IPSET_OPT_INDEX)			\
+	 | IPSET_FLAG(IPSET_OPT_FLAGS)			\
+	 | IPSET_FLAG(IPSET_OPT_CADT_FLAGS)		\
+	 | IPSET_FLAG(IPSET_OPT_TYPE))
+
 static void
 copy_addr(uint8_t family, union nf_inet_addr *ip, const void *value)
 {
@@ -95,6 +173,24 @@ copy_addr(uint8_t family, union nf_inet_addr *ip, const void *value)
 		in6cpy(&ip->in6, value);
 }
 
+/* Copy a string into the field of the option. A field not written since
+ * the last reset is zeroed already, so the padding can be skipped. */
+static void
+copy_str(const struct ipset_data *data, enum ipset_opt opt,
+	 char *dst, const char *src, size_t len)
+{
+	uint64_t written = IPSET_FLAG(opt);
+
+	if (!(DATA_FIXED_FLAGS & written))
+		written |= ~DATA_FIXED_FLAGS;
+	if (data->touched & written) {
+		ipset_strlcpy(dst, src, len);
+		return;
+	}
+	len = strnlen(src, len - 1);
+	memcpy(dst, src, len);
+}
+
 /**
  * ipset_strlcpy - copy the string from src to dst
  * @dst: the target string buffer
@@ -244,7 +340,7 @@ ipset_data_set(struct ipset_data *data, enum ipset_opt opt, const void *value)
 	switch (opt) {
 	/* Common ones */
 	case IPSET_SETNAME:
-		ipset_strlcpy(data->setname, value, IPSET_MAXNAMELEN);
+		copy_str(data, opt, data->setname, value, IPSET_MAXNAMELEN);
 		break;
 	case IPSET_OPT_TYPE:
 		data->type = value;
@@ -310,6 +406,12 @@ ipset_data_set(struct ipset_data *data, enum ipset_opt opt, const void *value)
 	case IPSET_OPT_SIZE:
 		data->create.size = *(const uint32_t *) value;
 		break;
+	case IPSET_OPT_MEMLIMIT:
+		data->create.memlimit = *(const uint32_t *) value;
+		break;
+	case IPSET_OPT_QUANTIZE:
+		data->create.quantize = *(const uint8_t *) value;
+		break;
 	case IPSET_OPT_COUNTERS:
 		cadt_flag_type_attr(data, opt, IPSET_FLAG_WITH_COUNTERS);
 		break;
@@ -322,6 +424,9 @@ ipset_data_set(struct ipset_data *data, enum ipset_opt opt, const void *value)
 	case IPSET_OPT_SKBINFO:
 		cadt_flag_type_attr(data, opt, IPSET_FLAG_WITH_SKBINFO);
 		break;
+	case IPSET_OPT_STATS:
+		cadt_flag_type_attr(data, opt, IPSET_FLAG_WITH_STATS);
+		break;
 	/* Create-specific options, filled out by the kernel */
 	case IPSET_OPT_ELEMENTS:
 		data->create.elements = *(const uint32_t *) value;
@@ -334,8 +439,8 @@ ipset_data_set(struct ipset_data *data, enum ipset_opt opt, const void *value)
 		break;
 	/* Create-specific options, type */
 	case IPSET_OPT_TYPENAME:
-		ipset_strlcpy(data->create.typename, value,
-			      IPSET_MAXNAMELEN);
+		copy_str(data, opt, data->create.typename, value,
+			 IPSET_MAXNAMELEN);
 		break;
 	case IPSET_OPT_REVISION:
 		data->create.revision = *(const uint8_t *) value;
@@ -348,10 +453,10 @@ ipset_data_set(struct ipset_data *data, enum ipset_opt opt, const void *value)
 		memcpy(data->adt.ether, value, ETH_ALEN);
 		break;
 	case IPSET_OPT_NAME:
-		ipset_strlcpy(data->adt.name, value, IPSET_MAXNAMELEN);
+		copy_str(data, opt, data->adt.name, value, IPSET_MAXNAMELEN);
 		break;
 	case IPSET_OPT_NAMEREF:
-		ipset_strlcpy(data->adt.nameref, value, IPSET_MAXNAMELEN);
+		copy_str(data, opt, data->adt.nameref, value, IPSET_MAXNAMELEN);
 		break;
 	case IPSET_OPT_IP2:
 		if (!(data->family == NFPROTO_IPV4 ||
@@ -372,7 +477,7 @@ ipset_data_set(struct ipset_data *data, enum ipset_opt opt, const void *value)
 		data->adt.proto = *(const uint8_t *) value;
 		break;
 	case IPSET_OPT_IFACE:
-		ipset_strlcpy(data->adt.iface, value, IFNAMSIZ);
+		copy_str(data, opt, data->adt.iface, value, IFNAMSIZ);
 		break;
 	case IPSET_OPT_PACKETS:
 		data->adt.packets = *(const uint64_t *) value;
@@ -381,8 +486,8 @@ ipset_data_set(struct ipset_data *data, enum ipset_opt opt, const void *value)
 		data->adt.bytes = *(const uint64_t *) value;
 		break;
 	case IPSET_OPT_ADT_COMMENT:
-		ipset_strlcpy(data->adt.comment, value,
-			      IPSET_MAX_COMMENT_SIZE + 1);
+		copy_str(data, opt, data->adt.comment, value,
+			 IPSET_MAX_COMMENT_SIZE + 1);
 		break;
 	case IPSET_OPT_SKBMARK:
 		data->adt.skbmark = *(const uint64_t *) value;
@@ -395,7 +500,7 @@ ipset_data_set(struct ipset_data *data, enum ipset_opt opt, const void *value)
 		break;
 	/* Swap/rename */
 	case IPSET_OPT_SETNAME2:
-		ipset_strlcpy(data->setname2, value, IPSET_MAXNAMELEN);
+		copy_str(data, opt, data->setname2, value, IPSET_MAXNAMELEN);
 		break;
 	/* flags */
 	case IPSET_OPT_EXIST:
@@ -439,11 +544,15 @@ ipset_data_set(struct ipset_data *data, enum ipset_opt opt, const void *value)
 		if (data->cadt_flags & IPSET_FLAG_IFACE_WILDCARD)
 			ipset_data_flags_set(data,
 					     IPSET_FLAG(IPSET_OPT_IFACE_WILDCARD));
+		if (data->cadt_flags & IPSET_FLAG_WITH_STATS)
+			ipset_data_flags_set(data,
+					     IPSET_FLAG(IPSET_OPT_STATS));
 		break;
 	default:
 		return -1;
 	};
 
+	data->touched |= IPSET_FLAG(opt);
 	ipset_data_flags_set(data, IPSET_FLAG(opt));
 	return 0;
 }
@@ -514,6 +623,10 @@ ipset_data_get(const struct ipset_data *data, enum ipset_opt opt)
 		return &data->create.resize;
 	case IPSET_OPT_SIZE:
 		return &data->create.size;
+	case IPSET_OPT_MEMLIMIT:
+		return &data->create.memlimit;
+	case IPSET_OPT_QUANTIZE:
+		return &data->create.quantize;
 	/* Create-specific options, filled out by the kernel */
 	case IPSET_OPT_ELEMENTS:
 		return &data->create.elements;
@@ -571,6 +684,7 @@ ipset_data_get(const struct ipset_data *data, enum ipset_opt opt)
 	case IPSET_OPT_FORCEADD:
 	case IPSET_OPT_SKBINFO:
 	case IPSET_OPT_IFACE_WILDCARD:
+	case IPSET_OPT_STATS:
 		return &data->cadt_flags;
 	default:
 		return NULL;
@@ -613,6 +727,7 @@ ipset_data_sizeof(enum ipset_opt opt, uint8_t family)
 	case IPSET_OPT_MAXELEM:
 	case IPSET_OPT_MARKMASK:
 	case IPSET_OPT_SIZE:
+	case IPSET_OPT_MEMLIMIT:
 	case IPSET_OPT_ELEMENTS:
 	case IPSET_OPT_REFERENCES:
 	case IPSET_OPT_MEMSIZE:
@@ -628,6 +743,7 @@ ipset_data_sizeof(enum ipset_opt opt, uint8_t family)
 	case IPSET_OPT_PROBES:
 	case IPSET_OPT_RESIZE:
 	case IPSET_OPT_PROTO:
+	case IPSET_OPT_QUANTIZE:
 		return sizeof(uint8_t);
 	case IPSET_OPT_ETHER:
 		return ETH_ALEN;
@@ -638,6 +754,7 @@ ipset_data_sizeof(enum ipset_opt opt, uint8_t family)
 	case IPSET_OPT_COUNTERS:
 	case IPSET_OPT_FORCEADD:
 	case IPSET_OPT_IFACE_WILDCARD:
+	case IPSET_OPT_STATS:
 		return sizeof(uint32_t);
 	case IPSET_OPT_ADT_COMMENT:
 		return IPSET_MAX_COMMENT_SIZE + 1;
@@ -710,12 +827,21 @@ ipset_data_flags(const struct ipset_data *data)
  * @data: data blob
  *
  * Resets the data blob to the unset state for every field.
+ * Only the fields written since the last reset are cleared.
  */
 void
 ipset_data_reset(struct ipset_data *data)
 {
+	uint64_t touched;
+	unsigned int opt;
+
 	assert(data);
-	memset(data, 0, sizeof(*data));
+	for (touched = data->touched; touched; touched &= touched - 1) {
+		opt = __builtin_ctzll(touched);
+		memset((char *)data + data_field[opt].offset, 0,
+		       data_field[opt].size);
+	}
+	data->bits = data->ignored = data->touched = 0;
 }
 
 /**
@@ -23,6 +23,8 @@ static const struct ipset_attrname cmdattr2name[] = {
 	[IPSET_ATTR_ADT]	= { .name = "ADT" },
 	[IPSET_ATTR_LINENO]	= { .name = "LINENO" },
 	[IPSET_ATTR_PROTOCOL_MIN] = { .name = "PROTO_MIN" },
+	[IPSET_ATTR_INDEX]	= { .name = "INDEX" },
+	[IPSET_ATTR_PACKED]	= { .name = "PACKED" },
 };
 
 static const struct ipset_attrname createattr2name[] = {
@@ -46,6 +48,10 @@ static const struct ipset_attrname createattr2name[] = {
 	[IPSET_ATTR_ELEMENTS]	= { .name = "ELEMENTS" },
 	[IPSET_ATTR_REFERENCES]	= { .name = "REFERENCES" },
 	[IPSET_ATTR_MEMSIZE]	= { .name = "MEMSIZE" },
+	[IPSET_ATTR_MEMLIMIT]	= { .name = "MEMLIMIT" },
+	[IPSET_ATTR_STATS]	= { .name = "STATS" },
+	[IPSET_ATTR_QUANTIZE]	= { .name = "QUANTIZE" },
+	[IPSET_ATTR_CIDRS]	= { .name = "CIDRS" },
 };
 
 static const struct ipset_attrname adtattr2name[] = {
@@ -78,6 +78,8 @@ static const struct ipset_errcode_table core_errcode_table[] = {
 	  "Comment cannot be used: set was created without comment support" },
 	{ IPSET_ERR_SKBINFO, 0,
 	  "Skbinfo mapping cannot be used: set was created without skbinfo support" },
+	{ IPSET_ERR_MEMLIMIT, 0,
+	  "Element cannot be added to the set: the memory limit of the set is reached" },
 
 	/* ADD specific error codes */
 	{ IPSET_ERR_EXIST, IPSET_CMD_ADD,
@@ -125,6 +127,8 @@ static const struct ipset_errcode_table hash_errcode_table[] = {
 	  "Range is not supported in the \"net\" component of the element" },
 	{ IPSET_ERR_HASH_RANGE, 0,
 	  "Invalid range, covers the whole address space" },
+	{ IPSET_ERR_HASH_CIDRS, 0,
+	  "The set stores as many prefix lengths as cidr-quantize allows" },
 	{ },
 };
 
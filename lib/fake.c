@@ -0,0 +1,2201 @@
+/* Copyright 2007-2010 Jozsef Kadlecsik (kadlec@netfilter.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* In-process emulation of the ipset kernel side, for tests and
+ * benchmarks without a kernel. Sessions use it instead of the kernel
+ * when IPSET_FAKE_STATE is set or ipset_session_transport() selects it.
+ * When IPSET_FAKE_LOG names a file, the requests are logged into it.
+ * The sets are kept in memory and, when IPSET_FAKE_STATE names a file,
+ * loaded from and saved into the file, so that consecutive ipset
+ * processes see the same sets. The elements
+ * are stored as the attributes sent by userspace, after the ranges are
+ * expanded and the networks are masked as the kernel does. Packets
+ * cannot be matched, thus the counters change only by the commands.
+ * In non-blocking mode the replies are queued in the handle and one
+ * end of a socket pair signals that they can be received.
+ */
+#include <assert.h>				/* assert */
+#include <endian.h>				/* htobe64 */
+#include <errno.h>				/* errno */
+#include <fcntl.h>				/* open */
+#include <limits.h>				/* PATH_MAX */
+#include <stdio.h>				/* FILE, snprintf */
+#include <stdlib.h>				/* calloc, free */
+#include <string.h>				/* str*, mem* */
+#include <time.h>				/* time */
+#include <unistd.h>				/* getpid */
+#include <arpa/inet.h>				/* hto* */
+#include <sys/file.h>				/* flock */
+#include <sys/socket.h>				/* socketpair */
+#include <net/ethernet.h>			/* ETH_ALEN */
+
+#include <libipset/linux_ip_set.h>		/* enum ipset_cmd */
+#include <libipset/linux_ip_set_bitmap.h>	/* IPSET_ERR_BITMAP_* */
+#include <libipset/linux_ip_set_hash.h>
+#include <libipset/linux_ip_set_list.h>		/* IPSET_ERR_HASH_* */
+#include <libipset/compat.h>			/* htobe64() */
+#include <libipset/debug.h>			/* D() */
+#include <libipset/list_sort.h>			/* list_head */
+#include <libipset/nfproto.h>			/* NFPROTO_* */
+#include <libipset/types.h>			/* ipset_types */
+#include <libipset/utils.h>			/* STREQ */
+#include <libipset/mnl.h>			/* prototypes */
+
+#ifndef NFNL_SUBSYS_IPSET
+#define NFNL_SUBSYS_IPSET	6
+#endif
+
+#define FAKE_MAXSETS		65535		/* The kernel grows the array */
+#define FAKE_HASHSIZE		1024
+#define FAKE_MAXELEM		65536
+#define FAKE_LISTSIZE		8		/* Default list:set size */
+#define FAKE_ELEMLEN		1024		/* Max length of an element */
+#define FAKE_STATE_MAGIC	"ipset-fake 2\n"
+
+struct fake_elem {
+	struct list_head list;			/* Elements in insertion order */
+	struct fake_elem *next;			/* Hash bucket chain */
+	uint32_t hash;				/* Hash of the key */
+	time_t expires;				/* Timeout or zero */
+	uint16_t len;				/* Length of the attributes */
+	unsigned char attrs[];			/* Attributes of the element */
+};
+
+struct fake_set {
+	struct list_head list;			/* Sets in creation order */
+	char name[IPSET_MAXNAMELEN];		/* Name of the set */
+	char typename[IPSET_MAXNAMELEN];	/* Type of the set */
+	uint8_t revision;			/* Revision of the type */
+	uint8_t family;				/* Family of the set */
+	uint16_t clen;				/* Length of create attributes */
+	unsigned char *create;			/* Create attributes */
+	bool with_timeout;			/* Set with timeout */
+	uint32_t timeout;			/* Default timeout */
+	uint8_t netmask;			/* Netmask of hash:ip or zero */
+	uint32_t markmask;			/* Markmask of hash:ip,mark */
+	bool counters;				/* Set with counters */
+	bool with_stats;			/* Set with statistics */
+	uint64_t stats[IPSET_ATTR_STATS_MAX];	/* Statistics of the set */
+	bool bitmap;				/* Bitmap type */
+	bool ipmac;				/* bitmap:ip,mac */
+	bool setlist;				/* list:set */
+	bool iface;				/* hash:net,iface */
+	uint8_t quantize;			/* Max prefix lengths or zero */
+	uint32_t ncidr[129];			/* Elements by prefix length */
+	uint32_t refs;				/* References by list:set */
+	uint32_t first, last;			/* Range of a bitmap type */
+	uint32_t maxelem;			/* Max number of elements */
+	uint32_t elements;			/* Number of elements */
+	uint32_t hsize;				/* Number of hash buckets */
+	size_t memsize;				/* Size of the elements */
+	struct list_head elems;			/* Elements */
+	struct fake_elem **hash;		/* Hash buckets */
+};
+
+/* The emulated kernel: shared by all handles of the process */
+static struct list_head fake_sets = { &fake_sets, &fake_sets };
+static unsigned int fake_nsets;
+static unsigned int fake_users;
+static bool fake_dirty;
+static int fake_lock = -1;
+
+struct ipset_handle {
+	unsigned int seq;		/* netlink message sequence number */
+	unsigned int portid;		/* the fake port identifier */
+	mnl_cb_t *cb_ctl;		/* control block callbacks */
+	void *data;			/* data pointer */
+	void *reply;			/* reply buffer */
+	size_t replylen;		/* size of reply buffer */
+	/* Non-blocking mode */
+	bool async;			/* queue the replies */
+	int sock[2];			/* readable while replies are queued */
+	void *queue;			/* queued replies */
+	size_t queued;			/* length of the queued replies */
+	size_t queuelen;		/* size of the queue */
+};
+
+/*
+ * Attribute helpers
+ */
+
+static int
+fake_attr_cb(const struct nlattr *attr, void *data)
+{
+	const struct nlattr **tb = data;
+	uint16_t type = mnl_attr_get_type(attr);
+
+	/* The callers pass tables large enough for IPSET_ATTR_ADT_MAX */
+	if (type <= IPSET_ATTR_ADT_MAX)
+		tb[type] = attr;
+	return MNL_CB_OK;
+}
+
+static uint32_t
+fake_get_u32(const struct nlattr *attr)
+{
+	uint32_t v = mnl_attr_get_u32(attr);
+
+	return attr->nla_type & NLA_F_NET_BYTEORDER ? ntohl(v) : v;
+}
+
+/* The address attribute nested into an IP attribute */
+static struct nlattr *
+fake_ipaddr(const struct nlattr *attr)
+{
+	struct nlattr *a = mnl_attr_get_payload(attr);
+
+	if (!mnl_attr_ok(a, mnl_attr_get_payload_len(attr)))
+		return NULL;
+	return a;
+}
+
+static unsigned char *
+fake_put(unsigned char *p, uint16_t type, const void *d, uint16_t len)
+{
+	struct nlattr *a = (struct nlattr *) p;
+
+	a->nla_type = type;
+	a->nla_len = MNL_ATTR_HDRLEN + len;
+	memcpy(p + MNL_ATTR_HDRLEN, d, len);
+	memset(p + a->nla_len, 0, MNL_ALIGN(a->nla_len) - a->nla_len);
+	return p + MNL_ALIGN(a->nla_len);
+}
+
+/* Copy the attributes of a nest into a message */
+static void
+fake_put_raw(struct nlmsghdr *nlh, const void *d, size_t len)
+{
+	memcpy(mnl_nlmsg_get_payload_tail(nlh), d, len);
+	nlh->nlmsg_len += MNL_ALIGN(len);
+}
+
+static void
+fake_put_net32(struct nlmsghdr *nlh, uint16_t type, uint32_t v)
+{
+	mnl_attr_put_u32(nlh, type | NLA_F_NET_BYTEORDER, htonl(v));
+}
+
+/* Extensions and control attributes are not part of the key, neither
+ * the MAC address of bitmap:ip,mac, which is filled out by the packets,
+ * nor the position of the list:set elements
+ */
+static bool
+fake_key_attr(const struct fake_set *set, uint16_t type)
+{
+	switch (type) {
+	case IPSET_ATTR_ETHER:
+		return !set->bitmap || !set->ipmac;
+	case IPSET_ATTR_NAMEREF:
+		return false;
+	case IPSET_ATTR_TIMEOUT:
+	case IPSET_ATTR_CADT_FLAGS:
+	case IPSET_ATTR_LINENO:
+	case IPSET_ATTR_BYTES:
+	case IPSET_ATTR_PACKETS:
+	case IPSET_ATTR_COMMENT:
+	case IPSET_ATTR_SKBMARK:
+	case IPSET_ATTR_SKBPRIO:
+	case IPSET_ATTR_SKBQUEUE:
+	case IPSET_ATTR_PAD:
+		return false;
+	default:
+		return true;
+	}
+}
+
+static const struct nlattr *
+fake_key_next(const struct fake_set *set, const struct nlattr *a,
+	      const unsigned char *end)
+{
+	while (mnl_attr_ok(a, end - (const unsigned char *) a)) {
+		if (fake_key_attr(set, mnl_attr_get_type(a)))
+			return a;
+		a = mnl_attr_next(a);
+	}
+	return NULL;
+}
+
+static uint32_t
+fake_hash(const struct fake_set *set, const unsigned char *attrs,
+	  uint16_t len)
+{
+	const unsigned char *end = attrs + len;
+	const struct nlattr *a = (const struct nlattr *) attrs;
+	uint32_t h = 2166136261U;
+	const unsigned char *p;
+
+	/* FNV-1a over the key attributes */
+	for (a = fake_key_next(set, a, end); a != NULL;
+	     a = fake_key_next(set, mnl_attr_next(a), end)) {
+		for (p = (const unsigned char *) a;
+		     p < (const unsigned char *) a + a->nla_len; p++) {
+			h ^= *p;
+			h *= 16777619U;
+		}
+	}
+	return h;
+}
+
+static bool
+fake_key_equal(const struct fake_set *set,
+	       const unsigned char *x, uint16_t xlen,
+	       const unsigned char *y, uint16_t ylen)
+{
+	const unsigned char *xend = x + xlen, *yend = y + ylen;
+	const struct nlattr *a, *b;
+
+	a = fake_key_next(set, (const struct nlattr *) x, xend);
+	b = fake_key_next(set, (const struct nlattr *) y, yend);
+	while (a != NULL && b != NULL) {
+		if (a->nla_len != b->nla_len || memcmp(a, b, a->nla_len))
+			return false;
+		a = fake_key_next(set, mnl_attr_next(a), xend);
+		b = fake_key_next(set, mnl_attr_next(b), yend);
+	}
+	return a == NULL && b == NULL;
+}
+
+static struct nlattr *
+fake_elem_attr(const unsigned char *attrs, uint16_t len, uint16_t type)
+{
+	const struct nlattr *a;
+
+	for (a = (const struct nlattr *) attrs;
+	     mnl_attr_ok(a, attrs + len - (const unsigned char *) a);
+	     a = mnl_attr_next(a))
+		if (mnl_attr_get_type(a) == type)
+			return (struct nlattr *) a;
+	return NULL;
+}
+
+/*
+ * Sets and elements
+ */
+
+static struct fake_set *
+fake_set_find(const char *name)
+{
+	struct fake_set *set;
+
+	list_for_each_entry(set, &fake_sets, list)
+		if (STREQ(set->name, name))
+			return set;
+	return NULL;
+}
+
+/* The member sets of list:set are referenced */
+static void
+fake_ref(const struct fake_set *set, const struct fake_elem *e, int delta)
+{
+	const struct nlattr *name;
+	struct fake_set *s;
+
+	if (!set->setlist)
+		return;
+	name = fake_elem_attr(e->attrs, e->len, IPSET_ATTR_NAME);
+	s = name ? fake_set_find(mnl_attr_get_str(name)) : NULL;
+	if (s != NULL)
+		s->refs += delta;
+}
+
+static struct fake_elem **
+fake_elem_find(struct fake_set *set, const unsigned char *attrs,
+	       uint16_t len, uint32_t hash)
+{
+	struct fake_elem **e;
+
+	for (e = &set->hash[hash % set->hsize]; *e != NULL; e = &(*e)->next)
+		if ((*e)->hash == hash &&
+		    fake_key_equal(set, (*e)->attrs, (*e)->len,
+				   attrs, len))
+			return e;
+	return e;
+}
+
+static int
+fake_set_resize(struct fake_set *set, uint32_t hsize)
+{
+	struct fake_elem **hash, *e;
+
+	hash = calloc(hsize, sizeof(*hash));
+	if (hash == NULL)
+		return -ENOMEM;
+	free(set->hash);
+	set->hash = hash;
+	set->hsize = hsize;
+	list_for_each_entry(e, &set->elems, list) {
+		e->next = hash[e->hash % hsize];
+		hash[e->hash % hsize] = e;
+	}
+	return 0;
+}
+
+static void
+fake_set_flush(struct fake_set *set)
+{
+	struct fake_elem *e, *n;
+
+	list_for_each_entry_safe(e, n, &set->elems, list) {
+		fake_ref(set, e, -1);
+		list_del(&e->list);
+		free(e);
+	}
+	memset(set->hash, 0, set->hsize * sizeof(*set->hash));
+	memset(set->ncidr, 0, sizeof(set->ncidr));
+	set->elements = 0;
+	set->memsize = 0;
+}
+
+static void
+fake_set_free(struct fake_set *set)
+{
+	fake_set_flush(set);
+	list_del(&set->list);
+	free(set->hash);
+	free(set->create);
+	free(set);
+	fake_nsets--;
+}
+
+static struct fake_set *
+fake_set_alloc(const char *name, const char *typename,
+	       uint8_t revision, uint8_t family,
+	       const void *create, uint16_t clen)
+{
+	struct fake_set *set;
+
+	set = calloc(1, sizeof(*set));
+	if (set == NULL)
+		return NULL;
+	INIT_LIST_HEAD(&set->elems);
+	set->create = malloc(clen ? clen : 1);
+	if (set->create == NULL ||
+	    fake_set_resize(set, FAKE_HASHSIZE) < 0) {
+		free(set->create);
+		free(set);
+		return NULL;
+	}
+	ipset_strlcpy(set->name, name, IPSET_MAXNAMELEN);
+	ipset_strlcpy(set->typename, typename, IPSET_MAXNAMELEN);
+	set->revision = revision;
+	set->family = family;
+	memcpy(set->create, create, clen);
+	set->clen = clen;
+	set->maxelem = FAKE_MAXELEM;
+	list_add_tail(&set->list, &fake_sets);
+	fake_nsets++;
+	return set;
+}
+
+/* Default values of the create attributes reported by the kernel */
+static int fake_set_bitmap(struct fake_set *set);
+
+static int
+fake_set_create_attrs(struct fake_set *set)
+{
+	const unsigned char *end = set->create + set->clen;
+	const struct nlattr *a;
+	bool hashsize = false, maxelem = false;
+	bool markmask = !STREQ(set->typename, "hash:ip,mark");
+	unsigned char *create, *p;
+
+	for (a = (const struct nlattr *) set->create;
+	     mnl_attr_ok(a, end - (const unsigned char *) a);
+	     a = mnl_attr_next(a)) {
+		switch (mnl_attr_get_type(a)) {
+		case IPSET_ATTR_HASHSIZE:
+			hashsize = true;
+			break;
+		case IPSET_ATTR_MAXELEM:
+			maxelem = true;
+			set->maxelem = fake_get_u32(a);
+			break;
+		case IPSET_ATTR_TIMEOUT:
+			set->with_timeout = true;
+			set->timeout = fake_get_u32(a);
+			break;
+		case IPSET_ATTR_MARKMASK:
+			markmask = true;
+			set->markmask = fake_get_u32(a);
+			break;
+		case IPSET_ATTR_NETMASK:
+			set->netmask = mnl_attr_get_u8(a);
+			break;
+		case IPSET_ATTR_QUANTIZE:
+			set->quantize = mnl_attr_get_u8(a);
+			break;
+		case IPSET_ATTR_CADT_FLAGS:
+			set->counters = fake_get_u32(a) &
+					IPSET_FLAG_WITH_COUNTERS;
+			set->with_stats = fake_get_u32(a) &
+					  IPSET_FLAG_WITH_STATS;
+			break;
+		case IPSET_ATTR_SIZE:
+			/* Reported only, the kernel does not enforce it */
+			maxelem = true;
+			break;
+		case IPSET_ATTR_LINENO:
+			/* Drop it */
+			break;
+		}
+	}
+	set->bitmap = STRNEQ(set->typename, "bitmap:", 7);
+	set->ipmac = STREQ(set->typename, "bitmap:ip,mac");
+	set->setlist = STREQ(set->typename, "list:set");
+	set->iface = STREQ(set->typename, "hash:net,iface");
+	if (set->bitmap)
+		return fake_set_bitmap(set);
+	if (set->setlist && !maxelem) {
+		uint32_t v = htonl(FAKE_LISTSIZE);
+
+		create = malloc(set->clen + MNL_ALIGN(MNL_ATTR_HDRLEN + 4));
+		if (create == NULL)
+			return -ENOMEM;
+		memcpy(create, set->create, set->clen);
+		p = fake_put(create + set->clen,
+			     IPSET_ATTR_SIZE | NLA_F_NET_BYTEORDER,
+			     &v, sizeof(v));
+		free(set->create);
+		set->create = create;
+		set->clen = p - create;
+		return 0;
+	}
+	if (strncmp(set->typename, "hash:", 5) != 0 ||
+	    (hashsize && maxelem && markmask))
+		return 0;
+
+	create = malloc(set->clen + 3 * MNL_ALIGN(MNL_ATTR_HDRLEN + 4));
+	if (create == NULL)
+		return -ENOMEM;
+	memcpy(create, set->create, set->clen);
+	p = create + set->clen;
+	if (!hashsize) {
+		uint32_t v = htonl(FAKE_HASHSIZE);
+
+		p = fake_put(p, IPSET_ATTR_HASHSIZE | NLA_F_NET_BYTEORDER,
+			     &v, sizeof(v));
+	}
+	if (!maxelem) {
+		uint32_t v = htonl(FAKE_MAXELEM);
+
+		p = fake_put(p, IPSET_ATTR_MAXELEM | NLA_F_NET_BYTEORDER,
+			     &v, sizeof(v));
+	}
+	if (!markmask) {
+		uint32_t v = 0xffffffff;
+
+		p = fake_put(p, IPSET_ATTR_MARKMASK, &v, sizeof(v));
+	}
+	free(set->create);
+	set->create = create;
+	set->clen = p - create;
+	return 0;
+}
+
+static void
+fake_mask(unsigned char *addr, unsigned int len, uint8_t cidr)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++, cidr = cidr > 8 ? cidr - 8 : 0)
+		addr[i] &= cidr >= 8 ? 0xFF : (uint8_t) (0xFF << (8 - cidr));
+}
+
+/* The prefix length of the element of a set bounded by cidr-quantize */
+static uint32_t *
+fake_ncidr(struct fake_set *set, const unsigned char *attrs, uint16_t len)
+{
+	const struct nlattr *a;
+
+	if (!set->quantize)
+		return NULL;
+	a = fake_elem_attr(attrs, len, IPSET_ATTR_CIDR);
+	return a ? &set->ncidr[mnl_attr_get_u8(a)] : NULL;
+}
+
+/* The set stores the prefix length already or it has got room for it */
+static bool
+fake_ncidr_fits(const struct fake_set *set, const uint32_t *n)
+{
+	unsigned int i, lengths = 0;
+
+	if (n == NULL || *n)
+		return true;
+	for (i = 0; i < ARRAY_SIZE(set->ncidr); i++)
+		lengths += set->ncidr[i] != 0;
+	return lengths < set->quantize;
+}
+
+static void
+fake_elem_del(struct fake_set *set, struct fake_elem **pos)
+{
+	struct fake_elem *e = *pos;
+	uint32_t *n = fake_ncidr(set, e->attrs, e->len);
+
+	if (n != NULL)
+		(*n)--;
+	fake_ref(set, e, -1);
+	*pos = e->next;
+	list_del(&e->list);
+	set->memsize -= e->len;
+	set->elements--;
+	free(e);
+}
+
+/* Remove the timed out elements */
+static void
+fake_gc(void)
+{
+	struct fake_set *set;
+	struct fake_elem *e, *n;
+	time_t now = time(NULL);
+
+	list_for_each_entry(set, &fake_sets, list) {
+		if (!set->with_timeout)
+			continue;
+		list_for_each_entry_safe(e, n, &set->elems, list) {
+			if (!e->expires || e->expires > now)
+				continue;
+			fake_elem_del(set, fake_elem_find(set, e->attrs,
+							  e->len, e->hash));
+			fake_dirty = true;
+		}
+	}
+}
+
+static int
+fake_elem_add(struct fake_set *set, const unsigned char *attrs,
+	      uint16_t len, bool exist, time_t expires)
+{
+	uint32_t hash = fake_hash(set, attrs, len);
+	struct fake_elem **pos = fake_elem_find(set, attrs, len, hash), *e;
+	unsigned char counters[FAKE_ELEMLEN];
+
+	/* The MAC address of bitmap:ip,mac can be filled out once */
+	if (*pos != NULL && !exist &&
+	    !(set->ipmac && fake_elem_attr(attrs, len, IPSET_ATTR_ETHER) &&
+	      !fake_elem_attr((*pos)->attrs, (*pos)->len, IPSET_ATTR_ETHER)))
+		return -IPSET_ERR_EXIST;
+	if (*pos == NULL && !fake_ncidr_fits(set, fake_ncidr(set, attrs, len)))
+		return -IPSET_ERR_HASH_CIDRS;
+	if (*pos == NULL && set->elements >= set->maxelem)
+		return -IPSET_ERR_HASH_FULL;
+	if (set->counters) {
+		/* Counters are kept when not specified */
+		static const uint16_t types[] = {
+			IPSET_ATTR_BYTES, IPSET_ATTR_PACKETS,
+		};
+		unsigned char *p = counters;
+		const struct nlattr *c;
+		unsigned int i;
+
+		memcpy(p, attrs, len);
+		p += len;
+		for (i = 0; i < ARRAY_SIZE(types); i++) {
+			if (fake_elem_attr(attrs, len, types[i]))
+				continue;
+			c = *pos ? fake_elem_attr((*pos)->attrs, (*pos)->len,
+						  types[i]) : NULL;
+			if (c != NULL) {
+				memcpy(p, c, c->nla_len);
+				p += MNL_ALIGN(c->nla_len);
+			} else {
+				uint64_t zero = 0;
+
+				p = fake_put(p, types[i] | NLA_F_NET_BYTEORDER,
+					     &zero, sizeof(zero));
+			}
+		}
+		attrs = counters;
+		len = p - counters;
+	}
+
+	e = malloc(sizeof(*e) + len);
+	if (e == NULL)
+		return -ENOMEM;
+	e->hash = hash;
+	e->len = len;
+	e->expires = expires;
+	memcpy(e->attrs, attrs, len);
+	if (*pos != NULL) {
+		/* Update the extensions */
+		struct fake_elem *old = *pos;
+
+		e->next = old->next;
+		list_add(&e->list, &old->list);
+		list_del(&old->list);
+		set->memsize -= old->len;
+		free(old);
+		*pos = e;
+	} else {
+		e->next = NULL;
+		*pos = e;
+		list_add_tail(&e->list, &set->elems);
+		set->elements++;
+		if (fake_ncidr(set, attrs, len) != NULL)
+			(*fake_ncidr(set, attrs, len))++;
+		fake_ref(set, e, 1);
+		if (set->elements > 2 * set->hsize)
+			fake_set_resize(set, 2 * set->hsize);
+	}
+	set->memsize += len;
+	return 0;
+}
+
+/* The parts of an element varied by the ranges and the network lookups */
+struct fake_key {
+	unsigned char *ip, *ip2;		/* Addresses */
+	unsigned int iplen, ip2len;		/* Lengths of the addresses */
+	unsigned char *cidr, *cidr2;		/* Prefix lengths */
+	unsigned char *port;			/* Port */
+};
+
+/* The kernel accepts the zero prefix length in the network dimensions
+ * of hash:net,iface and hash:net,port,net only: the other types reserve
+ * it or store the prefix length minus one.
+ */
+static bool
+fake_cidr_zero(const struct fake_set *set, bool second)
+{
+	return STREQ(set->typename, "hash:net,port,net") ||
+	       (!second && STREQ(set->typename, "hash:net,iface"));
+}
+
+/* The network is stored with any interface: hash:net,iface matches
+ * the most specific network only, whatever its interface is
+ */
+static bool
+fake_net_taken(const struct fake_set *set, const unsigned char *buf,
+	       uint16_t len)
+{
+	const struct nlattr *ip = fake_elem_attr(buf, len, IPSET_ATTR_IP);
+	const struct nlattr *cidr = fake_elem_attr(buf, len, IPSET_ATTR_CIDR);
+	const struct nlattr *a, *c;
+	const struct fake_elem *e;
+
+	list_for_each_entry(e, &set->elems, list) {
+		a = fake_elem_attr(e->attrs, e->len, IPSET_ATTR_IP);
+		c = fake_elem_attr(e->attrs, e->len, IPSET_ATTR_CIDR);
+		if (a && c && cidr && a->nla_len == ip->nla_len &&
+		    !memcmp(a, ip, a->nla_len) &&
+		    mnl_attr_get_u8(c) == mnl_attr_get_u8(cidr))
+			return true;
+	}
+	return false;
+}
+
+/* A host address tested against all the networks, like the kernel does */
+static struct fake_elem *
+fake_test_nets(struct fake_set *set, unsigned char *buf, uint16_t len,
+	       const struct fake_key *k)
+{
+	unsigned char ip[16], ip2[16];
+	int c, c2, cmax = 0, c2max = 0;
+	int cmin = fake_cidr_zero(set, false) ? 0 : 1;
+	int c2min = fake_cidr_zero(set, true) ? 0 : 1;
+	struct fake_elem *e;
+
+	if (k->cidr && *k->cidr == k->iplen * 8)
+		cmax = *k->cidr;
+	if (k->cidr2 && *k->cidr2 == k->ip2len * 8)
+		c2max = *k->cidr2;
+	if (!cmax && !c2max)
+		return NULL;
+	memcpy(ip, k->ip, k->iplen);
+	if (c2max)
+		memcpy(ip2, k->ip2, k->ip2len);
+
+	for (c = cmax ? cmax : 1; c >= cmin; c--) {
+		if (cmax) {
+			memcpy(k->ip, ip, k->iplen);
+			fake_mask(k->ip, k->iplen, c);
+			*k->cidr = c;
+		}
+		for (c2 = c2max ? c2max : 1; c2 >= c2min; c2--) {
+			if (c2max) {
+				memcpy(k->ip2, ip2, k->ip2len);
+				fake_mask(k->ip2, k->ip2len, c2);
+				*k->cidr2 = c2;
+			}
+			e = *fake_elem_find(set, buf, len, fake_hash(set, buf, len));
+			if (e != NULL)
+				return e;
+			if (set->iface && fake_net_taken(set, buf, len))
+				return NULL;
+			if (!c2max)
+				break;
+		}
+		if (!cmax)
+			break;
+	}
+	return NULL;
+}
+
+static bool
+fake_nomatch(const unsigned char *attrs, uint16_t len)
+{
+	const struct nlattr *a;
+
+	a = fake_elem_attr(attrs, len, IPSET_ATTR_CADT_FLAGS);
+	return a && (fake_get_u32(a) & IPSET_FLAG_NOMATCH);
+}
+
+/* Filling out the MAC address of a bitmap:ip,mac element keeps the
+ * timeout stored at the add, unless a different one is given
+ */
+static void
+fake_ipmac_timeout(struct fake_set *set, const unsigned char *attrs,
+		   uint16_t len, struct nlattr *timeout)
+{
+	struct fake_elem *e;
+	const struct nlattr *stored;
+
+	if (fake_get_u32(timeout) != set->timeout ||
+	    !fake_elem_attr(attrs, len, IPSET_ATTR_ETHER))
+		return;
+	e = *fake_elem_find(set, attrs, len, fake_hash(set, attrs, len));
+	if (e == NULL || fake_elem_attr(e->attrs, e->len, IPSET_ATTR_ETHER))
+		return;
+	stored = fake_elem_attr(e->attrs, e->len, IPSET_ATTR_TIMEOUT);
+	if (stored != NULL)
+		memcpy(mnl_attr_get_payload(timeout),
+		       mnl_attr_get_payload(stored), sizeof(uint32_t));
+}
+
+/* The list:set elements are kept in the order given by the commands */
+static int
+fake_list_adt(struct fake_set *set, enum ipset_cmd cmd,
+	      const unsigned char *attrs, uint16_t len, bool exist,
+	      time_t expires)
+{
+	const struct nlattr *name, *ref, *flags, *a;
+	unsigned char buf[FAKE_ELEMLEN], *p;
+	struct fake_elem **pos, *e, *r = NULL;
+	struct fake_set *s;
+	bool before;
+	int ret;
+
+	name = fake_elem_attr(attrs, len, IPSET_ATTR_NAME);
+	ref = fake_elem_attr(attrs, len, IPSET_ATTR_NAMEREF);
+	flags = fake_elem_attr(attrs, len, IPSET_ATTR_CADT_FLAGS);
+	before = flags && (fake_get_u32(flags) & IPSET_FLAG_BEFORE);
+	if (name == NULL)
+		return -IPSET_ERR_PROTOCOL;
+	s = fake_set_find(mnl_attr_get_str(name));
+	if (s == NULL)
+		return -IPSET_ERR_NAME;
+	if (s->setlist)
+		return -IPSET_ERR_LOOP;
+	if (before && ref == NULL)
+		return -IPSET_ERR_BEFORE;
+	if (ref != NULL) {
+		if (fake_set_find(mnl_attr_get_str(ref)) == NULL)
+			return -IPSET_ERR_NAMEREF;
+		p = fake_put(buf, IPSET_ATTR_NAME, mnl_attr_get_payload(ref),
+			     mnl_attr_get_payload_len(ref));
+		r = *fake_elem_find(set, buf, p - buf,
+				    fake_hash(set, buf, p - buf));
+		if (r == NULL)
+			return cmd == IPSET_CMD_TEST ? -IPSET_ERR_EXIST
+						     : -IPSET_ERR_REF_EXIST;
+	}
+	pos = fake_elem_find(set, attrs, len, fake_hash(set, attrs, len));
+	e = *pos;
+
+	switch (cmd) {
+	case IPSET_CMD_ADD:
+		/* The position is not stored */
+		p = buf;
+		for (a = (const struct nlattr *) attrs;
+		     mnl_attr_ok(a, attrs + len - (const unsigned char *) a);
+		     a = mnl_attr_next(a)) {
+			if (a == ref || a == flags)
+				continue;
+			memcpy(p, a, a->nla_len);
+			p += MNL_ALIGN(a->nla_len);
+		}
+		ret = fake_elem_add(set, buf, p - buf, exist, expires);
+		if (ret < 0 || e != NULL || r == NULL)
+			return ret;
+		e = list_entry(set->elems.prev, struct fake_elem, list);
+		list_del(&e->list);
+		if (before)
+			list_add_tail(&e->list, &r->list);
+		else
+			list_add(&e->list, &r->list);
+		return 0;
+	case IPSET_CMD_DEL:
+	case IPSET_CMD_TEST:
+		if (e == NULL || (r != NULL &&
+				  (before ? e->list.next != &r->list
+					  : r->list.next != &e->list)))
+			return cmd == IPSET_CMD_DEL && exist ? 0
+							     : -IPSET_ERR_EXIST;
+		if (cmd == IPSET_CMD_DEL)
+			fake_elem_del(set, pos);
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static int
+fake_elem_adt(struct fake_set *set, enum ipset_cmd cmd,
+	      unsigned char *attrs, uint16_t len, bool exist,
+	      const struct fake_key *k)
+{
+	struct fake_elem **pos, *e;
+	struct nlattr *timeout, *ether, *a;
+	time_t expires;
+
+	if (set->setlist && cmd != IPSET_CMD_ADD)
+		return fake_list_adt(set, cmd, attrs, len, exist, 0);
+
+	switch (cmd) {
+	case IPSET_CMD_ADD:
+		timeout = fake_elem_attr(attrs, len, IPSET_ATTR_TIMEOUT);
+		if (timeout && set->ipmac)
+			fake_ipmac_timeout(set, attrs, len, timeout);
+		expires = timeout && fake_get_u32(timeout) ?
+			  time(NULL) + fake_get_u32(timeout) : 0;
+		/* The timer of bitmap:ip,mac starts with the MAC address */
+		if (set->ipmac && !fake_elem_attr(attrs, len, IPSET_ATTR_ETHER))
+			expires = 0;
+		if (set->setlist)
+			return fake_list_adt(set, cmd, attrs, len, exist,
+					     expires);
+		return fake_elem_add(set, attrs, len, exist, expires);
+	case IPSET_CMD_DEL:
+		pos = fake_elem_find(set, attrs, len, fake_hash(set, attrs, len));
+		if (*pos == NULL)
+			return exist ? 0 : -IPSET_ERR_EXIST;
+		fake_elem_del(set, pos);
+		return 0;
+	case IPSET_CMD_TEST:
+		/* The nomatch flag of the command inverts the result */
+		pos = fake_elem_find(set, attrs, len, fake_hash(set, attrs, len));
+		e = *pos ? *pos : fake_test_nets(set, attrs, len, k);
+		if (e != NULL && set->ipmac &&
+		    (ether = fake_elem_attr(attrs, len, IPSET_ATTR_ETHER)) &&
+		    (!(a = fake_elem_attr(e->attrs, e->len,
+					  IPSET_ATTR_ETHER)) ||
+		     memcmp(mnl_attr_get_payload(a),
+			    mnl_attr_get_payload(ether), ETH_ALEN)))
+			return -IPSET_ERR_EXIST;
+		if (e != NULL &&
+		    fake_nomatch(e->attrs, e->len) == fake_nomatch(attrs, len))
+			return 0;
+		return -IPSET_ERR_EXIST;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+/* The first dimension of the type is an IP address, not a network */
+static bool
+fake_ip_dim(const struct fake_set *set)
+{
+	return STRNEQ(set->typename, "hash:ip", 7) ||
+	       STRNEQ(set->typename, "bitmap:ip", 9);
+}
+
+/* The second IP dimension of the type is a network */
+static bool
+fake_ip2_net(const struct fake_set *set)
+{
+	return strstr(set->typename, ",net") != NULL;
+}
+
+static unsigned int
+fake_iplen(const struct nlattr *attr)
+{
+	const struct nlattr *addr = attr ? fake_ipaddr(attr) : NULL;
+
+	return addr ? mnl_attr_get_payload_len(addr) : 0;
+}
+
+static bool
+fake_zero(const unsigned char *d, unsigned int len)
+{
+	while (len-- > 0)
+		if (*d++)
+			return false;
+	return true;
+}
+
+/* The next block of an IPv4 range: the largest network fitting into
+ * the range or, when fixed, a network of the given size. Returns the
+ * last address of the block.
+ */
+static uint32_t
+fake_range_next(uint32_t ip, uint32_t ip_to, uint8_t *cidr, bool fixed)
+{
+	uint32_t hosts;
+
+	if (!fixed) {
+		for (*cidr = 0; *cidr < 32; (*cidr)++) {
+			hosts = ~0U >> *cidr;
+			if (!(ip & hosts) && ip_to - ip >= hosts)
+				break;
+		}
+	}
+	return *cidr < 32 ? ip | (~0U >> *cidr) : ip;
+}
+
+/* An IPv4 address with its optional range */
+static int
+fake_range(const struct nlattr *tb[], int ip_type, int to_type,
+	   uint32_t *ip, uint32_t *ip_to)
+{
+	const struct nlattr *addr = fake_ipaddr(tb[ip_type]);
+	uint32_t tmp;
+
+	*ip = *ip_to = ntohl(mnl_attr_get_u32(addr));
+	if (!tb[to_type])
+		return 0;
+	addr = fake_ipaddr(tb[to_type]);
+	if (addr == NULL || mnl_attr_get_payload_len(addr) != sizeof(*ip))
+		return -IPSET_ERR_PROTOCOL;
+	*ip_to = ntohl(mnl_attr_get_u32(addr));
+	if (*ip > *ip_to) {
+		tmp = *ip;
+		*ip = *ip_to;
+		*ip_to = tmp;
+	}
+	return 0;
+}
+
+static void
+fake_put_ip(unsigned char *d, uint32_t ip)
+{
+	ip = htonl(ip);
+	memcpy(d, &ip, sizeof(ip));
+}
+
+/* Normalize, expand and apply an element of an add/del/test command:
+ * the key attributes are stored in the order of their types, with the
+ * networks masked and the prefix lengths made explicit.
+ */
+static int
+fake_elem(struct fake_set *set, enum ipset_cmd cmd,
+	  const struct nlattr *data, bool exist, uint32_t *lineno)
+{
+	const struct nlattr *tb[IPSET_ATTR_ADT_MAX+1] = {};
+	const struct nlattr *a;
+	unsigned char buf[FAKE_ELEMLEN], *p;
+	struct fake_key k = {};
+	uint32_t ip = 0, ip_to = 0, ip2 = 0, ip2_to = 0, i, i2, last, last2;
+	uint16_t port = 0, port_to = 0, j;
+	uint8_t cidr = 0, cidr2 = 0, c, c2;
+	bool ipdim = fake_ip_dim(set), ip2net = fake_ip2_net(set);
+	bool range = false, range2 = false;
+	unsigned int type;
+	int ret = 0;
+
+	if (mnl_attr_get_payload_len(data) > FAKE_ELEMLEN / 2 ||
+	    mnl_attr_parse_nested(data, fake_attr_cb, tb) < MNL_CB_STOP)
+		return -IPSET_ERR_PROTOCOL;
+	if (tb[IPSET_ATTR_LINENO])
+		*lineno = fake_get_u32(tb[IPSET_ATTR_LINENO]);
+	if (tb[IPSET_ATTR_TIMEOUT] && !set->with_timeout)
+		return -IPSET_ERR_TIMEOUT;
+
+	/* The prefix lengths are checked as the uadt functions do */
+	k.iplen = fake_iplen(tb[IPSET_ATTR_IP]);
+	k.ip2len = ip2net ? fake_iplen(tb[IPSET_ATTR_IP2]) : 0;
+	if (k.iplen && !ipdim) {
+		cidr = tb[IPSET_ATTR_CIDR] ?
+		       mnl_attr_get_u8(tb[IPSET_ATTR_CIDR]) : k.iplen * 8;
+		if ((!cidr && !fake_cidr_zero(set, false)) ||
+		    cidr > k.iplen * 8)
+			return -IPSET_ERR_INVALID_CIDR;
+	}
+	if (k.ip2len) {
+		cidr2 = tb[IPSET_ATTR_CIDR2] ?
+			mnl_attr_get_u8(tb[IPSET_ATTR_CIDR2]) : k.ip2len * 8;
+		if ((!cidr2 && !fake_cidr_zero(set, true)) ||
+		    cidr2 > k.ip2len * 8)
+			return -IPSET_ERR_INVALID_CIDR;
+	}
+	if (tb[IPSET_ATTR_ETHER] && STREQ(set->typename, "hash:mac") &&
+	    fake_zero(mnl_attr_get_payload(tb[IPSET_ATTR_ETHER]), ETH_ALEN))
+		return -IPSET_ERR_HASH_ELEM;
+
+	/* Ranges: the test command checks the first element alone */
+	if (k.iplen == sizeof(uint32_t)) {
+		ret = fake_range(tb, IPSET_ATTR_IP, IPSET_ATTR_IP_TO,
+				 &ip, &ip_to);
+		if (ret < 0)
+			return ret;
+		range = tb[IPSET_ATTR_IP_TO] != NULL;
+		if (ipdim && !range && tb[IPSET_ATTR_CIDR]) {
+			c = mnl_attr_get_u8(tb[IPSET_ATTR_CIDR]);
+			if (!c || c > 32)
+				return -IPSET_ERR_INVALID_CIDR;
+			ip &= c ? ~0U << (32 - c) : 0;
+			ip_to = ip | (c < 32 ? ~0U >> c : 0);
+			range = true;
+		}
+		if (ipdim && set->netmask) {
+			ip &= ~0U << (32 - set->netmask);
+			ip_to |= set->netmask < 32 ? ~0U >> set->netmask : 0;
+		} else if (!ipdim && !range) {
+			ip &= cidr ? ~0U << (32 - cidr) : 0;
+			ip_to = fake_range_next(ip, ip, &cidr, true);
+		}
+	} else if (k.iplen && tb[IPSET_ATTR_IP_TO]) {
+		return -IPSET_ERR_HASH_RANGE_UNSUPPORTED;
+	} else if (k.iplen && ipdim && tb[IPSET_ATTR_CIDR] &&
+		   mnl_attr_get_u8(tb[IPSET_ATTR_CIDR]) != 128) {
+		return -IPSET_ERR_INVALID_CIDR;
+	}
+	if (k.ip2len == sizeof(uint32_t)) {
+		ret = fake_range(tb, IPSET_ATTR_IP2, IPSET_ATTR_IP2_TO,
+				 &ip2, &ip2_to);
+		if (ret < 0)
+			return ret;
+		range2 = tb[IPSET_ATTR_IP2_TO] != NULL;
+		if (!range2) {
+			ip2 &= cidr2 ? ~0U << (32 - cidr2) : 0;
+			ip2_to = fake_range_next(ip2, ip2, &cidr2, true);
+		}
+	} else if (k.ip2len && tb[IPSET_ATTR_IP2_TO]) {
+		return -IPSET_ERR_HASH_RANGE_UNSUPPORTED;
+	}
+	if (tb[IPSET_ATTR_PORT]) {
+		port = port_to = ntohs(*(const uint16_t *)
+				       mnl_attr_get_payload(tb[IPSET_ATTR_PORT]));
+		if (tb[IPSET_ATTR_PORT_TO]) {
+			port_to = ntohs(*(const uint16_t *)
+				mnl_attr_get_payload(tb[IPSET_ATTR_PORT_TO]));
+			if (port > port_to) {
+				j = port;
+				port = port_to;
+				port_to = j;
+			}
+		}
+	}
+	if (set->bitmap &&
+	    ((k.iplen && (ip < set->first || ip_to > set->last)) ||
+	     (!k.iplen && tb[IPSET_ATTR_PORT] &&
+	      (port < set->first || port_to > set->last))))
+		return -IPSET_ERR_BITMAP_RANGE;
+	if (cmd == IPSET_CMD_TEST) {
+		ip_to = ip;
+		ip2_to = ip2;
+		port_to = port;
+		range = range2 = false;
+	}
+
+	/* Copy the attributes without the range and control ones */
+	p = buf;
+	for (type = IPSET_ATTR_UNSPEC + 1; type <= IPSET_ATTR_ADT_MAX; type++) {
+		a = tb[type];
+		switch (type) {
+		case IPSET_ATTR_LINENO:
+		case IPSET_ATTR_IP_TO:
+		case IPSET_ATTR_IP2_TO:
+		case IPSET_ATTR_PORT_TO:
+			continue;
+		case IPSET_ATTR_CIDR:
+			if (!k.iplen || ipdim)
+				continue;
+			k.cidr = p + MNL_ATTR_HDRLEN;
+			p = fake_put(p, IPSET_ATTR_CIDR, &cidr, sizeof(cidr));
+			continue;
+		case IPSET_ATTR_CIDR2:
+			if (!k.ip2len)
+				continue;
+			k.cidr2 = p + MNL_ATTR_HDRLEN;
+			p = fake_put(p, IPSET_ATTR_CIDR2, &cidr2, sizeof(cidr2));
+			continue;
+		case IPSET_ATTR_TIMEOUT:
+			if (a == NULL && set->with_timeout &&
+			    cmd == IPSET_CMD_ADD) {
+				uint32_t v = htonl(set->timeout);
+
+				p = fake_put(p, IPSET_ATTR_TIMEOUT |
+					     NLA_F_NET_BYTEORDER,
+					     &v, sizeof(v));
+				continue;
+			}
+			break;
+		}
+		if (a == NULL)
+			continue;
+		memcpy(p, a, a->nla_len);
+		if (type == IPSET_ATTR_IP && k.iplen) {
+			/* The address inside the nest */
+			k.ip = p + 2 * MNL_ATTR_HDRLEN;
+			if (!ipdim)
+				fake_mask(k.ip, k.iplen, cidr);
+			else if (set->netmask)
+				fake_mask(k.ip, k.iplen, set->netmask);
+		} else if (type == IPSET_ATTR_IP2 && k.ip2len) {
+			k.ip2 = p + 2 * MNL_ATTR_HDRLEN;
+			fake_mask(k.ip2, k.ip2len, cidr2);
+		} else if (type == IPSET_ATTR_PORT) {
+			k.port = p + MNL_ATTR_HDRLEN;
+		} else if (type == IPSET_ATTR_MARK && set->markmask) {
+			uint32_t *mark = (uint32_t *) (p + MNL_ATTR_HDRLEN);
+
+			*mark &= a->nla_type & NLA_F_NET_BYTEORDER ?
+				 htonl(set->markmask) : set->markmask;
+		}
+		p += MNL_ALIGN(a->nla_len);
+	}
+	if (k.ip && ipdim && STREQ(set->typename, "hash:ip") &&
+	    fake_zero(k.ip, k.iplen))
+		return -IPSET_ERR_HASH_ELEM;
+
+	/* Hosts, blocks of the netmask or networks covering the ranges */
+	i = ip;
+	do {
+		c = ipdim ? (set->netmask ? set->netmask : 32) : cidr;
+		last = fake_range_next(i, ip_to, &c, ipdim || !range);
+		if (k.ip && k.iplen == sizeof(uint32_t)) {
+			if (i == 0 && STREQ(set->typename, "hash:ip"))
+				return -IPSET_ERR_HASH_ELEM;
+			fake_put_ip(k.ip, i);
+			if (k.cidr)
+				*k.cidr = c;
+		}
+		i2 = ip2;
+		do {
+			c2 = cidr2;
+			last2 = fake_range_next(i2, ip2_to, &c2, !range2);
+			if (k.ip2 && k.ip2len == sizeof(uint32_t)) {
+				fake_put_ip(k.ip2, i2);
+				*k.cidr2 = c2;
+			}
+			j = port;
+			do {
+				if (k.port) {
+					uint16_t v = htons(j);
+
+					memcpy(k.port, &v, sizeof(v));
+				}
+				ret = fake_elem_adt(set, cmd, buf, p - buf,
+						    exist, &k);
+				if (ret < 0)
+					return ret;
+			} while (j++ != port_to);
+			i2 = last2 + 1;
+		} while (last2 < ip2_to);
+		i = last + 1;
+	} while (last < ip_to);
+	return ret;
+}
+
+static unsigned char *
+fake_put_ipaddr4(unsigned char *p, uint16_t type, uint32_t ip)
+{
+	struct nlattr *nest = (struct nlattr *) p;
+
+	ip = htonl(ip);
+	fake_put(p + MNL_ATTR_HDRLEN,
+		 IPSET_ATTR_IPADDR_IPV4 | NLA_F_NET_BYTEORDER,
+		 &ip, sizeof(ip));
+	nest->nla_type = type | NLA_F_NESTED;
+	nest->nla_len = MNL_ATTR_HDRLEN + MNL_ALIGN(MNL_ATTR_HDRLEN + 4);
+	return p + nest->nla_len;
+}
+
+/* The range of a bitmap type, reported as a range by the kernel */
+static int
+fake_set_bitmap(struct fake_set *set)
+{
+	const struct nlattr *tb[IPSET_ATTR_ADT_MAX+1] = {};
+	const unsigned char *end = set->create + set->clen;
+	const struct nlattr *a;
+	unsigned char *create, *p;
+	uint32_t first, last, hosts = 1;
+	uint16_t port;
+	bool ports = STREQ(set->typename, "bitmap:port");
+
+	for (a = (const struct nlattr *) set->create;
+	     mnl_attr_ok(a, end - (const unsigned char *) a);
+	     a = mnl_attr_next(a))
+		fake_attr_cb(a, tb);
+	if (ports) {
+		if (!tb[IPSET_ATTR_PORT] || !tb[IPSET_ATTR_PORT_TO])
+			return -IPSET_ERR_PROTOCOL;
+		memcpy(&port, mnl_attr_get_payload(tb[IPSET_ATTR_PORT]), 2);
+		first = ntohs(port);
+		memcpy(&port, mnl_attr_get_payload(tb[IPSET_ATTR_PORT_TO]), 2);
+		last = ntohs(port);
+	} else {
+		if (fake_iplen(tb[IPSET_ATTR_IP]) != sizeof(uint32_t))
+			return -IPSET_ERR_PROTOCOL;
+		if (tb[IPSET_ATTR_IP_TO]) {
+			if (fake_range(tb, IPSET_ATTR_IP, IPSET_ATTR_IP_TO,
+				       &first, &last) < 0)
+				return -IPSET_ERR_PROTOCOL;
+		} else if (tb[IPSET_ATTR_CIDR]) {
+			uint8_t cidr = mnl_attr_get_u8(tb[IPSET_ATTR_CIDR]);
+
+			if (cidr >= 32)
+				return -IPSET_ERR_INVALID_CIDR;
+			first = ntohl(mnl_attr_get_u32(
+					fake_ipaddr(tb[IPSET_ATTR_IP])));
+			first &= cidr ? ~0U << (32 - cidr) : 0;
+			last = first | (~0U >> cidr);
+		} else {
+			return -IPSET_ERR_PROTOCOL;
+		}
+		if (set->netmask) {
+			first &= ~0U << (32 - set->netmask);
+			last |= set->netmask < 32 ? ~0U >> set->netmask : 0;
+			hosts = set->netmask < 32 ? ~0U >> set->netmask : 0;
+			hosts++;
+		}
+	}
+	if (first > last) {
+		uint32_t tmp = first;
+
+		first = last;
+		last = tmp;
+	}
+	if (hosts && (uint64_t) (last - first) / hosts + 1 > 65536)
+		return -IPSET_ERR_BITMAP_RANGE_SIZE;
+	set->first = first;
+	set->last = last;
+
+	/* Create attributes with the range first */
+	create = malloc(set->clen + 2 * MNL_ALIGN(2 * MNL_ATTR_HDRLEN + 4));
+	if (create == NULL)
+		return -ENOMEM;
+	p = create;
+	if (ports) {
+		port = htons(first);
+		p = fake_put(p, IPSET_ATTR_PORT | NLA_F_NET_BYTEORDER,
+			     &port, sizeof(port));
+		port = htons(last);
+		p = fake_put(p, IPSET_ATTR_PORT_TO | NLA_F_NET_BYTEORDER,
+			     &port, sizeof(port));
+	} else {
+		p = fake_put_ipaddr4(p, IPSET_ATTR_IP, first);
+		p = fake_put_ipaddr4(p, IPSET_ATTR_IP_TO, last);
+	}
+	for (a = (const struct nlattr *) set->create;
+	     mnl_attr_ok(a, end - (const unsigned char *) a);
+	     a = mnl_attr_next(a)) {
+		switch (mnl_attr_get_type(a)) {
+		case IPSET_ATTR_IP:
+		case IPSET_ATTR_IP_TO:
+		case IPSET_ATTR_CIDR:
+		case IPSET_ATTR_PORT:
+		case IPSET_ATTR_PORT_TO:
+			continue;
+		}
+		memcpy(p, a, a->nla_len);
+		p += MNL_ALIGN(a->nla_len);
+	}
+	free(set->create);
+	set->create = create;
+	set->clen = p - create;
+	return 0;
+}
+
+static int
+fake_elem_cmp(const void *x, const void *y)
+{
+	const struct fake_elem *a = *(struct fake_elem * const *) x;
+	const struct fake_elem *b = *(struct fake_elem * const *) y;
+
+	/* The first attribute is the address or the port */
+	return memcmp(a->attrs, b->attrs, a->len < b->len ? a->len : b->len);
+}
+
+/* The bitmap types list the elements in the order of the values */
+static void
+fake_set_sort(struct fake_set *set)
+{
+	struct fake_elem **elems, *e;
+	uint32_t i = 0;
+
+	elems = malloc(set->elements * sizeof(*elems));
+	if (elems == NULL)
+		return;
+	list_for_each_entry(e, &set->elems, list)
+		elems[i++] = e;
+	qsort(elems, set->elements, sizeof(*elems), fake_elem_cmp);
+	INIT_LIST_HEAD(&set->elems);
+	for (i = 0; i < set->elements; i++)
+		list_add_tail(&elems[i]->list, &set->elems);
+	free(elems);
+}
+
+/*
+ * Replies
+ */
+
+static struct nlmsghdr *
+fake_msg_start(struct ipset_handle *handle, void *buffer,
+	       enum ipset_cmd cmd, uint16_t flags)
+{
+	struct nlmsghdr *nlh = mnl_nlmsg_put_header(buffer);
+	struct nfgenmsg *nfg;
+
+	nlh->nlmsg_type = cmd | (NFNL_SUBSYS_IPSET << 8);
+	nlh->nlmsg_flags = flags;
+	nlh->nlmsg_seq = handle->seq;
+	nlh->nlmsg_pid = handle->portid;
+	nfg = mnl_nlmsg_put_extra_header(nlh, sizeof(struct nfgenmsg));
+	nfg->nfgen_family = AF_INET;
+	nfg->version = NFNETLINK_V0;
+	nfg->res_id = htons(0);
+	mnl_attr_put_u8(nlh, IPSET_ATTR_PROTOCOL, IPSET_PROTOCOL);
+	return nlh;
+}
+
+/* Queue a reply in non-blocking mode */
+static int
+fake_queue(struct ipset_handle *handle, const struct nlmsghdr *nlh)
+{
+	size_t len = MNL_ALIGN(nlh->nlmsg_len);
+
+	if (handle->queued + len > handle->queuelen) {
+		size_t size = handle->queuelen ? 2 * handle->queuelen : 4096;
+		void *queue;
+
+		while (size < handle->queued + len)
+			size *= 2;
+		queue = realloc(handle->queue, size);
+		if (queue == NULL)
+			return MNL_CB_ERROR;
+		handle->queue = queue;
+		handle->queuelen = size;
+	}
+	memcpy((char *) handle->queue + handle->queued, nlh, nlh->nlmsg_len);
+	/* Signal the first queued reply */
+	if (handle->queued == 0 && write(handle->sock[1], "", 1) != 1)
+		return MNL_CB_ERROR;
+	handle->queued += len;
+	return MNL_CB_OK;
+}
+
+static int
+fake_run(struct ipset_handle *handle, const struct nlmsghdr *nlh)
+{
+	if (handle->async)
+		return fake_queue(handle, nlh);
+#ifdef IPSET_DEBUG
+	ipset_debug_msg("received", (void *) nlh, nlh->nlmsg_len);
+#endif
+	return mnl_cb_run2(nlh, nlh->nlmsg_len, handle->seq, handle->portid,
+			   handle->cb_ctl[NLMSG_MIN_TYPE], handle->data,
+			   handle->cb_ctl, NLMSG_MIN_TYPE);
+}
+
+/* ACK or error report: errors carry the request with the failed line */
+static int
+fake_ack(struct ipset_handle *handle, const struct nlmsghdr *req,
+	 int error, uint32_t lineno)
+{
+	struct nlmsghdr *nlh = mnl_nlmsg_put_header(handle->reply);
+	struct nlmsgerr *err;
+	size_t len = error ? req->nlmsg_len : sizeof(*req);
+
+	nlh->nlmsg_type = NLMSG_ERROR;
+	nlh->nlmsg_seq = handle->seq;
+	nlh->nlmsg_pid = handle->portid;
+	err = mnl_nlmsg_put_extra_header(nlh, sizeof(*err) - sizeof(*req) +
+					 MNL_ALIGN(len));
+	err->error = error;
+	memcpy(&err->msg, req, len);
+	if (error && lineno) {
+		struct nlattr *a;
+
+		mnl_attr_for_each(a, &err->msg,
+				  MNL_ALIGN(sizeof(struct nfgenmsg))) {
+			if (mnl_attr_get_type(a) != IPSET_ATTR_LINENO)
+				continue;
+			*(uint32_t *) mnl_attr_get_payload(a) =
+				a->nla_type & NLA_F_NET_BYTEORDER ?
+				htonl(lineno) : lineno;
+		}
+	}
+	return fake_run(handle, nlh);
+}
+
+static int
+fake_type(struct ipset_handle *handle, const struct nlmsghdr *req,
+	  const struct nlattr *tb[])
+{
+	const struct ipset_type *t;
+	const char *typename;
+	uint8_t family, rmin = 0, rmax = 0;
+	struct nlmsghdr *nlh;
+	bool found = false;
+
+	if (!tb[IPSET_ATTR_TYPENAME] || !tb[IPSET_ATTR_FAMILY])
+		return fake_ack(handle, req, -IPSET_ERR_PROTOCOL, 0);
+	typename = mnl_attr_get_str(tb[IPSET_ATTR_TYPENAME]);
+	family = mnl_attr_get_u8(tb[IPSET_ATTR_FAMILY]);
+
+	/* The kernel supports the revisions known by userspace */
+	for (t = ipset_types(); t != NULL; t = t->next) {
+		if (!ipset_match_typename(typename, t) ||
+		    !(family == NFPROTO_UNSPEC || t->family == family ||
+		      t->family == NFPROTO_IPSET_IPV46))
+			continue;
+		if (!found || t->revision > rmax)
+			rmax = t->revision;
+		if (!found || t->revision < rmin)
+			rmin = t->revision;
+		found = true;
+	}
+	if (!found)
+		return fake_ack(handle, req, -IPSET_ERR_FIND_TYPE, 0);
+
+	nlh = fake_msg_start(handle, handle->reply, IPSET_CMD_TYPE, 0);
+	mnl_attr_put(nlh, IPSET_ATTR_TYPENAME, strlen(typename) + 1,
+		     typename);
+	mnl_attr_put_u8(nlh, IPSET_ATTR_FAMILY, family);
+	mnl_attr_put_u8(nlh, IPSET_ATTR_REVISION, rmax);
+	mnl_attr_put_u8(nlh, IPSET_ATTR_REVISION_MIN, rmin);
+	return fake_run(handle, nlh);
+}
+
+/* Memory size of a set, as reported in the header */
+static size_t
+fake_set_memsize(const struct fake_set *set)
+{
+	return sizeof(*set) + set->hsize * sizeof(*set->hash) +
+	       set->memsize + set->elements * sizeof(struct fake_elem);
+}
+
+static void
+fake_put_header(struct nlmsghdr *nlh, const struct fake_set *set)
+{
+	struct nlattr *nest;
+
+	mnl_attr_put(nlh, IPSET_ATTR_TYPENAME, strlen(set->typename) + 1,
+		     set->typename);
+	mnl_attr_put_u8(nlh, IPSET_ATTR_FAMILY, set->family);
+	mnl_attr_put_u8(nlh, IPSET_ATTR_REVISION, set->revision);
+	nest = mnl_attr_nest_start(nlh, IPSET_ATTR_DATA);
+	fake_put_raw(nlh, set->create, set->clen);
+	fake_put_net32(nlh, IPSET_ATTR_REFERENCES, set->refs);
+	fake_put_net32(nlh, IPSET_ATTR_MEMSIZE, fake_set_memsize(set));
+	fake_put_net32(nlh, IPSET_ATTR_ELEMENTS, set->elements);
+	if (set->quantize) {
+		/* The prefix lengths in decreasing order, as the kernel */
+		uint8_t cidrs[ARRAY_SIZE(set->ncidr)];
+		unsigned int n = 0;
+		int i;
+
+		for (i = ARRAY_SIZE(set->ncidr) - 1; i >= 0; i--)
+			if (set->ncidr[i])
+				cidrs[n++] = i;
+		mnl_attr_put(nlh, IPSET_ATTR_CIDRS, n, cidrs);
+	}
+	if (set->with_stats) {
+		struct nlattr *stats;
+		uint64_t v;
+		int i;
+
+		stats = mnl_attr_nest_start(nlh, IPSET_ATTR_STATS);
+		for (i = IPSET_ATTR_STATS_UNSPEC + 1;
+		     i < IPSET_ATTR_STATS_PAD; i++) {
+			v = htobe64(set->stats[i]);
+			mnl_attr_put(nlh, i | NLA_F_NET_BYTEORDER,
+				     sizeof(v), &v);
+		}
+		mnl_attr_nest_end(nlh, stats);
+	}
+	mnl_attr_nest_end(nlh, nest);
+}
+
+static int
+fake_header(struct ipset_handle *handle, const struct nlmsghdr *req,
+	    const struct nlattr *tb[])
+{
+	const struct fake_set *set;
+	struct nlmsghdr *nlh;
+
+	nlh = fake_msg_start(handle, handle->reply, IPSET_CMD_HEADER, 0);
+	if (!tb[IPSET_ATTR_SETNAME]) {
+		/* Totals of all sets */
+		struct nlattr *nest;
+		uint32_t memsize = 0, elements = 0;
+
+		list_for_each_entry(set, &fake_sets, list) {
+			memsize += fake_set_memsize(set);
+			elements += set->elements;
+		}
+		nest = mnl_attr_nest_start(nlh, IPSET_ATTR_DATA);
+		fake_put_net32(nlh, IPSET_ATTR_MEMSIZE, memsize);
+		fake_put_net32(nlh, IPSET_ATTR_ELEMENTS, elements);
+		mnl_attr_nest_end(nlh, nest);
+		return fake_run(handle, nlh);
+	}
+	set = fake_set_find(mnl_attr_get_str(tb[IPSET_ATTR_SETNAME]));
+	if (set == NULL)
+		return fake_ack(handle, req, -ENOENT, 0);
+	mnl_attr_put(nlh, IPSET_ATTR_SETNAME, strlen(set->name) + 1,
+		     set->name);
+	mnl_attr_put(nlh, IPSET_ATTR_TYPENAME, strlen(set->typename) + 1,
+		     set->typename);
+	mnl_attr_put_u8(nlh, IPSET_ATTR_FAMILY, set->family);
+	mnl_attr_put_u8(nlh, IPSET_ATTR_REVISION, set->revision);
+	return fake_run(handle, nlh);
+}
+
+static int
+fake_create(struct ipset_handle *handle, const struct nlmsghdr *req,
+	    const struct nlattr *tb[])
+{
+	const struct ipset_type *t;
+	struct fake_set *set;
+	const char *name, *typename;
+	uint8_t family, revision;
+	bool found = false;
+	int ret;
+
+	if (!tb[IPSET_ATTR_SETNAME] || !tb[IPSET_ATTR_TYPENAME] ||
+	    !tb[IPSET_ATTR_REVISION] || !tb[IPSET_ATTR_FAMILY] ||
+	    !tb[IPSET_ATTR_DATA])
+		return fake_ack(handle, req, -IPSET_ERR_PROTOCOL, 0);
+	name = mnl_attr_get_str(tb[IPSET_ATTR_SETNAME]);
+	typename = mnl_attr_get_str(tb[IPSET_ATTR_TYPENAME]);
+	revision = mnl_attr_get_u8(tb[IPSET_ATTR_REVISION]);
+	family = mnl_attr_get_u8(tb[IPSET_ATTR_FAMILY]);
+
+	for (t = ipset_types(); t != NULL && !found; t = t->next)
+		found = ipset_match_typename(typename, t) &&
+			t->revision == revision;
+	if (!found)
+		return fake_ack(handle, req, -IPSET_ERR_FIND_TYPE, 0);
+
+	set = fake_set_find(name);
+	if (set != NULL) {
+		/* Same set is accepted without NLM_F_EXCL */
+		if ((req->nlmsg_flags & NLM_F_EXCL) ||
+		    !STREQ(set->typename, typename) ||
+		    set->family != family || set->revision != revision)
+			return fake_ack(handle, req, -IPSET_ERR_EXIST, 0);
+		return fake_ack(handle, req, 0, 0);
+	}
+	if (fake_nsets >= FAKE_MAXSETS)
+		return fake_ack(handle, req, -IPSET_ERR_MAX_SETS, 0);
+
+	set = fake_set_alloc(name, typename, revision, family,
+			     mnl_attr_get_payload(tb[IPSET_ATTR_DATA]),
+			     mnl_attr_get_payload_len(tb[IPSET_ATTR_DATA]));
+	if (set == NULL)
+		return fake_ack(handle, req, -ENOMEM, 0);
+	ret = fake_set_create_attrs(set);
+	if (ret < 0) {
+		fake_set_free(set);
+		return fake_ack(handle, req, ret, 0);
+	}
+	fake_dirty = true;
+	return fake_ack(handle, req, 0, 0);
+}
+
+static int
+fake_setcmd(struct ipset_handle *handle, const struct nlmsghdr *req,
+	    enum ipset_cmd cmd, const struct nlattr *tb[])
+{
+	struct fake_set *set = NULL, *set2 = NULL, *n;
+	char tmp[IPSET_MAXNAMELEN];
+	uint32_t refs;
+
+	if (tb[IPSET_ATTR_SETNAME]) {
+		set = fake_set_find(mnl_attr_get_str(tb[IPSET_ATTR_SETNAME]));
+		if (set == NULL)
+			return fake_ack(handle, req, -ENOENT, 0);
+	} else if (cmd == IPSET_CMD_RENAME || cmd == IPSET_CMD_SWAP) {
+		return fake_ack(handle, req, -IPSET_ERR_PROTOCOL, 0);
+	}
+	fake_dirty = true;
+
+	switch (cmd) {
+	case IPSET_CMD_DESTROY:
+		if (set != NULL) {
+			if (set->refs)
+				return fake_ack(handle, req,
+						-IPSET_ERR_BUSY, 0);
+			fake_set_free(set);
+			break;
+		}
+		list_for_each_entry(set, &fake_sets, list)
+			if (set->refs)
+				return fake_ack(handle, req,
+						-IPSET_ERR_BUSY, 0);
+		list_for_each_entry_safe(set, n, &fake_sets, list)
+			fake_set_free(set);
+		break;
+	case IPSET_CMD_FLUSH:
+		if (set != NULL) {
+			fake_set_flush(set);
+			break;
+		}
+		list_for_each_entry(set, &fake_sets, list)
+			fake_set_flush(set);
+		break;
+	case IPSET_CMD_ZERO:
+		if (set != NULL) {
+			memset(set->stats, 0, sizeof(set->stats));
+			break;
+		}
+		list_for_each_entry(set, &fake_sets, list)
+			memset(set->stats, 0, sizeof(set->stats));
+		break;
+	case IPSET_CMD_RENAME:
+		if (!tb[IPSET_ATTR_SETNAME2])
+			return fake_ack(handle, req, -IPSET_ERR_PROTOCOL, 0);
+		if (set->refs)
+			return fake_ack(handle, req,
+					-IPSET_ERR_REFERENCED, 0);
+		if (fake_set_find(mnl_attr_get_str(tb[IPSET_ATTR_SETNAME2])))
+			return fake_ack(handle, req,
+					-IPSET_ERR_EXIST_SETNAME2, 0);
+		ipset_strlcpy(set->name,
+			      mnl_attr_get_str(tb[IPSET_ATTR_SETNAME2]),
+			      IPSET_MAXNAMELEN);
+		break;
+	case IPSET_CMD_SWAP:
+		if (!tb[IPSET_ATTR_SETNAME2])
+			return fake_ack(handle, req, -IPSET_ERR_PROTOCOL, 0);
+		set2 = fake_set_find(mnl_attr_get_str(tb[IPSET_ATTR_SETNAME2]));
+		if (set2 == NULL)
+			return fake_ack(handle, req,
+					-IPSET_ERR_EXIST_SETNAME2, 0);
+		if (!STREQ(set->typename, set2->typename) ||
+		    set->family != set2->family)
+			return fake_ack(handle, req,
+					-IPSET_ERR_TYPE_MISMATCH, 0);
+		memcpy(tmp, set->name, IPSET_MAXNAMELEN);
+		memcpy(set->name, set2->name, IPSET_MAXNAMELEN);
+		memcpy(set2->name, tmp, IPSET_MAXNAMELEN);
+		/* The list:set elements refer to the names */
+		refs = set->refs;
+		set->refs = set2->refs;
+		set2->refs = refs;
+		break;
+	default:
+		break;
+	}
+	return fake_ack(handle, req, 0, 0);
+}
+
+/* Count the commands from userspace like the kernel does */
+static void
+fake_stats(struct fake_set *set, enum ipset_cmd cmd, int ret)
+{
+	if (!set->with_stats)
+		return;
+	fake_dirty = true;
+	if (ret == -IPSET_ERR_HASH_FULL)
+		set->stats[IPSET_ATTR_STATS_FULL]++;
+	switch (cmd) {
+	case IPSET_CMD_TEST:
+		set->stats[IPSET_ATTR_STATS_TESTS]++;
+		if (ret == 0)
+			set->stats[IPSET_ATTR_STATS_HITS]++;
+		break;
+	case IPSET_CMD_ADD:
+		if (ret == 0)
+			set->stats[IPSET_ATTR_STATS_UADDS]++;
+		break;
+	case IPSET_CMD_DEL:
+		if (ret == 0)
+			set->stats[IPSET_ATTR_STATS_UDELS]++;
+		break;
+	default:
+		break;
+	}
+}
+
+static int
+fake_adt(struct ipset_handle *handle, const struct nlmsghdr *req,
+	 enum ipset_cmd cmd, const struct nlattr *tb[])
+{
+	struct fake_set *set;
+	const struct nlattr *a;
+	bool exist = !(req->nlmsg_flags & NLM_F_EXCL);
+	uint32_t lineno = 0;
+	int ret = 0;
+
+	if (!tb[IPSET_ATTR_SETNAME] ||
+	    !(tb[IPSET_ATTR_DATA] || tb[IPSET_ATTR_ADT]))
+		return fake_ack(handle, req, -IPSET_ERR_PROTOCOL, 0);
+	set = fake_set_find(mnl_attr_get_str(tb[IPSET_ATTR_SETNAME]));
+	if (set == NULL)
+		return fake_ack(handle, req, -ENOENT, 0);
+	if (tb[IPSET_ATTR_LINENO])
+		lineno = fake_get_u32(tb[IPSET_ATTR_LINENO]);
+
+	if (cmd != IPSET_CMD_TEST)
+		fake_dirty = true;
+	if (tb[IPSET_ATTR_DATA]) {
+		ret = fake_elem(set, cmd, tb[IPSET_ATTR_DATA], exist, &lineno);
+		fake_stats(set, cmd, ret);
+	} else {
+		/* The elements before a failed one stay in the set */
+		mnl_attr_for_each_nested(a, tb[IPSET_ATTR_ADT]) {
+			if (mnl_attr_get_type(a) != IPSET_ATTR_DATA)
+				continue;
+			ret = fake_elem(set, cmd, a, exist, &lineno);
+			fake_stats(set, cmd, ret);
+			if (ret < 0)
+				break;
+		}
+	}
+	return fake_ack(handle, req, ret, lineno);
+}
+
+static int
+fake_dump_set(struct ipset_handle *handle, struct fake_set *set,
+	      uint32_t flags, size_t len)
+{
+	const struct fake_elem *e;
+	struct nlmsghdr *nlh;
+	struct nlattr *adt, *data, *timeout;
+	time_t now = time(NULL);
+	int ret;
+
+	nlh = fake_msg_start(handle, handle->reply, IPSET_CMD_LIST,
+			     NLM_F_MULTI);
+	mnl_attr_put(nlh, IPSET_ATTR_SETNAME, strlen(set->name) + 1,
+		     set->name);
+	if (!(flags & IPSET_FLAG_LIST_SETNAME))
+		fake_put_header(nlh, set);
+	ret = fake_run(handle, nlh);
+	if (ret <= MNL_CB_STOP)
+		return ret;
+	if (flags & (IPSET_FLAG_LIST_SETNAME | IPSET_FLAG_LIST_HEADER))
+		return MNL_CB_OK;
+
+	if (set->bitmap)
+		fake_set_sort(set);
+
+	/* Elements packed into messages as large as the kernel's */
+	nlh = NULL;
+	adt = NULL;
+	list_for_each_entry(e, &set->elems, list) {
+		if (nlh != NULL &&
+		    nlh->nlmsg_len + MNL_ATTR_HDRLEN + e->len > len) {
+			mnl_attr_nest_end(nlh, adt);
+			ret = fake_run(handle, nlh);
+			if (ret <= MNL_CB_STOP)
+				return ret;
+			nlh = NULL;
+		}
+		if (nlh == NULL) {
+			nlh = fake_msg_start(handle, handle->reply,
+					     IPSET_CMD_LIST, NLM_F_MULTI);
+			mnl_attr_put(nlh, IPSET_ATTR_SETNAME,
+				     strlen(set->name) + 1, set->name);
+			adt = mnl_attr_nest_start(nlh, IPSET_ATTR_ADT);
+		}
+		data = mnl_nlmsg_get_payload_tail(nlh);
+		mnl_attr_put(nlh, IPSET_ATTR_DATA | NLA_F_NESTED,
+			     e->len, e->attrs);
+		timeout = fake_elem_attr(mnl_attr_get_payload(data),
+					 e->len, IPSET_ATTR_TIMEOUT);
+		if (e->expires && timeout != NULL)
+			*(uint32_t *) mnl_attr_get_payload(timeout) =
+				htonl(e->expires > now ? e->expires - now : 0);
+	}
+	if (nlh != NULL) {
+		mnl_attr_nest_end(nlh, adt);
+		ret = fake_run(handle, nlh);
+		if (ret <= MNL_CB_STOP)
+			return ret;
+	}
+	return MNL_CB_OK;
+}
+
+static int
+fake_dump(struct ipset_handle *handle, const struct nlmsghdr *req,
+	  const struct nlattr *tb[], size_t len)
+{
+	struct fake_set *set, *only = NULL;
+	struct nlmsghdr *nlh;
+	uint32_t flags = 0;
+	int pass, ret;
+
+	if (tb[IPSET_ATTR_FLAGS])
+		flags = fake_get_u32(tb[IPSET_ATTR_FLAGS]);
+	if (tb[IPSET_ATTR_SETNAME]) {
+		only = fake_set_find(mnl_attr_get_str(tb[IPSET_ATTR_SETNAME]));
+		if (only == NULL)
+			return fake_ack(handle, req, -ENOENT, 0);
+	}
+
+	/* The list:set type sets are dumped last, after their members */
+	for (pass = 0; pass < 2; pass++) {
+		list_for_each_entry(set, &fake_sets, list) {
+			if (only != NULL ? set != only || pass
+					 : set->setlist != pass)
+				continue;
+			ret = fake_dump_set(handle, set, flags, len);
+			if (ret <= MNL_CB_STOP)
+				return ret;
+		}
+	}
+	nlh = mnl_nlmsg_put_header(handle->reply);
+	nlh->nlmsg_type = NLMSG_DONE;
+	nlh->nlmsg_flags = NLM_F_MULTI;
+	nlh->nlmsg_seq = handle->seq;
+	nlh->nlmsg_pid = handle->portid;
+	*(int *) mnl_nlmsg_put_extra_header(nlh, sizeof(int)) = 0;
+	return fake_run(handle, nlh);
+}
+
+/* Log the requests into IPSET_FAKE_LOG, so tests can count the queries */
+static void
+fake_log(enum ipset_cmd cmd, const struct nlattr *tb[])
+{
+	const char *file = getenv("IPSET_FAKE_LOG");
+	FILE *f;
+
+	if (file == NULL || (f = fopen(file, "a")) == NULL)
+		return;
+	if (cmd == IPSET_CMD_PROTOCOL)
+		fprintf(f, "protocol\n");
+	else if (cmd == IPSET_CMD_TYPE && tb[IPSET_ATTR_TYPENAME])
+		fprintf(f, "type %s\n",
+			mnl_attr_get_str(tb[IPSET_ATTR_TYPENAME]));
+	else
+		fprintf(f, "command %u\n", cmd);
+	fclose(f);
+}
+
+/* Execute a request and pass the replies to fake_run() */
+static int
+fake_request(struct ipset_handle *handle, void *buffer, size_t len)
+{
+	const struct nlattr *tb[IPSET_ATTR_ADT_MAX+1] = {};
+	struct nlmsghdr *req = buffer;
+	enum ipset_cmd cmd;
+
+	req->nlmsg_seq = ++handle->seq;
+#ifdef IPSET_DEBUG
+	ipset_debug_msg("sent", req, req->nlmsg_len);
+#endif
+	/* Error reports carry the whole request */
+	if (handle->replylen < 2 * len) {
+		void *reply = realloc(handle->reply, 2 * len);
+
+		if (reply == NULL)
+			return -ENOMEM;
+		handle->reply = reply;
+		handle->replylen = 2 * len;
+	}
+
+	cmd = ipset_get_nlmsg_type(req);
+	if (mnl_attr_parse(req, MNL_ALIGN(sizeof(struct nfgenmsg)),
+			   fake_attr_cb, tb) < MNL_CB_STOP ||
+	    !tb[IPSET_ATTR_PROTOCOL])
+		return fake_ack(handle, req, -IPSET_ERR_PROTOCOL, 0);
+	fake_log(cmd, tb);
+	if (cmd != IPSET_CMD_PROTOCOL &&
+	    mnl_attr_get_u8(tb[IPSET_ATTR_PROTOCOL]) != IPSET_PROTOCOL)
+		return fake_ack(handle, req, -IPSET_ERR_PROTOCOL, 0);
+
+	fake_gc();
+
+	switch (cmd) {
+	case IPSET_CMD_PROTOCOL: {
+		struct nlmsghdr *nlh;
+
+		nlh = fake_msg_start(handle, handle->reply,
+				     IPSET_CMD_PROTOCOL, 0);
+		mnl_attr_put_u8(nlh, IPSET_ATTR_PROTOCOL_MIN,
+				IPSET_PROTOCOL_MIN);
+		return fake_run(handle, nlh);
+	}
+	case IPSET_CMD_TYPE:
+		return fake_type(handle, req, tb);
+	case IPSET_CMD_HEADER:
+		return fake_header(handle, req, tb);
+	case IPSET_CMD_CREATE:
+		return fake_create(handle, req, tb);
+	case IPSET_CMD_DESTROY:
+	case IPSET_CMD_FLUSH:
+	case IPSET_CMD_ZERO:
+	case IPSET_CMD_RENAME:
+	case IPSET_CMD_SWAP:
+		return fake_setcmd(handle, req, cmd, tb);
+	case IPSET_CMD_ADD:
+	case IPSET_CMD_DEL:
+	case IPSET_CMD_TEST:
+		return fake_adt(handle, req, cmd, tb);
+	case IPSET_CMD_LIST:
+	case IPSET_CMD_SAVE:
+		return fake_dump(handle, req, tb, len);
+	default:
+		return fake_ack(handle, req, -EOPNOTSUPP, 0);
+	}
+}
+
+static int
+ipset_fake_query(struct ipset_handle *handle, void *buffer, size_t len)
+{
+	assert(handle);
+	assert(buffer);
+
+	return fake_request(handle, buffer, len);
+}
+
+static int
+ipset_fake_fd(struct ipset_handle *handle)
+{
+	assert(handle);
+
+	if (handle->sock[0] < 0 &&
+	    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		       0, handle->sock) < 0)
+		return -errno;
+	return handle->sock[0];
+}
+
+/* The request is executed at once, the replies are queued */
+static int
+ipset_fake_send(struct ipset_handle *handle, void *buffer, size_t len)
+{
+	int ret;
+
+	assert(handle);
+	assert(buffer);
+
+	if (ipset_fake_fd(handle) < 0)
+		return -ECOMM;
+	handle->async = true;
+	ret = fake_request(handle, buffer, len);
+	handle->async = false;
+	return ret < MNL_CB_STOP ? -ECOMM : 0;
+}
+
+/* Receive the queued whole replies which fit into the buffer,
+ * returns 0 when there is nothing to receive
+ */
+static int
+ipset_fake_recv(struct ipset_handle *handle, void *buffer, size_t len)
+{
+	const struct nlmsghdr *nlh;
+	size_t n = 0, msglen;
+	char c;
+
+	assert(handle);
+	assert(buffer);
+
+	while (n < handle->queued) {
+		nlh = (const void *) ((const char *) handle->queue + n);
+		msglen = MNL_ALIGN(nlh->nlmsg_len);
+		if (n + msglen > len)
+			break;
+		n += msglen;
+	}
+	if (n == 0)
+		return handle->queued ? -ENOBUFS : 0;
+	memcpy(buffer, handle->queue, n);
+	handle->queued -= n;
+	memmove(handle->queue, (char *) handle->queue + n, handle->queued);
+	if (handle->queued == 0)
+		while (read(handle->sock[0], &c, 1) > 0)
+			;
+#ifdef IPSET_DEBUG
+	ipset_debug_msg("received", buffer, n);
+#endif
+	return n;
+}
+
+/*
+ * State file
+ */
+
+static bool
+fake_read(FILE *f, void *d, size_t len)
+{
+	return fread(d, 1, len, f) == len;
+}
+
+static void
+fake_load(const char *file)
+{
+	char magic[sizeof(FAKE_STATE_MAGIC) - 1];
+	unsigned char buf[FAKE_ELEMLEN];
+	struct fake_set *set;
+	struct {
+		char name[IPSET_MAXNAMELEN];
+		char typename[IPSET_MAXNAMELEN];
+		uint8_t revision, family;
+		uint16_t clen;
+		uint32_t elements;
+		uint64_t stats[IPSET_ATTR_STATS_MAX];
+	} hdr;
+	unsigned char *create;
+	time_t expires;
+	uint16_t len;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (f == NULL)
+		return;
+	if (!fake_read(f, magic, sizeof(magic)) ||
+	    memcmp(magic, FAKE_STATE_MAGIC, sizeof(magic)) != 0)
+		goto out;
+	while (fake_read(f, &hdr, sizeof(hdr))) {
+		hdr.name[IPSET_MAXNAMELEN - 1] = '\0';
+		hdr.typename[IPSET_MAXNAMELEN - 1] = '\0';
+		create = malloc(hdr.clen ? hdr.clen : 1);
+		if (create == NULL || !fake_read(f, create, hdr.clen)) {
+			free(create);
+			goto out;
+		}
+		set = fake_set_alloc(hdr.name, hdr.typename, hdr.revision,
+				     hdr.family, create, hdr.clen);
+		free(create);
+		if (set == NULL)
+			goto out;
+		fake_set_create_attrs(set);
+		memcpy(set->stats, hdr.stats, sizeof(set->stats));
+		while (hdr.elements-- > 0) {
+			if (!fake_read(f, &len, sizeof(len)) ||
+			    !fake_read(f, &expires, sizeof(expires)) ||
+			    len > sizeof(buf) || !fake_read(f, buf, len))
+				goto out;
+			fake_elem_add(set, buf, len, true, expires);
+		}
+	}
+out:
+	fclose(f);
+	/* Members may be loaded after the list:set referring to them */
+	list_for_each_entry(set, &fake_sets, list)
+		set->refs = 0;
+	list_for_each_entry(set, &fake_sets, list) {
+		struct fake_elem *e;
+
+		list_for_each_entry(e, &set->elems, list)
+			fake_ref(set, e, 1);
+	}
+}
+
+static void
+fake_save(const char *file)
+{
+	char tmp[PATH_MAX];
+	const struct fake_set *set;
+	const struct fake_elem *e;
+	struct {
+		char name[IPSET_MAXNAMELEN];
+		char typename[IPSET_MAXNAMELEN];
+		uint8_t revision, family;
+		uint16_t clen;
+		uint32_t elements;
+		uint64_t stats[IPSET_ATTR_STATS_MAX];
+	} hdr;
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.%u", file, (unsigned int) getpid());
+	f = fopen(tmp, "w");
+	if (f == NULL)
+		return;
+	fwrite(FAKE_STATE_MAGIC, 1, sizeof(FAKE_STATE_MAGIC) - 1, f);
+	list_for_each_entry(set, &fake_sets, list) {
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.name, set->name, IPSET_MAXNAMELEN);
+		memcpy(hdr.typename, set->typename, IPSET_MAXNAMELEN);
+		hdr.revision = set->revision;
+		hdr.family = set->family;
+		hdr.clen = set->clen;
+		hdr.elements = set->elements;
+		memcpy(hdr.stats, set->stats, sizeof(hdr.stats));
+		fwrite(&hdr, sizeof(hdr), 1, f);
+		fwrite(set->create, 1, set->clen, f);
+		list_for_each_entry(e, &set->elems, list) {
+			fwrite(&e->len, sizeof(e->len), 1, f);
+			fwrite(&e->expires, sizeof(e->expires), 1, f);
+			fwrite(e->attrs, 1, e->len, f);
+		}
+	}
+	if (fclose(f) != 0 || rename(tmp, file) != 0)
+		unlink(tmp);
+}
+
+/* The state file, an empty IPSET_FAKE_STATE keeps the sets in memory */
+static const char *
+fake_state_file(void)
+{
+	const char *file = getenv("IPSET_FAKE_STATE");
+
+	return file != NULL && file[0] != '\0' ? file : NULL;
+}
+
+static struct ipset_handle *
+ipset_fake_init(mnl_cb_t *cb_ctl, void *data)
+{
+	struct ipset_handle *handle;
+	const char *file = fake_state_file();
+
+	assert(cb_ctl);
+	assert(data);
+
+	handle = calloc(1, sizeof(*handle));
+	if (!handle)
+		return NULL;
+
+	handle->portid = getpid();
+	handle->cb_ctl = cb_ctl;
+	handle->data = data;
+	handle->sock[0] = handle->sock[1] = -1;
+
+	if (fake_users++ == 0 && file != NULL) {
+		/* Commands of the processes are serialized, like in the kernel */
+		char lock[PATH_MAX];
+
+		snprintf(lock, sizeof(lock), "%s.lock", file);
+		fake_lock = open(lock, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (fake_lock >= 0)
+			flock(fake_lock, LOCK_EX);
+		if (list_empty(&fake_sets))
+			fake_load(file);
+	}
+
+	return handle;
+}
+
+static int
+ipset_fake_fini(struct ipset_handle *handle)
+{
+	const char *file = fake_state_file();
+
+	assert(handle);
+
+	if (--fake_users == 0 && file != NULL) {
+		if (fake_dirty)
+			fake_save(file);
+		fake_dirty = false;
+		if (fake_lock >= 0)
+			close(fake_lock);
+		fake_lock = -1;
+	}
+	if (handle->sock[0] >= 0) {
+		close(handle->sock[0]);
+		close(handle->sock[1]);
+	}
+	free(handle->queue);
+	free(handle->reply);
+	free(handle);
+	return 0;
+}
+
+const struct ipset_transport ipset_fake_transport = {
+	.init	= ipset_fake_init,
+	.fini	= ipset_fake_fini,
+	.fill_hdr = ipset_mnl_fill_hdr,
+	.query	= ipset_fake_query,
+	.fd	= ipset_fake_fd,
+	.send	= ipset_fake_send,
+	.recv	= ipset_fake_recv,
+};
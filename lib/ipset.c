@@ -13,6 +13,9 @@
 #include <stdio.h>				/* printf */
 #include <stdlib.h>				/* exit */
 #include <string.h>				/* str* */
+#include <sys/mman.h>				/* mmap */
+#include <sys/stat.h>				/* fstat */
+#include <unistd.h>				/* read */
 
 #include <config.h>
 
@@ -25,6 +28,7 @@
 #include <libipset/session.h>			/* ipset_envopt_parse */
 #include <libipset/parse.h>			/* ipset_parse_family */
 #include <libipset/print.h>			/* ipset_print_family */
+#include <libipset/resolve.h>			/* ipset_resolve_* */
 #include <libipset/utils.h>			/* STREQ */
 #include <libipset/ipset.h>			/* prototypes */
 
@@ -45,10 +49,13 @@ struct ipset {
 	bool interactive;			/* "Interactive" CLI */
 	bool full_io;				/* Use session ios */
 	bool no_vhi;				/* No version/help/interactive */
-	char cmdline[MAX_CMDLINE_CHARS];	/* For restore mode */
+	char cmdline[MAX_CMDLINE_CHARS];	/* For interactive mode */
 	char *newargv[MAX_ARGS];
 	int newargc;
+	char *argbuf;				/* Arguments of newargv */
+	size_t argsize;
 	const char *filename;			/* Input/output filename */
+	struct ipset_argtable *argtables;	/* Keyword tables of types */
 };
 
 /* Commands and environment options */
@@ -133,6 +140,13 @@ const struct ipset_commands ipset_commands[] = {
 		.help = "FROM-SETNAME TO-SETNAME\n"
 			"        Swap the contect of two existing sets",
 	},
+	{	/* st[ats] */
+		.cmd = IPSET_CMD_STATS,
+		.name = { "stats", NULL },
+		.has_arg = IPSET_OPTIONAL_ARG,
+		.help = "[SETNAME]\n"
+			"        List the statistics of a named set or all sets",
+	},
 	{	/* h[elp, --help, -H */
 		.cmd = IPSET_CMD_HELP,
 		.name = { "help", "-h", "-H" },
@@ -191,17 +205,22 @@ ipset_match_cmd(const char *arg, const char * const name[])
 
 /* Used up so far
  *
+ *	-a		-aggregate
  *	-A		add
+ *	-c		-cache
  *	-D		del
  *	-E		rename
  *	-f		-file
  *	-F		flush
+ *	-g		-group
  *	-h		help
  *	-H		help
+ *	-j		-jobs
  *	-L		list
  *	-n		-name
  *	-N		create
  *	-o		-output
+ *	-p		-phases
  *	-r		-resolve
  *	-R		restore
  *	-s		-sorted
@@ -210,6 +229,7 @@ ipset_match_cmd(const char *arg, const char * const name[])
  *	-T		test
  *	-q		-quiet
  *	-X		destroy
+ *	-z		-zero
  *	-v		version
  *	-V		version
  *	-W		swap
@@ -220,7 +240,7 @@ const struct ipset_envopts ipset_envopts[] = {
 	{ .name = { "-o", "-output" },
 	  .has_arg = IPSET_MANDATORY_ARG,	.flag = IPSET_OPT_MAX,
 	  .parse = ipset_parse_output,
-	  .help = "plain|save|xml\n"
+	  .help = "plain|save|xml|binary\n"
 		  "       Specify output mode for listing sets.\n"
 		  "       Default value for \"list\" command is mode \"plain\"\n"
 		  "       and for \"save\" command is mode \"save\".",
@@ -264,6 +284,54 @@ const struct ipset_envopts ipset_envopts[] = {
 		  "        When listing, list setnames and set headers\n"
 		  "        from kernel only.",
 	},
+	{ .name = { "-total", NULL },
+	  .parse = ipset_envopt_parse,
+	  .has_arg = IPSET_NO_ARG,	.flag = IPSET_ENV_TOTAL,
+	  .help = "\n"
+		  "        When listing all sets, print the total memory size\n"
+		  "        and number of entries of the sets at the end.",
+	},
+	{ .name = { "-g", "-group" },
+	  .parse = ipset_envopt_parse,
+	  .has_arg = IPSET_NO_ARG,	.flag = IPSET_ENV_GROUP,
+	  .help = "\n"
+		  "        In restore mode, group the add/del commands\n"
+		  "        by set when the lines of the sets are interleaved.",
+	},
+	{ .name = { "-a", "-aggregate" },
+	  .parse = ipset_envopt_parse,
+	  .has_arg = IPSET_NO_ARG,	.flag = IPSET_ENV_AGGREGATE,
+	  .help = "\n"
+		  "        In restore mode, merge the networks added to\n"
+		  "        the hash:net sets into the fewest ones.",
+	},
+	{ .name = { "-c", "-cache" },
+	  .parse = ipset_envopt_parse,
+	  .has_arg = IPSET_NO_ARG,	.flag = IPSET_ENV_CACHE,
+	  .help = "\n"
+		  "        Cache the protocol and set type revisions\n"
+		  "        supported by the kernel across invocations.",
+	},
+	{ .name = { "-p", "-phases" },
+	  .parse = ipset_envopt_parse,
+	  .has_arg = IPSET_NO_ARG,	.flag = IPSET_ENV_PHASES,
+	  .help = "\n"
+		  "        Print the time spent in parsing, encoding,\n"
+		  "        in the kernel and in formatting to stderr at exit.",
+	},
+	{ .name = { "-z", "-zero" },
+	  .parse = ipset_envopt_parse,
+	  .has_arg = IPSET_NO_ARG,	.flag = IPSET_ENV_ZERO,
+	  .help = "\n"
+		  "        Zero the statistics of the sets after listing them\n"
+		  "        with the \"stats\" command.",
+	},
+	{ .name = { "-j", "-jobs" },
+	  .has_arg = IPSET_MANDATORY_ARG,	.flag = IPSET_OPT_MAX,
+	  .parse = ipset_parse_jobs,
+	  .help = "N\n"
+		  "        Save all sets in N parallel jobs.",
+	},
 	{ .name = { "-f", "-file" },
 	  .parse = ipset_parse_filename,
 	  .has_arg = IPSET_MANDATORY_ARG,	.flag = IPSET_OPT_MAX,
@@ -416,11 +484,45 @@ ipset_parse_output(struct ipset *ipset,
 		return ipset_session_output(session, IPSET_LIST_XML);
 	else if (STREQ(str, "save"))
 		return ipset_session_output(session, IPSET_LIST_SAVE);
+	else if (STREQ(str, "binary"))
+		return ipset_session_output(session, IPSET_LIST_BINARY);
 
 	return ipset_err(session,
 		"Syntax error: unknown output mode '%s'", str);
 }
 
+/**
+ * ipset_parse_jobs - parse number of parallel jobs
+ * @ipset: ipset structure
+ * @opt: option kind of the data
+ * @str: string to parse
+ *
+ * Parse the number of parallel jobs used at saving all sets.
+ * The value is stored in the session.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int
+ipset_parse_jobs(struct ipset *ipset,
+		 int opt UNUSED, const char *str)
+{
+	struct ipset_session *session;
+	unsigned long jobs;
+	char *end;
+
+	assert(ipset);
+	assert(str);
+
+	session = ipset_session(ipset);
+	errno = 0;
+	jobs = strtoul(str, &end, 10);
+	if (errno || end == str || *end != '\0' || jobs > IPSET_JOBS_MAX)
+		return ipset_err(session,
+			"Syntax error: invalid number of jobs '%s'", str);
+
+	return ipset_session_jobs(session, jobs);
+}
+
 /**
  * ipset_envopt_parse - parse/set environment option
  * @ipset: ipset structure
@@ -446,6 +548,12 @@ ipset_envopt_parse(struct ipset *ipset, int opt,
 	case IPSET_ENV_EXIST:
 	case IPSET_ENV_LIST_SETNAME:
 	case IPSET_ENV_LIST_HEADER:
+	case IPSET_ENV_GROUP:
+	case IPSET_ENV_CACHE:
+	case IPSET_ENV_PHASES:
+	case IPSET_ENV_ZERO:
+	case IPSET_ENV_AGGREGATE:
+	case IPSET_ENV_TOTAL:
 		ipset_envopt_set(session, opt);
 		return 0;
 	default:
@@ -547,36 +655,40 @@ reset_argv(struct ipset *ipset)
 	int i;
 
 	/* Reset */
-	for (i = 1; i < ipset->newargc; i++) {
-		if (ipset->newargv[i])
-			free(ipset->newargv[i]);
+	for (i = 1; i < ipset->newargc; i++)
 		ipset->newargv[i] = NULL;
-	}
 	ipset->newargc = 1;
 }
 
-/* Build fake argv from parsed line */
+/* Build fake argv from parsed line: the line is copied once and
+ * the arguments are split in place in the copy */
 static int
-build_argv(struct ipset *ipset, char *buffer)
+build_argv(struct ipset *ipset, const char *buffer, size_t len)
 {
 	void *p = ipset_session_printf_private(ipset->session);
-	char *tmp, *arg;
-	int i;
+	char *tmp, *arg, *w;
 	bool quoted = false;
 
 	reset_argv(ipset);
-	arg = calloc(strlen(buffer) + 1, sizeof(*buffer));
-	if (!arg)
-		return ipset->custom_error(ipset, p, IPSET_OTHER_PROBLEM,
-					   "Cannot allocate memory.");
-	for (tmp = buffer, i = 0; *tmp; tmp++) {
+	if (len + 1 > ipset->argsize) {
+		tmp = realloc(ipset->argbuf, len + 1);
+		if (!tmp)
+			return ipset->custom_error(ipset, p,
+						   IPSET_OTHER_PROBLEM,
+						   "Cannot allocate memory.");
+		ipset->argbuf = tmp;
+		ipset->argsize = len + 1;
+	}
+	memcpy(ipset->argbuf, buffer, len);
+	ipset->argbuf[len] = '\0';
+
+	/* The unquoted argument is never longer than the input read so far */
+	for (tmp = arg = w = ipset->argbuf; *tmp; tmp++) {
 		if ((ipset->newargc + 1) ==
-		    (int)(sizeof(ipset->newargv)/sizeof(char *))) {
-			free(arg);
+		    (int)(sizeof(ipset->newargv)/sizeof(char *)))
 			return ipset->custom_error(ipset,
 					p, IPSET_PARAMETER_PROBLEM,
 					"Line is too long to parse.");
-		}
 		switch (*tmp) {
 		case '"':
 			quoted = !quoted;
@@ -589,37 +701,25 @@ build_argv(struct ipset *ipset, char *buffer)
 		case '\t':
 			if (!quoted)
 				break;
-			arg[i++] = *tmp;
+			*w++ = *tmp;
 			continue;
 		default:
-			arg[i++] = *tmp;
+			*w++ = *tmp;
 			if (*(tmp+1))
 				continue;
 			break;
 		}
-		if (!*(tmp+1) && quoted) {
-			free(arg);
+		if (!*(tmp+1) && quoted)
 			return ipset->custom_error(ipset,
 				p, IPSET_PARAMETER_PROBLEM,
 				"Missing close quote!");
-		}
-		if (!*arg)
+		if (w == arg)
 			continue;
-		ipset->newargv[ipset->newargc] =
-			calloc(strlen(arg) + 1, sizeof(*arg));
-		if (!ipset->newargv[ipset->newargc]) {
-			free(arg);
-			return ipset->custom_error(ipset,
-				p, IPSET_OTHER_PROBLEM,
-				"Cannot allocate memory.");
-		}
-		ipset_strlcpy(ipset->newargv[ipset->newargc++],
-			      arg, strlen(arg) + 1);
-		memset(arg, 0, strlen(arg) + 1);
-		i = 0;
+		*w++ = '\0';
+		ipset->newargv[ipset->newargc++] = arg;
+		arg = w;
 	}
 
-	free(arg);
 	return 0;
 }
 
@@ -640,6 +740,96 @@ restore(struct ipset *ipset)
 	return ipset_parse_stream(ipset, f);
 }
 
+/* Keyword lookup table of the arguments of a type command, built once
+ * and used instead of matching every keyword of the type in turn. */
+#define ARG_HASH_SIZE	128			/* Power of two */
+
+struct ipset_argtable {
+	struct ipset_argtable *next;
+	const struct ipset_type *type;
+	enum ipset_adt cmd;
+	/* Index of the keyword in args * 2 + index of the name, plus one */
+	uint8_t slot[ARG_HASH_SIZE];
+};
+
+static unsigned int
+arg_hash(const char *name)
+{
+	unsigned int h = 0;
+
+	while (*name)
+		h = h * 31 + (unsigned char) *name++;
+	return h & (ARG_HASH_SIZE - 1);
+}
+
+static const struct ipset_arg *
+argtable_arg(const struct ipset_argtable *t, uint8_t slot, const char **name)
+{
+	const struct ipset_arg *arg;
+
+	arg = ipset_keyword(t->type->cmd[t->cmd].args[(slot - 1) / 2]);
+	*name = arg->name[(slot - 1) % 2];
+	return arg;
+}
+
+static struct ipset_argtable *
+argtable_get(struct ipset *ipset, const struct ipset_type *type,
+	     enum ipset_adt cmd)
+{
+	struct ipset_argtable *t;
+	const struct ipset_arg *arg;
+	const char *name;
+	unsigned int h;
+	int j, n;
+
+	for (t = ipset->argtables; t != NULL; t = t->next)
+		if (t->type == type && t->cmd == cmd)
+			return t;
+
+	t = calloc(1, sizeof(*t));
+	if (t == NULL)
+		return NULL;
+	t->type = type;
+	t->cmd = cmd;
+	/* The first keyword wins when more have got the same name */
+	for (j = 0; type->cmd[cmd].args[j] != IPSET_ARG_NONE; j++) {
+		arg = ipset_keyword(type->cmd[cmd].args[j]);
+		for (n = 0; n < 2 && arg->name[n] != NULL; n++) {
+			for (h = arg_hash(arg->name[n]); t->slot[h];
+			     h = (h + 1) & (ARG_HASH_SIZE - 1)) {
+				argtable_arg(t, t->slot[h], &name);
+				if (STREQ(name, arg->name[n]))
+					break;
+			}
+			if (!t->slot[h])
+				t->slot[h] = j * 2 + n + 1;
+		}
+	}
+	t->next = ipset->argtables;
+	ipset->argtables = t;
+	return t;
+}
+
+/* Same as ipset_match_option() against the keywords of the table */
+static const struct ipset_arg *
+argtable_match(const struct ipset_argtable *t, const char *str)
+{
+	const struct ipset_arg *arg;
+	const char *name;
+	unsigned int h;
+
+	/* Skip two leading dashes */
+	if (str[0] == '-' && str[1] == '-')
+		str += 2;
+
+	for (h = arg_hash(str); t->slot[h]; h = (h + 1) & (ARG_HASH_SIZE - 1)) {
+		arg = argtable_arg(t, t->slot[h], &name);
+		if (STREQ(str, name))
+			return arg;
+	}
+	return NULL;
+}
+
 static bool do_parse(const struct ipset_arg *arg, bool family)
 {
 	return !((family == true) ^ (arg->opt == IPSET_OPT_FAMILY));
@@ -650,6 +840,7 @@ call_parser(struct ipset *ipset, int *argc, char *argv[],
 	    const struct ipset_type *type, enum ipset_adt cmd, bool family)
 {
 	void *p = ipset_session_printf_private(ipset->session);
+	const struct ipset_argtable *table;
 	const struct ipset_arg *arg;
 	const char *optstr;
 	const struct ipset_type *t = type;
@@ -661,57 +852,57 @@ call_parser(struct ipset *ipset, int *argc, char *argv[],
 		return ipset->custom_error(ipset,
 				p, IPSET_PARAMETER_PROBLEM,
 				"Unknown argument: `%s'", argv[i]);
+	if (*argc <= i)
+		goto out;
+
+	table = argtable_get(ipset, type, cmd);
+	if (table == NULL)
+		return ipset->custom_error(ipset, p, IPSET_OTHER_PROBLEM,
+					   "Cannot allocate memory.");
 
 	while (*argc > i) {
-		ret = -1;
-		for (j = 0; type->cmd[cmd].args[j] != IPSET_ARG_NONE; j++) {
-			arg = ipset_keyword(type->cmd[cmd].args[j]);
-			D("argc: %u, %s vs %s", i, argv[i], arg->name[0]);
-			if (!(ipset_match_option(argv[i], arg->name)))
-				continue;
+		arg = argtable_match(table, argv[i]);
+		if (arg == NULL)
+			goto err_unknown;
 
-			optstr = argv[i];
-			/* Matched option */
-			D("match %s, argc %u, i %u, %s",
-			  arg->name[0], *argc, i + 1,
-			  do_parse(arg, family) ? "parse" : "skip");
-			i++;
-			ret = 0;
-			switch (arg->has_arg) {
-			case IPSET_MANDATORY_ARG:
-				if (*argc - i < 1)
-					return ipset->custom_error(ipset, p,
-						IPSET_PARAMETER_PROBLEM,
-						"Missing mandatory argument "
-						"of option `%s'",
-						arg->name[0]);
-				/* Fall through */
-			case IPSET_OPTIONAL_ARG:
-				if (*argc - i >= 1) {
-					if (do_parse(arg, family)) {
-						ret = ipset_call_parser(
-							ipset->session,
-							arg, argv[i]);
-						if (ret < 0)
-							return ret;
-					}
-					i++;
-					break;
-				}
-				/* Fall through */
-			default:
+		optstr = argv[i];
+		/* Matched option */
+		D("match %s, argc %u, i %u, %s",
+		  arg->name[0], *argc, i + 1,
+		  do_parse(arg, family) ? "parse" : "skip");
+		i++;
+		ret = 0;
+		switch (arg->has_arg) {
+		case IPSET_MANDATORY_ARG:
+			if (*argc - i < 1)
+				return ipset->custom_error(ipset, p,
+					IPSET_PARAMETER_PROBLEM,
+					"Missing mandatory argument "
+					"of option `%s'",
+					arg->name[0]);
+			/* Fall through */
+		case IPSET_OPTIONAL_ARG:
+			if (*argc - i >= 1) {
 				if (do_parse(arg, family)) {
-					ret = ipset_call_parser(
-						ipset->session, arg, optstr);
+					ret = ipset_call_parser(ipset->session,
+								arg, argv[i]);
 					if (ret < 0)
 						return ret;
 				}
+				i++;
+				break;
+			}
+			/* Fall through */
+		default:
+			if (do_parse(arg, family)) {
+				ret = ipset_call_parser(ipset->session,
+							arg, optstr);
+				if (ret < 0)
+					return ret;
 			}
-			break;
 		}
-		if (ret < 0)
-			goto err_unknown;
 	}
+out:
 	if (!family)
 		*argc = 0;
 	return ret;
@@ -948,6 +1139,7 @@ ipset_parse_argv(struct ipset *ipset, int oargc, char *oargv[])
 	void *p = ipset_session_printf_private(session);
 	int argc = oargc;
 	char *argv[MAX_ARGS] = {};
+	bool envopts;
 
 	/* We need a local copy because of ipset_shift_argv */
 	memcpy(argv, oargv, sizeof(char *) * argc);
@@ -957,8 +1149,11 @@ ipset_parse_argv(struct ipset *ipset, int oargc, char *oargv[])
 
 	/* Commandline parsing, somewhat similar to that of 'ip' */
 
-	/* First: parse core options */
-	for (opt = ipset_envopts; opt->flag; opt++) {
+	/* First: parse core options, which all start with a dash */
+	for (i = 1; i < argc && argv[i][0] != '-'; i++)
+		;
+	envopts = i < argc;
+	for (opt = ipset_envopts; envopts && opt->flag; opt++) {
 		for (i = 1; i < argc; ) {
 			if (!ipset_match_envopt(argv[i], opt->name)) {
 				i++;
@@ -1210,6 +1405,7 @@ ipset_parse_argv(struct ipset *ipset, int oargc, char *oargv[])
 		/* Fall through to parse optional setname */
 	case IPSET_CMD_DESTROY:
 	case IPSET_CMD_FLUSH:
+	case IPSET_CMD_STATS:
 		/* Args: [setname] */
 		if (arg0) {
 			ret = ipset_parse_setname(session,
@@ -1307,19 +1503,371 @@ ipset_parse_line(struct ipset *ipset, char *line)
 		return 0;
 	}
 	/* Build fake argv, argc */
-	ret = build_argv(ipset, c);
+	ret = build_argv(ipset, c, strlen(c));
 	if (ret < 0)
 		return ret;
 	/* Parse and execute line */
 	return ipset_parse_argv(ipset, ipset->newargc, ipset->newargv);
 }
 
+/* Lines read ahead at restore, to resolve the hostnames in them at once */
+#define RESTORE_BATCH_LINES		1024
+/* Deadline of resolving the hostnames of a batch, in milliseconds */
+#define RESTORE_RESOLVE_TIMEOUT		10000
+
+/* The IPv6 sets created in the restore file, the others are taken
+ * as IPv4 ones when resolving ahead */
+struct restore_sets {
+	char (*name)[IPSET_MAXNAMELEN];
+	unsigned int n, size;
+};
+
+static const char *
+restore_word(const char *c, const char *end, char *buf, size_t len)
+{
+	size_t i = 0;
+
+	while (c < end && isspace(c[0]))
+		c++;
+	for (; c < end && c[0] != '\0' && !isspace(c[0]); c++)
+		if (i < len - 1)
+			buf[i++] = c[0];
+	buf[i] = '\0';
+	return c;
+}
+
+/* Hostnames like name.domain: addresses have no letters, IPv6 addresses,
+ * protocol:port values and MAC addresses have colons */
+static bool
+restore_hostname(const char *str)
+{
+	bool dot = false, alpha = false;
+
+	for (; str[0] != '\0'; str++) {
+		if (str[0] == '.')
+			dot = true;
+		else if (isalpha(str[0]))
+			alpha = true;
+		else if (!isdigit(str[0]) && str[0] != '-' && str[0] != '_')
+			return false;
+	}
+	return dot && alpha;
+}
+
+/* Queue the hostnames of an element part like parse_ipaddr() splits it:
+ * host, host/cidr or host-host, where hostnames with dashes are escaped.
+ * Returns true when a hostname is queued. */
+static bool
+restore_queue_part(struct ipset_resolve *resolve, char *part, uint8_t family)
+{
+	char *end, *next;
+	bool queued = false;
+	int i;
+
+	if ((end = strchr(part, IPSET_CIDR_SEPARATOR[0])) != NULL)
+		*end = '\0';
+	for (i = 0; i < 2 && part[0] != '\0'; i++) {
+		if (part[0] == IPSET_ESCAPE_START[0]) {
+			end = strchr(++part, IPSET_ESCAPE_END[0]);
+			if (end == NULL)
+				return queued;
+		} else
+			end = part + strcspn(part, IPSET_RANGE_SEPARATOR);
+		next = end[0] == '\0' ? end : end + 1;
+		*end = '\0';
+		if (restore_hostname(part) &&
+		    ipset_resolve_add(resolve, part, family) > 0)
+			queued = true;
+		if (next[0] == IPSET_RANGE_SEPARATOR[0])
+			next++;
+		part = next;
+	}
+	return queued;
+}
+
+/* Queue the hostnames in the element of an add, del or test line.
+ * Returns true when a hostname is queued. */
+static bool
+restore_scan(struct ipset_resolve *resolve, struct restore_sets *sets,
+	     const char *line, const char *end)
+{
+	const struct ipset_commands *command;
+	char word[MAX_CMDLINE_CHARS], setname[IPSET_MAXNAMELEN];
+	uint8_t family = NFPROTO_IPV4;
+	char *part, *next;
+	bool queued = false;
+	unsigned int i;
+
+	line = restore_word(line, end, word, sizeof(word));
+	if (word[0] == '\0' || word[0] == '#')
+		return false;
+	for (command = ipset_commands; command->cmd; command++)
+		if (ipset_match_cmd(word, command->name))
+			break;
+	line = restore_word(line, end, setname, sizeof(setname));
+
+	switch (command->cmd) {
+	case IPSET_CMD_CREATE:
+		while (line < end && line[0] != '\0') {
+			line = restore_word(line, end, word, sizeof(word));
+			if (!STREQ(word, "family") && !STREQ(word, "-family") &&
+			    !STREQ(word, "--family"))
+				continue;
+			line = restore_word(line, end, word, sizeof(word));
+			if (!STREQ(word, "inet6") && !STREQ(word, "ipv6"))
+				return false;
+			if (sets->n == sets->size) {
+				char (*name)[IPSET_MAXNAMELEN];
+
+				i = sets->size ? 2 * sets->size : 16;
+				name = realloc(sets->name, i * sizeof(*name));
+				if (name == NULL)
+					return false;
+				sets->name = name;
+				sets->size = i;
+			}
+			ipset_strlcpy(sets->name[sets->n++], setname,
+				      IPSET_MAXNAMELEN);
+			return false;
+		}
+		return false;
+	case IPSET_CMD_ADD:
+	case IPSET_CMD_DEL:
+	case IPSET_CMD_TEST:
+		break;
+	default:
+		return false;
+	}
+	for (i = 0; i < sets->n; i++)
+		if (STREQ(sets->name[i], setname))
+			family = NFPROTO_IPV6;
+
+	restore_word(line, end, word, sizeof(word));
+	for (part = word; part != NULL; part = next) {
+		next = strchr(part, IPSET_ELEM_SEPARATOR[0]);
+		if (next != NULL)
+			*next++ = '\0';
+		if (restore_queue_part(resolve, part, family))
+			queued = true;
+	}
+	return queued;
+}
+
+static bool
+restore_commit(const char *c, const char *end)
+{
+	while (c < end && isspace(c[0]))
+		c++;
+	return (end - c == 7 && memcmp(c, "COMMIT\n", 7) == 0) ||
+	       (end - c == 8 && memcmp(c, "COMMIT\r\n", 8) == 0);
+}
+
+/* Execute a line of the restore file */
+static int
+restore_exec(struct ipset *ipset, const char *line, size_t len)
+{
+	void *p = ipset_session_printf_private(ipset->session);
+	const char *c = line, *end = line + len;
+	int ret;
+
+	ipset->restore_line++;
+	while (c < end && isspace(c[0]))
+		c++;
+	if (c == end || c[0] == '\0' || c[0] == '#')
+		return 0;
+	else if (restore_commit(c, end)) {
+		ret = ipset_commit(ipset->session);
+		if (ret < 0)
+			ipset->standard_error(ipset, p);
+		return 0;
+	}
+	/* Build faked argv, argc */
+	ret = build_argv(ipset, c, end - c);
+	if (ret < 0)
+		return ret;
+
+	/* Execute line */
+	ret = ipset_parse_argv(ipset, ipset->newargc, ipset->newargv);
+	if (ret < 0)
+		ipset->standard_error(ipset, p);
+	return 0;
+}
+
+/* The restore input: regular files are mapped into memory, other
+ * streams are read from the descriptor as the data comes, into a large
+ * buffer. The lines are passed on as slices of the input, split like
+ * fgets() into a MAX_CMDLINE_CHARS buffer did, so the line numbers are
+ * the same. */
+#define RESTORE_READ_SIZE		(1024 * 1024)
+
+struct restore_input {
+	int fd;
+	char *data;			/* Mapped file or read buffer */
+	size_t pos;			/* Start of the next line */
+	size_t len;			/* End of the data */
+	size_t size;			/* Size of the read buffer */
+	size_t maplen;			/* Size of the mapping */
+	bool eof;
+};
+
+/* A line of a batch, as offsets: the read buffer may move */
+struct restore_line {
+	size_t off, len;
+};
+
+/* Start reading the input, -1 on errors */
+static int
+restore_input_open(struct restore_input *in, FILE *f)
+{
+	struct stat st;
+	off_t offset;
+	void *map;
+	int c;
+
+	memset(in, 0, sizeof(*in));
+	in->fd = fileno(f);
+
+	offset = ftello(f);
+	if (offset >= 0 &&
+	    fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) &&
+	    st.st_size > offset) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+			   fileno(f), 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			in->data = map;
+			in->maplen = st.st_size;
+			in->pos = offset;
+			in->len = st.st_size;
+			in->eof = true;
+			return 0;
+		}
+	}
+	/* The character pushed back after checking for a snapshot */
+	if (!feof(f) && !ferror(f) && (c = getc(f)) != EOF) {
+		in->data = malloc(RESTORE_READ_SIZE);
+		if (in->data == NULL)
+			return -1;
+		in->size = RESTORE_READ_SIZE;
+		in->data[in->len++] = c;
+	}
+	return 0;
+}
+
+static void
+restore_input_close(struct restore_input *in)
+{
+	if (in->maplen)
+		munmap(in->data, in->maplen);
+	else
+		free(in->data);
+}
+
+/* Drop the lines already executed from the read buffer, when they
+ * take more room than the data after them */
+static void
+restore_input_compact(struct restore_input *in)
+{
+	if (in->maplen || in->pos == 0 || in->pos < in->len - in->pos)
+		return;
+	memmove(in->data, in->data + in->pos, in->len - in->pos);
+	in->len -= in->pos;
+	in->pos = 0;
+}
+
+/* Read the data available on the descriptor, -1 on errors */
+static int
+restore_input_fill(struct restore_input *in)
+{
+	ssize_t n;
+	char *tmp;
+
+	if (in->size - in->len < RESTORE_READ_SIZE) {
+		tmp = realloc(in->data, in->size + RESTORE_READ_SIZE);
+		if (tmp == NULL)
+			return -1;
+		in->data = tmp;
+		in->size += RESTORE_READ_SIZE;
+	}
+	do {
+		n = read(in->fd, in->data + in->len, in->size - in->len);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return -1;
+	in->len += n;
+	if (n == 0)
+		in->eof = true;
+	return 0;
+}
+
+/* The length of the next line in the buffer, 0 when it is incomplete */
+static size_t
+restore_input_next(const struct restore_input *in)
+{
+	size_t n = in->len - in->pos;
+	const char *nl;
+
+	if (n > MAX_CMDLINE_CHARS - 1)
+		n = MAX_CMDLINE_CHARS - 1;
+	nl = memchr(in->data + in->pos, '\n', n);
+	if (nl != NULL)
+		return nl - (in->data + in->pos) + 1;
+	return n == MAX_CMDLINE_CHARS - 1 || in->eof ? n : 0;
+}
+
+/* Whether the next line can be taken without reading the input */
+static bool
+restore_input_ready(const struct restore_input *in)
+{
+	return in->eof || restore_input_next(in) > 0;
+}
+
+/* Find the next line, 0 at the end of the input and -1 on errors */
+static int
+restore_input_line(struct restore_input *in, struct restore_line *line)
+{
+	size_t n;
+
+	while ((n = restore_input_next(in)) == 0) {
+		if (in->eof)
+			return 0;
+		if (restore_input_fill(in) < 0)
+			return -1;
+	}
+	line->off = in->pos;
+	line->len = n;
+	in->pos += n;
+	return 1;
+}
+
+/* Resolve the hostnames queued for a batch of lines, then execute the
+ * lines in order */
+static int
+restore_batch(struct ipset *ipset, const struct restore_input *in,
+	      const struct restore_line *lines, unsigned int nlines)
+{
+	struct ipset_resolve *resolve = ipset_session_resolve(ipset->session);
+	unsigned int i;
+	int ret;
+
+	ipset_resolve_run(resolve, RESTORE_RESOLVE_TIMEOUT);
+	for (i = 0; i < nlines; i++) {
+		ret = restore_exec(ipset, in->data + lines[i].off,
+				   lines[i].len);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
 /**
  * ipset_parse_stream - parse an stream and execute the commands
  * @ipset: ipset structure
  * @f: stream
  *
  * Parse an already opened file as stream and execute the commands.
+ * A binary snapshot is detected and restored as a whole. The stream
+ * must not have been read from yet.
  *
  * Returns 0 on success or a negative error code.
  */
@@ -1328,37 +1876,88 @@ ipset_parse_stream(struct ipset *ipset, FILE *f)
 {
 	struct ipset_session *session = ipset_session(ipset);
 	void *p = ipset_session_printf_private(session);
+	struct ipset_resolve *resolve = ipset_session_resolve(session);
+	struct restore_sets sets = {};
+	struct restore_line *lines;
+	struct restore_input in;
+	unsigned int nlines = 0;
+	const char *line, *end;
 	int ret = 0;
-	char *c;
-
-	while (fgets(ipset->cmdline, sizeof(ipset->cmdline), f)) {
-		ipset->restore_line++;
-		c = ipset->cmdline;
-		while (isspace(c[0]))
-			c++;
-		if (c[0] == '\0' || c[0] == '#')
-			continue;
-		else if (STREQ(c, "COMMIT\n") || STREQ(c, "COMMIT\r\n")) {
-			ret = ipset_commit(ipset->session);
+
+	/* The commands are read from the descriptor as the data comes,
+	 * stdio must not buffer ahead of them */
+	setvbuf(f, NULL, _IONBF, 0);
+
+	/* Binary snapshot instead of commands */
+	ret = getc(f);
+	if (ret != EOF && ungetc(ret, f) == (unsigned char) IPSET_SNAPSHOT_MAGIC[0]) {
+		ret = ipset_snapshot_restore(session, f);
+		if (ret < 0)
+			ipset->standard_error(ipset, p);
+		return ret;
+	}
+	ret = 0;
+
+	lines = calloc(RESTORE_BATCH_LINES, sizeof(*lines));
+	if (lines == NULL)
+		return ipset->custom_error(ipset, p, IPSET_OTHER_PROBLEM,
+					   "Cannot allocate memory.");
+	if (restore_input_open(&in, f) < 0) {
+		free(lines);
+		return ipset->custom_error(ipset, p, IPSET_OTHER_PROBLEM,
+					   "Cannot allocate memory.");
+	}
+
+	/* A line with hostnames to resolve starts a batch: the lines are
+	 * read ahead and the hostnames in them are resolved at once. The
+	 * batch is executed when it is full, at COMMIT and before waiting
+	 * for more input. The other lines are executed as they come. */
+	for (;;) {
+		if (nlines > 0 && !restore_input_ready(&in)) {
+			ret = restore_batch(ipset, &in, lines, nlines);
 			if (ret < 0)
-				ipset->standard_error(ipset, p);
-			continue;
+				goto out;
+			nlines = 0;
 		}
-		/* Build faked argv, argc */
-		ret = build_argv(ipset, c);
+		if (nlines == 0)
+			restore_input_compact(&in);
+		ret = restore_input_line(&in, &lines[nlines]);
+		if (ret < 0) {
+			ret = ipset->custom_error(ipset,
+				p, IPSET_OTHER_PROBLEM,
+				"Cannot read the restore input: %s.",
+				strerror(errno));
+			goto out;
+		} else if (ret == 0)
+			break;
+		line = in.data + lines[nlines].off;
+		end = line + lines[nlines].len;
+		if ((resolve && restore_scan(resolve, &sets, line, end)) ||
+		    nlines > 0) {
+			if (++nlines < RESTORE_BATCH_LINES &&
+			    !restore_commit(line, end))
+				continue;
+			ret = restore_batch(ipset, &in, lines, nlines);
+			nlines = 0;
+		} else
+			ret = restore_exec(ipset, line, end - line);
 		if (ret < 0)
-			return ret;
-
-		/* Execute line */
-		ret = ipset_parse_argv(ipset, ipset->newargc, ipset->newargv);
+			goto out;
+	}
+	if (nlines > 0) {
+		ret = restore_batch(ipset, &in, lines, nlines);
 		if (ret < 0)
-			ipset->standard_error(ipset, p);
+			goto out;
 	}
 	/* implicit "COMMIT" at EOF */
 	ret = ipset_commit(ipset->session);
 	if (ret < 0)
 		ipset->standard_error(ipset, p);
 
+out:
+	restore_input_close(&in);
+	free(lines);
+	free(sets.name);
 	return ret;
 }
 
@@ -1451,6 +2050,35 @@ ipset_init(void)
 	return ipset;
 }
 
+/* One machine readable line of the phase times in seconds */
+static void
+print_phases(struct ipset_session *session)
+{
+	static const char * const name[IPSET_PHASE_MAX] = {
+		[IPSET_PHASE_PARSE]	= "parse",
+		[IPSET_PHASE_ENCODE]	= "encode",
+		[IPSET_PHASE_KERNEL]	= "kernel",
+		[IPSET_PHASE_FORMAT]	= "format",
+	};
+	unsigned int phase;
+	uint64_t ns;
+
+	fprintf(stderr, "phases:");
+	for (phase = 0; phase < IPSET_PHASE_MAX; phase++) {
+		ns = ipset_session_phase_time(session, phase);
+		fprintf(stderr, " %s=%llu.%06llu", name[phase],
+			(unsigned long long)(ns / 1000000000),
+			(unsigned long long)(ns % 1000000000 / 1000));
+	}
+	/* Registering the set types, part of the parse phase */
+	ns = ipset_types_load_time();
+	fprintf(stderr, " types=%llu.%06llu",
+		(unsigned long long)(ns / 1000000000),
+		(unsigned long long)(ns % 1000000000 / 1000));
+	/* Service and protocol names not found in the caches */
+	fprintf(stderr, " lookups=%u\n", ipset_parse_name_lookups());
+}
+
 /**
  * ipset_fini - destroy an ipset library interface
  * @ipset: ipset structure
@@ -1464,11 +2092,21 @@ ipset_fini(struct ipset *ipset)
 {
 	assert(ipset);
 
-	if (ipset->session)
+	if (ipset->session) {
+		if (ipset_envopt_test(ipset->session, IPSET_ENV_PHASES))
+			print_phases(ipset->session);
 		ipset_session_fini(ipset->session);
+	}
 	reset_argv(ipset);
 	if (ipset->newargv[0])
 		free(ipset->newargv[0]);
+	free(ipset->argbuf);
+	while (ipset->argtables) {
+		struct ipset_argtable *t = ipset->argtables;
+
+		ipset->argtables = t->next;
+		free(t);
+	}
 
 	free(ipset);
 	return 0;
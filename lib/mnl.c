@@ -9,6 +9,7 @@
 #include <stdlib.h>				/* calloc, free */
 #include <time.h>				/* time */
 #include <arpa/inet.h>				/* hto* */
+#include <sys/socket.h>				/* recv */
 
 #include <libipset/linux_ip_set.h>		/* enum ipset_cmd */
 #include <libipset/debug.h>			/* D() */
@@ -60,7 +61,7 @@ ipset_get_nlmsg_type(const struct nlmsghdr *nlh)
 	return nlh->nlmsg_type & ~(NFNL_SUBSYS_IPSET << 8);
 }
 
-static void
+void
 ipset_mnl_fill_hdr(struct ipset_handle *handle, enum ipset_cmd cmd,
 		   void *buffer, size_t len UNUSED, uint8_t envflags)
 {
@@ -118,6 +119,49 @@ ipset_mnl_query(struct ipset_handle *handle, void *buffer, size_t len)
 	return ret;
 }
 
+static int
+ipset_mnl_fd(struct ipset_handle *handle)
+{
+	assert(handle);
+
+	return mnl_socket_get_fd(handle->h);
+}
+
+static int
+ipset_mnl_send(struct ipset_handle *handle, void *buffer, size_t len UNUSED)
+{
+	struct nlmsghdr *nlh = buffer;
+
+	assert(handle);
+	assert(buffer);
+
+	nlh->nlmsg_seq = ++handle->seq;
+#ifdef IPSET_DEBUG
+	ipset_debug_msg("sent", nlh, nlh->nlmsg_len);
+#endif
+	if (mnl_socket_sendto(handle->h, nlh, nlh->nlmsg_len) < 0)
+		return -ECOMM;
+	return 0;
+}
+
+/* Receive without blocking: returns 0 when there is nothing to read */
+static int
+ipset_mnl_recv(struct ipset_handle *handle, void *buffer, size_t len)
+{
+	ssize_t ret;
+
+	assert(handle);
+	assert(buffer);
+
+	ret = recv(mnl_socket_get_fd(handle->h), buffer, len, MSG_DONTWAIT);
+	if (ret < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -errno;
+#ifdef IPSET_DEBUG
+	ipset_debug_msg("received", buffer, ret);
+#endif
+	return ret;
+}
+
 static struct ipset_handle *
 ipset_mnl_init(mnl_cb_t *cb_ctl, void *data)
 {
@@ -169,4 +213,7 @@ const struct ipset_transport ipset_mnl_transport = {
 	.fini	= ipset_mnl_fini,
 	.fill_hdr = ipset_mnl_fill_hdr,
 	.query	= ipset_mnl_query,
+	.fd	= ipset_mnl_fd,
+	.send	= ipset_mnl_send,
+	.recv	= ipset_mnl_recv,
 };
@@ -5,9 +5,11 @@
  * published by the Free Software Foundation.
  */
 #include <assert.h>				/* assert */
+#include <ctype.h>				/* isdigit */
 #include <errno.h>				/* errno */
 #include <limits.h>				/* ULLONG_MAX */
 #include <netdb.h>				/* getservbyname, getaddrinfo */
+#include <stdbool.h>				/* bool */
 #include <stdlib.h>				/* strtoull, etc. */
 #include <sys/types.h>				/* getaddrinfo */
 #include <sys/socket.h>				/* getaddrinfo, AF_ */
@@ -20,6 +22,7 @@
 #include <libipset/icmp.h>			/* name_to_icmp */
 #include <libipset/icmpv6.h>			/* name_to_icmpv6 */
 #include <libipset/pfxlen.h>			/* prefixlen_netmask_map */
+#include <libipset/resolve.h>			/* ipset_resolve_get */
 #include <libipset/session.h>			/* ipset_err */
 #include <libipset/types.h>			/* ipset_type_get */
 #include <libipset/utils.h>			/* string utilities */
@@ -266,6 +269,98 @@ strip_escape(struct ipset_session *session, char *str)
 	return str;
 }
 
+/* Parse a number without reporting errors, names are tried next */
+static bool
+parse_number(const char *str, unsigned long max, unsigned long *num)
+{
+	char *end;
+
+	if (!isdigit((unsigned char) str[0]))
+		return false;
+	errno = 0;
+	*num = strtoul(str, &end, 0);
+	return *end == '\0' && errno == 0 && *num <= max;
+}
+
+/*
+ * Service and protocol names resolved so far: getservbyname() and
+ * getprotobyname() open and scan /etc/services and /etc/protocols
+ * at every call, which dominated restoring port elements.
+ */
+#define NAME_CACHE_SIZE		64
+
+struct name_cache {
+	char name[32];			/* Service or protocol name */
+	char proto[12];			/* Protocol of the service or "" */
+	uint16_t num;			/* Port or protocol number */
+};
+
+static struct name_cache name_cache[NAME_CACHE_SIZE];
+static unsigned int name_cache_next;
+static unsigned int name_lookups;	/* Lookups in the system databases */
+
+static bool
+name_cache_get(const char *name, const char *proto, uint16_t *num)
+{
+	const struct name_cache *c;
+
+	for (c = name_cache;
+	     c < name_cache + NAME_CACHE_SIZE && c->name[0]; c++) {
+		if (STREQ(c->name, name) && STREQ(c->proto, proto)) {
+			*num = c->num;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void
+name_cache_put(const char *name, const char *proto, uint16_t num)
+{
+	struct name_cache *c = &name_cache[name_cache_next];
+
+	if (strlen(name) >= sizeof(c->name) ||
+	    strlen(proto) >= sizeof(c->proto))
+		return;
+	ipset_strlcpy(c->name, name, sizeof(c->name));
+	ipset_strlcpy(c->proto, proto, sizeof(c->proto));
+	c->num = num;
+	name_cache_next = (name_cache_next + 1) % NAME_CACHE_SIZE;
+}
+
+/* Protocol numbers looked up so far: 0 not yet, 1 known, 2 unknown */
+static uint8_t proto_numbers[256];
+
+static bool
+proto_number_known(uint8_t num)
+{
+	if (!proto_numbers[num]) {
+		name_lookups++;
+		proto_numbers[num] = getprotobynumber(num) != NULL ? 1 : 2;
+	}
+	return proto_numbers[num] == 1;
+}
+
+static struct protoent *
+proto_lookup(const char *name)
+{
+	name_lookups++;
+	return getprotobyname(name);
+}
+
+/**
+ * ipset_parse_name_lookups - number of name lookups
+ *
+ * Returns the number of the service and protocol names and protocol
+ * numbers looked up in the system databases by the parser so far,
+ * the ones found in the caches are not counted.
+ */
+unsigned int
+ipset_parse_name_lookups(void)
+{
+	return name_lookups;
+}
+
 /*
  * Parse TCP service names or port numbers
  */
@@ -283,9 +378,15 @@ parse_portname(struct ipset_session *session, const char *str,
 	if (tmp == NULL)
 		goto error;
 
+	if (name_cache_get(tmp, proto, port)) {
+		free(saved);
+		return 0;
+	}
+	name_lookups++;
 	service = getservbyname(tmp, proto);
 	if (service != NULL) {
 		*port = ntohs((uint16_t) service->s_port);
+		name_cache_put(tmp, proto, *port);
 		free(saved);
 		return 0;
 	}
@@ -313,12 +414,17 @@ ipset_parse_port(struct ipset_session *session,
 		 enum ipset_opt opt, const char *str,
 		 const char *proto)
 {
+	unsigned long num;
 	uint16_t port;
 
 	assert(session);
 	assert(opt == IPSET_OPT_PORT || opt == IPSET_OPT_PORT_TO);
 	assert(str);
 
+	if (parse_number(str, 65535, &num)) {
+		port = num;
+		return ipset_session_data_set(session, opt, &port);
+	}
 	if (parse_portname(session, str, &port, proto) == 0) {
 		return ipset_session_data_set(session, opt, &port);
 	}
@@ -468,23 +574,32 @@ ipset_parse_proto(struct ipset_session *session,
 		  enum ipset_opt opt, const char *str)
 {
 	const struct protoent *protoent;
+	const char *name;
+	unsigned long num;
+	uint16_t protonum;
 	uint8_t proto = 0;
 
 	assert(session);
 	assert(opt == IPSET_OPT_PROTO);
 	assert(str);
 
-	protoent = getprotobyname(strcasecmp(str, "icmpv6") == 0
-				  ? "ipv6-icmp" : str);
-	if (protoent == NULL) {
-		uint8_t protonum = 0;
-
-		if (string_to_u8(session, str, &protonum) ||
-		    (protoent = getprotobynumber(protonum)) == NULL)
+	name = strcasecmp(str, "icmpv6") == 0 ? "ipv6-icmp" : str;
+	if (parse_number(str, 255, &num)) {
+		if (!proto_number_known(num))
+			return syntax_err("cannot parse '%s' "
+					  "as a protocol", str);
+		proto = num;
+	} else if (name_cache_get(name, "", &protonum)) {
+		proto = protonum;
+	} else if ((protoent = proto_lookup(name)) != NULL) {
+		proto = protoent->p_proto;
+		name_cache_put(name, "", proto);
+	} else {
+		if (string_to_u8(session, str, &proto) ||
+		    !proto_number_known(proto))
 			return syntax_err("cannot parse '%s' "
 					  "as a protocol", str);
 	}
-	proto = protoent->p_proto;
 	if (!proto)
 		return syntax_err("Unsupported protocol '%s'", str);
 
@@ -763,6 +878,40 @@ print_warn(struct ipset_session *session)
 	ipset_session_report_reset(session);
 }
 
+/* Use the hostname resolved ahead at restore, 1 if it is not there */
+static int
+get_resolved(struct ipset_session *session,
+	     enum ipset_opt opt,
+	     const char *str,
+	     uint8_t family)
+{
+	union nf_inet_addr ip;
+	int n;
+
+	n = ipset_resolve_get(ipset_session_resolve(session), str, family, &ip);
+	if (n == -EAGAIN)
+		return 1;
+	if (n == -ENOENT) {
+		syntax_err("cannot parse %s: resolving to %s address failed",
+			   str, family == NFPROTO_IPV4 ? "IPv4" : "IPv6");
+		return EINVAL;
+	}
+	if (n == 0)
+		return syntax_err("cannot parse %s: "
+				  "%s address could not be resolved",
+				  str,
+				  family == NFPROTO_IPV4 ? "IPv4" : "IPv6");
+	if (n > 1) {
+		ipset_warn(session,
+			   "%s resolves to multiple addresses: "
+			   "using only the first one returned "
+			   "by the resolver.",
+			   str);
+		print_warn(session);
+	}
+	return ipset_session_data_set(session, opt, &ip);
+}
+
 #ifdef HAVE_GETHOSTBYNAME2
 static int
 get_hostbyname2(struct ipset_session *session,
@@ -770,8 +919,17 @@ get_hostbyname2(struct ipset_session *session,
 		const char *str,
 		int af)
 {
-	struct hostent *h = gethostbyname2(str, af);
+	struct hostent *h;
+	int err;
 
+	err = get_resolved(session, opt, str,
+			   af == AF_INET ? NFPROTO_IPV4 : NFPROTO_IPV6);
+	if (err == EINVAL)
+		return -1;
+	else if (err != 1)
+		return err;
+
+	h = gethostbyname2(str, af);
 	if (h == NULL) {
 		syntax_err("cannot parse %s: resolving to %s address failed",
 			   str, af == AF_INET ? "IPv4" : "IPv6");
@@ -885,7 +1043,13 @@ get_addrinfo(struct ipset_session *session,
 	struct addrinfo *i;
 	size_t addrlen = family == NFPROTO_IPV4 ? sizeof(struct sockaddr_in)
 					   : sizeof(struct sockaddr_in6);
-	int found, err = 0;
+	int found, err;
+
+	*info = NULL;
+	err = get_resolved(session, opt, str, family);
+	if (err != 1)
+		return err;
+	err = 0;
 
 	if ((*info = call_getaddrinfo(session, str, family)) == NULL) {
 		syntax_err("cannot parse %s: resolving to %s address failed",
@@ -982,7 +1146,8 @@ parse_ipaddr(struct ipset_session *session,
 	if ((aerr = get_addrinfo(session, opt, tmp, &info, family)) != 0 ||
 	    !range)
 		goto out;
-	freeaddrinfo(info);
+	if (info)
+		freeaddrinfo(info);
 	a = strip_escape(session, a);
 	if (a == NULL) {
 		err = -1;
@@ -991,9 +1156,11 @@ parse_ipaddr(struct ipset_session *session,
 	aerr = get_addrinfo(session, opt2, a, &info, family);
 
 out:
-	if (aerr != EINVAL)
+	if (aerr != EINVAL) {
 		/* getaddrinfo not failed */
-		freeaddrinfo(info);
+		if (info)
+			freeaddrinfo(info);
+	}
 	else if (aerr)
 		err = -1;
 	free(saved);
@@ -1700,6 +1867,49 @@ ipset_parse_netmask(struct ipset_session *session,
 	return ipset_data_set(data, opt, &cidr);
 }
 
+/**
+ * ipset_parse_quantize - parse string as a number of prefix lengths
+ * @session: session structure
+ * @opt: option kind of the data
+ * @str: string to parse
+ *
+ * Parse string as the max number of the prefix lengths a hash:net
+ * set may store, depending on family type. If family is not set yet,
+ * INET is assumed. The value is stored in the data blob of the session.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int
+ipset_parse_quantize(struct ipset_session *session,
+		     enum ipset_opt opt, const char *str)
+{
+	uint8_t family, value;
+	struct ipset_data *data;
+	int err = 0;
+
+	assert(session);
+	assert(opt == IPSET_OPT_QUANTIZE);
+	assert(str);
+
+	data = ipset_session_data(session);
+	family = ipset_data_family(data);
+	if (family == NFPROTO_UNSPEC) {
+		family = NFPROTO_IPV4;
+		ipset_data_set(data, IPSET_OPT_FAMILY, &family);
+	}
+
+	err = string_to_cidr(session, str, 1,
+			     family == NFPROTO_IPV4 ? 32 : 128,
+			     &value);
+
+	if (err)
+		return syntax_err("cidr-quantize is out of the inclusive range "
+				  "of 1-%u",
+				  family == NFPROTO_IPV4 ? 32 : 128);
+
+	return ipset_data_set(data, opt, &value);
+}
+
 /**
  * ipset_parse_flag - "parse" option flags
  * @session: session structure
@@ -645,6 +645,10 @@ ipset_print_skbprio(char *buf, unsigned int len,
 }
 
 
+/* Protocol names looked up so far, getprotobynumber() scans the
+ * /etc/protocols file at every call */
+static char proto_names[256][32];
+
 /**
  * ipset_print_proto - print protocol name
  * @buf: printing buffer
@@ -674,9 +678,16 @@ ipset_print_proto(char *buf, unsigned int len,
 	proto = *(const uint8_t *) ipset_data_get(data, IPSET_OPT_PROTO);
 	assert(proto);
 
+	if (proto_names[proto][0])
+		return snprintf(buf, len, "%s", proto_names[proto]);
+
 	protoent = getprotobynumber(proto);
-	if (protoent)
+	if (protoent) {
+		if (strlen(protoent->p_name) < sizeof(proto_names[proto]))
+			ipset_strlcpy(proto_names[proto], protoent->p_name,
+				      sizeof(proto_names[proto]));
 		return snprintf(buf, len, "%s", protoent->p_name);
+	}
 
 	/* Should not happen */
 	return snprintf(buf, len, "%u", proto);
@@ -951,6 +962,8 @@ ipset_print_data(char *buf, unsigned int len,
 	case IPSET_OPT_REFERENCES:
 	case IPSET_OPT_ELEMENTS:
 	case IPSET_OPT_SIZE:
+	case IPSET_OPT_MEMLIMIT:
+	case IPSET_OPT_QUANTIZE:
 		size = ipset_print_number(buf, len, data, opt, env);
 		break;
 	default:
@@ -0,0 +1,366 @@
+/* Copyright 2007-2010 Jozsef Kadlecsik (kadlec@netfilter.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define _GNU_SOURCE				/* getaddrinfo_a */
+#include <errno.h>				/* errno codes */
+#include <netdb.h>				/* getaddrinfo_a */
+#include <signal.h>				/* SIGEV_NONE */
+#include <stdbool.h>				/* bool */
+#include <stdlib.h>				/* malloc, free */
+#include <string.h>				/* strcmp */
+#include <sys/socket.h>				/* SOCK_RAW */
+#include <time.h>				/* clock_gettime, nanosleep */
+
+#include <libipset/nfproto.h>			/* NFPROTO_* */
+#include <libipset/utils.h>			/* UNUSED */
+#include <libipset/resolve.h>			/* prototypes */
+#include "../config.h"
+
+/* The hostnames found in a batch of restore lines are queued and
+ * resolved at once by getaddrinfo_a(), which runs the lookups in
+ * parallel threads, so the latency of the DNS queries is not paid
+ * line by line. The parser takes the first address from the cache.
+ * The names not resolved until the deadline or not resolved at all
+ * are looked up again when their line is parsed, so the errors are
+ * reported as before, with the line number of the element.
+ */
+
+#define RESOLVE_HASH_SIZE	4096		/* Power of two */
+#define RESOLVE_POLL		1000000L	/* Poll interval in ns */
+
+enum resolve_state {
+	RESOLVE_QUEUED,			/* Not submitted yet */
+	RESOLVE_PENDING,		/* Lookup in progress */
+	RESOLVE_DONE,			/* Address in the cache */
+	RESOLVE_NOADDR,			/* No address of the family */
+	RESOLVE_FAILED,			/* Name cannot be resolved */
+	RESOLVE_RETRY,			/* Left to the parser */
+};
+
+struct resolve_entry {
+	struct resolve_entry *next;	/* Hash chain */
+	union nf_inet_addr ip;		/* First address */
+	unsigned int naddr;		/* Number of the addresses */
+	uint8_t family;
+	uint8_t state;
+#ifdef HAVE_GETADDRINFO_A
+	struct gaicb req;		/* Request of getaddrinfo_a() */
+	struct addrinfo hints;
+#endif
+	char name[];
+};
+
+struct ipset_resolve {
+	struct resolve_entry **hash;	/* Allocated at the first name */
+	struct resolve_entry **queue;	/* Names to resolve at the next run */
+	unsigned int nqueue, qsize;
+};
+
+static unsigned int
+resolve_hash(const char *name, uint8_t family)
+{
+	unsigned int h = family;
+
+	while (*name)
+		h = h * 31 + (unsigned char) *name++;
+	return h & (RESOLVE_HASH_SIZE - 1);
+}
+
+static struct resolve_entry *
+resolve_find(const struct ipset_resolve *resolve, const char *name,
+	     uint8_t family)
+{
+	struct resolve_entry *e;
+
+	if (resolve == NULL || resolve->hash == NULL)
+		return NULL;
+	for (e = resolve->hash[resolve_hash(name, family)]; e; e = e->next)
+		if (e->family == family && strcmp(e->name, name) == 0)
+			return e;
+	return NULL;
+}
+
+#ifdef HAVE_GETADDRINFO_A
+/* Take the result of a finished lookup, false if it is still running */
+static bool
+resolve_result(struct resolve_entry *e)
+{
+	size_t addrlen = e->family == NFPROTO_IPV4
+			 ? sizeof(struct sockaddr_in)
+			 : sizeof(struct sockaddr_in6);
+	const struct addrinfo *i;
+	int ret = gai_error(&e->req);
+
+	switch (ret) {
+	case EAI_INPROGRESS:
+		return false;
+	case 0:
+		break;
+	case EAI_NONAME:
+	case EAI_NODATA:
+	case EAI_ADDRFAMILY:
+	case EAI_FAIL:
+		e->state = RESOLVE_FAILED;
+		return true;
+	default:
+		/* Cancelled, not submitted or temporary failure */
+		e->state = RESOLVE_RETRY;
+		return true;
+	}
+	for (i = e->req.ar_result; i != NULL; i = i->ai_next) {
+		if (i->ai_family != e->family ||
+		    i->ai_addrlen != addrlen)
+			continue;
+		if (e->naddr++ > 0)
+			continue;
+		/* Workaround: direct cast increases
+		 * required alignment on Sparc
+		 */
+		if (e->family == NFPROTO_IPV4) {
+			const struct sockaddr_in *saddr =
+				(void *)i->ai_addr;
+			e->ip.in = saddr->sin_addr;
+		} else {
+			const struct sockaddr_in6 *saddr =
+				(void *)i->ai_addr;
+			e->ip.in6 = saddr->sin6_addr;
+		}
+	}
+	freeaddrinfo(e->req.ar_result);
+	e->req.ar_result = NULL;
+	e->state = e->naddr > 0 ? RESOLVE_DONE : RESOLVE_NOADDR;
+	return true;
+}
+#endif
+
+/**
+ * ipset_resolve_init - create the cache of the resolved hostnames
+ *
+ * Returns the cache or NULL if there is no memory.
+ */
+struct ipset_resolve *
+ipset_resolve_init(void)
+{
+	return calloc(1, sizeof(struct ipset_resolve));
+}
+
+/**
+ * ipset_resolve_fini - release the cache of the resolved hostnames
+ * @resolve: the cache
+ *
+ * The lookups still running are cancelled.
+ */
+void
+ipset_resolve_fini(struct ipset_resolve *resolve)
+{
+	struct resolve_entry *e, *next;
+	unsigned int i;
+
+	if (resolve == NULL)
+		return;
+	for (i = 0; resolve->hash != NULL && i < RESOLVE_HASH_SIZE; i++) {
+		for (e = resolve->hash[i]; e != NULL; e = next) {
+			next = e->next;
+#ifdef HAVE_GETADDRINFO_A
+			/* A lookup which cannot be cancelled writes
+			 * into its request later, so it is not freed */
+			if (e->state == RESOLVE_PENDING) {
+				gai_cancel(&e->req);
+				if (!resolve_result(e))
+					continue;
+			}
+#endif
+			free(e);
+		}
+	}
+	free(resolve->hash);
+	free(resolve->queue);
+	free(resolve);
+}
+
+/**
+ * ipset_resolve_add - queue a hostname to resolve
+ * @resolve: the cache
+ * @name: hostname
+ * @family: NFPROTO_IPV4 or NFPROTO_IPV6
+ *
+ * The names in the cache already are not queued again.
+ *
+ * Returns 1 when the name is queued, 0 when it is in the cache already
+ * or -ENOMEM.
+ */
+int
+ipset_resolve_add(struct ipset_resolve *resolve, const char *name,
+		  uint8_t family)
+{
+	struct resolve_entry *e, **queue;
+	unsigned int h;
+
+	if (resolve->hash == NULL) {
+		resolve->hash = calloc(RESOLVE_HASH_SIZE,
+				       sizeof(*resolve->hash));
+		if (resolve->hash == NULL)
+			return -ENOMEM;
+	}
+	if (resolve_find(resolve, name, family) != NULL)
+		return 0;
+	if (resolve->nqueue == resolve->qsize) {
+		h = resolve->qsize ? 2 * resolve->qsize : 64;
+		queue = realloc(resolve->queue, h * sizeof(*queue));
+		if (queue == NULL)
+			return -ENOMEM;
+		resolve->queue = queue;
+		resolve->qsize = h;
+	}
+	e = calloc(1, sizeof(*e) + strlen(name) + 1);
+	if (e == NULL)
+		return -ENOMEM;
+	strcpy(e->name, name);
+	e->family = family;
+	e->state = RESOLVE_QUEUED;
+
+	h = resolve_hash(name, family);
+	e->next = resolve->hash[h];
+	resolve->hash[h] = e;
+	resolve->queue[resolve->nqueue++] = e;
+	return 1;
+}
+
+/**
+ * ipset_resolve_run - resolve the queued hostnames
+ * @resolve: the cache
+ * @timeout: deadline in milliseconds
+ *
+ * Resolve the queued hostnames in parallel and wait for the results
+ * until the deadline. The lookups not finished by then are cancelled.
+ * Without getaddrinfo_a() nothing is resolved ahead.
+ *
+ * Returns the number of the resolved hostnames.
+ */
+#ifdef HAVE_GETADDRINFO_A
+unsigned int
+ipset_resolve_run(struct ipset_resolve *resolve, unsigned int timeout)
+{
+	unsigned int i, n = resolve->nqueue, pending = n, resolved = 0;
+	struct timespec now, end, ts;
+	struct resolve_entry *e;
+	struct gaicb **list;
+	struct sigevent sev;
+
+	if (n == 0)
+		return 0;
+	list = calloc(n, sizeof(*list));
+	if (list == NULL) {
+		for (i = 0; i < n; i++)
+			resolve->queue[i]->state = RESOLVE_RETRY;
+		resolve->nqueue = 0;
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		e = resolve->queue[i];
+		e->hints.ai_family = e->family;
+		e->hints.ai_socktype = SOCK_RAW;
+		e->req.ar_name = e->name;
+		e->req.ar_request = &e->hints;
+		e->state = RESOLVE_PENDING;
+		list[i] = &e->req;
+	}
+	/* The requests not submitted at errors fail at gai_error() */
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_NONE;
+	getaddrinfo_a(GAI_NOWAIT, list, n, &sev);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += timeout / 1000;
+	end.tv_nsec += (timeout % 1000) * 1000000L;
+	if (end.tv_nsec >= 1000000000L) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000L;
+	}
+	while (pending > 0) {
+		for (i = 0, pending = 0; i < n; i++) {
+			if (list[i] == NULL)
+				continue;
+			e = resolve->queue[i];
+			if (!resolve_result(e)) {
+				pending++;
+				continue;
+			}
+			if (e->state == RESOLVE_DONE)
+				resolved++;
+			list[i] = NULL;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (pending == 0 || now.tv_sec > end.tv_sec ||
+		    (now.tv_sec == end.tv_sec && now.tv_nsec >= end.tv_nsec))
+			break;
+		/* Not gai_suspend(): it may leave its waiting list on the
+		 * stack linked to a request finishing at the same time and
+		 * the lookup thread writes into the stack later */
+		ts.tv_sec = 0;
+		ts.tv_nsec = RESOLVE_POLL;
+		if (end.tv_sec == now.tv_sec &&
+		    end.tv_nsec - now.tv_nsec < RESOLVE_POLL)
+			ts.tv_nsec = end.tv_nsec - now.tv_nsec;
+		nanosleep(&ts, NULL);
+	}
+	/* Late results are still taken at ipset_resolve_get() */
+	for (i = 0; pending > 0 && i < n; i++)
+		if (list[i] != NULL)
+			gai_cancel(list[i]);
+
+	free(list);
+	resolve->nqueue = 0;
+	return resolved;
+}
+#else
+unsigned int
+ipset_resolve_run(struct ipset_resolve *resolve, unsigned int timeout UNUSED)
+{
+	unsigned int i;
+
+	for (i = 0; i < resolve->nqueue; i++)
+		resolve->queue[i]->state = RESOLVE_RETRY;
+	resolve->nqueue = 0;
+	return 0;
+}
+#endif
+
+/**
+ * ipset_resolve_get - get the first address of a resolved hostname
+ * @resolve: the cache, may be NULL
+ * @name: hostname
+ * @family: NFPROTO_IPV4 or NFPROTO_IPV6
+ * @ip: the first address returned by the resolver
+ *
+ * Returns the number of the addresses, 0 if the name has got no address
+ * of the family, -ENOENT if the name cannot be resolved and -EAGAIN if
+ * it is not resolved ahead.
+ */
+int
+ipset_resolve_get(struct ipset_resolve *resolve, const char *name,
+		  uint8_t family, union nf_inet_addr *ip)
+{
+	struct resolve_entry *e = resolve_find(resolve, name, family);
+
+	if (e == NULL)
+		return -EAGAIN;
+#ifdef HAVE_GETADDRINFO_A
+	if (e->state == RESOLVE_PENDING && !resolve_result(e))
+		return -EAGAIN;
+#endif
+	switch (e->state) {
+	case RESOLVE_DONE:
+		*ip = e->ip;
+		return e->naddr;
+	case RESOLVE_NOADDR:
+		return 0;
+	case RESOLVE_FAILED:
+		return -ENOENT;
+	default:
+		return -EAGAIN;
+	}
+}
@@ -7,13 +7,20 @@
 #include <assert.h>				/* assert */
 #include <endian.h>				/* htobe64 */
 #include <errno.h>				/* errno */
+#include <fcntl.h>				/* open */
+#include <limits.h>				/* INT_MAX */
+#include <poll.h>				/* poll */
 #include <setjmp.h>				/* setjmp, longjmp */
 #include <stdio.h>				/* snprintf */
 #include <stdarg.h>				/* va_* */
 #include <stdbool.h>				/* bool */
 #include <stdlib.h>				/* free */
 #include <string.h>				/* str* */
-#include <unistd.h>				/* getpagesize */
+#include <time.h>				/* clock_gettime */
+#include <unistd.h>				/* getpagesize, fork */
+#include <sys/mman.h>				/* mmap */
+#include <sys/stat.h>				/* fstat */
+#include <sys/wait.h>				/* waitpid */
 #include <net/ethernet.h>			/* ETH_ALEN */
 #include <net/if.h>				/* IFNAMSIZ */
 
@@ -24,10 +31,12 @@
 #include <libipset/print.h>			/* ipset_print_* */
 #include <libipset/types.h>			/* struct ipset_type */
 #include <libipset/transport.h>			/* transport */
-#include <libipset/mnl.h>			/* default backend */
+#include <libipset/mnl.h>			/* backends */
 #include <libipset/utils.h>			/* STREQ */
 #include <libipset/ipset.h>			/* IPSET_ENV_* */
 #include <libipset/list_sort.h>			/* list_sort */
+#include <libipset/aggregate.h>			/* ipset_aggr_* */
+#include <libipset/resolve.h>			/* ipset_resolve_* */
 #include <libipset/session.h>			/* prototypes */
 
 #define IPSET_NEST_MAX	4
@@ -39,6 +48,28 @@ struct ipset_sorted {
 };
 
 
+/* Pending add/del message of a set when grouping restore lines */
+struct ipset_group {
+	char setname[IPSET_MAXNAMELEN];		/* Set of the message */
+	const struct ipset_type *type;		/* Type of the set */
+	enum ipset_cmd cmd;			/* ADD or DEL */
+	uint32_t lineno;			/* First line in the message */
+	struct nlattr *nested;			/* Open ADT container */
+	void *buffer;				/* Message buffer */
+};
+
+/* A set created or flushed at restore, of which the added networks
+ * are aggregated when it is a hash:net set */
+struct ipset_aggr_set {
+	char setname[IPSET_MAXNAMELEN];		/* Name of the set */
+	const struct ipset_type *type;		/* Type of the set */
+	uint8_t family;				/* Family of the set */
+	uint8_t quantize;			/* Max prefix lengths, 0: any */
+	bool enabled;				/* All elements are known */
+	uint32_t lineno;			/* First pending line */
+	struct ipset_aggr *aggr;		/* Networks, NULL: none yet */
+};
+
 /* The session structure */
 struct ipset_session {
 	const struct ipset_transport *transport;/* Transport protocol */
@@ -71,7 +102,37 @@ struct ipset_session {
 	/* Error/warning reporting */
 	char report[IPSET_ERRORBUFLEN];		/* Error/report buffer */
 	enum ipset_err_type err_type;		/* ERROR/WARNING/NOTICE */
-	uint8_t envopts;			/* Session env opts */
+	uint16_t envopts;			/* Session env opts */
+	unsigned int jobs;			/* Parallel jobs at saving */
+	/* Restore lines grouped by set */
+	struct ipset_group *groups;		/* Pending messages */
+	unsigned int ngroups;			/* Number of pending messages */
+	/* Restored elements of hash:net sets aggregated */
+	struct ipset_aggr_set *aggrs;		/* Sets seen so far */
+	unsigned int naggrs;			/* Number of the sets */
+	struct ipset_data *aggr_data;		/* Data of the added networks */
+	bool aggr_busy;				/* Adding the networks */
+	/* Hostnames resolved ahead at restore */
+	struct ipset_resolve *resolve;
+	/* Kernel capabilities cached across invocations */
+	struct ipset_caps *caps;
+	/* Non-blocking mode */
+	struct ipset_async *async;		/* Commands waiting for ACK */
+	unsigned int nasync;			/* Number of waiting commands */
+	unsigned int async_size;		/* Size of async array */
+	struct ipset_data *async_data;		/* Data at error decoding */
+	void *async_buf;			/* Receive buffer */
+	bool async_busy;			/* In completion callback */
+	/* Phase timing */
+	enum ipset_phase phase;			/* Current phase */
+	uint64_t phase_start;			/* Start of the current phase */
+	uint64_t phase_ns[IPSET_PHASE_MAX];	/* Time spent in the phases */
+	/* Statistics of the listed set */
+	uint64_t stats[IPSET_ATTR_STATS_MAX + 1];
+	bool with_stats;			/* Set has statistics */
+	/* Prefix lengths of the listed set, in lookup order */
+	uint8_t cidrs[129];
+	unsigned int ncidrs;
 	/* Kernel message buffer */
 	size_t bufsize;
 	void *buffer;
@@ -152,6 +213,77 @@ ipset_session_printf_private(struct ipset_session *session)
  * Environment options
  */
 
+/*
+ * Phase timing
+ */
+
+static uint64_t
+phase_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Switch to a new phase and return the previous one */
+static enum ipset_phase
+phase_enter(struct ipset_session *session, enum ipset_phase phase)
+{
+	enum ipset_phase prev = session->phase;
+	uint64_t now;
+
+	if (!(session->envopts & IPSET_ENV_PHASES))
+		return prev;
+
+	now = phase_now();
+	session->phase_ns[prev] += now - session->phase_start;
+	session->phase_start = now;
+	session->phase = phase;
+	return prev;
+}
+
+/**
+ * ipset_session_phase_time - time spent in a phase
+ * @session: session structure
+ * @phase: phase of the commands
+ *
+ * Returns the time in nanoseconds spent in the given phase since the
+ * IPSET_ENV_PHASES environment option was set, including the
+ * current phase up to now.
+ */
+uint64_t
+ipset_session_phase_time(const struct ipset_session *session,
+			 enum ipset_phase phase)
+{
+	uint64_t ns;
+
+	assert(session);
+	assert(phase < IPSET_PHASE_MAX);
+
+	ns = session->phase_ns[phase];
+	if ((session->envopts & IPSET_ENV_PHASES) && session->phase == phase)
+		ns += phase_now() - session->phase_start;
+	return ns;
+}
+
+/**
+ * ipset_session_resolve - the hostnames resolved ahead at restore
+ * @session: session structure
+ *
+ * Returns the cache of the resolved hostnames of the session, created
+ * at the first call, or NULL if there is no memory.
+ */
+struct ipset_resolve *
+ipset_session_resolve(struct ipset_session *session)
+{
+	assert(session);
+
+	if (session->resolve == NULL)
+		session->resolve = ipset_resolve_init();
+	return session->resolve;
+}
+
 /**
  * ipset_envopt_test - test environment option
  * @session: session structure
@@ -179,6 +311,11 @@ void
 ipset_envopt_set(struct ipset_session *session, enum ipset_envopt opt)
 {
 	assert(session);
+	if ((opt & IPSET_ENV_PHASES) &&
+	    !(session->envopts & IPSET_ENV_PHASES)) {
+		session->phase = IPSET_PHASE_PARSE;
+		session->phase_start = phase_now();
+	}
 	session->envopts |= opt;
 }
 
@@ -214,6 +351,52 @@ ipset_session_output(struct ipset_session *session,
 	return 0;
 }
 
+/**
+ * ipset_session_transport - set the transport of the session
+ * @session: session structure
+ * @transport: transport methods
+ *
+ * Select the transport used to reach the kernel, for example
+ * ipset_fake_transport to emulate the kernel side for testing. It
+ * must be called before the first command of the session.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int
+ipset_session_transport(struct ipset_session *session,
+			const struct ipset_transport *transport)
+{
+	assert(session);
+	assert(transport);
+
+	if (session->handle != NULL)
+		return ipset_err(session, "Transport cannot be changed "
+				 "after the first command.");
+	session->transport = transport;
+	return 0;
+}
+
+/**
+ * ipset_session_jobs - set the number of parallel jobs
+ * @session: session structure
+ * @jobs: number of jobs
+ *
+ * Set the number of parallel jobs used when all sets are saved.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int
+ipset_session_jobs(struct ipset_session *session, unsigned int jobs)
+{
+	assert(session);
+	if (jobs < 1 || jobs > IPSET_JOBS_MAX)
+		return ipset_err(session,
+				 "Number of jobs must be between 1 and %u",
+				 IPSET_JOBS_MAX);
+	session->jobs = jobs;
+	return 0;
+}
+
 /*
  * Error and warning reporting
  */
@@ -383,6 +566,9 @@ static const struct ipset_attr_policy cmd_attrs[] = {
 		.type = MNL_TYPE_U16,
 		.opt = IPSET_OPT_INDEX,
 	},
+	[IPSET_ATTR_PACKED] = {
+		.type = MNL_TYPE_BINARY,
+	},
 };
 
 static const struct ipset_attr_policy create_attrs[] = {
@@ -462,6 +648,22 @@ static const struct ipset_attr_policy create_attrs[] = {
 		.type = MNL_TYPE_U32,
 		.opt = IPSET_OPT_MEMSIZE,
 	},
+	[IPSET_ATTR_MEMLIMIT] = {
+		.type = MNL_TYPE_U32,
+		.opt = IPSET_OPT_MEMLIMIT,
+	},
+	/* Parsed by list_create() into the session */
+	[IPSET_ATTR_STATS] = {
+		.type = MNL_TYPE_NESTED,
+	},
+	[IPSET_ATTR_QUANTIZE] = {
+		.type = MNL_TYPE_U8,
+		.opt = IPSET_OPT_QUANTIZE,
+	},
+	/* Parsed by list_create() into the session */
+	[IPSET_ATTR_CIDRS] = {
+		.type = MNL_TYPE_BINARY,
+	},
 };
 
 static const struct ipset_attr_policy adt_attrs[] = {
@@ -749,6 +951,7 @@ static const char cmd2name[][9] = {
 	[IPSET_CMD_HEADER]	= "HEADER",
 	[IPSET_CMD_TYPE]	= "TYPE",
 	[IPSET_CMD_PROTOCOL]	= "PROTOCOL",
+	[IPSET_CMD_ZERO]	= "ZERO",
 };
 
 static inline int
@@ -848,33 +1051,25 @@ safe_dprintf(struct ipset_session *session, ipset_printfn fn,
 	return ret;
 }
 
-static int
-list_adt(struct ipset_session *session, struct nlattr *nla[])
+static const struct ipset_type *
+list_type(struct ipset_session *session)
 {
 	const struct ipset_data *data = session->data;
-	const struct ipset_type *type;
-	const struct ipset_arg *arg;
-	size_t offset = 0;
-	int i, found = 0;
 
-	D("enter");
 	/* Check and load type, family */
 	if (!ipset_data_test(data, IPSET_OPT_TYPE))
-		type = ipset_type_get(session, IPSET_CMD_ADD);
-	else
-		type = ipset_data_get(data, IPSET_OPT_TYPE);
+		return ipset_type_get(session, IPSET_CMD_ADD);
 
-	if (type == NULL)
-		return MNL_CB_ERROR;
+	return ipset_data_get(data, IPSET_OPT_TYPE);
+}
 
-	for (i = IPSET_ATTR_UNSPEC + 1; i <= IPSET_ATTR_ADT_MAX; i++)
-		if (nla[i]) {
-			found++;
-			ATTR2DATA(session, nla, i, adt_attrs);
-	}
-	D("attr found %u", found);
-	if (!found)
-		return MNL_CB_OK;
+static int
+list_elem(struct ipset_session *session, const struct ipset_type *type)
+{
+	const struct ipset_data *data = session->data;
+	const struct ipset_arg *arg;
+	size_t offset = 0;
+	int i;
 
 	if (session->sort) {
 		if (session->outbuflen <= session->pos + 1)
@@ -956,10 +1151,196 @@ list_adt(struct ipset_session *session, struct nlattr *nla[])
 	return MNL_CB_OK;
 }
 
+static int
+list_adt(struct ipset_session *session, struct nlattr *nla[])
+{
+	const struct ipset_type *type;
+	int i, found = 0;
+
+	D("enter");
+	type = list_type(session);
+	if (type == NULL)
+		return MNL_CB_ERROR;
+
+	for (i = IPSET_ATTR_UNSPEC + 1; i <= IPSET_ATTR_ADT_MAX; i++)
+		if (nla[i]) {
+			found++;
+			ATTR2DATA(session, nla, i, adt_attrs);
+	}
+	D("attr found %u", found);
+	if (!found)
+		return MNL_CB_OK;
+
+	return list_elem(session, type);
+}
+
+/* Decode the fixed size element records of the compact dump */
+static int
+list_packed(struct ipset_session *session, const struct nlattr *attr,
+	    enum ipset_cmd cmd)
+{
+	struct ipset_data *data = session->data;
+	const struct ipset_type *type;
+	const char *rec = mnl_attr_get_payload(attr);
+	uint16_t len = mnl_attr_get_payload_len(attr);
+	uint8_t family = ipset_data_family(data);
+	size_t size = family == NFPROTO_IPV6
+		? sizeof(struct ip_set_packed6)
+		: sizeof(struct ip_set_packed4);
+	uint32_t flags;
+	uint8_t cidr;
+
+	D("enter");
+	type = list_type(session);
+	if (type == NULL)
+		return MNL_CB_ERROR;
+
+	if (len % size)
+		FAILURE("Broken %s kernel message: "
+			"invalid size of packed records!", cmd2name[cmd]);
+
+	for (; len >= size; len -= size, rec += size) {
+		/* Reset ADT specific flags */
+		ipset_data_flags_unset(data, IPSET_ADT_FLAGS);
+		if (family == NFPROTO_IPV6) {
+			const struct ip_set_packed6 *r =
+				(const struct ip_set_packed6 *)rec;
+
+			ipset_data_set(data, IPSET_OPT_IP, r->ip6);
+			cidr = r->cidr;
+			flags = r->flags;
+		} else {
+			const struct ip_set_packed4 *r =
+				(const struct ip_set_packed4 *)rec;
+
+			ipset_data_set(data, IPSET_OPT_IP, &r->ip);
+			cidr = r->cidr;
+			flags = r->flags;
+		}
+		if (cidr)
+			ipset_data_set(data, IPSET_OPT_CIDR, &cidr);
+		if (flags)
+			ipset_data_set(data, IPSET_OPT_CADT_FLAGS, &flags);
+		if (list_elem(session, type) != MNL_CB_OK)
+			return MNL_CB_ERROR;
+	}
+	return MNL_CB_OK;
+}
+
 #define FAMILY_TO_STR(f)		\
 	((f) == NFPROTO_IPV4 ? "inet" :	\
 	 (f) == NFPROTO_IPV6 ? "inet6" : "any")
 
+static const char * const stats2name[] = {
+	[IPSET_ATTR_STATS_TESTS]	= "tests",
+	[IPSET_ATTR_STATS_HITS]		= "hits",
+	[IPSET_ATTR_STATS_BUCKETS]	= "buckets",
+	[IPSET_ATTR_STATS_PROBES]	= "probes",
+	[IPSET_ATTR_STATS_KADDS]	= "kadds",
+	[IPSET_ATTR_STATS_KDELS]	= "kdels",
+	[IPSET_ATTR_STATS_UADDS]	= "uadds",
+	[IPSET_ATTR_STATS_UDELS]	= "udels",
+	[IPSET_ATTR_STATS_RESIZES]	= "resizes",
+	[IPSET_ATTR_STATS_EXPIRED]	= "expired",
+	[IPSET_ATTR_STATS_FULL]		= "full",
+};
+
+static int
+stats_attr_cb(const struct nlattr *attr, void *data)
+{
+	const struct nlattr **tb = data;
+	int type = mnl_attr_get_type(attr);
+
+	if (mnl_attr_type_valid(attr, IPSET_ATTR_STATS_MAX) < 0)
+		return MNL_CB_OK;
+	if (type != IPSET_ATTR_STATS_PAD &&
+	    mnl_attr_validate(attr, MNL_TYPE_U64) < 0)
+		return MNL_CB_ERROR;
+	tb[type] = attr;
+	return MNL_CB_OK;
+}
+
+/* Store the statistics of the set, missing ones are zero */
+static int
+list_stats(struct ipset_session *session, const struct nlattr *nla)
+{
+	struct nlattr *tb[IPSET_ATTR_STATS_MAX + 1] = {};
+	uint64_t v;
+	int i;
+
+	memset(session->stats, 0, sizeof(session->stats));
+	session->with_stats = nla != NULL;
+	if (nla == NULL)
+		return 0;
+	if (mnl_attr_parse_nested(nla, stats_attr_cb, tb) < 0)
+		return ipset_err(session,
+				 "Broken kernel message: "
+				 "cannot validate statistics.");
+	for (i = IPSET_ATTR_STATS_UNSPEC + 1; i < IPSET_ATTR_STATS_PAD; i++) {
+		if (!tb[i])
+			continue;
+		memcpy(&v, mnl_attr_get_payload(tb[i]), sizeof(v));
+		session->stats[i] = be64toh(v);
+	}
+	return 0;
+}
+
+static void
+print_stats(struct ipset_session *session)
+{
+	const uint64_t *st = session->stats;
+	unsigned long long tests = st[IPSET_ATTR_STATS_TESTS];
+	unsigned long long probes = st[IPSET_ATTR_STATS_PROBES];
+	int i;
+
+	if (session->mode == IPSET_LIST_XML) {
+		safe_snprintf(session, "<statistics>");
+		for (i = IPSET_ATTR_STATS_UNSPEC + 1;
+		     i < IPSET_ATTR_STATS_PAD; i++)
+			safe_snprintf(session, "<%s>%llu</%s>",
+				      stats2name[i],
+				      (unsigned long long) st[i],
+				      stats2name[i]);
+		safe_snprintf(session, "</statistics>\n");
+		return;
+	}
+	safe_snprintf(session, "\nStatistics:");
+	for (i = IPSET_ATTR_STATS_UNSPEC + 1; i < IPSET_ATTR_STATS_PAD; i++)
+		safe_snprintf(session, " %s %llu", stats2name[i],
+			      (unsigned long long) st[i]);
+	/* Average cost of a lookup in the hash types */
+	if (probes)
+		safe_snprintf(session, "\nProbes per test: %llu.%02llu",
+			      probes / tests, probes % tests * 100 / tests);
+}
+
+static void
+list_cidrs(struct ipset_session *session, const struct nlattr *nla)
+{
+	session->ncidrs = 0;
+	if (nla == NULL)
+		return;
+	session->ncidrs = MIN(mnl_attr_get_payload_len(nla),
+			      sizeof(session->cidrs));
+	memcpy(session->cidrs, mnl_attr_get_payload(nla), session->ncidrs);
+}
+
+static void
+print_cidrs(struct ipset_session *session)
+{
+	unsigned int i;
+
+	if (session->mode == IPSET_LIST_PLAIN)
+		safe_snprintf(session, "\nPrefix lengths:");
+	else
+		safe_snprintf(session, "<cidrs>");
+	for (i = 0; i < session->ncidrs; i++)
+		safe_snprintf(session, i || session->mode == IPSET_LIST_PLAIN ?
+			      " %u" : "%u", session->cidrs[i]);
+	if (session->mode == IPSET_LIST_XML)
+		safe_snprintf(session, "</cidrs>\n");
+}
+
 static int
 list_create(struct ipset_session *session, struct nlattr *nla[])
 {
@@ -970,10 +1351,14 @@ list_create(struct ipset_session *session, struct nlattr *nla[])
 	int i;
 
 	for (i = IPSET_ATTR_UNSPEC + 1; i <= IPSET_ATTR_CREATE_MAX; i++)
-		if (nla[i]) {
+		if (nla[i] && i != IPSET_ATTR_STATS &&
+		    i != IPSET_ATTR_CIDRS) {
 			D("add attr %u, opt %u", i, create_attrs[i].opt);
 			ATTR2DATA(session, nla, i, create_attrs);
 		}
+	if (list_stats(session, nla[IPSET_ATTR_STATS]) < 0)
+		return MNL_CB_ERROR;
+	list_cidrs(session, nla[IPSET_ATTR_CIDRS]);
 
 	type = ipset_type_check(session);
 	if (type == NULL)
@@ -1055,6 +1440,10 @@ list_create(struct ipset_session *session, struct nlattr *nla[])
 			safe_snprintf(session, "\nNumber of entries: ");
 			safe_dprintf(session, ipset_print_number, IPSET_OPT_ELEMENTS);
 		}
+		if (ipset_data_test(data, IPSET_OPT_QUANTIZE))
+			print_cidrs(session);
+		if (session->with_stats)
+			print_stats(session);
 		safe_snprintf(session,
 			session->envopts & IPSET_ENV_LIST_HEADER ?
 			"\n" : "\nMembers:\n");
@@ -1070,6 +1459,10 @@ list_create(struct ipset_session *session, struct nlattr *nla[])
 			safe_dprintf(session, ipset_print_number, IPSET_OPT_ELEMENTS);
 			safe_snprintf(session, "</numentries>\n");
 		}
+		if (ipset_data_test(data, IPSET_OPT_QUANTIZE))
+			print_cidrs(session);
+		if (session->with_stats)
+			print_stats(session);
 		safe_snprintf(session,
 			session->envopts & IPSET_ENV_LIST_HEADER ?
 			"</header>\n" :
@@ -1218,57 +1611,304 @@ print_set_done(struct ipset_session *session, bool callback_done)
 	return call_outfn(session) ? MNL_CB_ERROR : MNL_CB_STOP;
 }
 
+/*
+ * Binary snapshot
+ *
+ * The snapshot starts with a struct ipset_snapshot_hdr, followed by
+ * netlink attributes as records: the set records carry the attributes
+ * of the CREATE command, the element records are the IPSET_ATTR_DATA
+ * attributes of the ADD command, so both can be copied into the
+ * messages without decoding.
+ */
+struct ipset_snapshot_hdr {
+	char magic[8];				/* IPSET_SNAPSHOT_MAGIC */
+	uint32_t version;			/* IPSET_SNAPSHOT_VERSION */
+	uint32_t byteorder;			/* IPSET_SNAPSHOT_BYTEORDER */
+};
+
+#define IPSET_SNAPSHOT_BYTEORDER	0x01020304
+
+enum {
+	IPSET_SNAPSHOT_SET = 1,			/* Set: CREATE attributes */
+	IPSET_SNAPSHOT_END,			/* End of the snapshot */
+	IPSET_SNAPSHOT_ELEM = IPSET_ATTR_DATA,	/* Element: ADD data */
+};
+
+#define SNAPSHOT_SET_BUFLEN	1024
+#define SNAPSHOT_ELEM_BUFLEN	512
+
 static int
-callback_list(struct ipset_session *session, struct nlattr *nla[],
-	      enum ipset_cmd cmd)
+snapshot_write(struct ipset_session *session, const void *buf, size_t len)
 {
-	struct ipset_data *data = session->data;
+	if (fwrite(buf, 1, len, session->ostream) != len)
+		return ipset_err(session, "Cannot write snapshot: %s",
+				 strerror(errno));
+	return 0;
+}
 
-	if (setjmp(printf_failure)) {
-		session->saved_setname[0] = '\0';
-		session->printed_set = 0;
-		return MNL_CB_ERROR;
-	}
+static int
+snapshot_start(struct ipset_session *session)
+{
+	struct ipset_snapshot_hdr hdr = {
+		.version = IPSET_SNAPSHOT_VERSION,
+		.byteorder = IPSET_SNAPSHOT_BYTEORDER,
+	};
 
-	if (!nla[IPSET_ATTR_SETNAME])
-		FAILURE("Broken %s kernel message: missing setname!",
-			cmd2name[cmd]);
+	memcpy(hdr.magic, IPSET_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+	return snapshot_write(session, &hdr, sizeof(hdr));
+}
 
-	ATTR2DATA(session, nla, IPSET_ATTR_SETNAME, cmd_attrs);
-	D("setname %s", ipset_data_setname(data));
-	if (session->envopts & IPSET_ENV_LIST_SETNAME &&
-	    session->mode != IPSET_LIST_SAVE) {
-		if (session->mode == IPSET_LIST_XML)
-			safe_snprintf(session, "<ipset name=\"%s\"/>\n",
-				      ipset_data_setname(data));
-		else
-			safe_snprintf(session, "%s\n",
-				      ipset_data_setname(data));
-		return call_outfn(session) ? MNL_CB_ERROR : MNL_CB_OK;
-	}
+static int
+snapshot_end(struct ipset_session *session)
+{
+	struct nlattr end = {
+		.nla_len = MNL_ATTR_HDRLEN,
+		.nla_type = IPSET_SNAPSHOT_END,
+	};
+
+	if (snapshot_write(session, &end, sizeof(end)) < 0)
+		return -1;
+	if (fflush(session->ostream) != 0)
+		return ipset_err(session, "Cannot write snapshot: %s",
+				 strerror(errno));
+	return 0;
+}
 
-	if (STREQ(ipset_data_setname(data), session->saved_setname)) {
-		/* Header part already seen */
-		if (ipset_data_test(data, IPSET_OPT_TYPE) &&
-		    nla[IPSET_ATTR_DATA] != NULL)
-			FAILURE("Broken %s kernel message: "
-				"extra DATA received!", cmd2name[cmd]);
-	} else {
-		if (nla[IPSET_ATTR_DATA] == NULL)
+/* Copy an attribute as it is into the message */
+static inline void
+snapshot_copy_attr(struct nlmsghdr *nlh, const struct nlattr *attr)
+{
+	memcpy(mnl_nlmsg_get_payload_tail(nlh), attr, attr->nla_len);
+	nlh->nlmsg_len += MNL_ALIGN(attr->nla_len);
+}
+
+static const uint16_t snapshot_set_attrs[] = {
+	IPSET_ATTR_SETNAME,
+	IPSET_ATTR_TYPENAME,
+	IPSET_ATTR_REVISION,
+	IPSET_ATTR_FAMILY,
+};
+
+static int
+snapshot_set(struct ipset_session *session, struct nlattr *nla[],
+	     enum ipset_cmd cmd)
+{
+	char buffer[SNAPSHOT_SET_BUFLEN] __attribute__ ((aligned)) = {};
+	struct nlmsghdr *nlh = mnl_nlmsg_put_header(buffer);
+	struct nlattr *rec, *nested, *attr;
+	size_t len = MNL_NLMSG_HDRLEN + MNL_ATTR_HDRLEN;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(snapshot_set_attrs); i++) {
+		if (!nla[snapshot_set_attrs[i]])
 			FAILURE("Broken %s kernel message: "
-				"missing DATA part!", cmd2name[cmd]);
+				"missing set header attribute!",
+				cmd2name[cmd]);
+		len += MNL_ALIGN(nla[snapshot_set_attrs[i]]->nla_len);
+	}
+	len += MNL_ALIGN(nla[IPSET_ATTR_DATA]->nla_len);
+	if (len > sizeof(buffer))
+		FAILURE("Broken %s kernel message: "
+			"set header is too large!", cmd2name[cmd]);
 
-		/* Close previous set printing */
-		if (session->saved_setname[0] != '\0')
-			print_set_done(session, false);
+	/* Family is required to expand packed records */
+	ATTR2DATA(session, nla, IPSET_ATTR_FAMILY, cmd_attrs);
+
+	rec = mnl_attr_nest_start(nlh, IPSET_SNAPSHOT_SET);
+	for (i = 0; i < ARRAY_SIZE(snapshot_set_attrs); i++)
+		snapshot_copy_attr(nlh, nla[snapshot_set_attrs[i]]);
+	nested = mnl_attr_nest_start(nlh, IPSET_ATTR_DATA);
+	mnl_attr_for_each_nested(attr, nla[IPSET_ATTR_DATA]) {
+		switch (mnl_attr_get_type(attr)) {
+		case IPSET_ATTR_ELEMENTS:
+		case IPSET_ATTR_REFERENCES:
+		case IPSET_ATTR_MEMSIZE:
+			/* Kernel-only */
+			continue;
+		default:
+			snapshot_copy_attr(nlh, attr);
+		}
 	}
+	mnl_attr_nest_end(nlh, nested);
+	mnl_attr_nest_end(nlh, rec);
 
-	if (nla[IPSET_ATTR_DATA] != NULL) {
-		struct nlattr *cattr[IPSET_ATTR_CREATE_MAX+1] = {};
+	return snapshot_write(session, rec, rec->nla_len) < 0
+		? MNL_CB_ERROR : MNL_CB_OK;
+}
 
-		if (!(nla[IPSET_ATTR_TYPENAME] &&
-		      nla[IPSET_ATTR_FAMILY] &&
-		      nla[IPSET_ATTR_REVISION]))
+static int
+snapshot_elem(struct ipset_session *session, const struct nlattr *elem,
+	      enum ipset_cmd cmd)
+{
+	char buffer[SNAPSHOT_ELEM_BUFLEN] __attribute__ ((aligned)) = {};
+	struct nlmsghdr *nlh;
+	struct nlattr *rec;
+	const struct nlattr *attr;
+	bool pad = false;
+
+	mnl_attr_for_each_nested(attr, elem)
+		if (mnl_attr_get_type(attr) == IPSET_ATTR_PAD)
+			pad = true;
+	if (!pad)
+		return snapshot_write(session, elem, MNL_ALIGN(elem->nla_len));
+
+	/* Drop the alignment attributes of the 64bit counters */
+	if (MNL_NLMSG_HDRLEN + elem->nla_len > sizeof(buffer))
+		FAILURE("Broken %s kernel message: "
+			"element is too large!", cmd2name[cmd]);
+	nlh = mnl_nlmsg_put_header(buffer);
+	rec = mnl_attr_nest_start(nlh, IPSET_SNAPSHOT_ELEM);
+	mnl_attr_for_each_nested(attr, elem)
+		if (mnl_attr_get_type(attr) != IPSET_ATTR_PAD)
+			snapshot_copy_attr(nlh, attr);
+	mnl_attr_nest_end(nlh, rec);
+
+	return snapshot_write(session, rec, rec->nla_len);
+}
+
+/* Expand packed records into element records */
+static int
+snapshot_packed(struct ipset_session *session, const struct nlattr *attr,
+		enum ipset_cmd cmd)
+{
+	char buffer[SNAPSHOT_ELEM_BUFLEN] __attribute__ ((aligned)) = {};
+	struct nlmsghdr *nlh;
+	struct nlattr *rec, *nested;
+	const char *p = mnl_attr_get_payload(attr);
+	uint16_t len = mnl_attr_get_payload_len(attr);
+	uint8_t family = ipset_data_family(session->data);
+	size_t size = family == NFPROTO_IPV6
+		? sizeof(struct ip_set_packed6)
+		: sizeof(struct ip_set_packed4);
+	uint8_t cidr, flags;
+
+	if (len % size)
+		FAILURE("Broken %s kernel message: "
+			"invalid size of packed records!", cmd2name[cmd]);
+
+	for (; len >= size; len -= size, p += size) {
+		nlh = mnl_nlmsg_put_header(buffer);
+		rec = mnl_attr_nest_start(nlh, IPSET_SNAPSHOT_ELEM);
+		nested = mnl_attr_nest_start(nlh, IPSET_ATTR_IP);
+		if (family == NFPROTO_IPV6) {
+			const struct ip_set_packed6 *r =
+				(const struct ip_set_packed6 *)p;
+
+			mnl_attr_put(nlh, IPSET_ATTR_IPADDR_IPV6 |
+					  NLA_F_NET_BYTEORDER,
+				     sizeof(r->ip6), r->ip6);
+			cidr = r->cidr;
+			flags = r->flags;
+		} else {
+			const struct ip_set_packed4 *r =
+				(const struct ip_set_packed4 *)p;
+
+			mnl_attr_put(nlh, IPSET_ATTR_IPADDR_IPV4 |
+					  NLA_F_NET_BYTEORDER,
+				     sizeof(r->ip), &r->ip);
+			cidr = r->cidr;
+			flags = r->flags;
+		}
+		mnl_attr_nest_end(nlh, nested);
+		if (cidr)
+			mnl_attr_put_u8(nlh, IPSET_ATTR_CIDR, cidr);
+		if (flags)
+			mnl_attr_put_u32(nlh, IPSET_ATTR_CADT_FLAGS |
+					      NLA_F_NET_BYTEORDER,
+					 htonl(flags));
+		mnl_attr_nest_end(nlh, rec);
+		if (snapshot_write(session, rec, rec->nla_len) < 0)
+			return MNL_CB_ERROR;
+	}
+	return MNL_CB_OK;
+}
+
+static int
+snapshot_list(struct ipset_session *session, struct nlattr *nla[],
+	      enum ipset_cmd cmd)
+{
+	const struct nlattr *tb;
+
+	if (nla[IPSET_ATTR_DATA] != NULL &&
+	    snapshot_set(session, nla, cmd) != MNL_CB_OK)
+		return MNL_CB_ERROR;
+
+	if (nla[IPSET_ATTR_ADT] == NULL)
+		return MNL_CB_OK;
+
+	mnl_attr_for_each_nested(tb, nla[IPSET_ATTR_ADT]) {
+		switch (mnl_attr_get_type(tb)) {
+		case IPSET_ATTR_PACKED:
+			if (snapshot_packed(session, tb, cmd) != MNL_CB_OK)
+				return MNL_CB_ERROR;
+			break;
+		case IPSET_ATTR_DATA:
+			if (snapshot_elem(session, tb, cmd) < 0)
+				return MNL_CB_ERROR;
+			break;
+		default:
+			FAILURE("Broken %s kernel message: "
+				"cannot validate ADT attributes!",
+				cmd2name[cmd]);
+		}
+	}
+	return MNL_CB_OK;
+}
+
+static int
+callback_list(struct ipset_session *session, struct nlattr *nla[],
+	      enum ipset_cmd cmd)
+{
+	struct ipset_data *data = session->data;
+
+	if (setjmp(printf_failure)) {
+		session->saved_setname[0] = '\0';
+		session->printed_set = 0;
+		return MNL_CB_ERROR;
+	}
+
+	if (!nla[IPSET_ATTR_SETNAME])
+		FAILURE("Broken %s kernel message: missing setname!",
+			cmd2name[cmd]);
+
+	if (session->mode == IPSET_LIST_BINARY)
+		return snapshot_list(session, nla, cmd);
+
+	ATTR2DATA(session, nla, IPSET_ATTR_SETNAME, cmd_attrs);
+	D("setname %s", ipset_data_setname(data));
+	if (session->envopts & IPSET_ENV_LIST_SETNAME &&
+	    session->mode != IPSET_LIST_SAVE) {
+		if (session->mode == IPSET_LIST_XML)
+			safe_snprintf(session, "<ipset name=\"%s\"/>\n",
+				      ipset_data_setname(data));
+		else
+			safe_snprintf(session, "%s\n",
+				      ipset_data_setname(data));
+		return call_outfn(session) ? MNL_CB_ERROR : MNL_CB_OK;
+	}
+
+	if (STREQ(ipset_data_setname(data), session->saved_setname)) {
+		/* Header part already seen */
+		if (ipset_data_test(data, IPSET_OPT_TYPE) &&
+		    nla[IPSET_ATTR_DATA] != NULL)
+			FAILURE("Broken %s kernel message: "
+				"extra DATA received!", cmd2name[cmd]);
+	} else {
+		if (nla[IPSET_ATTR_DATA] == NULL)
+			FAILURE("Broken %s kernel message: "
+				"missing DATA part!", cmd2name[cmd]);
+
+		/* Close previous set printing */
+		if (session->saved_setname[0] != '\0')
+			print_set_done(session, false);
+	}
+
+	if (nla[IPSET_ATTR_DATA] != NULL) {
+		struct nlattr *cattr[IPSET_ATTR_CREATE_MAX+1] = {};
+
+		if (!(nla[IPSET_ATTR_TYPENAME] &&
+		      nla[IPSET_ATTR_FAMILY] &&
+		      nla[IPSET_ATTR_REVISION]))
 			FAILURE("Broken %s kernel message: missing %s!",
 				cmd2name[cmd],
 				!nla[IPSET_ATTR_TYPENAME] ? "typename" :
@@ -1301,6 +1941,11 @@ callback_list(struct ipset_session *session, struct nlattr *nla[],
 
 		mnl_attr_for_each_nested(tb, nla[IPSET_ATTR_ADT]) {
 			D("ADT attributes for %s", ipset_data_setname(data));
+			if (mnl_attr_get_type(tb) == IPSET_ATTR_PACKED) {
+				if (list_packed(session, tb, cmd) != MNL_CB_OK)
+					return MNL_CB_ERROR;
+				continue;
+			}
 			memset(adt, 0, sizeof(adt));
 			/* Reset ADT specific flags */
 			ipset_data_flags_unset(data, IPSET_ADT_FLAGS);
@@ -1317,6 +1962,293 @@ callback_list(struct ipset_session *session, struct nlattr *nla[],
 	return call_outfn(session) ? MNL_CB_ERROR : MNL_CB_OK;
 }
 
+/*
+ * Kernel capability cache
+ *
+ * The protocol versions and the set type revisions supported by the
+ * kernel are stored in a file, so that short-lived ipset invocations
+ * can skip the PROTOCOL and TYPE queries. The file is keyed by the
+ * boot id and the loaded ip_set modules: a reboot or (un)loading
+ * the modules invalidates it. When the kernel rejects a command with
+ * a protocol or settype error, the file is removed. The answers of the
+ * fake kernel are cached next to its state file.
+ */
+
+#ifndef IPSET_CACHEFILE
+#define IPSET_CACHEFILE		"/run/ipset.cache"
+#endif
+
+#define IPSET_CAPS_VERSION	1
+#define IPSET_CAPS_TYPES	64
+#define IPSET_CAPS_KEYLEN	17
+
+struct ipset_caps_type {
+	char typename[IPSET_MAXNAMELEN];	/* Queried settype */
+	uint8_t qfamily;			/* Queried family */
+	uint8_t family;				/* Received family */
+	uint8_t revision;			/* Received max revision */
+	uint8_t revision_min;			/* Received min revision */
+};
+
+struct ipset_caps {
+	char file[PATH_MAX];			/* Cache file */
+	bool loaded;				/* File read in */
+	bool dirty;				/* New kernel answers */
+	bool used;				/* Answers used from file */
+	bool has_protocol;			/* Protocol versions known */
+	uint8_t protocol_min, protocol_max;	/* Protocol versions */
+	unsigned int ntypes;			/* Number of known types */
+	struct ipset_caps_type types[IPSET_CAPS_TYPES];
+};
+
+static uint64_t
+caps_hash(uint64_t h, const char *s)
+{
+	/* FNV-1a */
+	while (*s) {
+		h ^= (unsigned char) *s++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static bool
+caps_key(char *key)
+{
+	char line[256], name[64], state[16], addr[32];
+	uint64_t h = 0xcbf29ce484222325ULL;
+	unsigned long size;
+	FILE *f;
+
+	f = fopen("/proc/sys/kernel/random/boot_id", "r");
+	if (f == NULL)
+		return false;
+	if (fgets(line, sizeof(line), f) == NULL) {
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+	h = caps_hash(h, line);
+
+	/* Name, size, state and address of the loaded ip_set modules */
+	f = fopen("/proc/modules", "r");
+	if (f != NULL) {
+		while (fgets(line, sizeof(line), f) != NULL) {
+			if (strncmp(line, "ip_set", 6) != 0 ||
+			    sscanf(line, "%63s %lu %*s %*s %15s %31s",
+				   name, &size, state, addr) != 4)
+				continue;
+			h = caps_hash(h, name);
+			snprintf(line, sizeof(line), " %lu %s %s ",
+				 size, state, addr);
+			h = caps_hash(h, line);
+		}
+		fclose(f);
+	}
+	snprintf(key, IPSET_CAPS_KEYLEN, "%016llx", (unsigned long long) h);
+	return true;
+}
+
+static void
+caps_load(struct ipset_caps *caps)
+{
+	char line[256], key[IPSET_CAPS_KEYLEN], fkey[IPSET_CAPS_KEYLEN];
+	struct ipset_caps_type *t;
+	unsigned int version, a, b, c, d;
+	struct stat st;
+	FILE *f;
+
+	caps->loaded = true;
+	if (!caps_key(key))
+		return;
+	f = fopen(caps->file, "r");
+	if (f == NULL)
+		return;
+	/* Trust files written by us or by root only */
+	if (fstat(fileno(f), &st) < 0 ||
+	    (st.st_uid != 0 && st.st_uid != geteuid()) ||
+	    (st.st_mode & (S_IWGRP | S_IWOTH)))
+		goto out;
+	if (fgets(line, sizeof(line), f) == NULL ||
+	    sscanf(line, "ipset-caps %u %16s", &version, fkey) != 2 ||
+	    version != IPSET_CAPS_VERSION || !STREQ(key, fkey)) {
+		D("stale capability cache");
+		goto out;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "protocol %u %u", &a, &b) == 2) {
+			caps->protocol_min = a;
+			caps->protocol_max = b;
+			caps->has_protocol = true;
+			continue;
+		}
+		if (caps->ntypes == IPSET_CAPS_TYPES)
+			break;
+		t = &caps->types[caps->ntypes];
+		if (sscanf(line, "type %31s %u %u %u %u",
+			   t->typename, &a, &b, &c, &d) != 5)
+			continue;
+		t->qfamily = a;
+		t->family = b;
+		t->revision = c;
+		t->revision_min = d;
+		caps->ntypes++;
+	}
+	D("capability cache: protocol %s, %u types",
+	  caps->has_protocol ? "known" : "unknown", caps->ntypes);
+out:
+	fclose(f);
+}
+
+static void
+caps_save(const struct ipset_caps *caps)
+{
+	char tmp[PATH_MAX + 16], key[IPSET_CAPS_KEYLEN];
+	const struct ipset_caps_type *t;
+	unsigned int i;
+	FILE *f;
+	int fd;
+
+	/* The modules of the new types may have been loaded meanwhile */
+	if (!caps_key(key))
+		return;
+	snprintf(tmp, sizeof(tmp), "%s.%u", caps->file,
+		 (unsigned int) getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		return;
+	f = fdopen(fd, "w");
+	if (f == NULL) {
+		close(fd);
+		goto unlink;
+	}
+	fprintf(f, "ipset-caps %u %s\n", IPSET_CAPS_VERSION, key);
+	if (caps->has_protocol)
+		fprintf(f, "protocol %u %u\n",
+			caps->protocol_min, caps->protocol_max);
+	for (i = 0; i < caps->ntypes; i++) {
+		t = &caps->types[i];
+		fprintf(f, "type %s %u %u %u %u\n", t->typename,
+			t->qfamily, t->family, t->revision, t->revision_min);
+	}
+	if (fclose(f) == 0 && rename(tmp, caps->file) == 0)
+		return;
+unlink:
+	unlink(tmp);
+}
+
+/* Get the cache file of the transport, false if there is none */
+static bool
+caps_file(const struct ipset_session *session, char *file, size_t len)
+{
+	const char *state;
+
+	if (session->transport != &ipset_fake_transport) {
+		ipset_strlcpy(file, IPSET_CACHEFILE, len);
+		return true;
+	}
+	/* The fake kernel without state file forgets the sets too */
+	state = getenv("IPSET_FAKE_STATE");
+	if (state == NULL || state[0] == '\0')
+		return false;
+	return snprintf(file, len, "%s.cache", state) < (int) len;
+}
+
+static struct ipset_caps *
+caps_get(struct ipset_session *session)
+{
+	if (!(session->envopts & IPSET_ENV_CACHE))
+		return NULL;
+	if (session->caps == NULL) {
+		session->caps = calloc(1, sizeof(struct ipset_caps));
+		if (session->caps == NULL)
+			return NULL;
+		if (!caps_file(session, session->caps->file,
+			       sizeof(session->caps->file))) {
+			/* Keep the answers in the session only */
+			session->caps->loaded = true;
+			session->caps->file[0] = '\0';
+		}
+	}
+	if (!session->caps->loaded)
+		caps_load(session->caps);
+	return session->caps;
+}
+
+/* Record the answer of the kernel to the PROTOCOL query */
+static void
+caps_protocol_add(struct ipset_session *session, uint8_t min, uint8_t max)
+{
+	struct ipset_caps *caps = session->caps;
+
+	if (caps == NULL || caps->has_protocol)
+		return;
+	caps->protocol_min = min;
+	caps->protocol_max = max;
+	caps->has_protocol = true;
+	caps->dirty = true;
+}
+
+static uint8_t
+caps_qfamily(const struct ipset_data *data)
+{
+	return ipset_data_test(data, IPSET_OPT_FAMILY) ?
+		ipset_data_family(data) : NFPROTO_UNSPEC;
+}
+
+static struct ipset_caps_type *
+caps_type_find(struct ipset_caps *caps, const struct ipset_data *data)
+{
+	const char *typename = ipset_data_get(data, IPSET_OPT_TYPENAME);
+	uint8_t qfamily = caps_qfamily(data);
+	unsigned int i;
+
+	for (i = 0; i < caps->ntypes; i++)
+		if (STREQ(caps->types[i].typename, typename) &&
+		    caps->types[i].qfamily == qfamily)
+			return &caps->types[i];
+	return NULL;
+}
+
+/* Record the answer of the kernel to a TYPE query */
+static void
+caps_type_add(struct ipset_session *session, uint8_t qfamily)
+{
+	struct ipset_caps *caps = session->caps;
+	const struct ipset_data *data = session->data;
+	struct ipset_caps_type *t;
+
+	if (caps == NULL || caps->ntypes == IPSET_CAPS_TYPES)
+		return;
+	t = &caps->types[caps->ntypes];
+	ipset_strlcpy(t->typename, ipset_data_get(data, IPSET_OPT_TYPENAME),
+		      IPSET_MAXNAMELEN);
+	t->qfamily = qfamily;
+	t->family = ipset_data_family(data);
+	t->revision = *(const uint8_t *)ipset_data_get(data,
+						       IPSET_OPT_REVISION);
+	t->revision_min = ipset_data_test(data, IPSET_OPT_REVISION_MIN) ?
+		*(const uint8_t *)ipset_data_get(data,
+						 IPSET_OPT_REVISION_MIN) :
+		t->revision;
+	caps->ntypes++;
+	caps->dirty = true;
+}
+
+/* The kernel rejected a command which may rely on stale answers */
+static void
+caps_invalidate(struct ipset_session *session)
+{
+	struct ipset_caps *caps = session->caps;
+
+	if (caps == NULL || !caps->used)
+		return;
+	D("remove capability cache");
+	if (caps->file[0] != '\0')
+		unlink(caps->file);
+	caps->dirty = false;
+}
+
 #ifndef IPSET_PROTOCOL_MIN
 #define IPSET_PROTOCOL_MIN	IPSET_PROTOCOL
 #endif
@@ -1326,17 +2258,8 @@ callback_list(struct ipset_session *session, struct nlattr *nla[],
 #endif
 
 static int
-callback_version(struct ipset_session *session, struct nlattr *nla[])
+check_version(struct ipset_session *session, uint8_t min, uint8_t max)
 {
-	uint8_t min, max;
-
-	min = max = mnl_attr_get_u8(nla[IPSET_ATTR_PROTOCOL]);
-
-	if (nla[IPSET_ATTR_PROTOCOL_MIN]) {
-		min = mnl_attr_get_u8(nla[IPSET_ATTR_PROTOCOL_MIN]);
-		D("min: %u", min);
-	}
-
 	if (min > IPSET_PROTOCOL_MAX || max < IPSET_PROTOCOL_MIN)
 		FAILURE("Cannot communicate with kernel: "
 			"Kernel support protocol versions %u-%u "
@@ -1356,14 +2279,45 @@ callback_version(struct ipset_session *session, struct nlattr *nla[])
 	return MNL_CB_STOP;
 }
 
+static int
+callback_version(struct ipset_session *session, struct nlattr *nla[])
+{
+	uint8_t min, max;
+
+	min = max = mnl_attr_get_u8(nla[IPSET_ATTR_PROTOCOL]);
+
+	if (nla[IPSET_ATTR_PROTOCOL_MIN]) {
+		min = mnl_attr_get_u8(nla[IPSET_ATTR_PROTOCOL_MIN]);
+		D("min: %u", min);
+	}
+	caps_protocol_add(session, min, max);
+
+	return check_version(session, min, max);
+}
+
 static int
 callback_header(struct ipset_session *session, struct nlattr *nla[])
 {
 	const char *setname;
 	const struct ipset_data *data = session->data;
 
-	if (!nla[IPSET_ATTR_SETNAME])
-		FAILURE("Broken HEADER kernel message: missing setname!");
+	if (!nla[IPSET_ATTR_SETNAME]) {
+		struct nlattr *cattr[IPSET_ATTR_CREATE_MAX+1] = {};
+
+		/* Totals of all sets in the namespace were requested */
+		if (ipset_data_test(data, IPSET_SETNAME) ||
+		    !nla[IPSET_ATTR_DATA])
+			FAILURE("Broken HEADER kernel message: "
+				"missing setname!");
+		if (mnl_attr_parse_nested(nla[IPSET_ATTR_DATA],
+					  create_attr_cb, cattr) < 0)
+			FAILURE("Broken HEADER kernel message: "
+				"cannot validate DATA attributes!");
+		ATTR2DATA(session, cattr, IPSET_ATTR_MEMSIZE, create_attrs);
+		ATTR2DATA(session, cattr, IPSET_ATTR_ELEMENTS, create_attrs);
+
+		return MNL_CB_STOP;
+	}
 
 	setname = mnl_attr_get_str(nla[IPSET_ATTR_SETNAME]);
 	if (!STREQ(setname, ipset_data_setname(data)))
@@ -1450,6 +2404,7 @@ callback_data(const struct nlmsghdr *nlh, void *data)
 {
 	struct ipset_session *session = data;
 	struct nlattr *nla[IPSET_ATTR_CMD_MAX+1] = {};
+	enum ipset_phase phase;
 	uint8_t proto, cmd;
 	int ret = MNL_CB_OK, nfmsglen = MNL_ALIGN(sizeof(struct nfgenmsg));
 
@@ -1487,10 +2442,12 @@ callback_data(const struct nlmsghdr *nlh, void *data)
 	switch (cmd) {
 	case IPSET_CMD_LIST:
 	case IPSET_CMD_SAVE:
+		phase = phase_enter(session, IPSET_PHASE_FORMAT);
 		ret = callback_list(session, nla, cmd);
 		D("flag multi: %u", nlh->nlmsg_flags & NLM_F_MULTI);
 		if (ret >= MNL_CB_STOP && !(nlh->nlmsg_flags & NLM_F_MULTI))
 			ret = print_set_done(session, false);
+		phase_enter(session, phase);
 		break;
 	case IPSET_CMD_PROTOCOL:
 		if (!session->version_checked)
@@ -1515,10 +2472,16 @@ static int
 callback_done(const struct nlmsghdr *nlh UNUSED, void *data)
 {
 	struct ipset_session *session = data;
+	enum ipset_phase phase;
+	int ret;
 
 	D(" called");
-	if (session->cmd == IPSET_CMD_LIST || session->cmd == IPSET_CMD_SAVE)
-		return print_set_done(session, true);
+	if (session->cmd == IPSET_CMD_LIST || session->cmd == IPSET_CMD_SAVE) {
+		phase = phase_enter(session, IPSET_PHASE_FORMAT);
+		ret = print_set_done(session, true);
+		phase_enter(session, phase);
+		return ret;
+	}
 
 	FAILURE("Invalid message received in non LIST or SAVE state.");
 }
@@ -1592,6 +2555,7 @@ callback_error(const struct nlmsghdr *nlh, void *cbdata)
 			ipset_cache_del(ipset_data_setname(data));
 			/* Fall through */
 		case IPSET_CMD_FLUSH:
+		case IPSET_CMD_ZERO:
 			break;
 		case IPSET_CMD_RENAME:
 			ipset_cache_rename(ipset_data_setname(data),
@@ -1646,6 +2610,10 @@ callback_error(const struct nlmsghdr *nlh, void *cbdata)
 		return ret;
 	}
 
+	if (err->error == -IPSET_ERR_PROTOCOL ||
+	    err->error == -IPSET_ERR_FIND_TYPE)
+		caps_invalidate(session);
+
 	decode_errmsg(session, nlh);
 
 	return ret;
@@ -1822,6 +2790,20 @@ addattr_adt(struct ipset_session *session,
 	return 0;
 }
 
+/* Send the message and process the replies, the printing callbacks
+ * account their time to the format phase
+ */
+static int
+session_query(struct ipset_session *session, void *buffer, size_t len)
+{
+	enum ipset_phase phase = phase_enter(session, IPSET_PHASE_KERNEL);
+	int ret;
+
+	ret = session->transport->query(session->handle, buffer, len);
+	phase_enter(session, phase);
+	return ret;
+}
+
 #define PRIVATE_MSG_BUFLEN	256
 
 static int
@@ -1832,6 +2814,26 @@ build_send_private_msg(struct ipset_session *session, enum ipset_cmd cmd)
 	struct ipset_data *data = session->data;
 	int len = PRIVATE_MSG_BUFLEN, ret;
 	enum ipset_cmd saved = session->cmd;
+	struct ipset_caps *caps = caps_get(session);
+	struct ipset_caps_type *t;
+	uint8_t qfamily = caps_qfamily(data);
+
+	/* Answer from the capability cache */
+	if (caps != NULL && cmd == IPSET_CMD_PROTOCOL && caps->has_protocol) {
+		caps->used = true;
+		return check_version(session, caps->protocol_min,
+				     caps->protocol_max) == MNL_CB_STOP ? 0 : -1;
+	}
+	if (caps != NULL && cmd == IPSET_CMD_TYPE &&
+	    ipset_data_test(data, IPSET_OPT_TYPENAME) &&
+	    (t = caps_type_find(caps, data)) != NULL) {
+		caps->used = true;
+		ipset_data_set(data, IPSET_OPT_FAMILY, &t->family);
+		ipset_data_set(data, IPSET_OPT_REVISION, &t->revision);
+		ipset_data_set(data, IPSET_OPT_REVISION_MIN,
+			       &t->revision_min);
+		return 0;
+	}
 
 	/* Initialize header */
 	session->transport->fill_hdr(session->handle, cmd, buffer, len, 0);
@@ -1843,11 +2845,9 @@ build_send_private_msg(struct ipset_session *session, enum ipset_cmd cmd)
 	case IPSET_CMD_PROTOCOL:
 		break;
 	case IPSET_CMD_HEADER:
-		if (!ipset_data_test(data, IPSET_SETNAME))
-			return ipset_err(session,
-				"Invalid internal HEADER command: "
-				"missing setname");
-		ADDATTR_SETNAME(session, nlh, data);
+		/* Without setname the totals of the namespace are queried */
+		if (ipset_data_test(data, IPSET_SETNAME))
+			ADDATTR_SETNAME(session, nlh, data);
 		break;
 	case IPSET_CMD_TYPE:
 		if (!ipset_data_test(data, IPSET_OPT_TYPENAME))
@@ -1868,53 +2868,277 @@ build_send_private_msg(struct ipset_session *session, enum ipset_cmd cmd)
 				 "unknown private command %u", cmd);
 	}
 
+	/* Replies of the non-blocking commands come first */
+	if (ipset_async_wait(session) < 0)
+		return -1;
+
 	/* Backup, then restore real command */
 	session->cmd = cmd;
-	ret = session->transport->query(session->handle, buffer, len);
+	ret = session_query(session, buffer, len);
 	session->cmd = saved;
 
-	return ret;
-}
+	if (ret == 0 && cmd == IPSET_CMD_TYPE)
+		caps_type_add(session, qfamily);
 
-static inline bool
-may_aggregate_ad(struct ipset_session *session, enum ipset_cmd cmd)
-{
-	return session->lineno != 0 &&
-	       (cmd == IPSET_CMD_ADD || cmd == IPSET_CMD_DEL) &&
-	       cmd == session->cmd &&
-	       STREQ(ipset_data_setname(session->data), session->saved_setname);
+	return ret;
 }
 
 static int
-build_msg(struct ipset_session *session, bool aggregate)
+print_total(struct ipset_session *session)
 {
-	struct nlmsghdr *nlh = session->buffer;
 	struct ipset_data *data = session->data;
 
-	/* Public commands */
-	D("cmd %s, nlmsg_len: %u", cmd2name[session->cmd], nlh->nlmsg_len);
-	if (nlh->nlmsg_len == 0) {
-		/* Initialize header */
-		aggregate = false;
-		session->transport->fill_hdr(session->handle,
-					     session->cmd,
-					     session->buffer,
-					     session->bufsize,
-					     session->envopts);
-		ADDATTR_PROTOCOL(nlh, session->protocol);
+	ipset_data_reset(data);
+	if (build_send_private_msg(session, IPSET_CMD_HEADER) < 0) {
+		/* Kernel does not support the totals, nothing to print */
+		ipset_session_report_reset(session);
+		return 0;
 	}
-	D("Protocol added, aggregate %s", aggregate ? "yes" : "no");
-	switch (session->cmd) {
-	case IPSET_CMD_CREATE: {
-		const struct ipset_type *type;
+	if (!(ipset_data_test(data, IPSET_OPT_MEMSIZE) &&
+	      ipset_data_test(data, IPSET_OPT_ELEMENTS)))
+		return 0;
 
-		/* Sanity checkings */
-		if (!ipset_data_test(data, IPSET_SETNAME))
-			return ipset_err(session,
-				"Invalid create command: missing setname");
-		if (!ipset_data_test(data, IPSET_OPT_TYPE))
-			return ipset_err(session,
-				"Invalid create command: missing settype");
+	return session->print_outfn(session, session->p,
+			"Total size in memory: %u\n"
+			"Total number of entries: %u\n",
+			*(const uint32_t *)
+				ipset_data_get(data, IPSET_OPT_MEMSIZE),
+			*(const uint32_t *)
+				ipset_data_get(data, IPSET_OPT_ELEMENTS)) < 0
+		? -1 : 0;
+}
+
+/* Max number of saved sets which are not printed yet */
+#define IPSET_SAVE_PENDING	256
+
+struct save_job {
+	char setname[IPSET_MAXNAMELEN];		/* Set to be saved */
+	FILE *out;				/* Output of the job */
+	pid_t pid;				/* Process of the job */
+	int status;				/* Exit status */
+	bool done;				/* Job finished */
+};
+
+/* Get the names of all sets in the order the kernel would dump them */
+static int
+save_setnames(struct ipset_session *session,
+	      struct save_job **jobs, unsigned int *nsets)
+{
+	ipset_print_outfn outfn = session->print_outfn;
+	void *p = session->p;
+	FILE *ostream = session->ostream;
+	uint16_t envopts = session->envopts;
+	enum ipset_output_mode mode = session->mode;
+	char line[IPSET_MAXNAMELEN + 2];
+	struct save_job *job;
+	unsigned int size = 0;
+	FILE *f;
+	int ret;
+
+	f = tmpfile();
+	if (!f)
+		return ipset_err(session,
+				 "Cannot create temporary file: %s",
+				 strerror(errno));
+	ipset_session_print_outfn(session, NULL, NULL);
+	session->ostream = f;
+	session->envopts = IPSET_ENV_LIST_SETNAME;
+	session->mode = IPSET_LIST_PLAIN;
+
+	ret = ipset_cmd(session, IPSET_CMD_LIST, 0);
+
+	session->print_outfn = outfn;
+	session->p = p;
+	session->ostream = ostream;
+	session->envopts = envopts;
+	session->mode = mode;
+	if (ret < 0)
+		goto out;
+
+	rewind(f);
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (*nsets == size) {
+			size = size ? 2 * size : 64;
+			job = realloc(*jobs, size * sizeof(*job));
+			if (!job) {
+				ret = ipset_err(session,
+					"Cannot allocate memory for %u sets",
+					size);
+				goto out;
+			}
+			*jobs = job;
+		}
+		job = *jobs + (*nsets)++;
+		memset(job, 0, sizeof(*job));
+		strncpy(job->setname, line, IPSET_MAXNAMELEN - 1);
+	}
+out:
+	fclose(f);
+	return ret;
+}
+
+/* Save a single set into the output file of the job in a new process */
+static int
+save_job_start(struct ipset_session *session, struct save_job *job)
+{
+	struct ipset_session *s;
+	int ret = -1;
+
+	job->out = tmpfile();
+	if (!job->out)
+		return ipset_err(session,
+				 "Cannot create temporary file: %s",
+				 strerror(errno));
+	job->pid = fork();
+	if (job->pid < 0)
+		return ipset_err(session, "Cannot fork: %s", strerror(errno));
+	if (job->pid > 0)
+		return 0;
+
+	/* Child: dump over a new netlink socket */
+	s = ipset_session_init(NULL, NULL);
+	if (s) {
+		s->ostream = job->out;
+		s->envopts = session->envopts &
+			~(IPSET_ENV_LIST_SETNAME | IPSET_ENV_LIST_HEADER |
+			  IPSET_ENV_PHASES);
+		s->mode = IPSET_LIST_SAVE;
+		ipset_data_set(s->data, IPSET_SETNAME, job->setname);
+		ret = ipset_cmd(s, IPSET_CMD_SAVE, 0);
+		if (ret < 0) {
+			/* Replace the output with the error message */
+			fflush(job->out);
+			if (ftruncate(fileno(job->out), 0) == 0) {
+				rewind(job->out);
+				fputs(ipset_session_report_msg(s), job->out);
+			}
+		}
+	}
+	fflush(job->out);
+	/* Don't flush the inherited stdio buffers of the parent */
+	_exit(ret < 0 ? 1 : 0);
+}
+
+/* Print the output of a finished job */
+static int
+save_job_print(struct ipset_session *session, struct save_job *job)
+{
+	char buf[IPSET_OUTBUFLEN];
+	size_t len;
+	int ret = 0;
+
+	rewind(job->out);
+	if (!WIFEXITED(job->status) || WEXITSTATUS(job->status)) {
+		len = fread(buf, 1, sizeof(buf) - 1, job->out);
+		buf[len] = '\0';
+		ret = ipset_err(session, "%s", len ? buf :
+				"Saving the set failed");
+		goto out;
+	}
+	while ((len = fread(buf, 1, sizeof(buf) - 1, job->out)) > 0) {
+		buf[len] = '\0';
+		if (session->print_outfn(session, session->p, "%s", buf) < 0) {
+			ret = -1;
+			goto out;
+		}
+	}
+out:
+	fclose(job->out);
+	job->out = NULL;
+	return ret;
+}
+
+/* Save all sets in parallel jobs, print the sets in the original order */
+static int
+save_parallel(struct ipset_session *session)
+{
+	struct save_job *jobs = NULL;
+	unsigned int nsets = 0, next = 0, printed = 0, running = 0, i;
+	int status, ret;
+	pid_t pid;
+
+	ret = save_setnames(session, &jobs, &nsets);
+	while (ret == 0 && printed < nsets) {
+		/* Keep the jobs running, limit the files open */
+		while (running < session->jobs && next < nsets &&
+		       next - printed < IPSET_SAVE_PENDING) {
+			ret = save_job_start(session, &jobs[next++]);
+			if (ret < 0)
+				goto out;
+			running++;
+		}
+		if (jobs[printed].done) {
+			ret = save_job_print(session, &jobs[printed++]);
+			continue;
+		}
+		/* Any of the running jobs may finish first */
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			ret = ipset_err(session, "Cannot wait for jobs: %s",
+					strerror(errno));
+			break;
+		}
+		for (i = printed; i < next; i++) {
+			if (jobs[i].pid == pid && !jobs[i].done) {
+				jobs[i].status = status;
+				jobs[i].done = true;
+				running--;
+				break;
+			}
+		}
+	}
+out:
+	/* Reap the remaining jobs at errors */
+	for (i = printed; i < next; i++) {
+		if (!jobs[i].done && jobs[i].pid > 0)
+			waitpid(jobs[i].pid, NULL, 0);
+		if (jobs[i].out)
+			fclose(jobs[i].out);
+	}
+	free(jobs);
+	return ret;
+}
+
+static inline bool
+may_aggregate_ad(struct ipset_session *session, enum ipset_cmd cmd)
+{
+	return session->lineno != 0 &&
+	       (cmd == IPSET_CMD_ADD || cmd == IPSET_CMD_DEL) &&
+	       cmd == session->cmd &&
+	       STREQ(ipset_data_setname(session->data), session->saved_setname);
+}
+
+static int
+build_msg(struct ipset_session *session, bool aggregate)
+{
+	struct nlmsghdr *nlh = session->buffer;
+	struct ipset_data *data = session->data;
+
+	/* Public commands */
+	D("cmd %s, nlmsg_len: %u", cmd2name[session->cmd], nlh->nlmsg_len);
+	if (nlh->nlmsg_len == 0) {
+		/* Initialize header */
+		aggregate = false;
+		session->transport->fill_hdr(session->handle,
+					     session->cmd,
+					     session->buffer,
+					     session->bufsize,
+					     session->envopts);
+		ADDATTR_PROTOCOL(nlh, session->protocol);
+	}
+	D("Protocol added, aggregate %s", aggregate ? "yes" : "no");
+	switch (session->cmd) {
+	case IPSET_CMD_CREATE: {
+		const struct ipset_type *type;
+
+		/* Sanity checkings */
+		if (!ipset_data_test(data, IPSET_SETNAME))
+			return ipset_err(session,
+				"Invalid create command: missing setname");
+		if (!ipset_data_test(data, IPSET_OPT_TYPE))
+			return ipset_err(session,
+				"Invalid create command: missing settype");
 
 		type = ipset_data_get(data, IPSET_OPT_TYPE);
 		/* Core attributes:
@@ -1943,24 +3167,27 @@ build_msg(struct ipset_session *session, bool aggregate)
 	}
 	case IPSET_CMD_DESTROY:
 	case IPSET_CMD_FLUSH:
-	case IPSET_CMD_SAVE:
+	case IPSET_CMD_ZERO:
 		if (ipset_data_test(data, IPSET_SETNAME))
 			ADDATTR_SETNAME(session, nlh, data);
 		break;
-	case IPSET_CMD_LIST: {
-		uint32_t flags = 0;
-
-		if (session->envopts & IPSET_ENV_LIST_SETNAME)
-			flags |= IPSET_FLAG_LIST_SETNAME;
-		if (session->envopts & IPSET_ENV_LIST_HEADER)
-			flags |= IPSET_FLAG_LIST_HEADER;
+	case IPSET_CMD_LIST:
+	case IPSET_CMD_SAVE: {
+		/* Kernels which don't support packed records ignore it */
+		uint32_t flags = IPSET_FLAG_LIST_PACKED;
+
+		if (session->mode != IPSET_LIST_SAVE &&
+		    session->mode != IPSET_LIST_BINARY) {
+			if (session->envopts & IPSET_ENV_LIST_SETNAME)
+				flags |= IPSET_FLAG_LIST_SETNAME;
+			if (session->envopts & IPSET_ENV_LIST_HEADER)
+				flags |= IPSET_FLAG_LIST_HEADER;
+		}
 		if (ipset_data_test(data, IPSET_SETNAME))
 			ADDATTR_SETNAME(session, nlh, data);
-		if (flags && session->mode != IPSET_LIST_SAVE) {
-			ipset_data_set(data, IPSET_OPT_FLAGS, &flags);
-			ADDATTR(session, nlh, data, IPSET_ATTR_FLAGS,
-				NFPROTO_IPV4, cmd_attrs);
-		}
+		ipset_data_set(data, IPSET_OPT_FLAGS, &flags);
+		ADDATTR(session, nlh, data, IPSET_ATTR_FLAGS,
+			NFPROTO_IPV4, cmd_attrs);
 		break;
 	}
 	case IPSET_CMD_RENAME:
@@ -2030,123 +3257,923 @@ build_msg(struct ipset_session *session, bool aggregate)
 		const struct ipset_type *type;
 		/* Return codes are not aggregated, so tests cannot be either */
 
-		/* Setname, type not checked/added yet */
+		/* Setname, type not checked/added yet */
+
+		if (!ipset_data_test(data, IPSET_SETNAME))
+			return ipset_err(session,
+				"Invalid test command: missing setname");
+
+		if (!ipset_data_test(data, IPSET_OPT_TYPE))
+			return ipset_err(session,
+				"Invalid test command: missing settype");
+
+		type = ipset_data_get(data, IPSET_OPT_TYPE);
+		D("family: %u, type family %u",
+		  ipset_data_family(data), type->family);
+		ADDATTR_SETNAME(session, nlh, data);
+		open_nested(session, nlh, IPSET_ATTR_DATA);
+		addattr_adt(session, nlh, data, ipset_data_family(data));
+		close_nested(session, nlh);
+		break;
+	}
+	default:
+		return ipset_err(session, "Internal error: unknown command %u",
+				 session->cmd);
+	}
+	return 0;
+}
+
+static int
+session_commit(struct ipset_session *session)
+{
+	struct nlmsghdr *nlh;
+	int ret = 0, i;
+
+	assert(session);
+
+	nlh = session->buffer;
+	D("send buffer: len %u, cmd %s",
+	  nlh->nlmsg_len, cmd2name[session->cmd]);
+	if (nlh->nlmsg_len == 0)
+		/* Nothing to do */
+		return 0;
+
+	/* Close nested data blocks */
+	for (i = session->nestid - 1; i >= 0; i--)
+		close_nested(session, nlh);
+
+	/* Replies of the non-blocking commands come first */
+	ret = ipset_async_wait(session);
+	if (ret < 0)
+		return ret;
+
+	/* Send buffer */
+	ret = session_query(session, session->buffer, session->bufsize);
+
+	/* Reset saved data and nested state */
+	session->saved_setname[0] = '\0';
+	session->printed_set = 0;
+	for (i = session->nestid - 1; i >= 0; i--)
+		session->nested[i] = NULL;
+	session->nestid = 0;
+	nlh->nlmsg_len = 0;
+
+	D("ret: %d", ret);
+
+	if (ret < 0) {
+		if (session->report[0] != '\0')
+			return -1;
+		else
+			return ipset_err(session,
+					 "Internal protocol error");
+	}
+	return 0;
+}
+
+/* Send the pending message of a set */
+static int
+group_send(struct ipset_session *session, struct ipset_group *g)
+{
+	void *buffer = session->buffer;
+	int ret;
+
+	session->buffer = g->buffer;
+	session->nested[0] = g->nested;
+	session->nestid = g->nested != NULL;
+	session->cmd = g->cmd;
+	session->lineno = g->lineno;
+	session->saved_type = g->type;
+	ret = session_commit(session);
+	session->buffer = buffer;
+	g->nested = NULL;
+
+	return ret;
+}
+
+static int
+group_cmp(const void *a, const void *b)
+{
+	const struct ipset_group *x = a, *y = b;
+
+	return x->lineno < y->lineno ? -1 : x->lineno > y->lineno;
+}
+
+/* Send the pending messages in the order of their first lines */
+static int
+group_commit(struct ipset_session *session)
+{
+	unsigned int i, n = session->ngroups;
+	int ret = 0;
+
+	qsort(session->groups, n, sizeof(*session->groups), group_cmp);
+	session->ngroups = 0;
+	for (i = 0; i < n; i++) {
+		if (ret == 0)
+			ret = group_send(session, &session->groups[i]);
+		else
+			/* Drop the rest after an error */
+			((struct nlmsghdr *)session->groups[i].buffer)->nlmsg_len
+				= 0;
+	}
+	return ret;
+}
+
+/* Add an add/del restore line to the pending message of its set */
+static int
+group_cmd(struct ipset_session *session, enum ipset_cmd cmd, uint32_t lineno)
+{
+	struct ipset_data *data = session->data;
+	const char *setname = ipset_data_setname(data);
+	struct ipset_group *g = NULL;
+	void *buffer = session->buffer;
+	unsigned int i;
+	int ret = 0;
+
+	if (session->groups == NULL) {
+		session->groups = calloc(IPSET_GROUP_MAX,
+					 sizeof(*session->groups));
+		if (session->groups == NULL) {
+			ret = ipset_err(session, "Cannot allocate memory");
+			goto cleanup;
+		}
+	}
+	for (i = 0; i < session->ngroups; i++) {
+		if (STREQ(session->groups[i].setname, setname)) {
+			g = &session->groups[i];
+			break;
+		}
+	}
+	if (g != NULL && g->cmd != cmd) {
+		/* Keep the order of add and del in the set */
+		ret = group_send(session, g);
+		if (ret < 0)
+			goto cleanup;
+	} else if (g == NULL && session->ngroups == IPSET_GROUP_MAX) {
+		/* Make room: send the largest pending message */
+		g = &session->groups[0];
+		for (i = 1; i < session->ngroups; i++)
+			if (((struct nlmsghdr *)session->groups[i].buffer)
+				->nlmsg_len >
+			    ((struct nlmsghdr *)g->buffer)->nlmsg_len)
+				g = &session->groups[i];
+		ret = group_send(session, g);
+		if (ret < 0)
+			goto cleanup;
+	} else if (g == NULL) {
+		g = &session->groups[session->ngroups];
+		if (g->buffer == NULL) {
+			g->buffer = calloc(1, session->bufsize);
+			if (g->buffer == NULL) {
+				ret = ipset_err(session,
+						"Cannot allocate memory");
+				goto cleanup;
+			}
+		}
+		session->ngroups++;
+	}
+	if (((struct nlmsghdr *)g->buffer)->nlmsg_len == 0) {
+		ipset_strlcpy(g->setname, setname, IPSET_MAXNAMELEN);
+		g->type = ipset_data_get(data, IPSET_OPT_TYPE);
+		g->cmd = cmd;
+		g->lineno = lineno;
+	}
+
+	/* Build the element into the message of the set */
+	session->buffer = g->buffer;
+	session->nested[0] = g->nested;
+	session->nestid = g->nested != NULL;
+	session->cmd = cmd;
+	session->lineno = lineno;
+	session->saved_type = g->type;
+	ret = build_msg(session, g->nested != NULL);
+	if (ret > 0) {
+		/* Buffer is full, send the pending elements */
+		ret = session_commit(session);
+		if (ret == 0) {
+			g->lineno = lineno;
+			ret = build_msg(session, false);
+		}
+	}
+	g->nested = session->nested[0];
+	session->nested[0] = NULL;
+	session->nestid = 0;
+	session->buffer = buffer;
+
+cleanup:
+	ipset_data_reset(data);
+	return ret;
+}
+
+/* Send the pending messages */
+static int
+buffer_commit(struct ipset_session *session)
+{
+	if (session->ngroups != 0 && group_commit(session) < 0)
+		return -1;
+	return session_commit(session);
+}
+
+static int session_cmd(struct ipset_session *session, enum ipset_cmd cmd,
+		       uint32_t lineno);
+
+/* The options of the plain elements, the others have got extensions */
+#define AGGR_PLAIN_OPTS				\
+	(IPSET_FLAG(IPSET_SETNAME)		\
+	| IPSET_FLAG(IPSET_OPT_TYPENAME)	\
+	| IPSET_FLAG(IPSET_OPT_FAMILY)		\
+	| IPSET_FLAG(IPSET_OPT_IP)		\
+	| IPSET_FLAG(IPSET_OPT_IP_TO)		\
+	| IPSET_FLAG(IPSET_OPT_CIDR)		\
+	| IPSET_FLAG(IPSET_OPT_FLAGS)		\
+	| IPSET_FLAG(IPSET_OPT_ELEM)		\
+	| IPSET_FLAG(IPSET_OPT_TYPE)		\
+	| IPSET_FLAG(IPSET_OPT_LINENO)		\
+	| IPSET_FLAG(IPSET_OPT_REVISION)	\
+	| IPSET_FLAG(IPSET_OPT_REVISION_MIN))
+
+struct aggr_cb {
+	struct ipset_session *session;
+	const struct ipset_aggr_set *set;
+	enum ipset_cmd cmd;
+};
+
+/* Add a network to the set or delete it */
+static int
+aggr_elem(const union nf_inet_addr *ip, uint8_t cidr, void *p)
+{
+	const struct aggr_cb *cb = p;
+	struct ipset_session *session = cb->session;
+	const struct ipset_aggr_set *s = cb->set;
+	struct ipset_data *data = session->data;
+
+	ipset_data_reset(data);
+	ipset_data_set(data, IPSET_SETNAME, s->setname);
+	ipset_data_set(data, IPSET_OPT_TYPE, s->type);
+	ipset_data_set(data, IPSET_OPT_FAMILY, &s->family);
+	ipset_data_set(data, IPSET_OPT_IP, ip);
+	ipset_data_set(data, IPSET_OPT_CIDR, &cidr);
+	return session_cmd(session, cb->cmd, s->lineno);
+}
+
+/* Add the pending networks of a set, merged or as they are, or delete
+ * the stale ones */
+static int
+aggr_send(struct ipset_session *session, struct ipset_aggr_set *s,
+	  enum ipset_cmd cmd, bool merge)
+{
+	struct ipset_data *data = session->data;
+	struct aggr_cb cb = { .session = session, .set = s, .cmd = cmd };
+	int ret;
+
+	if (s->aggr == NULL ||
+	    (cmd == IPSET_CMD_ADD && !ipset_aggr_pending(s->aggr)))
+		return 0;
+	if (session->aggr_data == NULL) {
+		session->aggr_data = ipset_data_init();
+		if (session->aggr_data == NULL)
+			return ipset_err(session, "Cannot allocate memory");
+	}
+	/* Keep the data of the current command */
+	session->data = session->aggr_data;
+	session->aggr_busy = true;
+	if (cmd == IPSET_CMD_ADD && s->quantize)
+		ret = ipset_aggr_quantize(s->aggr, s->quantize,
+					  aggr_elem, &cb);
+	else if (cmd == IPSET_CMD_ADD)
+		ret = ipset_aggr_walk(s->aggr, merge, aggr_elem, &cb);
+	else
+		ret = ipset_aggr_stale(s->aggr, aggr_elem, &cb);
+	session->aggr_busy = false;
+	session->data = data;
+	if (cmd == IPSET_CMD_ADD && s->quantize) {
+		/* The prefix lengths are chosen, the next elements are
+		 * added as they are */
+		ipset_aggr_fini(s->aggr);
+		s->aggr = NULL;
+		s->enabled = false;
+	}
+	if (ret == -ERANGE && session->report[0] == '\0')
+		return ipset_err(session,
+				 "Set %s: too many networks to expand the "
+				 "elements into the prefix lengths allowed "
+				 "by cidr-quantize", s->setname);
+	if (ret < 0 && session->report[0] == '\0')
+		return ipset_err(session, "Cannot allocate memory");
+	return ret;
+}
+
+/* Add the pending networks as they are and forget the set content:
+ * it is enabled again when the set is known to be empty */
+static int
+aggr_stop(struct ipset_session *session, struct ipset_aggr_set *s,
+	  bool empty)
+{
+	int ret = aggr_send(session, s, IPSET_CMD_ADD, false);
+
+	if (s->aggr != NULL) {
+		ipset_aggr_fini(s->aggr);
+		s->aggr = NULL;
+	}
+	s->enabled = empty;
+	return ret;
+}
+
+static struct ipset_aggr_set *
+aggr_set_find(struct ipset_session *session, const char *setname)
+{
+	unsigned int i;
+
+	for (i = 0; i < session->naggrs; i++)
+		if (STREQ(session->aggrs[i].setname, setname))
+			return &session->aggrs[i];
+	return NULL;
+}
+
+static struct ipset_aggr_set *
+aggr_set_get(struct ipset_session *session, const char *setname)
+{
+	struct ipset_aggr_set *s = aggr_set_find(session, setname);
+
+	if (s != NULL)
+		return s;
+	s = realloc(session->aggrs, (session->naggrs + 1) * sizeof(*s));
+	if (s == NULL)
+		return NULL;
+	session->aggrs = s;
+	s = &session->aggrs[session->naggrs++];
+	memset(s, 0, sizeof(*s));
+	ipset_strlcpy(s->setname, setname, IPSET_MAXNAMELEN);
+	return s;
+}
+
+/* Add the pending networks of all sets */
+static int
+aggr_commit(struct ipset_session *session, bool merge)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < session->naggrs; i++) {
+		ret = aggr_send(session, &session->aggrs[i], IPSET_CMD_ADD,
+				merge);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/* A restore line failed: add the pending networks of all sets as they
+ * are, so the elements of the lines before the failed one are in the
+ * sets like without aggregation. The report of the failure is kept. */
+static void
+aggr_flush(struct ipset_session *session)
+{
+	char report[IPSET_ERRORBUFLEN];
+	enum ipset_err_type err_type = session->err_type;
+	uint32_t lineno = session->lineno;
+	unsigned int i;
+
+	memcpy(report, session->report, sizeof(report));
+	ipset_session_report_reset(session);
+	for (i = 0; i < session->naggrs; i++)
+		aggr_stop(session, &session->aggrs[i], false);
+	buffer_commit(session);
+	memcpy(session->report, report, sizeof(report));
+	session->err_type = err_type;
+	session->lineno = lineno;
+}
+
+/* Collect an add restore line of an enabled hash:net set. Returns 1 when
+ * the line must be executed as usual. */
+static int
+aggr_cmd(struct ipset_session *session, uint32_t lineno)
+{
+	struct ipset_data *data = session->data;
+	const struct ipset_type *type = ipset_data_get(data, IPSET_OPT_TYPE);
+	struct ipset_aggr_set *s;
+	bool pending;
+	int ret;
+
+	s = aggr_set_find(session, ipset_data_setname(data));
+	if (s == NULL || !s->enabled)
+		return 1;
+	if (s->aggr == NULL) {
+		if (!ipset_data_test(data, IPSET_OPT_TYPE) ||
+		    !STREQ(type->name, "hash:net")) {
+			s->enabled = false;
+			return 1;
+		}
+		s->type = type;
+		s->family = ipset_data_family(data);
+		s->aggr = ipset_aggr_init(s->family);
+		if (s->aggr == NULL)
+			return ipset_err(session, "Cannot allocate memory");
+	}
+	if (!ipset_data_test(data, IPSET_OPT_IP))
+		return 1;
+
+	pending = ipset_aggr_pending(s->aggr);
+	ret = ipset_aggr_add(s->aggr, ipset_data_get(data, IPSET_OPT_IP),
+			     ipset_data_test(data, IPSET_OPT_IP_TO) ?
+			     ipset_data_get(data, IPSET_OPT_IP_TO) : NULL,
+			     ipset_data_test(data, IPSET_OPT_CIDR) ?
+			     *(const uint8_t *)ipset_data_get(data,
+							      IPSET_OPT_CIDR)
+			     : 0,
+			     ipset_data_flags_test(data, ~AGGR_PLAIN_OPTS));
+	if (ret < 0)
+		return ipset_err(session, "Cannot allocate memory");
+	if (!pending && ipset_aggr_pending(s->aggr))
+		s->lineno = lineno;
+	if (ret > 0) {
+		ret = aggr_send(session, s, IPSET_CMD_DEL, false);
+		return ret < 0 ? ret : 1;
+	}
+	ipset_data_reset(data);
+	return 0;
+}
+
+/* Update the aggregated sets before any other restore line. Without
+ * the -aggregate option only the sets created with cidr-quantize are
+ * followed. */
+static int
+aggr_other(struct ipset_session *session, enum ipset_cmd cmd)
+{
+	struct ipset_data *data = session->data;
+	bool aggregate = session->envopts & IPSET_ENV_AGGREGATE;
+	const char *setname = NULL;
+	struct ipset_aggr_set *s;
+	uint8_t quantize = 0;
+	unsigned int i;
+	int ret = 0;
+
+	if (ipset_data_test(data, IPSET_SETNAME))
+		setname = ipset_data_setname(data);
+
+	switch (cmd) {
+	case IPSET_CMD_CREATE:
+		if (ipset_data_test(data, IPSET_OPT_QUANTIZE))
+			quantize = *(const uint8_t *)
+				ipset_data_get(data, IPSET_OPT_QUANTIZE);
+		s = aggregate || quantize ? aggr_set_get(session, setname)
+					  : aggr_set_find(session, setname);
+		if (s == NULL)
+			return aggregate || quantize ?
+			       ipset_err(session, "Cannot allocate memory") : 0;
+		/* An existing set is not an error with -exist */
+		ret = aggr_stop(session, s, (aggregate || quantize) &&
+				!(session->envopts & IPSET_ENV_EXIST));
+		s->quantize = quantize;
+		return ret;
+	case IPSET_CMD_FLUSH:
+		if (setname == NULL)
+			break;
+		s = aggregate ? aggr_set_get(session, setname)
+			      : aggr_set_find(session, setname);
+		if (s == NULL)
+			return aggregate ?
+			       ipset_err(session, "Cannot allocate memory") : 0;
+		return aggr_stop(session, s, aggregate || s->quantize);
+	case IPSET_CMD_DEL:
+	case IPSET_CMD_DESTROY:
+	case IPSET_CMD_RENAME:
+	case IPSET_CMD_SWAP:
+		if (setname == NULL)
+			break;
+		/* The content of the set is changed in unknown ways */
+		s = aggr_set_find(session, setname);
+		if (s != NULL)
+			ret = aggr_stop(session, s, false);
+		if (ret < 0 || !ipset_data_test(data, IPSET_OPT_SETNAME2))
+			return ret;
+		s = aggr_set_find(session,
+				  ipset_data_get(data, IPSET_OPT_SETNAME2));
+		if (s != NULL)
+			ret = aggr_stop(session, s, false);
+		return ret;
+	default:
+		/* The elements must be there for test, list, etc. */
+		return aggr_commit(session, false);
+	}
+	/* Flush or destroy all sets */
+	for (i = 0; i < session->naggrs && ret >= 0; i++)
+		ret = aggr_stop(session, &session->aggrs[i],
+				cmd == IPSET_CMD_FLUSH &&
+				(aggregate || session->aggrs[i].quantize));
+	return ret;
+}
+
+/**
+ * ipset_commit - commit buffered commands
+ * @session: session structure
+ *
+ * Commit buffered commands, if there are any.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int
+ipset_commit(struct ipset_session *session)
+{
+	assert(session);
+
+	if (session->naggrs != 0 && !session->aggr_busy) {
+		/* Send the lines executed as usual first: when one of them
+		 * fails, the networks pending are still added */
+		if (buffer_commit(session) < 0) {
+			aggr_flush(session);
+			return -1;
+		}
+		if (aggr_commit(session, true) < 0)
+			return -1;
+	}
+	return buffer_commit(session);
+}
+
+static mnl_cb_t cb_ctl[] = {
+	[NLMSG_NOOP] = callback_noop,
+	[NLMSG_ERROR] = callback_error,
+	[NLMSG_DONE]  = callback_done,
+	[NLMSG_OVERRUN] = callback_noop,
+	[NLMSG_MIN_TYPE] = callback_data,
+};
+
+static inline struct ipset_handle *
+init_transport(struct ipset_session *session)
+{
+	session->handle = session->transport->init(cb_ctl, session);
+
+	return session->handle;
+}
+
+/*
+ * Non-blocking mode
+ */
+
+/* Command submitted in non-blocking mode, waiting for the ACK */
+struct ipset_async {
+	uint32_t seq;				/* Sequence number */
+	enum ipset_cmd cmd;			/* Command */
+	uint32_t lineno;			/* Line number of the caller */
+	const struct ipset_type *type;		/* Type for error decoding */
+	uint8_t family;				/* Family of created set */
+	char setname[IPSET_MAXNAMELEN];		/* For the set cache */
+	char setname2[IPSET_MAXNAMELEN];
+	ipset_async_fn fn;			/* Completion callback */
+	void *p;				/* Private data of fn */
+};
+
+/* Update the set cache as callback_error does at ACK */
+static void
+async_cache_update(const struct ipset_async *a)
+{
+	switch (a->cmd) {
+	case IPSET_CMD_CREATE:
+		ipset_cache_add(a->setname, a->type, a->family);
+		break;
+	case IPSET_CMD_DESTROY:
+		ipset_cache_del(a->setname[0] ? a->setname : NULL);
+		break;
+	case IPSET_CMD_RENAME:
+		ipset_cache_rename(a->setname, a->setname2);
+		break;
+	case IPSET_CMD_SWAP:
+		ipset_cache_swap(a->setname, a->setname2);
+		break;
+	default:
+		break;
+	}
+}
+
+static int
+async_complete(struct ipset_session *session, const struct nlmsghdr *nlh)
+{
+	const struct nlmsgerr *err = mnl_nlmsg_get_payload(nlh);
+	struct ipset_data *data = session->data;
+	enum ipset_cmd cmd = session->cmd;
+	const struct ipset_type *type = session->saved_type;
+	uint32_t lineno = session->lineno;
+	struct ipset_async a;
+	const char *msg = NULL;
+	unsigned int i;
+
+	if (nlh->nlmsg_type != NLMSG_ERROR ||
+	    nlh->nlmsg_len < mnl_nlmsg_size(sizeof(struct nlmsgerr)))
+		return ipset_err(session, "Broken message received "
+				 "in non-blocking mode.");
+	for (i = 0; i < session->nasync; i++)
+		if (session->async[i].seq == nlh->nlmsg_seq)
+			break;
+	if (i == session->nasync)
+		return ipset_err(session, "Unexpected message received "
+				 "in non-blocking mode: seq %u",
+				 nlh->nlmsg_seq);
+	a = session->async[i];
+	session->async[i] = session->async[--session->nasync];
+
+	if (err->error == 0) {
+		async_cache_update(&a);
+	} else {
+		/* Decode the error without touching the data of the caller */
+		session->data = session->async_data;
+		session->cmd = a.cmd;
+		session->saved_type = a.type;
+		session->lineno = a.lineno;
+		decode_errmsg(session, nlh);
+		msg = session->report;
+		session->data = data;
+		session->cmd = cmd;
+		session->saved_type = type;
+	}
+	if (a.fn) {
+		session->async_busy = true;
+		a.fn(session, err->error, session->lineno, msg, a.p);
+		session->async_busy = false;
+	}
+	session->lineno = lineno;
+	if (msg)
+		ipset_session_report_reset(session);
+	return 0;
+}
 
-		if (!ipset_data_test(data, IPSET_SETNAME))
-			return ipset_err(session,
-				"Invalid test command: missing setname");
+/**
+ * ipset_session_fd - switch the session into non-blocking mode
+ * @session: session structure
+ *
+ * Open the channel to the kernel and check the protocol version
+ * (the only blocking steps), then return the file descriptor to poll
+ * for readability in the event loop of the caller. The commands are
+ * submitted by ipset_cmd_async() and the completions are processed
+ * by ipset_async_process().
+ *
+ * Returns the file descriptor or a negative error code.
+ */
+int
+ipset_session_fd(struct ipset_session *session)
+{
+	assert(session);
 
-		if (!ipset_data_test(data, IPSET_OPT_TYPE))
+	if (session->transport->fd == NULL)
+		return ipset_err(session, "Non-blocking mode is not "
+				 "supported by the transport.");
+	if (session->async_data == NULL) {
+		session->async_data = ipset_data_init();
+		if (session->async_data == NULL)
 			return ipset_err(session,
-				"Invalid test command: missing settype");
-
-		type = ipset_data_get(data, IPSET_OPT_TYPE);
-		D("family: %u, type family %u",
-		  ipset_data_family(data), type->family);
-		ADDATTR_SETNAME(session, nlh, data);
-		open_nested(session, nlh, IPSET_ATTR_DATA);
-		addattr_adt(session, nlh, data, ipset_data_family(data));
-		close_nested(session, nlh);
-		break;
+					 "Cannot allocate memory.");
 	}
-	default:
-		return ipset_err(session, "Internal error: unknown command %u",
-				 session->cmd);
+	if (session->async_buf == NULL) {
+		/* Error reports carry the whole sent message */
+		session->async_buf = malloc(2 * session->bufsize);
+		if (session->async_buf == NULL)
+			return ipset_err(session,
+					 "Cannot allocate memory.");
 	}
-	return 0;
+	if (ipset_cmd(session, IPSET_CMD_NONE, 0) < 0)
+		return -1;
+	return session->transport->fd(session->handle);
 }
 
 /**
- * ipset_commit - commit buffered commands
+ * ipset_cmd_async - submit a command in non-blocking mode
  * @session: session structure
+ * @cmd: command to execute
+ * @lineno: line number reported back to the callback
+ * @fn: completion callback, may be NULL
+ * @p: private data passed to @fn
  *
- * Commit buffered commands, if there are any.
+ * Send a command to the kernel without waiting for the result.
+ * The data field of the session must be filled out as for ipset_cmd()
+ * and it is cleared after the call. Every submitted command is sent
+ * in a separate message, in the order of the calls, and @fn is called
+ * from ipset_async_process() with the status (zero or the negative
+ * error code of the kernel), @lineno and the error message.
+ * Listing and saving are not supported in non-blocking mode.
  *
  * Returns 0 on success or a negative error code.
  */
 int
-ipset_commit(struct ipset_session *session)
+ipset_cmd_async(struct ipset_session *session, enum ipset_cmd cmd,
+		uint32_t lineno, ipset_async_fn fn, void *p)
 {
-	struct nlmsghdr *nlh;
-	int ret = 0, i;
+	struct ipset_data *data = session->data;
+	struct nlmsghdr *nlh = session->buffer;
+	struct ipset_async *a;
+	int ret, i;
 
 	assert(session);
 
-	nlh = session->buffer;
-	D("send buffer: len %u, cmd %s",
-	  nlh->nlmsg_len, cmd2name[session->cmd]);
-	if (nlh->nlmsg_len == 0)
-		/* Nothing to do */
-		return 0;
+	if (session->async_buf == NULL)
+		return ipset_err(session, "Session is not in "
+				 "non-blocking mode.");
+	switch (cmd) {
+	case IPSET_CMD_CREATE:
+	case IPSET_CMD_DESTROY:
+	case IPSET_CMD_FLUSH:
+	case IPSET_CMD_ZERO:
+	case IPSET_CMD_RENAME:
+	case IPSET_CMD_SWAP:
+	case IPSET_CMD_ADD:
+	case IPSET_CMD_DEL:
+	case IPSET_CMD_TEST:
+		break;
+	default:
+		return ipset_err(session, "Command %s is not supported "
+				 "in non-blocking mode.",
+				 cmd > IPSET_CMD_NONE && cmd < IPSET_MSG_MAX
+				 ? cmd2name[cmd] : "unknown");
+	}
+	/* Send the commands buffered by ipset_cmd() first */
+	ret = ipset_commit(session);
+	if (ret < 0)
+		goto cleanup;
 
-	/* Close nested data blocks */
+	if (session->nasync == session->async_size) {
+		unsigned int size = session->async_size ?
+				    2 * session->async_size : 64;
+
+		a = realloc(session->async, size * sizeof(*a));
+		if (a == NULL) {
+			ret = ipset_err(session, "Cannot allocate memory.");
+			goto cleanup;
+		}
+		session->async = a;
+		session->async_size = size;
+	}
+	a = &session->async[session->nasync];
+	memset(a, 0, sizeof(*a));
+
+	session->cmd = cmd;
+	session->lineno = lineno;
+	ret = build_msg(session, false);
+	if (ret > 0)
+		ret = ipset_err(session, "Internal error: "
+				"element does not fit into a message");
+	if (ret < 0)
+		goto reset;
 	for (i = session->nestid - 1; i >= 0; i--)
 		close_nested(session, nlh);
 
-	/* Send buffer */
-	ret = session->transport->query(session->handle,
-					session->buffer,
-					session->bufsize);
+	a->cmd = cmd;
+	a->lineno = lineno;
+	a->type = ipset_data_get(data, IPSET_OPT_TYPE);
+	a->family = ipset_data_family(data);
+	if (ipset_data_test(data, IPSET_SETNAME))
+		ipset_strlcpy(a->setname, ipset_data_setname(data),
+			      IPSET_MAXNAMELEN);
+	if (ipset_data_test(data, IPSET_OPT_SETNAME2))
+		ipset_strlcpy(a->setname2,
+			      ipset_data_get(data, IPSET_OPT_SETNAME2),
+			      IPSET_MAXNAMELEN);
+	a->fn = fn;
+	a->p = p;
+
+	ret = session->transport->send(session->handle, session->buffer,
+				       session->bufsize);
+	if (ret < 0) {
+		ret = ipset_err(session, "Cannot send message to kernel.");
+		goto reset;
+	}
+	a->seq = nlh->nlmsg_seq;
+	session->nasync++;
 
-	/* Reset saved data and nested state */
-	session->saved_setname[0] = '\0';
-	session->printed_set = 0;
+reset:
 	for (i = session->nestid - 1; i >= 0; i--)
 		session->nested[i] = NULL;
 	session->nestid = 0;
+	session->lineno = 0;
 	nlh->nlmsg_len = 0;
+cleanup:
+	ipset_data_reset(data);
+	return ret;
+}
 
-	D("ret: %d", ret);
+/**
+ * ipset_async_process - process the completed commands
+ * @session: session structure
+ *
+ * Read the available replies of the kernel without blocking and
+ * call the completion callbacks of the commands. Call it when the
+ * file descriptor returned by ipset_session_fd() is readable.
+ *
+ * Returns the number of completed commands or a negative error code.
+ */
+int
+ipset_async_process(struct ipset_session *session)
+{
+	const struct nlmsghdr *nlh;
+	int len, n = 0;
 
-	if (ret < 0) {
-		if (session->report[0] != '\0')
-			return -1;
-		else
-			return ipset_err(session,
-					 "Internal protocol error");
+	assert(session);
+
+	/* The receive buffer is in use */
+	if (session->async_busy)
+		return 0;
+	while (session->nasync > 0) {
+		len = session->transport->recv(session->handle,
+					       session->async_buf,
+					       2 * session->bufsize);
+		if (len == 0)
+			break;
+		if (len < 0)
+			return ipset_err(session, "Cannot receive message "
+					 "from kernel: %s", strerror(-len));
+		for (nlh = session->async_buf; mnl_nlmsg_ok(nlh, len);
+		     nlh = mnl_nlmsg_next(nlh, &len)) {
+			if (async_complete(session, nlh) < 0)
+				return -1;
+			n++;
+		}
 	}
-	return 0;
+	return n;
 }
 
-static mnl_cb_t cb_ctl[] = {
-	[NLMSG_NOOP] = callback_noop,
-	[NLMSG_ERROR] = callback_error,
-	[NLMSG_DONE]  = callback_done,
-	[NLMSG_OVERRUN] = callback_noop,
-	[NLMSG_MIN_TYPE] = callback_data,
-};
-
-static inline struct ipset_handle *
-init_transport(struct ipset_session *session)
+/**
+ * ipset_async_pending - number of commands waiting for completion
+ * @session: session structure
+ *
+ * Returns the number of submitted but not yet completed commands.
+ */
+unsigned int
+ipset_async_pending(const struct ipset_session *session)
 {
-	session->handle = session->transport->init(cb_ctl, session);
+	assert(session);
 
-	return session->handle;
+	return session->nasync;
 }
 
 /**
- * ipset_cmd - execute a command
+ * ipset_async_wait - wait for the completion of all commands
  * @session: session structure
- * @cmd: command to execute
- * @lineno: command line number in restore mode
  *
- * Execute - or prepare/buffer in restore mode - a command.
- * It is the caller responsibility that the data field be filled out
- * with all required parameters for a successful execution.
- * The data field is cleared after this function call for the public
- * commands.
+ * Block until all submitted commands are completed. Blocking
+ * commands call it implicitly, because the replies must not be
+ * mixed on the channel, therefore blocking commands cannot be
+ * executed from the completion callbacks.
  *
  * Returns 0 on success or a negative error code.
  */
 int
-ipset_cmd(struct ipset_session *session, enum ipset_cmd cmd, uint32_t lineno)
+ipset_async_wait(struct ipset_session *session)
+{
+	struct pollfd pfd;
+
+	assert(session);
+
+	if (session->nasync == 0)
+		return 0;
+	if (session->async_busy)
+		return ipset_err(session, "Blocking command cannot be "
+				 "executed from a completion callback.");
+	pfd.fd = session->transport->fd(session->handle);
+	pfd.events = POLLIN;
+	while (session->nasync > 0) {
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			return ipset_err(session, "Cannot wait for kernel: %s",
+					 strerror(errno));
+		if (ipset_async_process(session) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* List the headers with the statistics of the sets, then zero the
+ * counters when asked so
+ */
+static int
+stats_cmd(struct ipset_session *session, uint32_t lineno)
+{
+	struct ipset_data *data = session->data;
+	char setname[IPSET_MAXNAMELEN] = "";
+	uint16_t envopts = session->envopts;
+	int ret;
+
+	if (ipset_data_test(data, IPSET_SETNAME))
+		strcpy(setname, ipset_data_setname(data));
+
+	session->envopts |= IPSET_ENV_LIST_HEADER;
+	ret = session_cmd(session, IPSET_CMD_LIST, lineno);
+	session->envopts = envopts;
+	if (ret < 0 || !(envopts & IPSET_ENV_ZERO))
+		return ret;
+
+	ipset_data_reset(data);
+	if (setname[0] != '\0')
+		ipset_data_set(data, IPSET_SETNAME, setname);
+	return session_cmd(session, IPSET_CMD_ZERO, lineno);
+}
+
+static int
+session_cmd(struct ipset_session *session, enum ipset_cmd cmd,
+	    uint32_t lineno)
 {
 	struct ipset_data *data;
-	bool aggregate = false;
+	bool aggregate = false, total;
 	int ret = -1;
 
 	assert(session);
 
+	if (cmd == IPSET_CMD_STATS)
+		return stats_cmd(session, lineno);
 	if (cmd < IPSET_CMD_NONE || cmd >= IPSET_MSG_MAX)
 		return 0;
 
@@ -2174,15 +4201,44 @@ ipset_cmd(struct ipset_session *session, enum ipset_cmd cmd, uint32_t lineno)
 	if (cmd == IPSET_CMD_TYPE || cmd == IPSET_CMD_HEADER)
 		return build_send_private_msg(session, cmd);
 
+	/* Aggregate the add lines of hash:net sets at restore */
+	if (lineno != 0 && !session->aggr_busy &&
+	    ((session->envopts & IPSET_ENV_AGGREGATE) || session->naggrs ||
+	     ipset_data_test(data, IPSET_OPT_QUANTIZE))) {
+		if (cmd == IPSET_CMD_ADD) {
+			ret = aggr_cmd(session, lineno);
+			if (ret <= 0)
+				return ret;
+		} else {
+			ret = aggr_other(session, cmd);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	/* Group the add/del lines of restore by set */
+	if (lineno != 0 && (cmd == IPSET_CMD_ADD || cmd == IPSET_CMD_DEL) &&
+	    (session->envopts & IPSET_ENV_GROUP) &&
+	    ipset_data_test(data, IPSET_SETNAME) &&
+	    ipset_data_test(data, IPSET_OPT_TYPE))
+		return group_cmd(session, cmd, lineno);
+
 	/* Check aggregatable commands */
 	aggregate = may_aggregate_ad(session, cmd);
 	if (!aggregate) {
 		/* Flush possible aggregated commands */
-		ret = ipset_commit(session);
+		ret = buffer_commit(session);
 		if (ret < 0)
 			return ret;
 	}
 
+	/* Save all sets in parallel jobs */
+	if (cmd == IPSET_CMD_SAVE && session->jobs > 1 &&
+	    !ipset_data_test(data, IPSET_SETNAME) &&
+	    (session->mode == IPSET_LIST_NONE ||
+	     session->mode == IPSET_LIST_SAVE))
+		return save_parallel(session);
+
 	/* Real command: update lineno too */
 	session->cmd = cmd;
 	session->lineno = lineno;
@@ -2195,10 +4251,22 @@ ipset_cmd(struct ipset_session *session, enum ipset_cmd cmd, uint32_t lineno)
 		if (session->mode == IPSET_LIST_NONE)
 			session->mode = IPSET_LIST_SAVE;
 	}
+	/* Listing all sets in plain mode: print the totals if requested */
+	total = cmd == IPSET_CMD_LIST &&
+		session->mode == IPSET_LIST_PLAIN &&
+		(session->envopts & IPSET_ENV_TOTAL) &&
+		!ipset_data_test(data, IPSET_SETNAME);
 	/* Start the root element in XML mode */
 	if ((cmd == IPSET_CMD_LIST || cmd == IPSET_CMD_SAVE) &&
 	    session->mode == IPSET_LIST_XML)
 		safe_snprintf(session, "<ipsets>\n");
+	/* Start the binary snapshot */
+	if ((cmd == IPSET_CMD_LIST || cmd == IPSET_CMD_SAVE) &&
+	    session->mode == IPSET_LIST_BINARY) {
+		ret = snapshot_start(session);
+		if (ret < 0)
+			goto cleanup;
+	}
 
 	D("next: build_msg");
 	/* Build new message or append buffered commands */
@@ -2206,7 +4274,7 @@ ipset_cmd(struct ipset_session *session, enum ipset_cmd cmd, uint32_t lineno)
 	D("build_msg returned %u", ret);
 	if (ret > 0) {
 		/* Buffer is full, send buffered commands */
-		ret = ipset_commit(session);
+		ret = buffer_commit(session);
 		if (ret < 0)
 			goto cleanup;
 		ret = build_msg(session, false);
@@ -2229,7 +4297,12 @@ ipset_cmd(struct ipset_session *session, enum ipset_cmd cmd, uint32_t lineno)
 	}
 
 	D("call commit");
-	ret = ipset_commit(session);
+	ret = buffer_commit(session);
+	if (ret == 0 && total)
+		ret = print_total(session);
+	else if (ret == 0 && session->mode == IPSET_LIST_BINARY &&
+		 (cmd == IPSET_CMD_LIST || cmd == IPSET_CMD_SAVE))
+		ret = snapshot_end(session);
 
 cleanup:
 	D("reset data");
@@ -2237,6 +4310,243 @@ cleanup:
 	return ret;
 }
 
+/**
+ * ipset_cmd - execute a command
+ * @session: session structure
+ * @cmd: command to execute
+ * @lineno: command line number in restore mode
+ *
+ * Execute - or prepare/buffer in restore mode - a command.
+ * It is the caller responsibility that the data field be filled out
+ * with all required parameters for a successful execution.
+ * The data field is cleared after this function call for the public
+ * commands.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int
+ipset_cmd(struct ipset_session *session, enum ipset_cmd cmd, uint32_t lineno)
+{
+	enum ipset_phase phase;
+	int ret;
+
+	assert(session);
+
+	phase = phase_enter(session, IPSET_PHASE_ENCODE);
+	ret = session_cmd(session, cmd, lineno);
+	if (ret < 0 && lineno != 0 && session->naggrs != 0)
+		aggr_flush(session);
+	phase_enter(session, phase);
+	return ret;
+}
+
+static int
+snapshot_create(struct ipset_session *session, const struct nlattr *rec)
+{
+	struct nlattr *nla[IPSET_ATTR_CMD_MAX+1] = {};
+	struct nlmsghdr *nlh = session->buffer;
+	const struct nlattr *attr;
+	unsigned int i;
+
+	/* Flush the elements of the previous set */
+	if (ipset_commit(session) < 0)
+		return -1;
+
+	if (mnl_attr_parse_nested(rec, cmd_attr_cb, nla) < MNL_CB_STOP ||
+	    !nla[IPSET_ATTR_DATA])
+		return ipset_err(session, "Broken snapshot: "
+				 "invalid set record!");
+	ipset_data_reset(session->data);
+	for (i = 0; i < ARRAY_SIZE(snapshot_set_attrs); i++) {
+		if (!nla[snapshot_set_attrs[i]])
+			return ipset_err(session, "Broken snapshot: "
+					 "invalid set record!");
+		if (attr2data(session, nla, snapshot_set_attrs[i],
+			      cmd_attrs) < 0)
+			return -1;
+	}
+	/* We have to save the type for error handling */
+	session->saved_type = ipset_type_check(session);
+	if (session->saved_type == NULL)
+		return -1;
+
+	if (MNL_NLMSG_HDRLEN + MNL_ALIGN(sizeof(struct nfgenmsg)) +
+	    MNL_ATTR_HDRLEN + MNL_ALIGN(sizeof(uint8_t)) + rec->nla_len +
+	    MNL_ALIGN(sizeof(struct nlmsgerr)) > session->bufsize)
+		return ipset_err(session, "Broken snapshot: "
+				 "set record of %s is too large!",
+				 ipset_data_setname(session->data));
+
+	session->cmd = IPSET_CMD_CREATE;
+	session->transport->fill_hdr(session->handle, session->cmd,
+				     session->buffer, session->bufsize,
+				     session->envopts);
+	ADDATTR_PROTOCOL(nlh, session->protocol);
+	mnl_attr_for_each_nested(attr, rec)
+		snapshot_copy_attr(nlh, attr);
+
+	return ipset_commit(session);
+}
+
+static int
+snapshot_add(struct ipset_session *session, const struct nlattr *rec)
+{
+	struct nlmsghdr *nlh = session->buffer;
+	uint32_t lineno = 0;
+
+	if (session->saved_type == NULL)
+		return ipset_err(session, "Broken snapshot: "
+				 "element record without set record!");
+	if (nlh->nlmsg_len != 0 &&
+	    nlh->nlmsg_len + MNL_ALIGN(rec->nla_len) +
+	    MNL_ALIGN(sizeof(struct nlmsgerr)) > session->bufsize &&
+	    ipset_commit(session) < 0)
+		return -1;
+	if (nlh->nlmsg_len == 0) {
+		/* Start a new batch of the elements */
+		session->cmd = IPSET_CMD_ADD;
+		session->transport->fill_hdr(session->handle, session->cmd,
+					     session->buffer,
+					     session->bufsize,
+					     session->envopts);
+		ADDATTR_PROTOCOL(nlh, session->protocol);
+		ADDATTR_SETNAME(session, nlh, session->data);
+		/* Elements don't carry lineno: errors are reported as is */
+		ADDATTR_RAW(session, nlh, &lineno, IPSET_ATTR_LINENO,
+			    cmd_attrs);
+		open_nested(session, nlh, IPSET_ATTR_ADT);
+		if (nlh->nlmsg_len + MNL_ALIGN(rec->nla_len) +
+		    MNL_ALIGN(sizeof(struct nlmsgerr)) > session->bufsize)
+			return ipset_err(session, "Broken snapshot: "
+					 "element record of %s is too large!",
+					 ipset_data_setname(session->data));
+	}
+	snapshot_copy_attr(nlh, rec);
+	return 0;
+}
+
+static int
+snapshot_load(struct ipset_session *session, const void *buf, size_t len)
+{
+	const struct ipset_snapshot_hdr *hdr = buf;
+	const char *end = (const char *)buf + len;
+	const struct nlattr *rec;
+	int ret = 0;
+
+	if (len < sizeof(*hdr) ||
+	    memcmp(hdr->magic, IPSET_SNAPSHOT_MAGIC, sizeof(hdr->magic)))
+		return ipset_err(session, "Broken snapshot: "
+				 "invalid header!");
+	if (hdr->version != IPSET_SNAPSHOT_VERSION)
+		return ipset_err(session, "Snapshot version %u is not "
+				 "supported", hdr->version);
+	if (hdr->byteorder != IPSET_SNAPSHOT_BYTEORDER)
+		return ipset_err(session, "Snapshot was saved on a host "
+				 "with different byte order");
+	if (len - sizeof(*hdr) > INT_MAX)
+		return ipset_err(session, "Snapshot is too large");
+
+	/* Initialize transport and check protocol version */
+	if (ipset_cmd(session, IPSET_CMD_NONE, 0) < 0)
+		return -1;
+	session->saved_type = NULL;
+	session->lineno = 0;
+
+	for (rec = (const void *)(hdr + 1);
+	     mnl_attr_ok(rec, end - (const char *)rec);
+	     rec = mnl_attr_next(rec)) {
+		switch (mnl_attr_get_type(rec)) {
+		case IPSET_SNAPSHOT_SET:
+			ret = snapshot_create(session, rec);
+			break;
+		case IPSET_SNAPSHOT_ELEM:
+			ret = snapshot_add(session, rec);
+			break;
+		case IPSET_SNAPSHOT_END:
+			return ipset_commit(session);
+		default:
+			ret = ipset_err(session, "Broken snapshot: "
+					"unknown record type %u!",
+					mnl_attr_get_type(rec));
+		}
+		if (ret < 0)
+			goto cleanup;
+	}
+	ret = ipset_err(session, "Broken snapshot: truncated file!");
+
+cleanup:
+	/* Drop the unsent elements */
+	((struct nlmsghdr *)session->buffer)->nlmsg_len = 0;
+	memset(session->nested, 0, sizeof(session->nested));
+	session->nestid = 0;
+	return ret;
+}
+
+/**
+ * ipset_snapshot_restore - restore sets from a binary snapshot
+ * @session: session structure
+ * @f: stream positioned at the start of the snapshot
+ *
+ * Create the sets and add the elements stored in a binary snapshot
+ * produced by the "binary" output mode. Regular files are mapped into
+ * memory, other streams are read into a buffer first.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int
+ipset_snapshot_restore(struct ipset_session *session, FILE *f)
+{
+	void *map = MAP_FAILED;
+	char *buf = NULL;
+	size_t size = 0, len = 0;
+	struct stat st;
+	off_t offset;
+	int ret;
+
+	assert(session);
+	assert(f);
+
+	offset = ftello(f);
+	if (offset >= 0 && offset % MNL_ALIGNTO == 0 &&
+	    fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) &&
+	    st.st_size > offset) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+			   fileno(f), 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			ret = snapshot_load(session, (char *)map + offset,
+					    st.st_size - offset);
+			munmap(map, st.st_size);
+			return ret;
+		}
+	}
+
+	/* Pipe or unmappable file: read it in */
+	do {
+		if (len == size) {
+			char *tmp;
+
+			size = size ? 2 * size : 1024 * 1024;
+			tmp = realloc(buf, size);
+			if (tmp == NULL) {
+				free(buf);
+				return ipset_err(session,
+					"Cannot allocate memory for snapshot");
+			}
+			buf = tmp;
+		}
+		len += fread(buf + len, 1, size - len, f);
+	} while (len == size);
+	if (ferror(f)) {
+		free(buf);
+		return ipset_err(session, "Cannot read snapshot: %s",
+				 strerror(errno));
+	}
+	ret = snapshot_load(session, buf, len);
+	free(buf);
+	return ret;
+}
+
 static
 int __attribute__ ((format (printf, 3, 4)))
 default_print_outfn(struct ipset_session *session, void *p UNUSED,
@@ -2308,8 +4618,9 @@ ipset_session_init(ipset_print_outfn print_outfn, void *p)
 	INIT_LIST_HEAD(&session->sorted);
 	INIT_LIST_HEAD(&session->pool);
 
-	/* The single transport method yet */
-	session->transport = &ipset_mnl_transport;
+	/* Kernel or the emulated one for testing */
+	session->transport = getenv("IPSET_FAKE_STATE") != NULL
+			     ? &ipset_fake_transport : &ipset_mnl_transport;
 
 	/* Output function */
 	ipset_session_print_outfn(session, print_outfn, p);
@@ -2553,6 +4864,33 @@ ipset_session_fini(struct ipset_session *session)
 		list_del(&pos->list);
 		free(pos);
 	}
+	free(session->async);
+	free(session->async_buf);
+	if (session->async_data)
+		ipset_data_fini(session->async_data);
+	if (session->caps) {
+		if (session->caps->dirty && session->caps->file[0] != '\0')
+			caps_save(session->caps);
+		free(session->caps);
+	}
+	if (session->groups) {
+		unsigned int i;
+
+		for (i = 0; i < IPSET_GROUP_MAX; i++)
+			free(session->groups[i].buffer);
+		free(session->groups);
+	}
+	if (session->aggrs) {
+		unsigned int i;
+
+		for (i = 0; i < session->naggrs; i++)
+			if (session->aggrs[i].aggr)
+				ipset_aggr_fini(session->aggrs[i].aggr);
+		free(session->aggrs);
+	}
+	if (session->aggr_data)
+		ipset_data_fini(session->aggr_data);
+	ipset_resolve_fini(session->resolve);
 	free(session->outbuf);
 	free(session);
 	return 0;
@@ -23,7 +23,9 @@
 #include <dlfcn.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <unistd.h>
 #endif
+#include <time.h>				/* clock_gettime */
 
 /* Userspace cache of sets which exists in the kernel */
 
@@ -36,6 +38,16 @@ struct ipset {
 
 static struct ipset_type *typelist;		/* registered set types */
 static struct ipset *setlist;			/* cached sets */
+static uint64_t types_load_ns;			/* time of registering types */
+
+static uint64_t
+types_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
 /**
  * ipset_cache_add - add a set to the cache
@@ -198,6 +210,175 @@ ipset_match_typename(const char *name, const struct ipset_type *type)
 	return false;
 }
 
+extern void ipset_types_init(void);
+extern int ipset_types_init_module(const char *module);
+
+/* Index of the known set types to register them on demand */
+struct ipset_type_index {
+	const char *name;			/* type name */
+	const char *alias;			/* type alias */
+	const char *module;			/* module name */
+	bool loaded;				/* module is registered */
+};
+
+static struct ipset_type_index type_index[] = {
+	{ "bitmap:ip",		"ipmap",	"ipset_bitmap_ip" },
+	{ "bitmap:ip,mac",	"macipmap",	"ipset_bitmap_ipmac" },
+	{ "bitmap:port",	"portmap",	"ipset_bitmap_port" },
+	{ "hash:ip",		"iphash",	"ipset_hash_ip" },
+	{ "hash:ip,mac",	"ipmachash",	"ipset_hash_ipmac" },
+	{ "hash:ip,mark",	"ipmarkhash",	"ipset_hash_ipmark" },
+	{ "hash:ip,port",	"ipporthash",	"ipset_hash_ipport" },
+	{ "hash:ip,port,ip",	"ipportiphash",	"ipset_hash_ipportip" },
+	{ "hash:ip,port,net",	"ipportnethash", "ipset_hash_ipportnet" },
+	{ "hash:mac",		"machash",	"ipset_hash_mac" },
+	{ "hash:net",		"nethash",	"ipset_hash_net" },
+	{ "hash:net,iface",	"netifacehash",	"ipset_hash_netiface" },
+	{ "hash:net,net",	"netnethash",	"ipset_hash_netnet" },
+	{ "hash:net,port",	"netporthash",	"ipset_hash_netport" },
+	{ "hash:net,port,net",	"netportnethash", "ipset_hash_netportnet" },
+	{ "list:set",		"setlist",	"ipset_list_set" },
+};
+
+static bool types_loaded;			/* all types are registered */
+
+#ifdef ENABLE_SETTYPE_MODULES
+static void
+load_module_file(const char *file)
+{
+	if (dlopen(file, RTLD_NOW) == NULL)
+		fprintf(stderr, "%s: %s\n", file, dlerror());
+}
+#endif
+
+/* Register all set types, static ones and from the modules directories */
+static void
+load_all_types(void)
+{
+#ifdef ENABLE_SETTYPE_MODULES
+	const char *dir  = IPSET_MODSDIR;
+	const char *next = NULL;
+	char   path[256];
+	char   file[256];
+	struct dirent **list = NULL;
+	int    n;
+	int    len;
+#endif
+	uint64_t start;
+	unsigned int i;
+
+	if (types_loaded)
+		return;
+	start = types_now();
+	types_loaded = true;
+	for (i = 0; i < ARRAY_SIZE(type_index); i++)
+		type_index[i].loaded = true;
+
+	/* Initialize static types */
+	ipset_types_init();
+
+#ifdef ENABLE_SETTYPE_MODULES
+	/* Initialize dynamic types */
+	do {
+		next = strchr(dir, ':');
+		if (next == NULL)
+			next = dir + strlen(dir);
+
+		len = snprintf(path, sizeof(path), "%.*s",
+			       (unsigned int)(next - dir), dir);
+
+		if (len >= (int)sizeof(path) || len < 0)
+			continue;
+
+		n = scandir(path, &list, NULL, alphasort);
+		if (n < 0)
+			continue;
+
+		while (n--) {
+			if (strstr(list[n]->d_name, ".so") == NULL)
+				goto nextf;
+
+			len = snprintf(file, sizeof(file), "%s/%s",
+				       path, list[n]->d_name);
+			if (len >= (int)sizeof(file) || len < (int)0)
+				goto nextf;
+
+			load_module_file(file);
+
+nextf:
+			free(list[n]);
+		}
+
+		free(list);
+
+		dir = next + 1;
+	} while (*next != '\0');
+#endif /* ENABLE_SETTYPE_MODULES */
+	types_load_ns += types_now() - start;
+}
+
+/* Register the revisions of a set type from the index */
+static void
+load_indexed_type(struct ipset_type_index *idx)
+{
+#ifdef ENABLE_SETTYPE_MODULES
+	const char *dir  = IPSET_MODSDIR;
+	const char *next = NULL;
+	char   file[256];
+	int    len;
+#endif
+	uint64_t start = types_now(), ns;
+
+	idx->loaded = true;
+	if (ipset_types_init_module(idx->module) == 0)
+		goto out;
+
+#ifdef ENABLE_SETTYPE_MODULES
+	/* Not built in: find the module */
+	do {
+		next = strchr(dir, ':');
+		if (next == NULL)
+			next = dir + strlen(dir);
+
+		len = snprintf(file, sizeof(file), "%.*s/%s.so",
+			       (unsigned int)(next - dir), dir, idx->module);
+		if (len < (int)sizeof(file) && len >= 0 &&
+		    access(file, R_OK) == 0) {
+			load_module_file(file);
+			goto out;
+		}
+		dir = next + 1;
+	} while (*next != '\0');
+#endif /* ENABLE_SETTYPE_MODULES */
+
+out:
+	ns = types_now() - start;
+	types_load_ns += ns;
+	D("type %s registered in %llu usec", idx->name,
+	  (unsigned long long) ns / 1000);
+}
+
+/* Register the set type with the name or alias on demand */
+static void
+load_type(const char *name)
+{
+	unsigned int i;
+
+	if (types_loaded)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(type_index); i++) {
+		if (STREQ(name, type_index[i].name) ||
+		    STREQ(name, type_index[i].alias)) {
+			if (!type_index[i].loaded)
+				load_indexed_type(&type_index[i]);
+			return;
+		}
+	}
+	/* Not in the index, can be provided by an external module */
+	load_all_types();
+}
+
 static inline const struct ipset_type *
 create_type_get(struct ipset_session *session)
 {
@@ -214,6 +395,7 @@ create_type_get(struct ipset_session *session)
 	typename = ipset_data_get(data, IPSET_OPT_TYPENAME);
 	assert(typename);
 	family = ipset_data_family(data);
+	load_type(typename);
 
 	/* Check registered types in userspace */
 	for (t = typelist; t != NULL; t = t->next) {
@@ -348,6 +530,7 @@ adt_type_get(struct ipset_session *session)
 	typename = ipset_data_get(data, IPSET_OPT_TYPENAME);
 	revision = ipset_data_get(data, IPSET_OPT_REVISION);
 	family = ipset_data_family(data);
+	load_type(typename);
 
 	/* Check registered types */
 	for (t = typelist, match = NULL;
@@ -463,6 +646,7 @@ ipset_type_check(struct ipset_session *session)
 	typename = ipset_data_get(data, IPSET_OPT_TYPENAME);
 	family = ipset_data_family(data);
 	revision = *(const uint8_t *) ipset_data_get(data, IPSET_OPT_REVISION);
+	load_type(typename);
 
 	/* Check registered types */
 	for (t = typelist; t != NULL && match == NULL; t = t->next) {
@@ -556,6 +740,7 @@ ipset_typename_resolve(const char *str)
 {
 	const struct ipset_type *t;
 
+	load_type(str);
 	for (t = typelist; t != NULL; t = t->next)
 		if (ipset_match_typename(str, t))
 			return t->name;
@@ -573,6 +758,7 @@ ipset_typename_resolve(const char *str)
 const struct ipset_type *
 ipset_types(void)
 {
+	load_all_types();
 	return typelist;
 }
 
@@ -606,68 +792,26 @@ ipset_cache_fini(void)
 	}
 }
 
-extern void ipset_types_init(void);
+/**
+ * ipset_types_load_time - time spent in registering the set types
+ *
+ * Returns the time in nanoseconds spent in registering the set types
+ * and loading their modules so far.
+ */
+uint64_t
+ipset_types_load_time(void)
+{
+	return types_load_ns;
+}
 
 /**
  * ipset_load_types - load known set types
  *
- * Load in (register) all known set types for the system
+ * Prepare the known set types for the system. The types are
+ * registered on demand, when they are first referred by name.
  */
 void
 ipset_load_types(void)
 {
-#ifdef ENABLE_SETTYPE_MODULES
-	const char *dir  = IPSET_MODSDIR;
-	const char *next = NULL;
-	char   path[256];
-	char   file[256];
-	struct dirent **list = NULL;
-	int    n;
-	int    len;
-#endif
-
-	if (typelist != NULL)
-		return;
-
-	/* Initialize static types */
-	ipset_types_init();
-
-#ifdef ENABLE_SETTYPE_MODULES
-	/* Initialize dynamic types */
-	do {
-		next = strchr(dir, ':');
-		if (next == NULL)
-			next = dir + strlen(dir);
-
-		len = snprintf(path, sizeof(path), "%.*s",
-			       (unsigned int)(next - dir), dir);
-
-		if (len >= (int)sizeof(path) || len < 0)
-			continue;
-
-		n = scandir(path, &list, NULL, alphasort);
-		if (n < 0)
-			continue;
-
-		while (n--) {
-			if (strstr(list[n]->d_name, ".so") == NULL)
-				goto nextf;
-
-			len = snprintf(file, sizeof(file), "%s/%s",
-				       path, list[n]->d_name);
-			if (len >= (int)sizeof(file) || len < (int)0)
-				goto nextf;
-
-			if (dlopen(file, RTLD_NOW) == NULL)
-				fprintf(stderr, "%s: %s\n", file, dlerror());
-
-nextf:
-			free(list[n]);
-		}
-
-		free(list);
-
-		dir = next + 1;
-	} while (*next != '\0');
-#endif /* ENABLE_SETTYPE_MODULES */
+	D("set types are registered on demand");
 }
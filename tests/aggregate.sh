@@ -0,0 +1,89 @@
+#!/bin/sh
+
+# Restore a generated blocklist into hash:net sets with and without
+# the -aggregate option, report the number of entries and distinct
+# prefix lengths and check the sets match the same addresses:
+#
+#	./aggregate.sh [networks [seed [quantize]]]
+#
+# With quantize, the set created with the cidr-quantize option is
+# compared too.
+#
+# The blocklist is synthetic: adjacent, overlapping and duplicated
+# networks and ranges from a few /16 blocks, like merged public lists.
+# The set is flushed after creating it, as -exist is used.
+
+ipset=${IPSET_BIN:-../src/ipset}
+
+nets=${1:-20000}
+seed=${2:-1}
+quantize=$3
+
+awk -v n=$nets -v seed=$seed 'BEGIN {
+    srand(seed)
+    print "create bl hash:net maxelem " 2 * n
+    print "flush bl"
+    for (i = 0; i < n; i++) {
+        a = int(rand() * 64); b = int(rand() * 256); c = int(rand() * 256)
+        r = rand()
+        if (r < 0.1) {
+            e = b + int(rand() * 4)
+            printf "add bl 10.%d.%d.0-10.%d.%d.255\n", a, b, a, (e > 255 ? 255 : e)
+        } else if (r < 0.4)
+            printf "add bl 10.%d.%d.0/24\n", a, b
+        else if (r < 0.5)
+            printf "add bl 10.%d.%d.%d/%d\n", a, b, c, 20 + int(rand() * 4)
+        else
+            printf "add bl 10.%d.%d.%d/%d\n", a, b, c, 25 + int(rand() * 8)
+    }
+}' > .foo.restore
+
+stats() {
+    $ipset save bl | awk '$1 == "add" {
+        n++; split($3, p, "/"); l[p[2] == "" ? 32 : p[2]] = 1
+    } END {
+        for (i in l) k++
+        printf "%d entries, %d prefix lengths", n, k
+    }'
+}
+
+# Random addresses from the blocks and the edges of the elements
+probes() {
+    awk -v seed=$seed 'BEGIN { srand(seed + 1) } $1 == "add" {
+        split($3, p, "[/-]"); print p[1]
+        if (rand() < 0.05)
+            printf "10.%d.%d.%d\n", int(rand() * 64), int(rand() * 256), int(rand() * 256)
+    }' .foo.restore | head -500
+}
+
+match() {
+    for ip in $(probes); do
+        $ipset -q test bl $ip && echo "$ip" || echo "$ip no"
+    done
+}
+
+$ipset x bl >/dev/null 2>&1
+$ipset -exist restore < .foo.restore || exit 1
+plain=$(stats)
+match > .foo.plain
+$ipset x bl
+$ipset -exist -aggregate restore < .foo.restore || exit 1
+aggregated=$(stats)
+match > .foo.aggregated
+$ipset x bl
+echo "plain: $plain"
+echo "aggregated: $aggregated"
+cmp -s .foo.plain .foo.aggregated
+ret=$?
+if [ -n "$quantize" -a $ret -eq 0 ]; then
+    sed -i "1s/maxelem .*/maxelem 1048576 cidr-quantize $quantize/" .foo.restore
+    $ipset -exist restore < .foo.restore || exit 1
+    quantized=$(stats)
+    match > .foo.quantized
+    $ipset x bl
+    echo "quantized: $quantized"
+    cmp -s .foo.plain .foo.quantized
+    ret=$?
+fi
+rm -f .foo.restore .foo.plain .foo.aggregated .foo.quantized
+exit $ret
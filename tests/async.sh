@@ -0,0 +1,45 @@
+#!/bin/sh
+
+# Check the non-blocking session API by the ipset_async example:
+#
+#	./async.sh add|del|error|test
+
+ipset=${IPSET_BIN:-../src/ipset}
+async=${IPSET_ASYNC_BIN:-../utils/ipset_async/ipset_async}
+
+$ipset x test >/dev/null 2>&1
+$ipset n test hash:ip || exit 1
+
+case "$1" in
+add)
+	# All elements are added with many commands in flight
+	seq 1 10000 | awk '{printf "10.%d.%d.%d\n", $1/65536, $1/256%256, $1%256}' | \
+		$async -n 256 add test || exit 1
+	test `$ipset l test | grep -c '^10\.'` -eq 10000 || exit 1
+	;;
+error)
+	# Failed commands are reported with their line numbers
+	printf "10.0.0.1\n10.0.0.2\n10.0.0.1\n10.0.0.3\n" | \
+		$async add test 2>.async.err && exit 1
+	grep -q "Error in line 3:" .async.err || exit 1
+	test `$ipset l test | grep -c '^10\.'` -eq 3 || exit 1
+	;;
+del)
+	# Elements are deleted one by one, waiting for every completion
+	seq 1 100 | awk '{printf "a test 10.0.0.%d\n", $1}' | $ipset r || exit 1
+	seq 1 50 | awk '{printf "10.0.0.%d\n", $1}' | \
+		$async -n 1 del test || exit 1
+	test `$ipset l test | grep -c '^10\.'` -eq 50 || exit 1
+	;;
+test)
+	$ipset a test 10.0.0.1
+	echo 10.0.0.1 | $async test test || exit 1
+	echo 10.0.0.2 | $async test test 2>/dev/null && exit 1
+	;;
+*)
+	echo "Usage: $0 add|del|error|test"
+	exit 1
+	;;
+esac
+$ipset x test
+rm -f .async.err
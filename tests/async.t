@@ -0,0 +1,9 @@
+# Non-blocking API: add elements with many commands in flight
+0 ./async.sh add
+# Non-blocking API: delete elements with one command in flight
+0 ./async.sh del
+# Non-blocking API: errors are reported with line numbers
+0 ./async.sh error
+# Non-blocking API: test elements
+0 ./async.sh test
+# eof
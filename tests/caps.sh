@@ -0,0 +1,68 @@
+#!/bin/sh
+
+# Check the kernel capability cache of the "-cache" option:
+#
+#	./caps.sh fresh|stale|reload
+#
+# The fresh and stale cases count the PROTOCOL and TYPE queries logged
+# by the fake kernel, the reload case needs the kernel.
+
+ipset=${IPSET_BIN:-../src/ipset}
+if [ -n "$IPSET_FAKE_STATE" ]; then
+	cache=$IPSET_FAKE_STATE.cache
+	IPSET_FAKE_LOG=.caps.log
+	export IPSET_FAKE_LOG
+else
+	cache=/run/ipset.cache
+fi
+
+# Number of the queries of the given kind since the last call
+queries() {
+	n=`grep -c "^$1" .caps.log`
+	: > .caps.log
+	echo $n
+}
+
+$ipset x test >/dev/null 2>&1
+rm -f $cache .caps.log
+
+case "$1" in
+fresh)
+	# The answers of the kernel are stored and used later
+	$ipset -c n test hash:ip || exit 1
+	grep -q "^protocol " $cache || exit 1
+	grep -q "^type hash:ip " $cache || exit 1
+	test `queries "protocol\|type"` -eq 2 || exit 1
+	$ipset -c a test 10.0.0.1 || exit 1
+	$ipset -c t test 10.0.0.1 2>/dev/null || exit 1
+	test `queries "protocol\|type"` -eq 0 || exit 1
+	# Without the option the kernel is queried
+	$ipset t test 10.0.0.1 2>/dev/null || exit 1
+	test `queries protocol` -eq 1 || exit 1
+	;;
+stale)
+	# A cache with an unknown key is ignored and rewritten
+	printf "ipset-caps 1 0000000000000000\nprotocol 0 0\n" > $cache
+	$ipset -c n test hash:ip || exit 1
+	test `queries "protocol\|type"` -eq 2 || exit 1
+	grep -q "^protocol 0 0" $cache && exit 1
+	$ipset -c a test 10.0.0.1 || exit 1
+	test `queries "protocol\|type"` -eq 0 || exit 1
+	;;
+reload)
+	# Unloading the set type module invalidates the cache
+	$ipset -c n test hash:ip || exit 1
+	key=`head -n 1 $cache`
+	$ipset x test
+	rmmod ip_set_hash_ip >/dev/null 2>&1 || exit 0
+	# The kernel is queried again and the cache rewritten
+	$ipset -c n test hash:ip || exit 1
+	test "$key" != "`head -n 1 $cache`" || exit 1
+	;;
+*)
+	echo "Usage: $0 fresh|stale|reload"
+	exit 1
+	;;
+esac
+$ipset x test
+rm -f $cache .caps.log
@@ -0,0 +1,8 @@
+# Capability cache: module reload invalidates the cache
+0 ./caps.sh reload
+skip test -n "$IPSET_FAKE_STATE"
+# Capability cache: kernel answers are cached and used
+0 ./caps.sh fresh
+# Capability cache: stale cache is ignored
+0 ./caps.sh stale
+# eof
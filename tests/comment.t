@@ -108,6 +108,18 @@
 0 n=`ipset -L test|grep '^10.'|wc -l` && test $n -eq 87040
 # Hash comment: Delete test set
 0 ipset destroy test
+# Hash comment: Stress test with shared comments
+0 ./commentgen.sh 65536 100 | ipset restore
+# Hash comment: List set and check the number of elements
+0 n=`ipset -L test|grep '^10.'|wc -l` && test $n -eq 65536
+# Hash comment: Check the number of distinct comments
+0 n=`ipset -L test|grep '^10.'|cut -d '"' -f 2|sort -u|wc -l` && test $n -eq 100
+# Hash comment: Delete the elements sharing a comment
+0 for x in `seq 0 100 65535`; do echo "del test 10.0.$((x >> 8)).$((x & 255))"; done | ipset restore
+# Hash comment: Check that the other comments are kept
+0 n=`ipset -L test|grep '^10.'|cut -d '"' -f 2|sort -u|wc -l` && test $n -eq 99
+# Hash comment: Destroy test set
+0 ipset destroy test
 # Hash comment: Check that resizing keeps the comments
 0 ./resizec.sh -4 netnet
 # Hash comment: Stress test with comments and timeout
@@ -0,0 +1,18 @@
+#!/bin/sh
+
+# Generate a hash:ip set where the elements share a limited number
+# of distinct comments:
+#
+#	./commentgen.sh [elements [comments]] | ipset restore
+#
+# Time the restore and check "Size in memory" in the header listing
+# to measure the interned comment storage, e.g. 1000000 elements
+# with 100 distinct comments.
+
+elements=${1:-65536}
+comments=${2:-100}
+
+echo "n test hash:ip hashsize 1024 maxelem $elements comment"
+for i in `seq 0 $((elements - 1))`; do
+    echo "a test 10.$((i >> 16)).$(((i >> 8) & 255)).$((i & 255)) comment \"feed=$((i % comments))\""
+done
@@ -0,0 +1,37 @@
+#!/bin/sh
+
+# Compare restoring interleaved lines of many sets with and without
+# grouping the lines by set:
+#
+#	./grouprestore.sh [sets [lines]]
+
+ipset=${IPSET_BIN:-../src/ipset}
+
+sets=${1:-100}
+lines=${2:-1000000}
+
+awk -v s=$sets -v n=$lines 'BEGIN {
+    for (i = 0; i < s; i++)
+        printf "create test%d hash:ip maxelem %d\n", i, n / s + 1
+    for (j = 0; j < n; j++) {
+        k = int(j / s)
+        printf "add test%d 10.%d.%d.%d\n", j % s,
+               int(k / 65536), int(k / 256) % 256, k % 256
+        # Deletions keep the order within the set
+        if (j % 7 == 0)
+            printf "del test%d 10.%d.%d.%d\n", j % s,
+                   int(k / 65536), int(k / 256) % 256, k % 256
+    }
+}' > .foo.restore
+
+$ipset x >/dev/null 2>&1
+$ipset restore < .foo.restore || exit 1
+$ipset -s save > .foo.plain
+$ipset x
+$ipset -group restore < .foo.restore || exit 1
+$ipset -s save > .foo.grouped
+$ipset x
+diff -q .foo.plain .foo.grouped
+ret=$?
+rm -f .foo.restore .foo.plain .foo.grouped
+exit $ret
@@ -30,6 +30,20 @@
 0 ipset add test 2.1.0.3,smtp
 # Delete port by number
 0 ipset del test 2.1.0.3,25
+# Add port by name again, resolved from the cache
+0 ipset add test 2.1.0.3,smtp
+# Add port by name with protocol name
+0 ipset add test 2.1.0.4,udp:domain
+# Restore ports by name: each name is looked up only once
+0 ipset -phases restore < hash:ip,port.t.names 2>&1 | grep -q ' lookups=3$'
+# Add port with protocol number
+0 ipset add test 2.1.0.5,17:53
+# Check the protocol is listed by name
+0 ipset -S test | grep -q 'add test 2.1.0.5,udp:53'
+# Delete the ports by number and by name
+0 ipset del test 2.1.0.3,25 && ipset del test 2.1.0.4,udp:domain && ipset del test 2.1.0.5,udp:53
+# Try to add port with unknown protocol number
+1 ipset add test 2.1.0.4,254:0
 # List set
 0 ipset list test | grep -v Revision: | sed 's/timeout ./timeout x/' > .foo0 && ./sort.sh .foo0
 # Check listing
@@ -210,4 +210,38 @@ skip which sendip
 0 ./check_extensions test 10.255.255.64 600 6 $((6*40))
 # Counters and timeout: destroy set
 0 ipset x test
+# Memlimit: create set with memory limit
+0 ipset n test hash:ip hashsize 64 memlimit 8192
+# Memlimit: check memlimit in listing
+0 ipset -S test | grep -q 'memlimit 8192'
+# Memlimit: add a range exceeding the memory limit
+1 ipset a test 10.0.0.0/20
+# Memlimit: check that elements can still be deleted
+0 ipset d test 10.0.0.0
+# Memlimit: check totals in listing
+0 ipset -total l | grep -q 'Total number of entries'
+# Memlimit: check that terse listing prints no totals
+1 ipset -t l | grep -q 'Total number of entries'
+# Memlimit: check that the total is the sum of the set sizes
+0 ipset -t -total l | awk '/^Size in memory:/ {s += $4} /^Total size in memory:/ {t = $5} END {exit s != t}'
+# Memlimit: destroy set
+0 ipset x test
+# Stats: create set with statistics
+0 ipset n test hash:ip stats
+# Stats: add element
+0 ipset a test 10.0.0.1
+# Stats: test matching element
+0 ipset t test 10.0.0.1
+# Stats: test missing element
+1 ipset t test 10.0.0.2
+# Stats: check lookup counters
+0 ipset stats test | grep -q 'tests 2 hits 1 '
+# Stats: check add counter
+0 ipset stats test | grep -q 'uadds 1 '
+# Stats: list and zero counters
+0 ipset -zero stats test > /dev/null
+# Stats: check zeroed counters
+0 ipset stats test | grep -q 'tests 0 hits 0 '
+# Stats: destroy set
+0 ipset x test
 # eof
@@ -226,4 +226,24 @@
 0 ./check_extensions test 2.0.0.0/25,wlan0 700 13 12479
 # Counters and timeout: destroy set
 0 ipset x test
+# Big comments: create heavily loaded set with maximal size comments
+0 ./netifacegen.sh 4096 | ipset restore
+# Big comments: check number of listed elements
+0 n=`ipset -S test | grep -c '^add'` && test $n -eq 4096
+# Big comments: save set
+0 ipset -S test > .foo
+# Big comments: destroy set
+0 ipset x test
+# Big comments: restore saved set
+0 ipset r < .foo
+# Big comments: check number of restored elements
+0 n=`ipset -S test | grep -c '^add'` && test $n -eq 4096
+# Big comments: destroy set
+0 ipset x test
+# Big buckets: 128 interfaces on one network, over the former 64 slot limit
+0 ./netifacegen.sh 128 128 | ipset restore
+# Big buckets: check number of listed elements
+0 n=`ipset -S test | grep -c '^add'` && test $n -eq 128
+# Big buckets: destroy set
+0 ipset x test
 # eof
@@ -180,4 +180,18 @@
 0 ./check_extensions test 2.0.0.0/25 700 13 12479
 # Counters and timeout: destroy set
 0 ipset x test
+# Packed dump: create set without extensions
+0 ipset n test hash:net
+# Packed dump: add networks and a nomatch entry
+0 ipset a test 1.1.1.0/24 && ipset a test 1.1.1.1 nomatch && ipset a test 2.0.0.0/8
+# Packed dump: check the nomatch flag in the listing
+0 ipset -S test | grep -q 'add test 1.1.1.1 nomatch'
+# Packed dump: check the prefix in the listing
+0 ipset -S test | grep -q 'add test 2.0.0.0/8'
+# Packed dump: add many networks
+0 for x in `seq 0 255`; do for y in `seq 0 31`; do echo "a test 10.$x.$y.0/24"; done; done | ipset r
+# Packed dump: check number of listed elements
+0 n=`ipset -S test | grep -c '^add'` && test $n -eq 8195
+# Packed dump: destroy set
+0 ipset x test
 # eof
@@ -0,0 +1,180 @@
+/* Copyright 2007-2010 Jozsef Kadlecsik (kadlec@netfilter.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Common parts of the benchmark programs */
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "kbench.h"
+
+const struct bench_type bench_types[] = {
+	{ "hash:ip",		DIM_IP },
+	{ "hash:ip,mac",	DIM_IP | DIM_MAC },
+	{ "hash:ip,mark",	DIM_IP | DIM_MARK },
+	{ "hash:ip,port",	DIM_IP | DIM_PORT },
+	{ "hash:ip,port,ip",	DIM_IP | DIM_PORT | DIM_IP2 },
+	{ "hash:ip,port,net",	DIM_IP | DIM_PORT | DIM_IP2 | DIM_CIDR2 },
+	{ "hash:mac",		DIM_MAC },
+	{ "hash:net",		DIM_IP | DIM_CIDR },
+	{ "hash:net,iface",	DIM_IP | DIM_CIDR | DIM_IFACE },
+	{ "hash:net,net",	DIM_IP | DIM_CIDR | DIM_IP2 | DIM_CIDR2 },
+	{ "hash:net,port",	DIM_IP | DIM_CIDR | DIM_PORT },
+	{ "hash:net,port,net",	DIM_IP | DIM_CIDR | DIM_PORT | DIM_IP2 |
+				DIM_CIDR2 },
+	{ },
+};
+
+static const char * const dist_names[] = {
+	[DIST_SEQ]	= "seq",
+	[DIST_RANDOM]	= "random",
+	[DIST_CLUSTER]	= "cluster",
+};
+
+const char *
+bench_dist_name(enum bench_dist dist)
+{
+	return dist_names[dist];
+}
+
+int
+bench_parse_dist(const char *str)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(dist_names); i++)
+		if (strcmp(str, dist_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+const char *
+bench_family_name(u8 family)
+{
+	return family == NFPROTO_IPV4 ? "inet" :
+	       family == NFPROTO_IPV6 ? "inet6" : "any";
+}
+
+u64
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+u32
+bench_rand32(void)
+{
+	return ((u32)random() << 16) ^ (u32)random();
+}
+
+/* The name of the i-th interface, as of the VLANs or the containers */
+void
+bench_iface_name(char *name, u32 i)
+{
+	snprintf(name, IFNAMSIZ, "veth%u", i);
+}
+
+/* The i-th address of the distribution: IPv4 in the first word of the
+ * host order array, IPv6 in all four words, under 2001:db8::/32
+ */
+void
+bench_addr(u32 *a, u8 family, enum bench_dist dist, u32 i, u8 cidr,
+	   u32 *cluster)
+{
+	u32 host = family == NFPROTO_IPV4 ? 32 : 128;
+	u32 n = i;
+
+	switch (dist) {
+	case DIST_CLUSTER:
+		/* Blocks of 256 consecutive addresses or networks */
+		if (i % 256 == 0)
+			*cluster = bench_rand32();
+		n = (*cluster & ~0xffU) | (i % 256);
+		/* Fall through */
+	case DIST_SEQ:
+		memset(a, 0, 4 * sizeof(u32));
+		if (family == NFPROTO_IPV4) {
+			a[0] = cidr == host ? n + 1 : n << (32 - cidr);
+			if (dist == DIST_SEQ)
+				a[0] += 0x0a000000;
+			break;
+		}
+		a[0] = 0x20010db8;
+		if (cidr == host)
+			a[3] = n + 1;
+		else if (cidr > 96)
+			a[3] = n << (128 - cidr);
+		else if (cidr > 64)
+			a[2] = n << (96 - cidr);
+		else if (cidr > 32)
+			a[1] = n << (64 - cidr);
+		break;
+	case DIST_RANDOM:
+		a[0] = bench_rand32();
+		a[1] = bench_rand32();
+		a[2] = bench_rand32();
+		a[3] = bench_rand32() | 1;
+		if (family == NFPROTO_IPV4)
+			a[0] |= 1;
+		else
+			a[0] = 0x20010db8;
+		break;
+	}
+}
+
+void
+bench_put_addr(struct sk_buff *skb, int type, u8 family, const u32 *a)
+{
+	struct nlattr *nested = nla_nest_start(skb, type | NLA_F_NESTED);
+
+	if (family == NFPROTO_IPV4) {
+		nla_put_net32(skb, IPSET_ATTR_IPADDR_IPV4, htonl(a[0]));
+	} else {
+		__be32 ip6[4] = { htonl(a[0]), htonl(a[1]),
+				  htonl(a[2]), htonl(a[3]) };
+
+		nla_put(skb, IPSET_ATTR_IPADDR_IPV6 | NLA_F_NET_BYTEORDER,
+			sizeof(ip6), ip6);
+	}
+	nla_nest_end(skb, nested);
+}
+
+/* Cache misses of the process, when the kernel lets us count them */
+int
+bench_counter_open(void)
+{
+	struct perf_event_attr attr = {
+		.type		= PERF_TYPE_HARDWARE,
+		.size		= sizeof(attr),
+		.config		= PERF_COUNT_HW_CACHE_MISSES,
+		.disabled	= 1,
+		.exclude_kernel	= 1,
+		.exclude_hv	= 1,
+	};
+	int fd;
+
+	fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fd >= 0)
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	return fd;
+}
+
+u64
+bench_counter_read(int fd)
+{
+	u64 count = 0;
+
+	if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+		return 0;
+	return count;
+}
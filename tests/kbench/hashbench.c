@@ -0,0 +1,567 @@
+/* Copyright 2007-2010 Jozsef Kadlecsik (kadlec@netfilter.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Microbenchmarks of the generic hash code (ip_set_hash_gen.h), run in
+ * userspace over the unmodified set type sources. Every operation goes
+ * through the uadt functions as the core calls them, with the element
+ * attributes prepared in advance. The results are printed as one JSON
+ * object per line.
+ */
+
+#include <getopt.h>
+
+#include "kbench.h"
+
+enum bench_op {
+	OP_ADD,
+	OP_TEST,
+	OP_MISS,
+	OP_HOST,
+	OP_LIST,
+	OP_RESIZE,
+	OP_DEL,
+	OP_EXPIRE,
+	OP_MAX,
+};
+
+static const char * const op_names[OP_MAX] = {
+	[OP_ADD]	= "add",
+	[OP_TEST]	= "test",
+	[OP_MISS]	= "miss",
+	[OP_HOST]	= "test-host",
+	[OP_LIST]	= "list",
+	[OP_RESIZE]	= "resize",
+	[OP_DEL]	= "del",
+	[OP_EXPIRE]	= "expire",
+};
+
+/* Benchmark parameters */
+static struct {
+	u32 elements;
+	u32 hashsize;
+	u32 maxelem;
+	u32 timeout;
+	unsigned int rounds;
+	unsigned int seed;
+	enum bench_dist dist;
+	u8 cidr_min, cidr_max;		/* zero: family default */
+	u32 ifaces;			/* hash:net,iface */
+	bool counters;
+	bool stats;
+	bool packed;
+	unsigned int ops;
+} opt = {
+	.elements	= 65536,
+	.hashsize	= 1024,
+	.rounds		= 3,
+	.seed		= 1,
+	.dist		= DIST_RANDOM,
+	.ifaces		= 500,
+	.ops		= (1 << OP_MAX) - 1,
+};
+
+/* Prepared elements: the attributes are stored back to back */
+struct bench_elems {
+	unsigned char *buf;
+	u32 *off;
+	u32 n;
+	struct sk_buff skb;
+};
+
+struct bench_result {
+	u64 best, total;		/* nanoseconds */
+	u64 ops;			/* operations in one round */
+	u64 result;			/* matched, listed, expired... */
+	size_t memsize;
+};
+
+static u8
+rand_cidr(u8 family)
+{
+	u8 lo = opt.cidr_min, hi = opt.cidr_max;
+
+	if (!lo)
+		lo = hi = family == NFPROTO_IPV4 ? 24 : 64;
+	return lo + random() % (hi - lo + 1);
+}
+
+/* Generate 2 * n elements: the first n are added to the sets,
+ * the second n are used for the miss tests. The host variant
+ * carries no prefix lengths, so the nets are searched by the host.
+ */
+static int
+gen_elems(struct bench_elems *e, struct bench_elems *host,
+	  unsigned int dims, u8 family)
+{
+	u32 host_cidr = family == NFPROTO_IPV4 ? 32 : 128;
+	u32 i, cluster = 0, cluster2 = 0, a[4], b[4];
+	size_t size = (size_t)2 * opt.elements * 96;
+	struct bench_elems *x;
+	unsigned int j;
+
+	srandom(opt.seed);
+	for (x = e, j = 0; j < 2; x = host, j++) {
+		x->n = 2 * opt.elements;
+		x->buf = malloc(size);
+		x->off = malloc((x->n + 1) * sizeof(u32));
+		if (!x->buf || !x->off)
+			return -ENOMEM;
+		kshim_skb_init(&x->skb, x->buf, size);
+	}
+	for (i = 0; i < e->n; i++) {
+		u8 cidr = dims & DIM_CIDR ? rand_cidr(family) : host_cidr;
+		u8 cidr2 = dims & DIM_CIDR2 ? rand_cidr(family) : host_cidr;
+		__be16 port = htons(1 + random() % 65535);
+		u8 proto = random() % 2 ? IPPROTO_TCP : IPPROTO_UDP;
+		__be32 mark = htonl(bench_rand32());
+		u8 mac[ETH_ALEN] = { 0x02, random(), random(), random(),
+				     random(), random() | 1 };
+		char iface[IFNAMSIZ];
+
+		bench_iface_name(iface, random() % opt.ifaces);
+
+		bench_addr(a, family, opt.dist, i, cidr, &cluster);
+		bench_addr(b, family, opt.dist, i, cidr2, &cluster2);
+		for (x = e, j = 0; j < 2; x = host, j++) {
+			struct sk_buff *skb = &x->skb;
+
+			x->off[i] = skb->len;
+			if (dims & DIM_IP)
+				bench_put_addr(skb, IPSET_ATTR_IP, family, a);
+			if ((dims & DIM_CIDR) && x == e)
+				nla_put_u8(skb, IPSET_ATTR_CIDR, cidr);
+			if (dims & DIM_PORT) {
+				nla_put_net16(skb, IPSET_ATTR_PORT, port);
+				nla_put_u8(skb, IPSET_ATTR_PROTO, proto);
+			}
+			if (dims & DIM_IP2)
+				bench_put_addr(skb, IPSET_ATTR_IP2, family, b);
+			if ((dims & DIM_CIDR2) && x == e)
+				nla_put_u8(skb, IPSET_ATTR_CIDR2, cidr2);
+			if (dims & DIM_MARK)
+				nla_put_net32(skb, IPSET_ATTR_MARK, mark);
+			if (dims & DIM_MAC)
+				nla_put(skb, IPSET_ATTR_ETHER, ETH_ALEN, mac);
+			if (dims & DIM_IFACE)
+				nla_put_string(skb, IPSET_ATTR_IFACE, iface);
+		}
+	}
+	e->off[e->n] = e->skb.len;
+	host->off[host->n] = host->skb.len;
+	return 0;
+}
+
+static void
+free_elems(struct bench_elems *e)
+{
+	free(e->buf);
+	free(e->off);
+}
+
+static int
+create_set(const char *typename, u8 family, bool timeout,
+	   struct ip_set **set)
+{
+	struct nlattr *tb[IPSET_ATTR_CREATE_MAX + 1] = {};
+	unsigned char buf[256];
+	struct sk_buff skb;
+	struct nlattr *nla;
+	u32 cadt_flags = 0;
+	int rem;
+
+	kshim_skb_init(&skb, buf, sizeof(buf));
+	nla_put_net32(&skb, IPSET_ATTR_HASHSIZE, htonl(opt.hashsize));
+	nla_put_net32(&skb, IPSET_ATTR_MAXELEM,
+		      htonl(opt.maxelem ? opt.maxelem :
+			    max_t(u32, 2 * opt.elements, 65536)));
+	if (timeout || opt.timeout)
+		nla_put_net32(&skb, IPSET_ATTR_TIMEOUT,
+			      htonl(opt.timeout ? opt.timeout : 600));
+	if (opt.counters)
+		cadt_flags |= IPSET_FLAG_WITH_COUNTERS;
+	if (opt.stats)
+		cadt_flags |= IPSET_FLAG_WITH_STATS;
+	if (cadt_flags)
+		nla_put_net32(&skb, IPSET_ATTR_CADT_FLAGS, htonl(cadt_flags));
+	nla_for_each_attr(nla, (struct nlattr *)buf, skb.len, rem)
+		tb[nla_type(nla)] = nla;
+
+	return kshim_create(typename, family, 0, tb, set);
+}
+
+static int
+run_adt(struct ip_set *set, const struct bench_elems *e, u32 from, u32 to,
+	enum ipset_adt adt, u64 *matched)
+{
+	struct nlattr *tb[IPSET_ATTR_ADT_MAX + 1];
+	u32 i;
+	int ret;
+
+	for (i = from; i < to; i++) {
+		nla_parse(tb, IPSET_ATTR_ADT_MAX,
+			  (struct nlattr *)(e->buf + e->off[i]),
+			  e->off[i + 1] - e->off[i], NULL);
+		ret = kshim_uadt(set, tb, adt, IPSET_FLAG_EXIST);
+		if (ret < 0)
+			return ret;
+		if (ret > 0)
+			(*matched)++;
+	}
+	return 0;
+}
+
+/* Dump the set in netlink sized messages, as the core does */
+static int
+run_list(struct ip_set *set, u64 *listed)
+{
+	struct netlink_callback cb = {};
+	unsigned char buf[8192];
+	struct sk_buff skb;
+	int ret;
+
+	if (opt.packed)
+		cb.args[IPSET_CB_DUMP] = IPSET_FLAG_LIST_PACKED << 16;
+	set->variant->uref(set, &cb, true);
+	do {
+		kshim_skb_init(&skb, buf, sizeof(buf));
+		ret = set->variant->list(set, &skb, &cb);
+		if (ret < 0)
+			break;
+		*listed += skb.len;
+	} while (cb.args[IPSET_CB_ARG0]);
+	set->variant->uref(set, &cb, false);
+	return ret;
+}
+
+static void
+account(struct bench_result *r, u64 start, u64 ops)
+{
+	u64 t = bench_now() - start;
+
+	if (!r->best || t < r->best)
+		r->best = t;
+	r->total += t;
+	r->ops = ops;
+}
+
+static int
+bench_round(const char *typename, u8 family,
+	    const struct bench_elems *e, const struct bench_elems *host,
+	    struct bench_result *res)
+{
+	u32 n = opt.elements;
+	struct ip_set *set;
+	u64 start, matched;
+	int ret;
+
+	ret = create_set(typename, family, false, &set);
+	if (ret)
+		return ret;
+
+	start = bench_now();
+	ret = run_adt(set, e, 0, n, IPSET_ADD, &matched);
+	if (ret)
+		goto out;
+	account(&res[OP_ADD], start, n);
+	res[OP_ADD].result = set->elements;
+	res[OP_ADD].memsize = set->variant->memsize(set);
+
+	if (opt.ops & (1 << OP_TEST)) {
+		matched = 0;
+		start = bench_now();
+		ret = run_adt(set, e, 0, n, IPSET_TEST, &matched);
+		if (ret)
+			goto out;
+		account(&res[OP_TEST], start, n);
+		res[OP_TEST].result = matched;
+	}
+	if (opt.ops & (1 << OP_MISS)) {
+		matched = 0;
+		start = bench_now();
+		ret = run_adt(set, e, n, 2 * n, IPSET_TEST, &matched);
+		if (ret)
+			goto out;
+		account(&res[OP_MISS], start, n);
+		res[OP_MISS].result = matched;
+	}
+	if (opt.ops & (1 << OP_HOST)) {
+		matched = 0;
+		start = bench_now();
+		ret = run_adt(set, host, 0, n, IPSET_TEST, &matched);
+		if (ret)
+			goto out;
+		account(&res[OP_HOST], start, n);
+		res[OP_HOST].result = matched;
+	}
+	if (opt.ops & (1 << OP_LIST)) {
+		matched = 0;
+		start = bench_now();
+		ret = run_list(set, &matched);
+		if (ret)
+			goto out;
+		account(&res[OP_LIST], start, set->elements);
+		res[OP_LIST].result = matched;
+	}
+	if (opt.ops & (1 << OP_RESIZE)) {
+		start = bench_now();
+		ret = set->variant->resize(set, true);
+		if (ret)
+			goto out;
+		account(&res[OP_RESIZE], start, set->elements);
+		res[OP_RESIZE].memsize = set->variant->memsize(set);
+	}
+	if (opt.ops & (1 << OP_DEL)) {
+		start = bench_now();
+		ret = run_adt(set, e, 0, n, IPSET_DEL, &matched);
+		if (ret)
+			goto out;
+		account(&res[OP_DEL], start, n);
+		res[OP_DEL].result = set->elements;
+	}
+	kshim_destroy(set);
+
+	if (opt.ops & (1 << OP_EXPIRE)) {
+		/* All elements time out at once, the gc removes them */
+		ret = create_set(typename, family, true, &set);
+		if (ret)
+			return ret;
+		ret = run_adt(set, e, 0, n, IPSET_ADD, &matched);
+		if (ret)
+			goto out;
+		matched = set->elements;
+		kshim_tick((u64)(set->timeout + IPSET_GC_TIME + 1) * HZ);
+		start = bench_now();
+		kshim_run_timers();
+		account(&res[OP_EXPIRE], start, matched);
+		res[OP_EXPIRE].result = matched - set->elements;
+		kshim_destroy(set);
+	}
+	return 0;
+
+out:
+	kshim_destroy(set);
+	return ret;
+}
+
+static int
+bench_type(const char *typename, unsigned int dims, u8 family)
+{
+	struct bench_result res[OP_MAX] = {};
+	struct bench_elems e = {}, host = {};
+	unsigned int i, op;
+	int ret;
+
+	ret = gen_elems(&e, &host, dims, family);
+	for (i = 0; !ret && i < opt.rounds; i++)
+		ret = bench_round(typename, family, &e, &host, res);
+	free_elems(&e);
+	free_elems(&host);
+	if (ret) {
+		fprintf(stderr, "%s %s: error %d\n",
+			typename, bench_family_name(family), ret);
+		return ret;
+	}
+
+	for (op = 0; op < OP_MAX; op++) {
+		const struct bench_result *r = &res[op];
+
+		if (!(opt.ops & (1 << op)) || !r->ops)
+			continue;
+		printf("{\"bench\":\"hash\",\"type\":\"%s\",\"family\":\"%s\","
+		       "\"op\":\"%s\",\"dist\":\"%s\",\"elements\":%u,"
+		       "\"hashsize\":%u,\"rounds\":%u,\"ops\":%llu,"
+		       "\"best_ns\":%.1f,\"mean_ns\":%.1f,\"result\":%llu",
+		       typename, bench_family_name(family), op_names[op],
+		       bench_dist_name(opt.dist), opt.elements, opt.hashsize,
+		       opt.rounds, (unsigned long long)r->ops,
+		       (double)r->best / r->ops,
+		       (double)r->total / opt.rounds / r->ops,
+		       (unsigned long long)r->result);
+		if (r->memsize)
+			printf(",\"memsize\":%zu", r->memsize);
+		printf("}\n");
+	}
+	fflush(stdout);
+	return 0;
+}
+
+static int
+bench(const char *typename, int family)
+{
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; bench_types[i].name; i++) {
+		const struct ip_set_type *type;
+
+		if (typename && strcmp(bench_types[i].name, typename) != 0)
+			continue;
+		type = kshim_find_type(bench_types[i].name, NFPROTO_IPV4);
+		if (!type)
+			continue;
+		if (type->family == NFPROTO_UNSPEC &&
+		    !(type->features & IPSET_TYPE_IP)) {
+			ret |= bench_type(type->name, bench_types[i].dims,
+					  NFPROTO_UNSPEC);
+			continue;
+		}
+		if (family != NFPROTO_IPV6)
+			ret |= bench_type(type->name, bench_types[i].dims,
+					  NFPROTO_IPV4);
+		if (family != NFPROTO_IPV4)
+			ret |= bench_type(type->name, bench_types[i].dims,
+					  NFPROTO_IPV6);
+		if (typename)
+			return ret;
+	}
+	if (typename && !bench_types[i].name) {
+		fprintf(stderr, "Unknown set type %s\n", typename);
+		return -1;
+	}
+	return ret;
+}
+
+static unsigned int
+parse_ops(char *arg)
+{
+	unsigned int ops = 0, op;
+	char *tok;
+
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		for (op = 0; op < OP_MAX; op++)
+			if (strcmp(tok, op_names[op]) == 0)
+				break;
+		if (op == OP_MAX) {
+			fprintf(stderr, "Unknown operation %s\n", tok);
+			exit(1);
+		}
+		ops |= 1 << op;
+	}
+	/* The other operations work on the added elements */
+	return ops | (1 << OP_ADD);
+}
+
+static void
+usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	       "  -t TYPE       set type, all hash types by default\n"
+	       "  -f FAMILY     inet or inet6, both by default\n"
+	       "  -n N          number of elements (%u)\n"
+	       "  -s SIZE       initial hashsize (%u)\n"
+	       "  -m N          maxelem (2 * elements, at least 65536)\n"
+	       "  -d DIST       seq, random or cluster addresses (random)\n"
+	       "  -c MIN[-MAX]  prefix lengths of the net types\n"
+	       "  -i N          interfaces of hash:net,iface (%u)\n"
+	       "  -T SECONDS    create the sets with timeout\n"
+	       "  -C            create the sets with counters\n"
+	       "  -x            create the sets with lookup statistics\n"
+	       "  -p            list in packed records where supported\n"
+	       "  -o OPS        comma separated list of %s",
+	       prog, opt.elements, opt.hashsize, opt.ifaces, op_names[0]);
+	for (unsigned int op = 1; op < OP_MAX; op++)
+		printf(",%s", op_names[op]);
+	printf("\n"
+	       "  -r N          rounds, the best and the mean are reported (%u)\n"
+	       "  -S SEED       random seed (%u)\n",
+	       opt.rounds, opt.seed);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *typename = NULL;
+	int family = NFPROTO_UNSPEC;
+	int c, dist;
+
+	while ((c = getopt(argc, argv, "t:f:n:s:m:d:c:i:T:Cxpo:r:S:h")) != -1) {
+		switch (c) {
+		case 't':
+			typename = optarg;
+			break;
+		case 'f':
+			if (strcmp(optarg, "inet") == 0)
+				family = NFPROTO_IPV4;
+			else if (strcmp(optarg, "inet6") == 0)
+				family = NFPROTO_IPV6;
+			else
+				goto error;
+			break;
+		case 'n':
+			opt.elements = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			opt.hashsize = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			opt.maxelem = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			dist = bench_parse_dist(optarg);
+			if (dist < 0)
+				goto error;
+			opt.dist = dist;
+			break;
+		case 'c': {
+			unsigned int lo, hi;
+
+			switch (sscanf(optarg, "%u-%u", &lo, &hi)) {
+			case 1:
+				hi = lo;
+				/* Fall through */
+			case 2:
+				if (!lo || lo > hi || hi > 128)
+					goto error;
+				opt.cidr_min = lo;
+				opt.cidr_max = hi;
+				break;
+			default:
+				goto error;
+			}
+			break;
+		}
+		case 'i':
+			opt.ifaces = strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			opt.timeout = strtoul(optarg, NULL, 0);
+			break;
+		case 'C':
+			opt.counters = true;
+			break;
+		case 'x':
+			opt.stats = true;
+			break;
+		case 'p':
+			opt.packed = true;
+			break;
+		case 'o':
+			opt.ops = parse_ops(optarg);
+			break;
+		case 'r':
+			opt.rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			opt.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			goto error;
+		}
+	}
+	if (!opt.elements || !opt.rounds || !opt.ifaces ||
+	    (family == NFPROTO_IPV4 && opt.cidr_max > 32))
+		goto error;
+
+	return bench(typename, family) ? 1 : 0;
+
+error:
+	usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,2 @@
+/* Userspace shim of <linux/bitops.h>, see kshim.h */
+#include <kshim.h>
@@ -0,0 +1,2 @@
+/* Userspace shim of <linux/etherdevice.h>, see kshim.h */
+#include <kshim.h>
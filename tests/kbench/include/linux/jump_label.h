@@ -0,0 +1,2 @@
+/* Userspace shim of <linux/jump_label.h>, see kshim.h */
+#include <kshim.h>
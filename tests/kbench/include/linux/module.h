@@ -0,0 +1,2 @@
+/* Userspace shim of <linux/module.h>, see kshim.h */
+#include <kshim.h>
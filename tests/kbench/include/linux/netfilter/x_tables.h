@@ -0,0 +1,2 @@
+/* Userspace shim of <linux/netfilter/x_tables.h>, see kshim.h */
+#include <kshim.h>
@@ -0,0 +1,2 @@
+/* Userspace shim of <linux/netfilter_ipv6/ip6_tables.h>, see kshim.h */
+#include <kshim.h>
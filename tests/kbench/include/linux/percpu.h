@@ -0,0 +1,2 @@
+/* Userspace shim of <linux/percpu.h>, see kshim.h */
+#include <kshim.h>
@@ -0,0 +1,2 @@
+/* Userspace shim of <linux/unaligned/packed_struct.h>, see kshim.h */
+#include <kshim.h>
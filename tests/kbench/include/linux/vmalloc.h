@@ -0,0 +1,2 @@
+/* Userspace shim of <linux/vmalloc.h>, see kshim.h */
+#include <kshim.h>
@@ -0,0 +1,2 @@
+/* Userspace shim of <net/ipv6.h>, see kshim.h */
+#include <kshim.h>
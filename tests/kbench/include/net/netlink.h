@@ -0,0 +1,2 @@
+/* Userspace shim of <net/netlink.h>, see kshim.h */
+#include <kshim.h>
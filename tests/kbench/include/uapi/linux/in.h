@@ -0,0 +1,2 @@
+/* Userspace shim of <uapi/linux/in.h>, see kshim.h */
+#include <kshim.h>
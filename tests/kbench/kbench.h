@@ -0,0 +1,87 @@
+/* Copyright 2007-2010 Jozsef Kadlecsik (kadlec@netfilter.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _KBENCH_H
+#define _KBENCH_H
+
+/* The interface of the shim to the benchmark programs */
+
+#include <kshim.h>
+#include <linux/netfilter/ipset/ip_set.h>
+
+/* Advance jiffies and run the expired timers */
+extern void kshim_tick(unsigned long ticks);
+extern int kshim_run_timers(void);
+
+/* Netlink attributes */
+extern int nla_parse(struct nlattr **tb, int maxtype,
+		     const struct nlattr *head, int len,
+		     const struct nla_policy *policy);
+extern void kshim_skb_init(struct sk_buff *skb, void *buf, unsigned int size);
+
+/* Registered set types */
+extern struct ip_set_type *kshim_find_type(const char *name, u8 family);
+extern void kshim_for_each_type(void (*fn)(struct ip_set_type *type,
+					   void *data),
+				void *data);
+
+/* Set commands, as the core calls the set types */
+extern int kshim_create(const char *typename, u8 family, u8 revision,
+			struct nlattr *tb[], struct ip_set **setp);
+extern void kshim_destroy(struct ip_set *set);
+extern int kshim_uadt(struct ip_set *set, struct nlattr *tb[],
+		      enum ipset_adt adt, u32 flags);
+extern int kshim_kadt(struct ip_set *set, const struct sk_buff *skb,
+		      const struct xt_action_param *par,
+		      enum ipset_adt adt, struct ip_set_adt_opt *opt);
+
+/* The set lock holding times of kshim_uadt() */
+struct kshim_lock_stats {
+	u64 locked;
+	u64 total_ns, max_ns;
+};
+extern struct kshim_lock_stats kshim_lock_stats;
+
+/* Common parts of the benchmarks */
+enum {
+	DIM_IP		= (1 << 0),
+	DIM_CIDR	= (1 << 1),
+	DIM_PORT	= (1 << 2),
+	DIM_IP2		= (1 << 3),
+	DIM_CIDR2	= (1 << 4),
+	DIM_MARK	= (1 << 5),
+	DIM_MAC		= (1 << 6),
+	DIM_IFACE	= (1 << 7),
+};
+
+/* The benchmarked types and the dimensions of their elements */
+struct bench_type {
+	const char *name;
+	unsigned int dims;
+};
+extern const struct bench_type bench_types[];
+
+/* Address distributions */
+enum bench_dist {
+	DIST_SEQ,
+	DIST_RANDOM,
+	DIST_CLUSTER,
+};
+
+extern const char *bench_dist_name(enum bench_dist dist);
+extern int bench_parse_dist(const char *str);
+extern const char *bench_family_name(u8 family);
+extern u64 bench_now(void);
+extern u32 bench_rand32(void);
+extern void bench_iface_name(char *name, u32 i);
+extern void bench_addr(u32 *a, u8 family, enum bench_dist dist, u32 i,
+		       u8 cidr, u32 *cluster);
+extern void bench_put_addr(struct sk_buff *skb, int type, u8 family,
+			   const u32 *a);
+extern int bench_counter_open(void);
+extern u64 bench_counter_read(int fd);
+
+#endif /* _KBENCH_H */
@@ -0,0 +1,854 @@
+/* Copyright 2007-2010 Jozsef Kadlecsik (kadlec@netfilter.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* The userspace side of the kernel shim: timers, netlink attributes and
+ * the part of ip_set_core.c the set types call back into. The core
+ * functions follow ip_set_core.c, without the netlink and namespace
+ * handling around them.
+ */
+
+#include <linux/jhash.h>
+
+#include "kbench.h"
+
+/*
+ * Time and timers
+ */
+
+unsigned long jiffies = 1;
+
+static struct list_head timers = LIST_HEAD_INIT(timers);
+
+void
+timer_setup(struct timer_list *t, void (*fn)(struct timer_list *t),
+	    unsigned int flags)
+{
+	t->function = fn;
+	t->pending = false;
+}
+
+void
+add_timer(struct timer_list *t)
+{
+	if (!t->pending)
+		list_add_tail(&t->entry, &timers);
+	t->pending = true;
+}
+
+int
+mod_timer(struct timer_list *t, unsigned long expires)
+{
+	int pending = t->pending;
+
+	t->expires = expires;
+	add_timer(t);
+	return pending;
+}
+
+int
+del_timer_sync(struct timer_list *t)
+{
+	int pending = t->pending;
+
+	if (pending)
+		list_del(&t->entry);
+	t->pending = false;
+	return pending;
+}
+
+void
+kshim_tick(unsigned long ticks)
+{
+	jiffies += ticks;
+}
+
+/* Run the expired timers, which may rearm themselves */
+int
+kshim_run_timers(void)
+{
+	struct timer_list *t;
+	int fired = 0;
+
+again:
+	list_for_each_entry(t, &timers, entry) {
+		if (time_after(t->expires, jiffies))
+			continue;
+		list_del(&t->entry);
+		t->pending = false;
+		t->function(t);
+		fired++;
+		goto again;
+	}
+	return fired;
+}
+
+void
+get_random_bytes(void *buf, int nbytes)
+{
+	unsigned char *p = buf;
+
+	while (nbytes-- > 0)
+		*p++ = random();
+}
+
+/*
+ * Netlink attributes
+ */
+
+/* The attributes are not validated against the policy */
+int
+nla_parse(struct nlattr **tb, int maxtype, const struct nlattr *head,
+	  int len, const struct nla_policy *policy)
+{
+	const struct nlattr *nla;
+	int rem;
+
+	memset(tb, 0, sizeof(struct nlattr *) * (maxtype + 1));
+	nla_for_each_attr(nla, head, len, rem) {
+		u16 type = nla_type(nla);
+
+		if (type > 0 && type <= maxtype)
+			tb[type] = (struct nlattr *)nla;
+	}
+	return rem > 0 ? -EINVAL : 0;
+}
+
+int
+nla_parse_nested(struct nlattr *tb[], int maxtype, const struct nlattr *nla,
+		 const struct nla_policy *policy)
+{
+	return nla_parse(tb, maxtype, nla_data(nla), nla_len(nla), policy);
+}
+
+struct nlattr *
+nla_reserve(struct sk_buff *skb, int attrtype, int attrlen)
+{
+	struct nlattr *nla;
+
+	if (skb_tailroom(skb) < (int)NLA_ALIGN(NLA_HDRLEN + attrlen))
+		return NULL;
+	nla = skb_put(skb, NLA_ALIGN(NLA_HDRLEN + attrlen));
+	nla->nla_type = attrtype;
+	nla->nla_len = NLA_HDRLEN + attrlen;
+	memset((unsigned char *)nla + nla->nla_len, 0,
+	       NLA_ALIGN(nla->nla_len) - nla->nla_len);
+	return nla;
+}
+
+int
+nla_put(struct sk_buff *skb, int attrtype, int attrlen, const void *data)
+{
+	struct nlattr *nla = nla_reserve(skb, attrtype, attrlen);
+
+	if (!nla)
+		return -EMSGSIZE;
+	if (attrlen)
+		memcpy(nla_data(nla), data, attrlen);
+	return 0;
+}
+
+void
+kshim_skb_init(struct sk_buff *skb, void *buf, unsigned int size)
+{
+	memset(skb, 0, sizeof(*skb));
+	skb->head = skb->data = buf;
+	skb->end = size;
+}
+
+/* From net/ipv6/exthdrs_core.c */
+int
+ipv6_skip_exthdr(const struct sk_buff *skb, int start, u8 *nexthdrp,
+		 __be16 *frag_offp)
+{
+	u8 nexthdr = *nexthdrp;
+
+	*frag_offp = 0;
+
+	while (nexthdr == NEXTHDR_HOP || nexthdr == NEXTHDR_ROUTING ||
+	       nexthdr == NEXTHDR_FRAGMENT || nexthdr == NEXTHDR_AUTH ||
+	       nexthdr == NEXTHDR_NONE || nexthdr == NEXTHDR_DEST) {
+		struct ipv6_opt_hdr _hdr, *hp;
+		int hdrlen;
+
+		if (nexthdr == NEXTHDR_NONE)
+			return -1;
+		hp = skb_header_pointer(skb, start, sizeof(_hdr), &_hdr);
+		if (!hp)
+			return -1;
+		if (nexthdr == NEXTHDR_FRAGMENT) {
+			__be16 _frag_off, *fp;
+
+			fp = skb_header_pointer(skb,
+						start +
+						offsetof(struct frag_hdr,
+							 frag_off),
+						sizeof(_frag_off),
+						&_frag_off);
+			if (!fp)
+				return -1;
+
+			*frag_offp = *fp;
+			if (ntohs(*frag_offp) & ~0x7)
+				break;
+			hdrlen = 8;
+		} else if (nexthdr == NEXTHDR_AUTH) {
+			hdrlen = (hp->hdrlen + 2) << 2;
+		} else {
+			hdrlen = ipv6_optlen(hp);
+		}
+
+		nexthdr = hp->nexthdr;
+		start += hdrlen;
+	}
+
+	*nexthdrp = nexthdr;
+	return start;
+}
+
+/*
+ * Set types, following ip_set_core.c
+ */
+
+static struct list_head ip_set_type_list = LIST_HEAD_INIT(ip_set_type_list);
+
+DEFINE_STATIC_KEY_FALSE(ip_set_stats_key);
+
+int
+ip_set_type_register(struct ip_set_type *type)
+{
+	if (type->protocol != IPSET_PROTOCOL)
+		return -EINVAL;
+	list_add_tail(&type->list, &ip_set_type_list);
+	return 0;
+}
+
+void
+ip_set_type_unregister(struct ip_set_type *type)
+{
+	list_del(&type->list);
+}
+
+struct ip_set_type *
+kshim_find_type(const char *name, u8 family)
+{
+	struct ip_set_type *type;
+
+	list_for_each_entry(type, &ip_set_type_list, list)
+		if (strcmp(type->name, name) == 0 &&
+		    (type->family == family ||
+		     type->family == NFPROTO_UNSPEC))
+			return type;
+	return NULL;
+}
+
+void
+kshim_for_each_type(void (*fn)(struct ip_set_type *type, void *data),
+		    void *data)
+{
+	struct ip_set_type *type;
+
+	list_for_each_entry(type, &ip_set_type_list, list)
+		fn(type, data);
+}
+
+void *
+ip_set_alloc(size_t size)
+{
+	return calloc(1, size);
+}
+
+void
+ip_set_free(void *members)
+{
+	free(members);
+}
+
+static bool
+flag_nested(const struct nlattr *nla)
+{
+	return nla->nla_type & NLA_F_NESTED;
+}
+
+int
+ip_set_get_ipaddr4(struct nlattr *nla, __be32 *ipaddr)
+{
+	struct nlattr *tb[IPSET_ATTR_IPADDR_MAX + 1];
+
+	if (unlikely(!flag_nested(nla)))
+		return -IPSET_ERR_PROTOCOL;
+	if (nla_parse_nested(tb, IPSET_ATTR_IPADDR_MAX, nla, NULL))
+		return -IPSET_ERR_PROTOCOL;
+	if (unlikely(!ip_set_attr_netorder(tb, IPSET_ATTR_IPADDR_IPV4)))
+		return -IPSET_ERR_PROTOCOL;
+
+	*ipaddr = nla_get_be32(tb[IPSET_ATTR_IPADDR_IPV4]);
+	return 0;
+}
+
+int
+ip_set_get_ipaddr6(struct nlattr *nla, union nf_inet_addr *ipaddr)
+{
+	struct nlattr *tb[IPSET_ATTR_IPADDR_MAX + 1];
+
+	if (unlikely(!flag_nested(nla)))
+		return -IPSET_ERR_PROTOCOL;
+	if (nla_parse_nested(tb, IPSET_ATTR_IPADDR_MAX, nla, NULL))
+		return -IPSET_ERR_PROTOCOL;
+	if (unlikely(!ip_set_attr_netorder(tb, IPSET_ATTR_IPADDR_IPV6)))
+		return -IPSET_ERR_PROTOCOL;
+
+	memcpy(ipaddr, nla_data(tb[IPSET_ATTR_IPADDR_IPV6]),
+	       sizeof(struct in6_addr));
+	return 0;
+}
+
+static u32
+ip_set_timeout_get(const unsigned long *timeout)
+{
+	u32 t;
+
+	if (*timeout == IPSET_ELEM_PERMANENT)
+		return 0;
+
+	t = jiffies_to_msecs(*timeout - jiffies) / MSEC_PER_SEC;
+	return t == 0 ? 1 : t;
+}
+
+#define IPSET_COMMENT_HBITS	8
+#define IPSET_COMMENT_HSIZE	(1U << IPSET_COMMENT_HBITS)
+
+static struct ip_set_comment_rcu *
+ip_set_comment_get(struct ip_set *set, const char *str, size_t len)
+{
+	struct ip_set_comment_rcu *c;
+	u32 hash = jhash(str, len, 0);
+	struct hlist_head *head =
+		&set->comments[hash & (IPSET_COMMENT_HSIZE - 1)];
+
+	hlist_for_each_entry(c, head, node) {
+		if (c->hash == hash &&
+		    strncmp(c->str, str, len) == 0 && c->str[len] == '\0') {
+			c->ref++;
+			return c;
+		}
+	}
+	c = kmalloc(sizeof(*c) + len + 1, GFP_ATOMIC);
+	if (unlikely(!c))
+		return NULL;
+	strlcpy(c->str, str, len + 1);
+	c->hash = hash;
+	c->ref = 1;
+	hlist_add_head(&c->node, head);
+	set->ext_size += sizeof(*c) + len + 1;
+	return c;
+}
+
+static void
+ip_set_comment_put(struct ip_set *set, struct ip_set_comment_rcu *c)
+{
+	if (--c->ref)
+		return;
+	hlist_del(&c->node);
+	set->ext_size -= sizeof(*c) + strlen(c->str) + 1;
+	kfree_rcu(c, rcu);
+}
+
+void
+ip_set_init_comment(struct ip_set *set, struct ip_set_comment *comment,
+		    const struct ip_set_ext *ext)
+{
+	struct ip_set_comment_rcu *c = rcu_dereference_protected(comment->c, 1);
+	size_t len = ext->comment ? strlen(ext->comment) : 0;
+
+	if (unlikely(len > IPSET_MAX_COMMENT_SIZE))
+		len = IPSET_MAX_COMMENT_SIZE;
+	if (unlikely(c)) {
+		if (len && strncmp(c->str, ext->comment, len) == 0 &&
+		    c->str[len] == '\0')
+			return;
+		rcu_assign_pointer(comment->c, NULL);
+		ip_set_comment_put(set, c);
+	}
+	if (!len)
+		return;
+	c = ip_set_comment_get(set, ext->comment, len);
+	if (unlikely(!c))
+		return;
+	rcu_assign_pointer(comment->c, c);
+}
+
+static void
+ip_set_comment_free(struct ip_set *set, void *ptr)
+{
+	struct ip_set_comment *comment = ptr;
+	struct ip_set_comment_rcu *c;
+
+	c = rcu_dereference_protected(comment->c, 1);
+	if (unlikely(!c))
+		return;
+	rcu_assign_pointer(comment->c, NULL);
+	ip_set_comment_put(set, c);
+}
+
+const struct ip_set_ext_type ip_set_extensions[] = {
+	[IPSET_EXT_ID_COUNTER] = {
+		.type	= IPSET_EXT_COUNTER,
+		.flag	= IPSET_FLAG_WITH_COUNTERS,
+		.len	= sizeof(struct ip_set_counter),
+		.align	= __alignof__(struct ip_set_counter),
+	},
+	[IPSET_EXT_ID_TIMEOUT] = {
+		.type	= IPSET_EXT_TIMEOUT,
+		.len	= sizeof(unsigned long),
+		.align	= __alignof__(unsigned long),
+	},
+	[IPSET_EXT_ID_SKBINFO] = {
+		.type	= IPSET_EXT_SKBINFO,
+		.flag	= IPSET_FLAG_WITH_SKBINFO,
+		.len	= sizeof(struct ip_set_skbinfo),
+		.align	= __alignof__(struct ip_set_skbinfo),
+	},
+	[IPSET_EXT_ID_COMMENT] = {
+		.type	 = IPSET_EXT_COMMENT | IPSET_EXT_DESTROY,
+		.flag	 = IPSET_FLAG_WITH_COMMENT,
+		.len	 = sizeof(struct ip_set_comment),
+		.align	 = __alignof__(struct ip_set_comment),
+		.destroy = ip_set_comment_free,
+	},
+};
+
+static bool
+add_extension(enum ip_set_ext_id id, u32 flags, struct nlattr *tb[])
+{
+	return ip_set_extensions[id].flag ?
+		(flags & ip_set_extensions[id].flag) :
+		!!tb[IPSET_ATTR_TIMEOUT];
+}
+
+size_t
+ip_set_elem_len(struct ip_set *set, struct nlattr *tb[], size_t len,
+		size_t align)
+{
+	enum ip_set_ext_id id;
+	u32 cadt_flags = 0;
+
+	if (tb[IPSET_ATTR_CADT_FLAGS])
+		cadt_flags = ip_set_get_h32(tb[IPSET_ATTR_CADT_FLAGS]);
+	if (cadt_flags & IPSET_FLAG_WITH_FORCEADD)
+		set->flags |= IPSET_CREATE_FLAG_FORCEADD;
+	if (!align)
+		align = 1;
+	for (id = 0; id < IPSET_EXT_ID_MAX; id++) {
+		if (!add_extension(id, cadt_flags, tb))
+			continue;
+		len = ALIGN(len, ip_set_extensions[id].align);
+		set->offset[id] = len;
+		set->extensions |= ip_set_extensions[id].type;
+		len += ip_set_extensions[id].len;
+	}
+	return ALIGN(len, align);
+}
+
+int
+ip_set_get_extensions(struct ip_set *set, struct nlattr *tb[],
+		      struct ip_set_ext *ext)
+{
+	u64 fullmark;
+
+	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_TIMEOUT) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_PACKETS) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_BYTES) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_SKBMARK) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_SKBPRIO) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_SKBQUEUE)))
+		return -IPSET_ERR_PROTOCOL;
+
+	if (tb[IPSET_ATTR_TIMEOUT]) {
+		if (!SET_WITH_TIMEOUT(set))
+			return -IPSET_ERR_TIMEOUT;
+		ext->timeout = ip_set_timeout_uget(tb[IPSET_ATTR_TIMEOUT]);
+	}
+	if (tb[IPSET_ATTR_BYTES] || tb[IPSET_ATTR_PACKETS]) {
+		if (!SET_WITH_COUNTER(set))
+			return -IPSET_ERR_COUNTER;
+		if (tb[IPSET_ATTR_BYTES])
+			ext->bytes = be64_to_cpu(nla_get_be64(
+						 tb[IPSET_ATTR_BYTES]));
+		if (tb[IPSET_ATTR_PACKETS])
+			ext->packets = be64_to_cpu(nla_get_be64(
+						   tb[IPSET_ATTR_PACKETS]));
+	}
+	if (tb[IPSET_ATTR_COMMENT]) {
+		if (!SET_WITH_COMMENT(set))
+			return -IPSET_ERR_COMMENT;
+		ext->comment = nla_data(tb[IPSET_ATTR_COMMENT]);
+	}
+	if (tb[IPSET_ATTR_SKBMARK]) {
+		if (!SET_WITH_SKBINFO(set))
+			return -IPSET_ERR_SKBINFO;
+		fullmark = be64_to_cpu(nla_get_be64(tb[IPSET_ATTR_SKBMARK]));
+		ext->skbinfo.skbmark = fullmark >> 32;
+		ext->skbinfo.skbmarkmask = fullmark & 0xffffffff;
+	}
+	if (tb[IPSET_ATTR_SKBPRIO]) {
+		if (!SET_WITH_SKBINFO(set))
+			return -IPSET_ERR_SKBINFO;
+		ext->skbinfo.skbprio =
+			be32_to_cpu(nla_get_be32(tb[IPSET_ATTR_SKBPRIO]));
+	}
+	if (tb[IPSET_ATTR_SKBQUEUE]) {
+		if (!SET_WITH_SKBINFO(set))
+			return -IPSET_ERR_SKBINFO;
+		ext->skbinfo.skbqueue =
+			be16_to_cpu(nla_get_be16(tb[IPSET_ATTR_SKBQUEUE]));
+	}
+	return 0;
+}
+
+static bool
+ip_set_put_counter(struct sk_buff *skb, const struct ip_set_counter *counter)
+{
+	return IPSET_NLA_PUT_NET64(skb, IPSET_ATTR_BYTES,
+				   cpu_to_be64(atomic64_read(&counter->bytes)),
+				   IPSET_ATTR_PAD) ||
+	       IPSET_NLA_PUT_NET64(skb, IPSET_ATTR_PACKETS,
+				   cpu_to_be64(atomic64_read(&counter->packets)),
+				   IPSET_ATTR_PAD);
+}
+
+static bool
+ip_set_put_skbinfo(struct sk_buff *skb, const struct ip_set_skbinfo *skbinfo)
+{
+	return ((skbinfo->skbmark || skbinfo->skbmarkmask) &&
+		IPSET_NLA_PUT_NET64(skb, IPSET_ATTR_SKBMARK,
+				    cpu_to_be64((u64)skbinfo->skbmark << 32 |
+						skbinfo->skbmarkmask),
+				    IPSET_ATTR_PAD)) ||
+	       (skbinfo->skbprio &&
+		nla_put_net32(skb, IPSET_ATTR_SKBPRIO,
+			      cpu_to_be32(skbinfo->skbprio))) ||
+	       (skbinfo->skbqueue &&
+		nla_put_net16(skb, IPSET_ATTR_SKBQUEUE,
+			      cpu_to_be16(skbinfo->skbqueue)));
+}
+
+int
+ip_set_put_extensions(struct sk_buff *skb, const struct ip_set *set,
+		      const void *e, bool active)
+{
+	if (SET_WITH_TIMEOUT(set)) {
+		unsigned long *timeout = ext_timeout(e, set);
+
+		if (nla_put_net32(skb, IPSET_ATTR_TIMEOUT,
+			htonl(active ? ip_set_timeout_get(timeout)
+			      : *timeout)))
+			return -EMSGSIZE;
+	}
+	if (SET_WITH_COUNTER(set) &&
+	    ip_set_put_counter(skb, ext_counter(e, set)))
+		return -EMSGSIZE;
+	if (SET_WITH_COMMENT(set)) {
+		struct ip_set_comment_rcu *c = ext_comment(e, set)->c;
+
+		if (c && nla_put_string(skb, IPSET_ATTR_COMMENT, c->str))
+			return -EMSGSIZE;
+	}
+	if (SET_WITH_SKBINFO(set) &&
+	    ip_set_put_skbinfo(skb, ext_skbinfo(e, set)))
+		return -EMSGSIZE;
+	return 0;
+}
+
+static bool
+ip_set_match_counter(u64 counter, u64 match, u8 op)
+{
+	switch (op) {
+	case IPSET_COUNTER_NONE:
+		return true;
+	case IPSET_COUNTER_EQ:
+		return counter == match;
+	case IPSET_COUNTER_NE:
+		return counter != match;
+	case IPSET_COUNTER_LT:
+		return counter < match;
+	case IPSET_COUNTER_GT:
+		return counter > match;
+	}
+	return false;
+}
+
+bool
+ip_set_match_extensions(struct ip_set *set, const struct ip_set_ext *ext,
+			struct ip_set_ext *mext, u32 flags, void *data)
+{
+	if (SET_WITH_TIMEOUT(set) &&
+	    ip_set_timeout_expired(ext_timeout(data, set)))
+		return false;
+	if (SET_WITH_COUNTER(set)) {
+		struct ip_set_counter *counter = ext_counter(data, set);
+
+		if (flags & IPSET_FLAG_MATCH_COUNTERS &&
+		    !(ip_set_match_counter(atomic64_read(&counter->packets),
+				mext->packets, mext->packets_op) &&
+		      ip_set_match_counter(atomic64_read(&counter->bytes),
+				mext->bytes, mext->bytes_op)))
+			return false;
+		if (ext->packets != ULLONG_MAX &&
+		    !(flags & IPSET_FLAG_SKIP_COUNTER_UPDATE)) {
+			atomic64_add((long long)ext->bytes, &counter->bytes);
+			atomic64_add((long long)ext->packets,
+				     &counter->packets);
+		}
+	}
+	if (SET_WITH_SKBINFO(set))
+		mext->skbinfo = *ext_skbinfo(data, set);
+	return true;
+}
+
+int
+ip_set_put_flags(struct sk_buff *skb, struct ip_set *set)
+{
+	u32 cadt_flags = 0;
+
+	if (SET_WITH_TIMEOUT(set))
+		if (unlikely(nla_put_net32(skb, IPSET_ATTR_TIMEOUT,
+					   htonl(set->timeout))))
+			return -EMSGSIZE;
+	if (set->memlimit)
+		if (unlikely(nla_put_net32(skb, IPSET_ATTR_MEMLIMIT,
+					   htonl(set->memlimit))))
+			return -EMSGSIZE;
+	if (SET_WITH_COUNTER(set))
+		cadt_flags |= IPSET_FLAG_WITH_COUNTERS;
+	if (SET_WITH_COMMENT(set))
+		cadt_flags |= IPSET_FLAG_WITH_COMMENT;
+	if (SET_WITH_SKBINFO(set))
+		cadt_flags |= IPSET_FLAG_WITH_SKBINFO;
+	if (SET_WITH_FORCEADD(set))
+		cadt_flags |= IPSET_FLAG_WITH_FORCEADD;
+	if (set->stats)
+		cadt_flags |= IPSET_FLAG_WITH_STATS;
+
+	if (!cadt_flags)
+		return 0;
+	return nla_put_net32(skb, IPSET_ATTR_CADT_FLAGS, htonl(cadt_flags));
+}
+
+#define IPSET_PUT_STATS(skb, type, sum, field)			\
+	IPSET_NLA_PUT_NET64(skb, IPSET_ATTR_STATS_##type,	\
+			    cpu_to_be64((sum).field), IPSET_ATTR_STATS_PAD)
+
+int
+ip_set_put_stats(struct sk_buff *skb, struct ip_set *set)
+{
+	struct ip_set_stats sum = {}, *s;
+	struct nlattr *nested;
+	int cpu;
+
+	if (!set->stats)
+		return 0;
+	for_each_possible_cpu(cpu) {
+		s = per_cpu_ptr(set->stats, cpu);
+		sum.tests += s->tests;
+		sum.hits += s->hits;
+		sum.buckets += s->buckets;
+		sum.probes += s->probes;
+		sum.kadds += s->kadds;
+		sum.kdels += s->kdels;
+		sum.uadds += s->uadds;
+		sum.udels += s->udels;
+		sum.resizes += s->resizes;
+		sum.expired += s->expired;
+		sum.full += s->full;
+	}
+	nested = nla_nest_start(skb, IPSET_ATTR_STATS);
+	if (!nested)
+		return -EMSGSIZE;
+	if (IPSET_PUT_STATS(skb, TESTS, sum, tests) ||
+	    IPSET_PUT_STATS(skb, HITS, sum, hits) ||
+	    IPSET_PUT_STATS(skb, BUCKETS, sum, buckets) ||
+	    IPSET_PUT_STATS(skb, PROBES, sum, probes) ||
+	    IPSET_PUT_STATS(skb, KADDS, sum, kadds) ||
+	    IPSET_PUT_STATS(skb, KDELS, sum, kdels) ||
+	    IPSET_PUT_STATS(skb, UADDS, sum, uadds) ||
+	    IPSET_PUT_STATS(skb, UDELS, sum, udels) ||
+	    IPSET_PUT_STATS(skb, RESIZES, sum, resizes) ||
+	    IPSET_PUT_STATS(skb, EXPIRED, sum, expired) ||
+	    IPSET_PUT_STATS(skb, FULL, sum, full))
+		return -EMSGSIZE;
+	nla_nest_end(skb, nested);
+	return 0;
+}
+
+/*
+ * Set commands, following ip_set_create() and call_ad()
+ */
+
+int
+kshim_create(const char *typename, u8 family, u8 revision,
+	     struct nlattr *tb[], struct ip_set **setp)
+{
+	static struct net net;
+	struct ip_set *set;
+	int ret;
+
+	set = kzalloc(sizeof(*set), GFP_KERNEL);
+	if (!set)
+		return -ENOMEM;
+	spin_lock_init(&set->lock);
+	strlcpy(set->name, typename, IPSET_MAXNAMELEN);
+	set->family = family;
+	set->type = kshim_find_type(typename, family);
+	if (!set->type) {
+		kfree(set);
+		return -IPSET_ERR_FIND_TYPE;
+	}
+	set->revision = revision ? revision : set->type->revision_max;
+
+	ret = set->type->create(&net, set, tb, 0);
+	if (ret != 0) {
+		kfree(set);
+		return ret;
+	}
+	if (tb[IPSET_ATTR_MEMLIMIT])
+		set->memlimit = ip_set_get_h32(tb[IPSET_ATTR_MEMLIMIT]);
+	if (tb[IPSET_ATTR_CADT_FLAGS] &&
+	    (ip_set_get_h32(tb[IPSET_ATTR_CADT_FLAGS]) &
+	     IPSET_FLAG_WITH_STATS)) {
+		set->stats = alloc_percpu(struct ip_set_stats);
+		if (!set->stats) {
+			set->variant->destroy(set);
+			kfree(set);
+			return -ENOMEM;
+		}
+		static_branch_inc(&ip_set_stats_key);
+	}
+	if (SET_WITH_COMMENT(set)) {
+		set->comments = kcalloc(IPSET_COMMENT_HSIZE,
+					sizeof(struct hlist_head),
+					GFP_KERNEL);
+		if (!set->comments) {
+			kshim_destroy(set);
+			return -ENOMEM;
+		}
+	}
+	*setp = set;
+	return 0;
+}
+
+void
+kshim_destroy(struct ip_set *set)
+{
+	set->variant->destroy(set);
+	kfree(set->comments);
+	if (set->stats) {
+		free_percpu(set->stats);
+		static_branch_dec(&ip_set_stats_key);
+	}
+	kfree(set);
+}
+
+struct kshim_lock_stats kshim_lock_stats;
+
+static void
+kshim_lock_account(u64 ns)
+{
+	kshim_lock_stats.locked++;
+	kshim_lock_stats.total_ns += ns;
+	if (ns > kshim_lock_stats.max_ns)
+		kshim_lock_stats.max_ns = ns;
+}
+
+/* Following call_ad() */
+int
+kshim_uadt(struct ip_set *set, struct nlattr *tb[], enum ipset_adt adt,
+	   u32 flags)
+{
+	bool eexist = flags & IPSET_FLAG_EXIST, retried = false;
+	u32 lineno = 0;
+	u64 start;
+	int ret;
+
+	do {
+		if (retried)
+			cond_resched();
+		spin_lock_bh(&set->lock);
+		start = bench_now();
+		ret = set->variant->uadt(set, tb, adt, &lineno, flags, retried);
+		kshim_lock_account(bench_now() - start);
+		spin_unlock_bh(&set->lock);
+		retried = true;
+	} while (ret == -ERANGE ||
+		 (ret == -EAGAIN &&
+		  set->variant->resize &&
+		  (ret = set->variant->resize(set, retried)) == 0));
+
+	if (adt == IPSET_TEST) {
+		/* Following ip_set_utest() */
+		ip_set_stats_inc(set, tests);
+		if (ret > 0)
+			ip_set_stats_inc(set, hits);
+	}
+	if (!ret) {
+		if (adt == IPSET_ADD)
+			ip_set_stats_inc(set, uadds);
+		else if (adt == IPSET_DEL)
+			ip_set_stats_inc(set, udels);
+		return 0;
+	}
+	if (ret == -IPSET_ERR_EXIST && eexist)
+		return 0;
+	return ret;
+}
+
+/* Following ip_set_test(), ip_set_add() and ip_set_del() */
+int
+kshim_kadt(struct ip_set *set, const struct sk_buff *skb,
+	   const struct xt_action_param *par,
+	   enum ipset_adt adt, struct ip_set_adt_opt *opt)
+{
+	int ret;
+
+	if (opt->dim < set->type->dimension ||
+	    !(opt->family == set->family || set->family == NFPROTO_UNSPEC))
+		return adt == IPSET_TEST ? 0 : -IPSET_ERR_TYPE_MISMATCH;
+
+	if (adt != IPSET_TEST) {
+		spin_lock_bh(&set->lock);
+		ret = set->variant->kadt(set, skb, par, adt, opt);
+		spin_unlock_bh(&set->lock);
+		if (!ret && adt == IPSET_ADD)
+			ip_set_stats_inc(set, kadds);
+		else if (!ret)
+			ip_set_stats_inc(set, kdels);
+		return ret;
+	}
+
+	rcu_read_lock_bh();
+	ret = set->variant->kadt(set, skb, par, IPSET_TEST, opt);
+	rcu_read_unlock_bh();
+	ip_set_stats_inc(set, tests);
+	if (ret > 0 || ret == -EAGAIN)
+		ip_set_stats_inc(set, hits);
+
+	if (ret == -EAGAIN) {
+		/* Type requests element to be completed */
+		spin_lock_bh(&set->lock);
+		set->variant->kadt(set, skb, par, IPSET_ADD, opt);
+		spin_unlock_bh(&set->lock);
+		ret = 1;
+	} else {
+		/* --return-nomatch: invert matched element */
+		if ((opt->cmdflags & IPSET_FLAG_RETURN_NOMATCH) &&
+		    (set->type->features & IPSET_TYPE_NOMATCH) &&
+		    (ret > 0 || ret == -ENOTEMPTY))
+			ret = -ret;
+	}
+
+	/* Convert error codes to nomatch */
+	return (ret < 0 ? 0 : ret);
+}
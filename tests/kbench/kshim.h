@@ -0,0 +1,737 @@
+/* Copyright 2007-2010 Jozsef Kadlecsik (kadlec@netfilter.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _KSHIM_H
+#define _KSHIM_H
+
+/* A thin userspace stand-in for the kernel API used by the set types,
+ * so that the kernel sources can be compiled and measured unmodified.
+ *
+ * The harness is single threaded: locks are no-ops, RCU readers are
+ * free and deferred frees are executed immediately. Timers fire only
+ * when kshim_run_timers() is called, jiffies move only by kshim_tick().
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <endian.h>
+
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/if_ether.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/icmp.h>
+#include <linux/icmpv6.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef u32 gfp_t;
+
+/* Kernel internal error codes */
+#ifndef ENOTSUPP
+#define ENOTSUPP		524
+#endif
+
+/* Compiler */
+#define __force
+#define __rcu
+#define __read_mostly
+#define __init
+#define __exit
+#define __aligned(x)		__attribute__((aligned(x)))
+#undef __always_inline
+#define __always_inline		inline __attribute__((always_inline))
+#define likely(x)		__builtin_expect(!!(x), 1)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+#define barrier()		__asm__ __volatile__("" : : : "memory")
+#define BUILD_BUG_ON(c)		((void)sizeof(char[1 - 2 * !!(c)]))
+#define WARN_ON(c)		(!!(c))
+#define WARN_ON_ONCE(c)		(!!(c))
+#define BUG_ON(c)		do { if (c) abort(); } while (0)
+
+#define __stringify_1(x...)	#x
+#define __stringify(x...)	__stringify_1(x)
+
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define ALIGN(x, a)		(((x) + (a) - 1) & ~((typeof(x))(a) - 1))
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define container_of(ptr, type, member)	\
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define max(a, b)		((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)		min((t)(a), (t)(b))
+#define max_t(t, a, b)		max((t)(a), (t)(b))
+#define swap(a, b)		\
+	do { typeof(a) __tmp = (a); (a) = (b); (b) = __tmp; } while (0)
+
+/* Messages: the harness output must stay machine readable */
+#define pr_debug(fmt, ...)	do { } while (0)
+#define pr_warn(fmt, ...)	do { } while (0)
+#define pr_info(fmt, ...)	do { } while (0)
+#define pr_err(fmt, ...)	fprintf(stderr, fmt, ##__VA_ARGS__)
+#define net_ratelimit()		0
+
+/* Byte order, usable in constant initializers */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define __kshim_be16(x)		__builtin_bswap16(x)
+#define __kshim_be32(x)		__builtin_bswap32(x)
+#define __kshim_be64(x)		__builtin_bswap64(x)
+#else
+#define __kshim_be16(x)		((u16)(x))
+#define __kshim_be32(x)		((u32)(x))
+#define __kshim_be64(x)		((u64)(x))
+#endif
+#undef htons
+#undef ntohs
+#undef htonl
+#undef ntohl
+#define htons(x)		__kshim_be16(x)
+#define ntohs(x)		__kshim_be16(x)
+#define htonl(x)		__kshim_be32(x)
+#define ntohl(x)		__kshim_be32(x)
+#define cpu_to_be16(x)		__kshim_be16(x)
+#define cpu_to_be32(x)		__kshim_be32(x)
+#define cpu_to_be64(x)		__kshim_be64(x)
+#define be16_to_cpu(x)		__kshim_be16(x)
+#define be32_to_cpu(x)		__kshim_be32(x)
+#define be64_to_cpu(x)		__kshim_be64(x)
+
+/* Bit operations */
+#define BITS_PER_LONG		(sizeof(long) * CHAR_BIT)
+#define BITS_TO_LONGS(n)	(((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits)	unsigned long name[BITS_TO_LONGS(bits)]
+
+static inline bool
+test_bit(unsigned long nr, const unsigned long *addr)
+{
+	return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1UL;
+}
+
+static inline void
+set_bit(unsigned long nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline void
+clear_bit(unsigned long nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+
+static inline int
+fls(unsigned int x)
+{
+	return x ? 32 - __builtin_clz(x) : 0;
+}
+
+static inline u32
+rol32(u32 word, unsigned int shift)
+{
+	return (word << (shift & 31)) | (word >> ((-shift) & 31));
+}
+
+static inline u32
+__get_unaligned_cpu32(const void *p)
+{
+	u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* Atomics and barriers */
+typedef struct { int counter; } atomic_t;
+typedef struct { long long counter; } atomic64_t;
+
+#define atomic_read(v)		((v)->counter)
+#define atomic_set(v, i)	((v)->counter = (i))
+#define atomic_inc(v)		((v)->counter++)
+#define atomic_dec(v)		((v)->counter--)
+#define atomic_dec_and_test(v)	(--(v)->counter == 0)
+#define atomic64_read(v)	((v)->counter)
+#define atomic64_set(v, i)	((v)->counter = (i))
+#define atomic64_add(i, v)	((v)->counter += (i))
+
+#define smp_mb()		__sync_synchronize()
+#define smp_mb__before_atomic()	barrier()
+#define smp_mb__after_atomic()	barrier()
+
+/* Static keys and per CPU data, of the only CPU */
+struct static_key_false {
+	int enabled;
+};
+
+#define DEFINE_STATIC_KEY_FALSE(name)	struct static_key_false name
+#define DECLARE_STATIC_KEY_FALSE(name)	extern struct static_key_false name
+#define static_branch_unlikely(k)	unlikely((k)->enabled > 0)
+#define static_branch_inc(k)		((k)->enabled++)
+#define static_branch_dec(k)		((k)->enabled--)
+
+#define __percpu
+#define alloc_percpu(type)		((type *)calloc(1, sizeof(type)))
+#define free_percpu(p)			free(p)
+#define per_cpu_ptr(p, cpu)		((void)(cpu), (p))
+#define this_cpu_add(var, n)		((var) += (n))
+#define for_each_possible_cpu(cpu)	for ((cpu) = 0; (cpu) < 1; (cpu)++)
+
+/* Lists */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+struct hlist_node {
+	struct hlist_node *next, **pprev;
+};
+
+struct hlist_head {
+	struct hlist_node *first;
+};
+
+#define LIST_HEAD_INIT(name)	{ &(name), &(name) }
+
+static inline void
+INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list->prev = list;
+}
+
+static inline void
+list_add_tail(struct list_head *n, struct list_head *head)
+{
+	n->prev = head->prev;
+	n->next = head;
+	head->prev->next = n;
+	head->prev = n;
+}
+
+static inline void
+list_del(struct list_head *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_entry((head)->next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+static inline void
+hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+{
+	n->next = h->first;
+	if (h->first)
+		h->first->pprev = &n->next;
+	h->first = n;
+	n->pprev = &h->first;
+}
+
+static inline void
+hlist_del(struct hlist_node *n)
+{
+	*n->pprev = n->next;
+	if (n->next)
+		n->next->pprev = n->pprev;
+}
+
+#define hlist_entry_safe(ptr, type, member)	\
+	((ptr) ? container_of(ptr, type, member) : NULL)
+#define hlist_for_each_entry(pos, head, member)				\
+	for (pos = hlist_entry_safe((head)->first, typeof(*pos), member);\
+	     pos;							\
+	     pos = hlist_entry_safe(pos->member.next, typeof(*pos), member))
+
+/* Locking and RCU: single threaded */
+typedef struct { int unused; } spinlock_t;
+
+#define spin_lock_init(l)	do { } while (0)
+#define spin_lock_bh(l)		do { } while (0)
+#define spin_unlock_bh(l)	do { } while (0)
+#define lockdep_is_held(l)	1
+
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+#define rcu_read_lock()			do { } while (0)
+#define rcu_read_unlock()		do { } while (0)
+#define rcu_read_lock_bh()		do { } while (0)
+#define rcu_read_unlock_bh()		do { } while (0)
+#define rcu_dereference(p)		(p)
+#define rcu_dereference_bh(p)		(p)
+#define rcu_dereference_protected(p, c)	(p)
+#define rcu_dereference_bh_check(p, c)	(p)
+#define rcu_assign_pointer(p, v)	do { barrier(); (p) = (v); } while (0)
+#define RCU_INIT_POINTER(p, v)		do { (p) = (v); } while (0)
+#define synchronize_rcu()		do { } while (0)
+#define rcu_barrier()			do { } while (0)
+#define cond_resched()			do { } while (0)
+#define kfree_rcu(ptr, field)		kfree(ptr)
+
+static inline void
+call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+	func(head);
+}
+
+static inline void
+cond_resched_rcu(void)
+{
+}
+
+/* Memory */
+#define GFP_KERNEL		0U
+#define GFP_ATOMIC		0U
+#define __GFP_NOWARN		0U
+#define KMALLOC_MAX_SIZE	(1UL << 22)
+
+#define kmalloc(size, flags)	malloc(size)
+#define kzalloc(size, flags)	calloc(1, size)
+#define kcalloc(n, size, flags)	calloc(n, size)
+#define kvcalloc(n, size, flags) calloc(n, size)
+#define kfree(p)		free((void *)(p))
+#define vzalloc(size)		calloc(1, size)
+#define vfree(p)		free((void *)(p))
+#define kvfree(p)		free((void *)(p))
+#define is_vmalloc_addr(p)	0
+
+#define MAX_ERRNO		4095
+#define ERR_PTR(err)		((void *)(long)(err))
+#define PTR_ERR(p)		((long)(p))
+#define IS_ERR(p)		((unsigned long)(p) >= (unsigned long)-MAX_ERRNO)
+
+static inline size_t
+strlcpy(char *dst, const char *src, size_t size)
+{
+	size_t len = strlen(src);
+
+	if (size) {
+		size_t n = len >= size ? size - 1 : len;
+
+		memcpy(dst, src, n);
+		dst[n] = '\0';
+	}
+	return len;
+}
+
+extern void get_random_bytes(void *buf, int nbytes);
+
+/* Time and timers */
+#define HZ			1000
+#define MSEC_PER_SEC		1000L
+
+extern unsigned long jiffies;
+
+#define msecs_to_jiffies(m)	((unsigned long)(m) * HZ / MSEC_PER_SEC)
+#define jiffies_to_msecs(j)	((unsigned int)((j) * MSEC_PER_SEC / HZ))
+#define time_after(a, b)	((long)((b) - (a)) < 0)
+#define time_is_before_jiffies(a)	time_after(jiffies, a)
+
+struct timer_list {
+	struct list_head entry;
+	unsigned long expires;
+	void (*function)(struct timer_list *t);
+	bool pending;
+};
+
+#define from_timer(var, callback_timer, timer_fieldname)	\
+	container_of(callback_timer, typeof(*var), timer_fieldname)
+
+extern void timer_setup(struct timer_list *t,
+			void (*fn)(struct timer_list *t), unsigned int flags);
+extern void add_timer(struct timer_list *t);
+extern int mod_timer(struct timer_list *t, unsigned long expires);
+extern int del_timer_sync(struct timer_list *t);
+
+/* Modules */
+struct module;
+struct net { int unused; };
+
+#define THIS_MODULE		((struct module *)NULL)
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_ALIAS(x)
+#define EXPORT_SYMBOL(x)
+#define EXPORT_SYMBOL_GPL(x)
+#define module_init(fn)					\
+static void __attribute__((constructor)) __kshim_##fn(void)	\
+{							\
+	fn();						\
+}
+#define module_exit(fn)					\
+static void (*__kshim_##fn)(void) __attribute__((unused)) = fn
+
+/* Socket buffers: linear only, the network header at skb->data */
+struct sk_buff {
+	unsigned char *head, *data;
+	unsigned int len;
+	unsigned int tail, end;
+	u16 mac_header, network_header;
+	__be16 protocol;
+	u32 mark;
+};
+
+static inline unsigned char *
+skb_tail_pointer(const struct sk_buff *skb)
+{
+	return skb->head + skb->tail;
+}
+
+static inline int
+skb_tailroom(const struct sk_buff *skb)
+{
+	return skb->end - skb->tail;
+}
+
+static inline void *
+skb_put(struct sk_buff *skb, unsigned int len)
+{
+	void *tmp = skb_tail_pointer(skb);
+
+	skb->tail += len;
+	skb->len += len;
+	return tmp;
+}
+
+static inline unsigned char *
+skb_mac_header(const struct sk_buff *skb)
+{
+	return skb->head + skb->mac_header;
+}
+
+static inline unsigned char *
+skb_network_header(const struct sk_buff *skb)
+{
+	return skb->head + skb->network_header;
+}
+
+static inline int
+skb_network_offset(const struct sk_buff *skb)
+{
+	return skb_network_header(skb) - skb->data;
+}
+
+static inline void *
+skb_header_pointer(const struct sk_buff *skb, int offset, int len,
+		   void *buffer)
+{
+	if (offset < 0 || (unsigned int)(offset + len) > skb->len)
+		return NULL;
+	return skb->data + offset;
+}
+
+static inline struct ethhdr *
+eth_hdr(const struct sk_buff *skb)
+{
+	return (struct ethhdr *)skb_mac_header(skb);
+}
+
+static inline struct iphdr *
+ip_hdr(const struct sk_buff *skb)
+{
+	return (struct iphdr *)skb_network_header(skb);
+}
+
+static inline unsigned int
+ip_hdrlen(const struct sk_buff *skb)
+{
+	return ip_hdr(skb)->ihl * 4;
+}
+
+static inline struct ipv6hdr *
+ipv6_hdr(const struct sk_buff *skb)
+{
+	return (struct ipv6hdr *)skb_network_header(skb);
+}
+
+#define IP_OFFSET		0x1FFF
+
+#define NEXTHDR_HOP		0
+#define NEXTHDR_ROUTING		43
+#define NEXTHDR_FRAGMENT	44
+#define NEXTHDR_AUTH		51
+#define NEXTHDR_NONE		59
+#define NEXTHDR_DEST		60
+
+struct frag_hdr {
+	__u8 nexthdr;
+	__u8 reserved;
+	__be16 frag_off;
+	__be32 identification;
+};
+
+#define ipv6_optlen(p)		(((p)->hdrlen + 1) << 3)
+
+extern int ipv6_skip_exthdr(const struct sk_buff *skb, int start,
+			    u8 *nexthdrp, __be16 *frag_offp);
+
+/* The 64 bit variants of the kernel: the elements are 4 byte aligned only */
+static inline bool
+ipv6_addr_equal(const struct in6_addr *a1, const struct in6_addr *a2)
+{
+	const u64 *a = (const u64 *)a1, *b = (const u64 *)a2;
+
+	return ((a[0] ^ b[0]) | (a[1] ^ b[1])) == 0;
+}
+
+static inline bool
+ipv6_addr_any(const struct in6_addr *a)
+{
+	const u64 *ul = (const u64 *)a;
+
+	return (ul[0] | ul[1]) == 0;
+}
+
+static inline bool
+ether_addr_equal(const u8 *addr1, const u8 *addr2)
+{
+	return memcmp(addr1, addr2, ETH_ALEN) == 0;
+}
+
+static inline bool
+is_zero_ether_addr(const u8 *addr)
+{
+	static const u8 zero[ETH_ALEN];
+
+	return memcmp(addr, zero, ETH_ALEN) == 0;
+}
+
+#define ether_addr_copy(dst, src)	memcpy(dst, src, ETH_ALEN)
+
+/* Netlink attributes, written into the skb buffers */
+enum {
+	NLA_UNSPEC,
+	NLA_U8,
+	NLA_U16,
+	NLA_U32,
+	NLA_U64,
+	NLA_STRING,
+	NLA_FLAG,
+	NLA_MSECS,
+	NLA_NESTED,
+	NLA_NESTED_ARRAY,
+	NLA_NUL_STRING,
+	NLA_BINARY,
+};
+
+struct nla_policy {
+	u16 type;
+	u16 len;
+};
+
+struct netlink_callback {
+	long args[6];
+};
+
+#define nla_for_each_attr(pos, head, len, rem)			\
+	for (pos = head, rem = len;				\
+	     rem >= (int)sizeof(*pos) && pos->nla_len >= sizeof(*pos) && \
+	     pos->nla_len <= rem;				\
+	     rem -= NLA_ALIGN(pos->nla_len),			\
+	     pos = (struct nlattr *)((char *)pos + NLA_ALIGN(pos->nla_len)))
+
+static inline int
+nla_type(const struct nlattr *nla)
+{
+	return nla->nla_type & NLA_TYPE_MASK;
+}
+
+static inline void *
+nla_data(const struct nlattr *nla)
+{
+	return (char *)nla + NLA_HDRLEN;
+}
+
+static inline int
+nla_len(const struct nlattr *nla)
+{
+	return nla->nla_len - NLA_HDRLEN;
+}
+
+#define __nla_get(nla, t)	({ t __v; memcpy(&__v, nla_data(nla), sizeof(__v)); __v; })
+#define nla_get_u8(nla)		(*(u8 *)nla_data(nla))
+#define nla_get_u16(nla)	__nla_get(nla, u16)
+#define nla_get_u32(nla)	__nla_get(nla, u32)
+#define nla_get_u64(nla)	__nla_get(nla, u64)
+#define nla_get_be16(nla)	__nla_get(nla, __be16)
+#define nla_get_be32(nla)	__nla_get(nla, __be32)
+#define nla_get_be64(nla)	__nla_get(nla, __be64)
+
+extern int nla_parse_nested(struct nlattr *tb[], int maxtype,
+			    const struct nlattr *nla,
+			    const struct nla_policy *policy);
+extern struct nlattr *nla_reserve(struct sk_buff *skb, int attrtype,
+				  int attrlen);
+extern int nla_put(struct sk_buff *skb, int attrtype, int attrlen,
+		   const void *data);
+
+static inline int
+nla_put_u8(struct sk_buff *skb, int attrtype, u8 value)
+{
+	return nla_put(skb, attrtype, sizeof(u8), &value);
+}
+
+static inline int
+nla_put_u32(struct sk_buff *skb, int attrtype, u32 value)
+{
+	return nla_put(skb, attrtype, sizeof(u32), &value);
+}
+
+static inline int
+nla_put_be16(struct sk_buff *skb, int attrtype, __be16 value)
+{
+	return nla_put(skb, attrtype, sizeof(__be16), &value);
+}
+
+static inline int
+nla_put_net16(struct sk_buff *skb, int attrtype, __be16 value)
+{
+	return nla_put_be16(skb, attrtype | NLA_F_NET_BYTEORDER, value);
+}
+
+static inline int
+nla_put_be32(struct sk_buff *skb, int attrtype, __be32 value)
+{
+	return nla_put(skb, attrtype, sizeof(__be32), &value);
+}
+
+static inline int
+nla_put_net32(struct sk_buff *skb, int attrtype, __be32 value)
+{
+	return nla_put_be32(skb, attrtype | NLA_F_NET_BYTEORDER, value);
+}
+
+static inline int
+nla_put_net64(struct sk_buff *skb, int attrtype, __be64 value, int padattr)
+{
+	return nla_put(skb, attrtype | NLA_F_NET_BYTEORDER,
+		       sizeof(__be64), &value);
+}
+
+static inline int
+nla_put_string(struct sk_buff *skb, int attrtype, const char *str)
+{
+	return nla_put(skb, attrtype, strlen(str) + 1, str);
+}
+
+static inline size_t
+nla_strlcpy(char *dst, const struct nlattr *nla, size_t dstsize)
+{
+	size_t srclen = nla_len(nla);
+	const char *src = nla_data(nla);
+
+	if (srclen > 0 && src[srclen - 1] == '\0')
+		srclen--;
+	if (dstsize > 0) {
+		size_t len = srclen >= dstsize ? dstsize - 1 : srclen;
+
+		memset(dst, 0, dstsize);
+		memcpy(dst, src, len);
+	}
+	return srclen;
+}
+
+static inline int
+nla_put_in_addr(struct sk_buff *skb, int attrtype, __be32 addr)
+{
+	return nla_put_be32(skb, attrtype, addr);
+}
+
+static inline int
+nla_put_in6_addr(struct sk_buff *skb, int attrtype,
+		 const struct in6_addr *addr)
+{
+	return nla_put(skb, attrtype, sizeof(*addr), addr);
+}
+
+static inline struct nlattr *
+nla_nest_start(struct sk_buff *skb, int attrtype)
+{
+	struct nlattr *start = (struct nlattr *)skb_tail_pointer(skb);
+
+	if (nla_put(skb, attrtype, 0, NULL) < 0)
+		return NULL;
+	return start;
+}
+
+static inline int
+nla_nest_end(struct sk_buff *skb, struct nlattr *start)
+{
+	start->nla_len = skb_tail_pointer(skb) - (unsigned char *)start;
+	return skb->len;
+}
+
+static inline void
+nlmsg_trim(struct sk_buff *skb, const void *mark)
+{
+	if (mark) {
+		skb->len -= skb_tail_pointer(skb) - (const unsigned char *)mark;
+		skb->tail = (const unsigned char *)mark - skb->head;
+	}
+}
+
+static inline void
+nla_nest_cancel(struct sk_buff *skb, struct nlattr *start)
+{
+	nlmsg_trim(skb, start);
+}
+
+/* Sequence number comparisons of net/tcp.h */
+static inline bool
+before(u32 seq1, u32 seq2)
+{
+	return (s32)(seq1 - seq2) < 0;
+}
+#define after(seq2, seq1)	before(seq1, seq2)
+
+struct sctphdr {
+	__be16 source;
+	__be16 dest;
+	__be32 vtag;
+	__le32 checksum;
+};
+
+/* Network devices: just the names, which hash:net,iface matches */
+struct net_device {
+	char name[IFNAMSIZ];
+};
+
+struct nf_hook_state {
+	const struct net_device *in;
+	const struct net_device *out;
+};
+
+/* Matches and targets */
+struct xt_action_param {
+	const struct nf_hook_state *state;
+	u8 family;
+};
+
+#define xt_family(par)		((par)->family)
+
+#endif /* _KSHIM_H */
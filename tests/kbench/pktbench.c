@@ -0,0 +1,734 @@
+/* Copyright 2007-2010 Jozsef Kadlecsik (kadlec@netfilter.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Microbenchmarks of the packet path of the set types: synthetic
+ * IPv4/IPv6 packets are matched by the kadt functions, as the set match
+ * of iptables calls them through ip_set_test(). The sets are filled out
+ * by the uadt functions, then the packets of the member elements (hit)
+ * and of other elements (miss) are tested. The results are printed as
+ * one JSON object per line, with the cache misses per lookup when the
+ * kernel lets us count them and the searched buckets and compared
+ * elements per lookup when the sets are created with stats.
+ */
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "kbench.h"
+
+/* Packet shapes */
+enum pkt_shape {
+	SHAPE_TCP,
+	SHAPE_UDP,
+	SHAPE_ICMP,
+	SHAPE_EXTHDR,		/* TCP after IPv4 options/IPv6 ext. headers */
+	SHAPE_FRAG,		/* Non-first TCP fragment */
+	SHAPE_MAX,
+};
+
+static const char * const shape_names[SHAPE_MAX] = {
+	[SHAPE_TCP]	= "tcp",
+	[SHAPE_UDP]	= "udp",
+	[SHAPE_ICMP]	= "icmp",
+	[SHAPE_EXTHDR]	= "exthdr",
+	[SHAPE_FRAG]	= "frag",
+};
+
+#define PKT_SLOT	128	/* Room of a packet, with the MAC header */
+#define PKT_ALIGN	2	/* The IP header is aligned, as NET_IP_ALIGN */
+#define MAX_SIZES	16
+
+/* Benchmark parameters */
+static struct {
+	u32 sizes[MAX_SIZES];
+	unsigned int nsizes;
+	unsigned int shapes;
+	u32 hashsize;			/* zero: type default */
+	u32 timeout;
+	unsigned int rounds;
+	unsigned int seed;
+	enum bench_dist dist;
+	u8 cidr_min, cidr_max;		/* zero: family default */
+	u8 netmask;			/* hash:ip only */
+	u32 ifaces;			/* hash:net,iface */
+	u32 wildcards;			/* hash:net,iface */
+	bool wildcards_apart;		/* on the networks of the misses */
+	bool counters;
+	bool stats;
+} opt = {
+	.sizes		= { 1000, 100000 },
+	.nsizes		= 2,
+	.shapes		= (1 << SHAPE_MAX) - 1,
+	.rounds		= 5,
+	.seed		= 1,
+	.dist		= DIST_RANDOM,
+	.ifaces		= 500,
+};
+
+/* An element and the packets matching it */
+struct pkt_key {
+	u32 ip[4], ip2[4];		/* Host order */
+	u8 cidr, cidr2;
+	__be16 port;
+	u8 proto;
+	__be32 mark;
+	u8 mac[ETH_ALEN];
+	u32 iface;
+};
+
+struct pkt_result {
+	u64 best, total;		/* nanoseconds */
+	u64 misses;			/* cache misses in all rounds */
+	u64 matched;
+	u64 buckets, probes;		/* in all rounds, from the stats */
+};
+
+static int counter_fd = -1;
+
+/* The output interfaces of the packets */
+static struct net_device *ifaces;
+
+static u8
+rand_cidr(u8 family)
+{
+	u8 lo = opt.cidr_min, hi = opt.cidr_max;
+
+	if (!lo)
+		lo = hi = family == NFPROTO_IPV4 ? 24 : 64;
+	return lo + random() % (hi - lo + 1);
+}
+
+static void
+gen_keys(struct pkt_key *keys, u32 n, unsigned int dims, u8 family,
+	 enum pkt_shape shape)
+{
+	u8 host = family == NFPROTO_IPV4 ? 32 : 128;
+	u32 i, cluster = 0, cluster2 = 0;
+
+	srandom(opt.seed);
+	for (i = 0; i < n; i++) {
+		struct pkt_key *k = &keys[i];
+
+		k->cidr = dims & DIM_CIDR ? rand_cidr(family) : host;
+		k->cidr2 = dims & DIM_CIDR2 ? rand_cidr(family) : host;
+		bench_addr(k->ip, family, opt.dist, i, k->cidr, &cluster);
+		bench_addr(k->ip2, family, opt.dist, i, k->cidr2, &cluster2);
+		switch (shape) {
+		case SHAPE_UDP:
+			k->proto = IPPROTO_UDP;
+			k->port = htons(1 + random() % 65535);
+			break;
+		case SHAPE_ICMP:
+			/* The type and the code are stored as the port */
+			k->proto = family == NFPROTO_IPV6 ? IPPROTO_ICMPV6
+							  : IPPROTO_ICMP;
+			k->port = htons(random() & 0xff0f);
+			break;
+		default:
+			k->proto = IPPROTO_TCP;
+			k->port = htons(1 + random() % 65535);
+			break;
+		}
+		k->mark = htonl(bench_rand32());
+		k->mac[0] = 0x02;
+		k->mac[1] = random();
+		k->mac[2] = random();
+		k->mac[3] = random();
+		k->mac[4] = random();
+		k->mac[5] = random() | 1;
+		k->iface = random() % opt.ifaces;
+	}
+}
+
+/* A host of the network, with random host bits */
+static void
+host_addr(u32 *h, const u32 *a, u8 family, u8 cidr)
+{
+	unsigned int i, words = family == NFPROTO_IPV4 ? 1 : 4;
+
+	for (i = 0; i < words; i++, cidr = cidr > 32 ? cidr - 32 : 0) {
+		u32 mask = cidr >= 32 ? ~0U : cidr ? ~0U << (32 - cidr) : 0;
+
+		h[i] = (a[i] & mask) | (bench_rand32() & ~mask);
+	}
+}
+
+static void
+put_ip6(struct in6_addr *in6, const u32 *a)
+{
+	unsigned int i;
+
+	for (i = 0; i < 4; i++)
+		in6->s6_addr32[i] = htonl(a[i]);
+}
+
+/* Build the packet of the element: the first dimension is matched by
+ * the source, the others by the destination parameters
+ */
+static void
+build_packet(struct sk_buff *skb, unsigned char *buf, const struct pkt_key *k,
+	     u8 family, enum pkt_shape shape)
+{
+	struct ethhdr *eth = (struct ethhdr *)(buf + PKT_ALIGN);
+	unsigned char *p = buf + PKT_ALIGN + ETH_HLEN, *l4;
+	u32 src[4] = {}, dst[4] = {};
+	u8 proto = k->proto;
+	unsigned int l4len;
+
+	memset(buf, 0, PKT_SLOT);
+	host_addr(src, k->ip, family, k->cidr);
+	host_addr(dst, k->ip2, family, k->cidr2);
+	ether_addr_copy(eth->h_source, k->mac);
+	ether_addr_copy(eth->h_dest, k->mac);
+	l4len = proto == IPPROTO_TCP ? sizeof(struct tcphdr) :
+		proto == IPPROTO_UDP ? sizeof(struct udphdr) :
+		sizeof(struct icmphdr);
+
+	if (family == NFPROTO_IPV4) {
+		struct iphdr *iph = (struct iphdr *)p;
+		unsigned int optlen = shape == SHAPE_EXTHDR ? 8 : 0;
+
+		eth->h_proto = htons(ETH_P_IP);
+		iph->version = 4;
+		iph->ihl = (sizeof(*iph) + optlen) / 4;
+		iph->ttl = 64;
+		iph->protocol = proto;
+		iph->saddr = htonl(src[0]);
+		iph->daddr = htonl(dst[0]);
+		if (shape == SHAPE_FRAG)
+			iph->frag_off = htons(185);
+		/* Options: NOPs and the end of the list */
+		memset(p + sizeof(*iph), IPOPT_NOOP, optlen);
+		l4 = p + sizeof(*iph) + optlen;
+		iph->tot_len = htons(l4 + l4len - p);
+	} else {
+		struct ipv6hdr *ip6h = (struct ipv6hdr *)p;
+		u8 *nexthdr = &ip6h->nexthdr;
+
+		eth->h_proto = htons(ETH_P_IPV6);
+		ip6h->version = 6;
+		ip6h->hop_limit = 64;
+		put_ip6(&ip6h->saddr, src);
+		put_ip6(&ip6h->daddr, dst);
+		l4 = p + sizeof(*ip6h);
+		if (shape == SHAPE_EXTHDR) {
+			/* Hop-by-hop and destination options, padded */
+			*nexthdr = NEXTHDR_HOP;
+			l4[0] = NEXTHDR_DEST;
+			l4[2] = 1;		/* PadN */
+			l4[3] = 4;
+			l4[8] = proto;
+			l4[10] = 1;
+			l4[11] = 4;
+			l4 += 16;
+		} else if (shape == SHAPE_FRAG) {
+			struct frag_hdr *fh = (struct frag_hdr *)l4;
+
+			*nexthdr = NEXTHDR_FRAGMENT;
+			fh->nexthdr = proto;
+			fh->frag_off = htons(185 << 3);
+			fh->identification = htonl(1);
+			l4 += sizeof(*fh);
+		} else {
+			*nexthdr = proto;
+		}
+		ip6h->payload_len = htons(l4 + l4len - p - sizeof(*ip6h));
+	}
+
+	switch (proto) {
+	case IPPROTO_TCP: {
+		struct tcphdr *th = (struct tcphdr *)l4;
+
+		th->source = htons(1024 + random() % 64511);
+		th->dest = k->port;
+		th->doff = sizeof(*th) / 4;
+		break;
+	}
+	case IPPROTO_UDP: {
+		struct udphdr *uh = (struct udphdr *)l4;
+
+		uh->source = htons(1024 + random() % 64511);
+		uh->dest = k->port;
+		uh->len = htons(sizeof(*uh));
+		break;
+	}
+	default: {
+		struct icmphdr *ic = (struct icmphdr *)l4;
+
+		ic->type = ntohs(k->port) >> 8;
+		ic->code = ntohs(k->port) & 0xff;
+		break;
+	}
+	}
+
+	memset(skb, 0, sizeof(*skb));
+	skb->head = buf;
+	skb->data = p;
+	skb->mac_header = PKT_ALIGN;
+	skb->network_header = PKT_ALIGN + ETH_HLEN;
+	skb->len = l4 + l4len - p;
+	skb->tail = l4 + l4len - buf;
+	skb->end = PKT_SLOT;
+	skb->protocol = eth->h_proto;
+	skb->mark = ntohl(k->mark);
+}
+
+static int
+add_key(struct ip_set *set, const struct pkt_key *k, unsigned int dims,
+	u8 family, const char *wildcard)
+{
+	struct nlattr *tb[IPSET_ATTR_ADT_MAX + 1];
+	unsigned char buf[256];
+	struct sk_buff skb;
+
+	kshim_skb_init(&skb, buf, sizeof(buf));
+	if (dims & DIM_IP)
+		bench_put_addr(&skb, IPSET_ATTR_IP, family, k->ip);
+	if (dims & DIM_CIDR)
+		nla_put_u8(&skb, IPSET_ATTR_CIDR, k->cidr);
+	if (dims & DIM_PORT) {
+		nla_put_net16(&skb, IPSET_ATTR_PORT, k->port);
+		nla_put_u8(&skb, IPSET_ATTR_PROTO, k->proto);
+	}
+	if (dims & DIM_IP2)
+		bench_put_addr(&skb, IPSET_ATTR_IP2, family, k->ip2);
+	if (dims & DIM_CIDR2)
+		nla_put_u8(&skb, IPSET_ATTR_CIDR2, k->cidr2);
+	if (dims & DIM_MARK)
+		nla_put_net32(&skb, IPSET_ATTR_MARK, k->mark);
+	if (dims & DIM_MAC)
+		nla_put(&skb, IPSET_ATTR_ETHER, ETH_ALEN, k->mac);
+	if (dims & DIM_IFACE && wildcard) {
+		nla_put_string(&skb, IPSET_ATTR_IFACE, wildcard);
+		nla_put_net32(&skb, IPSET_ATTR_CADT_FLAGS,
+			      htonl(IPSET_FLAG_IFACE_WILDCARD));
+	} else if (dims & DIM_IFACE) {
+		nla_put_string(&skb, IPSET_ATTR_IFACE, ifaces[k->iface].name);
+	}
+	nla_parse(tb, IPSET_ATTR_ADT_MAX, (struct nlattr *)buf, skb.len, NULL);
+
+	return kshim_uadt(set, tb, IPSET_ADD, IPSET_FLAG_EXIST);
+}
+
+/* Wildcard elements on the networks of the elements or, apart, on the
+ * networks of the missing packets, with prefixes which do not match
+ * the interfaces of the packets
+ */
+static int
+add_wildcards(struct ip_set *set, const struct pkt_key *keys, u32 n,
+	      unsigned int dims, u8 family)
+{
+	u32 i, first = opt.wildcards_apart ? n : 0;
+	char name[IFNAMSIZ];
+	int ret;
+
+	for (i = 0; i < opt.wildcards; i++) {
+		snprintf(name, sizeof(name), "vlan%u", i / n);
+		ret = add_key(set, &keys[first + i % n], dims, family, name);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int
+create_set(const char *typename, u8 family, u32 n, struct ip_set **set)
+{
+	struct nlattr *tb[IPSET_ATTR_CREATE_MAX + 1] = {};
+	unsigned char buf[256];
+	struct sk_buff skb;
+	struct nlattr *nla;
+	u32 cadt_flags = 0;
+	int rem;
+
+	kshim_skb_init(&skb, buf, sizeof(buf));
+	if (opt.hashsize)
+		nla_put_net32(&skb, IPSET_ATTR_HASHSIZE, htonl(opt.hashsize));
+	nla_put_net32(&skb, IPSET_ATTR_MAXELEM,
+		      htonl(max_t(u32, n + opt.wildcards, 65536)));
+	if (opt.timeout)
+		nla_put_net32(&skb, IPSET_ATTR_TIMEOUT, htonl(opt.timeout));
+	if (opt.counters)
+		cadt_flags |= IPSET_FLAG_WITH_COUNTERS;
+	if (opt.stats)
+		cadt_flags |= IPSET_FLAG_WITH_STATS;
+	if (cadt_flags)
+		nla_put_net32(&skb, IPSET_ATTR_CADT_FLAGS, htonl(cadt_flags));
+	if (opt.netmask && strcmp(typename, "hash:ip") == 0)
+		nla_put_u8(&skb, IPSET_ATTR_NETMASK, opt.netmask);
+	nla_for_each_attr(nla, (struct nlattr *)buf, skb.len, rem)
+		tb[nla_type(nla)] = nla;
+
+	return kshim_create(typename, family, 0, tb, set);
+}
+
+/* The searched buckets and the compared elements of the set */
+static void
+read_stats(const struct ip_set *set, u64 *buckets, u64 *probes)
+{
+	const struct ip_set_stats *s;
+	int cpu;
+
+	*buckets = *probes = 0;
+	if (!set->stats)
+		return;
+	for_each_possible_cpu(cpu) {
+		s = per_cpu_ptr(set->stats, cpu);
+		*buckets += s->buckets;
+		*probes += s->probes;
+	}
+}
+
+static void
+run_lookups(struct ip_set *set, const struct sk_buff *skbs,
+	    const struct nf_hook_state *states, u32 n,
+	    u8 family, struct pkt_result *r)
+{
+	struct xt_action_param par = { .family = family };
+	struct ip_set_adt_opt adt_opt = {
+		.family = family,
+		.dim = set->type->dimension,
+		.flags = IPSET_DIM_ONE_SRC,
+		.ext.timeout = IPSET_NO_TIMEOUT,
+	};
+	u64 start, t, misses, buckets, probes, b, p;
+	u32 i, matched = 0;
+
+	read_stats(set, &buckets, &probes);
+	misses = bench_counter_read(counter_fd);
+	start = bench_now();
+	for (i = 0; i < n; i++) {
+		par.state = &states[i];
+		if (kshim_kadt(set, &skbs[i], &par, IPSET_TEST, &adt_opt) > 0)
+			matched++;
+	}
+	t = bench_now() - start;
+	r->misses += bench_counter_read(counter_fd) - misses;
+	read_stats(set, &b, &p);
+	r->buckets += b - buckets;
+	r->probes += p - probes;
+
+	if (!r->best || t < r->best)
+		r->best = t;
+	r->total += t;
+	r->matched = matched;
+}
+
+static void
+print_result(const char *typename, u8 family, enum pkt_shape shape, u32 n,
+	     const char *c, const struct pkt_result *r)
+{
+	printf("{\"bench\":\"packet\",\"type\":\"%s\",\"family\":\"%s\","
+	       "\"shape\":\"%s\",\"dist\":\"%s\",\"elements\":%u,"
+	       "\"case\":\"%s\",\"rounds\":%u,\"lookups\":%u,"
+	       "\"best_ns\":%.1f,\"mean_ns\":%.1f,\"matched\":%llu",
+	       typename, bench_family_name(family), shape_names[shape],
+	       bench_dist_name(opt.dist), n, c, opt.rounds, n,
+	       (double)r->best / n, (double)r->total / opt.rounds / n,
+	       (unsigned long long)r->matched);
+	if (opt.wildcards)
+		printf(",\"wildcards\":%u,\"apart\":%s", opt.wildcards,
+		       opt.wildcards_apart ? "true" : "false");
+	if (counter_fd >= 0)
+		printf(",\"cache_misses\":%.2f",
+		       (double)r->misses / opt.rounds / n);
+	if (opt.stats)
+		printf(",\"buckets\":%.2f,\"probes\":%.2f",
+		       (double)r->buckets / opt.rounds / n,
+		       (double)r->probes / opt.rounds / n);
+	printf("}\n");
+}
+
+static int
+bench_size(const char *typename, unsigned int dims, u8 family,
+	   enum pkt_shape shape, u32 n)
+{
+	/* hash:mac is matched by IPv4 packets */
+	u8 pfamily = family == NFPROTO_UNSPEC ? NFPROTO_IPV4 : family;
+	struct pkt_result hit = {}, miss = {};
+	struct nf_hook_state *states = NULL;
+	struct sk_buff *skbs = NULL;
+	unsigned char *pkts = NULL;
+	struct pkt_key *keys;
+	struct ip_set *set = NULL;
+	unsigned int i;
+	int ret = -ENOMEM;
+
+	keys = malloc((size_t)2 * n * sizeof(*keys));
+	skbs = malloc((size_t)2 * n * sizeof(*skbs));
+	pkts = malloc((size_t)2 * n * PKT_SLOT);
+	states = calloc((size_t)2 * n, sizeof(*states));
+	if (!keys || !skbs || !pkts || !states)
+		goto out;
+
+	gen_keys(keys, 2 * n, dims, pfamily, shape);
+	for (i = 0; i < 2 * n; i++) {
+		build_packet(&skbs[i], pkts + (size_t)i * PKT_SLOT, &keys[i],
+			     pfamily, shape);
+		states[i].out = &ifaces[keys[i].iface];
+	}
+
+	ret = create_set(typename, family, n, &set);
+	if (ret)
+		goto out;
+	if (dims & DIM_IFACE) {
+		ret = add_wildcards(set, keys, n, dims, pfamily);
+		if (ret)
+			goto out;
+	}
+	for (i = 0; i < n; i++) {
+		ret = add_key(set, &keys[i], dims, pfamily, NULL);
+		if (ret)
+			goto out;
+	}
+
+	for (i = 0; i < opt.rounds; i++) {
+		run_lookups(set, skbs, states, n, pfamily, &hit);
+		run_lookups(set, skbs + n, states + n, n, pfamily, &miss);
+	}
+	print_result(typename, family, shape, n, "hit", &hit);
+	print_result(typename, family, shape, n, "miss", &miss);
+	fflush(stdout);
+
+out:
+	if (set)
+		kshim_destroy(set);
+	free(keys);
+	free(skbs);
+	free(pkts);
+	free(states);
+	if (ret)
+		fprintf(stderr, "%s %s %s %u: error %d\n", typename,
+			bench_family_name(family), shape_names[shape], n, ret);
+	return ret;
+}
+
+static int
+bench_type(const char *typename, unsigned int dims, u8 family)
+{
+	unsigned int shape, i;
+	int ret = 0;
+
+	for (shape = 0; shape < SHAPE_MAX; shape++) {
+		if (!(opt.shapes & (1 << shape)))
+			continue;
+		for (i = 0; i < opt.nsizes; i++)
+			ret |= bench_size(typename, dims, family, shape,
+					  opt.sizes[i]);
+	}
+	return ret;
+}
+
+static int
+bench(const char *typename, int family)
+{
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; bench_types[i].name; i++) {
+		const struct ip_set_type *type;
+
+		if (typename && strcmp(bench_types[i].name, typename) != 0)
+			continue;
+		type = kshim_find_type(bench_types[i].name, NFPROTO_IPV4);
+		if (!type)
+			continue;
+		if (type->family == NFPROTO_UNSPEC &&
+		    !(type->features & IPSET_TYPE_IP)) {
+			ret |= bench_type(type->name, bench_types[i].dims,
+					  NFPROTO_UNSPEC);
+			continue;
+		}
+		if (family != NFPROTO_IPV6)
+			ret |= bench_type(type->name, bench_types[i].dims,
+					  NFPROTO_IPV4);
+		if (family != NFPROTO_IPV4)
+			ret |= bench_type(type->name, bench_types[i].dims,
+					  NFPROTO_IPV6);
+		if (typename)
+			return ret;
+	}
+	if (typename && !bench_types[i].name) {
+		fprintf(stderr, "Unknown set type %s\n", typename);
+		return -1;
+	}
+	return ret;
+}
+
+static int
+parse_sizes(char *arg)
+{
+	char *tok;
+
+	opt.nsizes = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (opt.nsizes == MAX_SIZES)
+			return -1;
+		opt.sizes[opt.nsizes] = strtoul(tok, NULL, 0);
+		if (!opt.sizes[opt.nsizes++])
+			return -1;
+	}
+	return opt.nsizes ? 0 : -1;
+}
+
+static int
+parse_shapes(char *arg)
+{
+	unsigned int shape;
+	char *tok;
+
+	opt.shapes = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		for (shape = 0; shape < SHAPE_MAX; shape++)
+			if (strcmp(tok, shape_names[shape]) == 0)
+				break;
+		if (shape == SHAPE_MAX)
+			return -1;
+		opt.shapes |= 1 << shape;
+	}
+	return opt.shapes ? 0 : -1;
+}
+
+static void
+usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	       "  -t TYPE       set type, all hash types by default\n"
+	       "  -f FAMILY     inet or inet6, both by default\n"
+	       "  -n N[,N...]   numbers of elements (1000,100000)\n"
+	       "  -P SHAPES     comma separated list of %s",
+	       prog, shape_names[0]);
+	for (unsigned int shape = 1; shape < SHAPE_MAX; shape++)
+		printf(",%s", shape_names[shape]);
+	printf("\n"
+	       "  -d DIST       seq, random or cluster addresses (random)\n"
+	       "  -c MIN[-MAX]  prefix lengths of the net types\n"
+	       "  -s SIZE       initial hashsize\n"
+	       "  -N NETMASK    netmask of hash:ip\n"
+	       "  -i N          interfaces of hash:net,iface (%u)\n"
+	       "  -W N          wildcard elements of hash:net,iface, added\n"
+	       "                before the elements to the same networks\n"
+	       "  -A            add the wildcard elements to the networks\n"
+	       "                of the missing packets instead\n"
+	       "  -T SECONDS    create the sets with timeout\n"
+	       "  -C            create the sets with counters\n"
+	       "  -x            create the sets with lookup statistics\n"
+	       "  -r N          rounds, the best and the mean are reported (%u)\n"
+	       "  -S SEED       random seed (%u)\n",
+	       opt.ifaces, opt.rounds, opt.seed);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *typename = NULL;
+	int family = NFPROTO_UNSPEC;
+	int c, dist, ret;
+
+	while ((c = getopt(argc, argv, "t:f:n:P:d:c:s:N:i:W:AT:Cxr:S:h")) != -1) {
+		switch (c) {
+		case 't':
+			typename = optarg;
+			break;
+		case 'f':
+			if (strcmp(optarg, "inet") == 0)
+				family = NFPROTO_IPV4;
+			else if (strcmp(optarg, "inet6") == 0)
+				family = NFPROTO_IPV6;
+			else
+				goto error;
+			break;
+		case 'n':
+			if (parse_sizes(optarg) < 0)
+				goto error;
+			break;
+		case 'P':
+			if (parse_shapes(optarg) < 0)
+				goto error;
+			break;
+		case 'd':
+			dist = bench_parse_dist(optarg);
+			if (dist < 0)
+				goto error;
+			opt.dist = dist;
+			break;
+		case 'c': {
+			unsigned int lo, hi;
+
+			switch (sscanf(optarg, "%u-%u", &lo, &hi)) {
+			case 1:
+				hi = lo;
+				/* Fall through */
+			case 2:
+				if (!lo || lo > hi || hi > 128)
+					goto error;
+				opt.cidr_min = lo;
+				opt.cidr_max = hi;
+				break;
+			default:
+				goto error;
+			}
+			break;
+		}
+		case 's':
+			opt.hashsize = strtoul(optarg, NULL, 0);
+			break;
+		case 'N':
+			opt.netmask = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			opt.ifaces = strtoul(optarg, NULL, 0);
+			break;
+		case 'W':
+			opt.wildcards = strtoul(optarg, NULL, 0);
+			break;
+		case 'A':
+			opt.wildcards_apart = true;
+			break;
+		case 'T':
+			opt.timeout = strtoul(optarg, NULL, 0);
+			break;
+		case 'C':
+			opt.counters = true;
+			break;
+		case 'x':
+			opt.stats = true;
+			break;
+		case 'r':
+			opt.rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			opt.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			goto error;
+		}
+	}
+	if (!opt.rounds || !opt.ifaces ||
+	    (family == NFPROTO_IPV4 && opt.cidr_max > 32))
+		goto error;
+
+	ifaces = calloc(opt.ifaces, sizeof(*ifaces));
+	if (!ifaces)
+		return 1;
+	for (unsigned int i = 0; i < opt.ifaces; i++)
+		bench_iface_name(ifaces[i].name, i);
+
+	counter_fd = bench_counter_open();
+	ret = bench(typename, family);
+	if (counter_fd >= 0)
+		close(counter_fd);
+	free(ifaces);
+	return ret ? 1 : 0;
+
+error:
+	usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,278 @@
+/* Copyright 2007-2010 Jozsef Kadlecsik (kadlec@netfilter.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Microbenchmark of adding and deleting IPv4 ranges to/from the
+ * hash:ip,port,net and hash:net,port,net types, like
+ *
+ *   add foo 10.0.0.0-10.0.255.255,tcp:1-1024,192.168.0.0/16
+ *
+ * with one uadt call, as the core does. Besides the times, the number
+ * of times the set was locked and the longest lock holding time are
+ * reported. The results are printed as one JSON object per line.
+ */
+
+#include <getopt.h>
+
+#include <linux/netfilter/ipset/pfxlen.h>
+
+#include "kbench.h"
+
+/* Benchmark parameters */
+static struct {
+	const char *type;
+	u32 ip, ip_to;
+	u32 port, port_to;
+	u32 ip2, ip2_to;
+	u32 hashsize;
+	u32 maxelem;
+	unsigned int rounds;
+} opt = {
+	.type		= "hash:ip,port,net",
+	.ip		= 0x0a000000,		/* 10.0.0.0-10.0.3.255 */
+	.ip_to		= 0x0a0003ff,
+	.port		= 1,
+	.port_to	= 64,
+	.ip2		= 0xc0a80000,		/* 192.168.0.0/16 */
+	.ip2_to		= 0xc0a8ffff,
+	.hashsize	= 1024,
+	.rounds		= 3,
+};
+
+struct range_result {
+	u64 best, total;		/* nanoseconds */
+	u64 locked, max_ns;
+	u32 elements;
+	size_t memsize;
+};
+
+/* a.b.c.d, a.b.c.d-e.f.g.h or a.b.c.d/cidr */
+static int
+parse_range(const char *str, u32 *from, u32 *to)
+{
+	unsigned int a[8], cidr;
+	char c;
+	int n;
+
+	n = sscanf(str, "%u.%u.%u.%u%c", &a[0], &a[1], &a[2], &a[3], &c);
+	if (n < 4)
+		return -1;
+	*from = a[0] << 24 | a[1] << 16 | a[2] << 8 | a[3];
+	*to = *from;
+	if (n == 4)
+		return 0;
+	if (c == '-') {
+		if (sscanf(strchr(str, '-') + 1, "%u.%u.%u.%u",
+			   &a[4], &a[5], &a[6], &a[7]) != 4)
+			return -1;
+		*to = a[4] << 24 | a[5] << 16 | a[6] << 8 | a[7];
+		return *from <= *to ? 0 : -1;
+	}
+	if (c == '/') {
+		if (sscanf(strchr(str, '/') + 1, "%u", &cidr) != 1 ||
+		    !cidr || cidr > 32)
+			return -1;
+		ip_set_mask_from_to(*from, *to, cidr);
+		return 0;
+	}
+	return -1;
+}
+
+static int
+parse_ports(const char *str, u32 *from, u32 *to)
+{
+	switch (sscanf(str, "%u-%u", from, to)) {
+	case 1:
+		*to = *from;
+		/* Fall through */
+	case 2:
+		return *from <= *to && *to <= 65535 ? 0 : -1;
+	default:
+		return -1;
+	}
+}
+
+static int
+create_set(struct ip_set **set)
+{
+	struct nlattr *tb[IPSET_ATTR_CREATE_MAX + 1] = {};
+	unsigned char buf[256];
+	struct sk_buff skb;
+	struct nlattr *nla;
+	int rem;
+
+	kshim_skb_init(&skb, buf, sizeof(buf));
+	nla_put_net32(&skb, IPSET_ATTR_HASHSIZE, htonl(opt.hashsize));
+	nla_put_net32(&skb, IPSET_ATTR_MAXELEM, htonl(opt.maxelem));
+	nla_for_each_attr(nla, (struct nlattr *)buf, skb.len, rem)
+		tb[nla_type(nla)] = nla;
+
+	return kshim_create(opt.type, NFPROTO_IPV4, 0, tb, set);
+}
+
+/* The attributes of the range element */
+static void
+put_range(struct sk_buff *skb)
+{
+	nla_put_net32(skb, IPSET_ATTR_LINENO, 0);
+	bench_put_addr(skb, IPSET_ATTR_IP, NFPROTO_IPV4, &opt.ip);
+	bench_put_addr(skb, IPSET_ATTR_IP_TO, NFPROTO_IPV4, &opt.ip_to);
+	nla_put_net16(skb, IPSET_ATTR_PORT, htons(opt.port));
+	nla_put_net16(skb, IPSET_ATTR_PORT_TO, htons(opt.port_to));
+	nla_put_u8(skb, IPSET_ATTR_PROTO, IPPROTO_TCP);
+	bench_put_addr(skb, IPSET_ATTR_IP2, NFPROTO_IPV4, &opt.ip2);
+	bench_put_addr(skb, IPSET_ATTR_IP2_TO, NFPROTO_IPV4, &opt.ip2_to);
+}
+
+static int
+run_range(struct ip_set *set, struct nlattr *tb[], enum ipset_adt adt,
+	  struct range_result *r)
+{
+	u64 start, t;
+	int ret;
+
+	memset(&kshim_lock_stats, 0, sizeof(kshim_lock_stats));
+	start = bench_now();
+	ret = kshim_uadt(set, tb, adt, 0);
+	t = bench_now() - start;
+	if (ret)
+		return ret;
+
+	if (!r->best || t < r->best)
+		r->best = t;
+	r->total += t;
+	r->locked = kshim_lock_stats.locked;
+	r->max_ns = max(r->max_ns, kshim_lock_stats.max_ns);
+	r->elements = set->elements;
+	if (adt == IPSET_ADD)
+		r->memsize = set->variant->memsize(set);
+	return 0;
+}
+
+static void
+print_result(const char *op, const struct range_result *r, u32 n)
+{
+	printf("{\"bench\":\"range\",\"type\":\"%s\",\"op\":\"%s\","
+	       "\"elements\":%u,\"hashsize\":%u,\"rounds\":%u,"
+	       "\"best_ms\":%.3f,\"mean_ms\":%.3f,\"best_ns\":%.1f,"
+	       "\"locked\":%llu,\"max_lock_us\":%.1f,\"result\":%u",
+	       opt.type, op, n, opt.hashsize, opt.rounds,
+	       r->best / 1e6, r->total / 1e6 / opt.rounds,
+	       (double)r->best / n, (unsigned long long)r->locked,
+	       r->max_ns / 1e3, r->elements);
+	if (r->memsize)
+		printf(",\"memsize\":%zu", r->memsize);
+	printf("}\n");
+}
+
+static int
+bench(void)
+{
+	struct nlattr *tb[IPSET_ATTR_ADT_MAX + 1];
+	struct range_result add = {}, del = {};
+	unsigned char buf[256];
+	struct sk_buff skb;
+	struct ip_set *set;
+	unsigned int i;
+	u32 n;
+	int ret = 0;
+
+	kshim_skb_init(&skb, buf, sizeof(buf));
+	put_range(&skb);
+	nla_parse(tb, IPSET_ATTR_ADT_MAX, (struct nlattr *)buf, skb.len, NULL);
+
+	for (i = 0; !ret && i < opt.rounds; i++) {
+		ret = create_set(&set);
+		if (ret)
+			break;
+		ret = run_range(set, tb, IPSET_ADD, &add);
+		if (!ret)
+			ret = run_range(set, tb, IPSET_DEL, &del);
+		kshim_destroy(set);
+	}
+	if (ret) {
+		fprintf(stderr, "%s: error %d\n", opt.type, ret);
+		return ret;
+	}
+	n = add.elements;
+	print_result("add", &add, n);
+	print_result("del", &del, n);
+	fflush(stdout);
+	return 0;
+}
+
+static void
+usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	       "  -t TYPE       hash:ip,port,net or hash:net,port,net (%s)\n"
+	       "  -a RANGE      first address range (10.0.0.0-10.0.3.255)\n"
+	       "  -p PORTS      tcp port range (%u-%u)\n"
+	       "  -b RANGE      second address range (192.168.0.0/16)\n"
+	       "  -s SIZE       initial hashsize (%u)\n"
+	       "  -m N          maxelem (the number of elements)\n"
+	       "  -r N          rounds, the best and the mean are reported (%u)\n",
+	       prog, opt.type, opt.port, opt.port_to, opt.hashsize,
+	       opt.rounds);
+}
+
+int
+main(int argc, char *argv[])
+{
+	u64 n;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:a:p:b:s:m:r:h")) != -1) {
+		switch (c) {
+		case 't':
+			if (strcmp(optarg, "hash:ip,port,net") != 0 &&
+			    strcmp(optarg, "hash:net,port,net") != 0)
+				goto error;
+			opt.type = optarg;
+			break;
+		case 'a':
+			if (parse_range(optarg, &opt.ip, &opt.ip_to))
+				goto error;
+			break;
+		case 'p':
+			if (parse_ports(optarg, &opt.port, &opt.port_to))
+				goto error;
+			break;
+		case 'b':
+			if (parse_range(optarg, &opt.ip2, &opt.ip2_to))
+				goto error;
+			break;
+		case 's':
+			opt.hashsize = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			opt.maxelem = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			opt.rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			goto error;
+		}
+	}
+	if (!opt.rounds)
+		goto error;
+	if (!opt.maxelem) {
+		/* Upper bound of the number of elements */
+		n = ((u64)opt.ip_to - opt.ip + 1) *
+		    (opt.port_to - opt.port + 1) * 32;
+		opt.maxelem = min_t(u64, n, UINT_MAX);
+	}
+
+	return bench() ? 1 : 0;
+
+error:
+	usage(argv[0]);
+	return 1;
+}
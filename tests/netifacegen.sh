@@ -0,0 +1,27 @@
+#!/bin/sh
+
+# Generate a heavily loaded hash:net,iface set where every element
+# carries a distinct comment of the maximal size (255 characters):
+#
+#	./netifacegen.sh [elements] [interfaces] | ipset restore
+#
+# The buckets of the small hash table do not fit into a single netlink
+# message, so listing must resume in the middle of the buckets. With
+# the interfaces argument, that many elements share a network with
+# different interfaces: all of them are stored in the same bucket.
+
+elements=${1:-4096}
+share=${2:-1}
+
+filler=`printf '%0247d' 0 | tr 0 x`
+
+echo "n test hash:net,iface hashsize 64 maxelem $elements comment"
+for i in `seq 0 $((elements - 1))`; do
+    net=$((i / share))
+    if [ $share -gt 1 ]; then
+        iface=$((i % share))
+    else
+        iface=$((i % 16))
+    fi
+    echo "a test 10.$((net >> 8)).$((net & 255)).0/24,eth$iface comment \"`printf '%08d' $i`$filler\""
+done
@@ -0,0 +1,33 @@
+#!/bin/sh
+
+# Compare saving many sets sequentially and in parallel jobs:
+#
+#	./parallelsave.sh [sets [elements [jobs]]]
+#
+# The outputs must be identical, list:set type of sets come last.
+
+sets=${1:-1000}
+elements=${2:-10000}
+jobs=${3:-8}
+
+ipset f >/dev/null 2>&1
+ipset x >/dev/null 2>&1
+awk -v s=$sets -v n=$elements 'BEGIN {
+    for (i = 0; i < s; i++) {
+        printf "n test%d hash:ip maxelem %d\n", i, n
+        for (j = 0; j < n; j++)
+            printf "a test%d 10.%d.%d.%d\n", i,
+                   int(j / 65536), int(j / 256) % 256, j % 256
+    }
+    print "n all list:set size " s
+    for (i = 0; i < s && i < 8; i++)
+        printf "a all test%d\n", i
+}' | ipset restore || exit 1
+time ipset save > .foo.seq
+time ipset -j $jobs save > .foo.par
+diff -q .foo.seq .foo.par
+ret=$?
+rm -f .foo.seq .foo.par
+ipset f
+ipset x
+exit $ret
@@ -0,0 +1,27 @@
+#!/bin/sh
+
+# Restore hostname elements resolved ahead, with the names of a private
+# hosts file bind mounted over /etc/hosts in a new mount namespace:
+#
+#	./resolve.sh
+#
+# The restore fails at the unresolvable name: the error must report its
+# line and the elements sent to the kernel before it must be in the sets.
+
+ipset=${IPSET_BIN:-../src/ipset}
+
+if [ "$1" != "ns" ]; then
+	exec unshare -m sh -c \
+		'mount --bind "$1" /etc/hosts && exec "$2" ns' \
+		sh "$PWD/restore.t.hosts" "$0"
+fi
+
+$ipset x >/dev/null 2>&1
+# Not created in the restore file: its names are resolved ahead as IPv4
+# names, then looked up again as IPv6 ones when their line is parsed
+$ipset n test6 hash:ip family inet6 || exit 1
+$ipset restore < restore.t.resolve 2> .foo.err && exit 1
+grep -q "Error in line 9: .*nosuch\.invalid" .foo.err || exit 1
+$ipset -s save > .foo
+diff restore.t.resolve.saved .foo || exit 1
+$ipset x
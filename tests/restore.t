@@ -4,6 +4,45 @@
 0 ipset save > .foo && diff restore.t.multi.saved .foo
 # Delete all sets
 0 ipset x
+# Check interleaved restore grouped by set
+0 ./grouprestore.sh 10 10000
+# Check error in interleaved restore grouped by set
+1 ipset -g restore < restore.t.interleaved
+# Check the line number of the error
+0 grep -q "Error in line 8:" .foo.err
+# Delete all sets
+0 ipset x
+# Check long lines, CRLF endings and a last line without newline
+0 ./restorelines.sh
+# Check restore with the networks of hash:net sets aggregated
+0 ipset -aggregate restore < restore.t.aggregate
+# Save sets and compare
+0 ipset -s save > .foo && diff restore.t.aggregate.saved .foo
+# Delete all sets
+0 ipset x
+# Check restore with aggregation failing at a later line
+1 ipset -aggregate restore < restore.t.aggregate.failed
+# The networks of the lines before the failed one are added
+0 ipset -s save > .foo && diff restore.t.aggregate.failed.saved .foo
+# Delete all sets
+0 ipset x
+# Compare the sets restored with and without aggregation
+0 ./aggregate.sh 5000 > /dev/null
+# Check restore with the networks of hash:net sets quantized
+0 ipset restore < restore.t.quantize
+# Save sets and compare
+0 ipset -s save > .foo && diff restore.t.quantize.saved .foo
+# Check the prefix lengths in the listing
+0 ipset -t list test-quantize | grep -q '^Prefix lengths: 26 24$'
+# Try to add an element of a third prefix length
+1 ipset a test-quantize 10.3.0.0/16
+# Delete all sets
+0 ipset x
+# Compare the sets restored with and without quantizing
+0 ./aggregate.sh 5000 1 3 > /dev/null
+# Check hostnames resolved ahead and the line of an unresolvable one
+0 ./resolve.sh
+skip test -z "$IPSET_FAKE_STATE"
 # Check auto-increasing maximal number of sets
 0 ./setlist_resize.sh
 # eof
@@ -0,0 +1,117 @@
+#!/bin/sh
+
+# Measure the throughput of restore from a file and from a pipe, list,
+# save and sorted save on generated restore files:
+#
+#	./restorebench.sh [elements [seed]]
+#
+# Run it as root against the kernel, or set IPSET_FAKE_STATE to use
+# the kernel emulated by the library. The elements are
+# spread over sets of the common types with random addresses, mixed
+# prefix lengths, port ranges, comments and timeouts. Every step
+# prints a JSON line with the elapsed time and the parse, encode,
+# kernel and format phases reported by the -phases option. List and
+# save cover all sets, so better run it without other sets.
+
+ipset=${IPSET_BIN:-../src/ipset}
+
+elements=${1:-100000}
+seed=${2:-1}
+sets="rbench-ip rbench-net rbench-port rbench-comment rbench-net6"
+
+if [ -n "$IPSET_FAKE_STATE" ]; then
+    transport=fake
+else
+    transport=kernel
+fi
+
+destroy() {
+    for s in $sets; do
+	$ipset x $s >/dev/null 2>&1
+    done
+}
+
+now() {
+    date +%s.%N
+}
+
+# step start end: print the result of a step from the -phases line
+report() {
+    awk -v step=$1 -v t=$transport -v n=$elements -v s=$2 -v e=$3 '
+    /^phases:/ {
+        printf "{\"step\":\"%s\",\"transport\":\"%s\",\"elements\":%d,", \
+               step, t, n
+        printf "\"seconds\":%.6f", e - s
+        for (i = 2; i <= NF; i++) {
+            split($i, kv, "=")
+            printf ",\"%s\":%s", kv[1], kv[2]
+        }
+        printf "}\n"
+        found = 1
+    }
+    !/^phases:/ { print > "/dev/stderr" }
+    END { exit !found }' .foo.err
+}
+
+# step args...: run and time an ipset command, discarding its output
+run() {
+    step=$1
+    shift
+    start=$(now)
+    $ipset -phases "$@" >/dev/null 2>.foo.err
+    ret=$?
+    end=$(now)
+    report $step $start $end || ret=1
+    return $ret
+}
+
+awk -v n=$elements -v seed=$seed 'BEGIN {
+    srand(seed)
+    k = int(n / 5) + 1
+    print "create rbench-ip hash:ip timeout 3600 maxelem " 2 * k
+    print "create rbench-net hash:net maxelem " 2 * k
+    print "create rbench-port hash:ip,port maxelem " 8 * k
+    print "create rbench-comment hash:net,port comment maxelem " 2 * k
+    print "create rbench-net6 hash:net family inet6 maxelem " 2 * k
+    for (i = 0; i < k; i++) {
+        # Half of the elements with their own timeout
+        if (i % 2)
+            printf "add rbench-ip %s timeout %d\n", ip(), 60 + int(rand() * 3600)
+        else
+            printf "add rbench-ip %s\n", ip()
+
+        # Prefix lengths mostly /24, like netgen.sh
+        r = rand()
+        cidr = r < 0.6 ? 24 : r < 0.75 ? 16 : r < 0.85 ? 20 : r < 0.95 ? 28 : 32
+        printf "add rbench-net %s/%d\n", ip(), cidr
+
+        # Single ports and short port ranges
+        port = 1 + int(rand() * 65000)
+        proto = rand() < 0.7 ? "tcp" : "udp"
+        if (rand() < 0.2)
+            printf "add rbench-port %s,%s:%d-%d\n", ip(), proto, port,
+                   port + int(rand() * 4)
+        else
+            printf "add rbench-port %s,%s:%d\n", ip(), proto, port
+
+        printf "add rbench-comment %s/%d,tcp:%d comment \"rule %d of %s\"\n",
+               ip(), 16 + int(rand() * 17), port, i, proto
+
+        printf "add rbench-net6 2001:db8:%x:%x::/%d\n",
+               int(rand() * 65536), int(rand() * 65536), 48 + 8 * int(rand() * 3)
+    }
+}
+function ip() {
+    return sprintf("%d.%d.%d.%d", 1 + int(rand() * 223), int(rand() * 256),
+                   int(rand() * 256), 1 + int(rand() * 254))
+}' > .foo.restore
+
+destroy
+cat .foo.restore | run restore-pipe -exist restore || exit 1
+destroy
+run restore -exist restore < .foo.restore || exit 1
+run list list || exit 1
+run save save || exit 1
+run sorted-save -sorted save || exit 1
+destroy
+rm -f .foo.restore .foo.err
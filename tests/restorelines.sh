@@ -0,0 +1,61 @@
+#!/bin/sh
+
+# Restore lines at and over the maximal line length, lines with CRLF
+# endings and a last line without newline, from a file and from a pipe.
+# Long lines are split at 1023 characters like fgets() did, so the line
+# numbers in the error messages do not change:
+#
+#	./restorelines.sh
+
+ipset=${IPSET_BIN:-../src/ipset}
+
+# The line padded with spaces to the given length, without the newline
+pad() {
+	printf "%-${2}s\n" "$1"
+}
+
+lines() {
+	echo "create test hash:ip"
+	# Fits into the line buffer with the newline
+	pad "add test 10.0.0.1" 1022
+	# The newline is read as an empty line
+	pad "add test 10.0.0.2" 1023
+	# The rest of the spaces are read as a line
+	pad "add test 10.0.0.3" 1500
+	printf 'add test 10.0.0.4\r\n'
+	printf 'COMMIT\r\n'
+	printf 'add test %s' "$1"
+}
+
+cat > .foo.saved <<EOT
+create test hash:ip family inet hashsize 1024 maxelem 65536
+add test 10.0.0.1
+add test 10.0.0.2
+add test 10.0.0.3
+add test 10.0.0.4
+add test 10.0.0.5
+EOT
+
+for input in file pipe; do
+	lines 10.0.0.5 > .foo.restore
+	$ipset x >/dev/null 2>&1
+	if [ $input = file ]; then
+		$ipset restore < .foo.restore || exit 1
+	else
+		cat .foo.restore | $ipset restore || exit 1
+	fi
+	$ipset -s save > .foo
+	diff .foo.saved .foo || exit 1
+
+	# The last line is the ninth one
+	lines 10.0.0.1 > .foo.restore
+	$ipset x
+	if [ $input = file ]; then
+		$ipset restore < .foo.restore 2> .foo.err && exit 1
+	else
+		cat .foo.restore | $ipset restore 2> .foo.err && exit 1
+	fi
+	grep -q 'Error in line 9:' .foo.err || exit 1
+done
+$ipset x
+rm -f .foo.restore .foo.saved .foo.err
@@ -0,0 +1,20 @@
+#!/bin/sh
+
+# Measure the end-to-end time of saving a big hash:net set:
+#
+#	./savebench.sh [elements]
+#
+# Sets without extensions are dumped in packed element records when
+# the kernel supports it.
+
+elements=${1:-5000000}
+
+ipset x test >/dev/null 2>&1
+awk -v n=$elements 'BEGIN {
+    print "n test hash:net hashsize 1048576 maxelem " n
+    for (i = 0; i < n; i++)
+        printf "a test %d.%d.%d.0/24\n",
+               10 + int(i / 65536), int(i / 256) % 256, i % 256
+}' | ipset restore
+time ipset save test > /dev/null
+ipset x test
@@ -30,6 +30,10 @@
 1 ipset -T test foo,after,bar
 # Save sets
 0 ipset -S > setlist.t.r
+# Save sets in parallel jobs
+0 ipset -j 4 -S > .foo
+# Check that parallel save gives the same output
+0 diff -u setlist.t.r .foo
 # Delete bar,before,foo
 1 ipset -D test bar,before,foo
 # Delete foo,after,bar
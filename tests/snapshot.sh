@@ -0,0 +1,102 @@
+#!/bin/sh
+
+# Round-trip the sets of all types through a binary snapshot and
+# compare the result with the text save:
+#
+#	./snapshot.sh file|stdin|pipe|truncated
+
+ipset=${IPSET_BIN:-../src/ipset}
+
+mode=${1:-file}
+
+$ipset f >/dev/null 2>&1
+$ipset x >/dev/null 2>&1
+
+awk 'BEGIN {
+    print "n bip bitmap:ip range 10.0.0.0/16 counters comment"
+    print "a bip 10.0.0.1 packets 5 bytes 500 comment \"first\""
+    print "a bip 10.0.255.255"
+    print "n bipmac bitmap:ip,mac range 10.0.0.0/24"
+    print "a bipmac 10.0.0.1,00:11:22:33:44:55"
+    print "n bport bitmap:port range 1-1024 skbinfo"
+    print "a bport 80 skbmark 0x10/0xff skbprio 1:10 skbqueue 2"
+    print "a bport 443"
+    print "n hip hash:ip"
+    print "n hip6 hash:ip family inet6"
+    print "n hipext hash:ip counters comment skbinfo timeout 600"
+    print "a hipext 10.0.0.1 timeout 300 packets 1 bytes 64 comment \"x y\" skbmark 0x1"
+    print "a hipext 10.0.0.2 timeout 0"
+    print "n hmac hash:mac"
+    print "a hmac 00:11:22:33:44:55"
+    print "n hipmac hash:ip,mac"
+    print "a hipmac 10.0.0.1,00:11:22:33:44:55"
+    print "n hipmark hash:ip,mark markmask 0xff00"
+    print "a hipmark 10.0.0.1,0x1100"
+    print "n hipport hash:ip,port"
+    print "a hipport 10.0.0.1,tcp:80"
+    print "a hipport 10.0.0.1,udp:53"
+    print "n hipportip hash:ip,port,ip"
+    print "a hipportip 10.0.0.1,udp:53,10.0.0.2"
+    print "n hipportnet hash:ip,port,net"
+    print "a hipportnet 10.0.0.1,tcp:80,192.168.0.0/24"
+    print "n hnet hash:net"
+    print "n hnet6 hash:net family inet6"
+    print "a hnet 192.168.1.0/24 nomatch"
+    print "n hnetnet hash:net,net"
+    print "a hnetnet 10.0.0.0/8,192.168.0.0/16"
+    print "n hnetport hash:net,port"
+    print "a hnetport 10.0.0.0/8,tcp:22"
+    print "n hnetportnet hash:net,port,net"
+    print "a hnetportnet 10.0.0.0/8,tcp:22,192.168.0.0/16"
+    print "n hnetiface hash:net,iface"
+    print "a hnetiface 10.0.0.0/8,eth0"
+    print "a hnetiface 10.1.0.0/16,physdev:eth1"
+    print "n lset list:set"
+    print "a lset hip"
+    print "a lset hnet"
+    # Enough elements to span several messages
+    for (i = 0; i < 20000; i++) {
+        printf "a hip 10.%d.%d.%d\n", int(i / 65536), int(i / 256) % 256, i % 256
+        printf "a hip6 2001:db8::%x\n", i
+        printf "a hnet 10.%d.%d.0/24\n", int(i / 256), i % 256
+        printf "a hnet6 2001:db8:%x::/48\n", i
+    }
+}' | $ipset restore || exit 1
+
+# The remaining timeout values and the hash order may differ
+normalize() {
+    sed 's/ timeout [0-9]*//' | sort
+}
+
+$ipset save | normalize > .foo.txt
+$ipset -o binary save > .foo.bin || exit 1
+$ipset f
+$ipset x
+
+case "$mode" in
+file)
+	$ipset restore -file .foo.bin || exit 1
+	;;
+stdin)
+	$ipset restore < .foo.bin || exit 1
+	;;
+pipe)
+	cat .foo.bin | $ipset restore || exit 1
+	;;
+truncated)
+	size=`wc -c < .foo.bin`
+	head -c $((size / 2)) .foo.bin | $ipset restore 2>/dev/null && exit 1
+	$ipset f
+	$ipset x
+	rm -f .foo.txt .foo.bin
+	exit 0
+	;;
+esac
+
+$ipset save | normalize > .foo.restored
+diff -u .foo.txt .foo.restored
+ret=$?
+rm -f .foo.txt .foo.bin .foo.restored
+$ipset f
+$ipset x
+exit $ret
@@ -0,0 +1,9 @@
+# Binary snapshot: restore from file
+0 ./snapshot.sh file
+# Binary snapshot: restore from standard input
+0 ./snapshot.sh stdin
+# Binary snapshot: restore from pipe
+0 ./snapshot.sh pipe
+# Binary snapshot: truncated snapshot is rejected
+0 ./snapshot.sh truncated
+# eof
@@ -0,0 +1,45 @@
+#!/bin/sh
+
+# Measure the startup overhead of short-lived ipset invocations:
+#
+#	./startbench.sh [runs]
+#
+# Set types are registered on demand, so a single add/test loads
+# the type of the given set only. Run it as root against the kernel,
+# or set IPSET_FAKE_STATE to use the kernel emulated by the library.
+# The average elapsed time of an invocation is printed together with
+# the time spent in registering the set types, from the -phases line.
+
+ipset=${IPSET_BIN:-../src/ipset}
+
+runs=${1:-1000}
+
+# cmd args...: run the command $runs times, print the average times
+bench() {
+	cmd=$1
+	shift
+	start=`date +%s%N`
+	i=0
+	while [ $i -lt $runs ]; do
+		$ipset -phases "$@" 2>&1 >/dev/null | grep '^phases:'
+		i=$((i + 1))
+	done | awk -v cmd=$cmd -v start=$start '{
+		for (i = 2; i <= NF; i++) {
+			split($i, kv, "=")
+			if (kv[1] == "types")
+				t += kv[2]
+		}
+		n++
+	}
+	END {
+		"date +%s%N" | getline end
+		printf "%s: %d runs, %.1f usec/run, types %.1f usec/run\n",
+		       cmd, n, (end - start) / 1000 / n, t * 1000000 / n
+	}'
+}
+
+$ipset x test >/dev/null 2>&1
+$ipset n test hash:ip
+bench add add test 10.0.0.1 -exist
+bench test test test 10.0.0.1
+$ipset x test
@@ -0,0 +1,132 @@
+/* Copyright 2007-2010 Jozsef Kadlecsik (kadlec@netfilter.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Example of the non-blocking libipset session API:
+ *
+ *	ipset_async [-n inflight] add|del|test SETNAME < elements
+ *
+ * The elements are read from stdin, one per line, and submitted from
+ * an epoll based event loop with at most "inflight" commands waiting
+ * for the kernel. The failed lines are reported on stderr.
+ */
+#include <stdio.h>			/* fprintf */
+#include <stdlib.h>			/* exit */
+#include <string.h>			/* str* */
+#include <unistd.h>			/* getopt */
+#include <sys/epoll.h>			/* epoll_* */
+
+#include <libipset/utils.h>		/* STREQ */
+#include <libipset/ipset.h>		/* ipset library */
+
+static unsigned int failed;
+
+static void
+done(struct ipset_session *session, int status, uint32_t lineno,
+     const char *msg, void *p)
+{
+	if (status != 0) {
+		failed++;
+		fprintf(stderr, "%s", msg ? msg : "Unknown error\n");
+	}
+}
+
+static int
+submit(struct ipset_session *session, enum ipset_cmd cmd,
+       const char *setname, char *elem, uint32_t lineno)
+{
+	const struct ipset_type *type;
+
+	elem[strcspn(elem, "\r\n")] = '\0';
+	if (elem[0] == '\0')
+		return 0;
+	if (ipset_parse_setname(session, IPSET_SETNAME, setname) < 0)
+		return -1;
+	/* The header of the set is queried at its first use only */
+	type = ipset_type_get(session, cmd);
+	if (type == NULL)
+		return -1;
+	if (ipset_parse_elem(session, type->last_elem_optional, elem) < 0)
+		return -1;
+	return ipset_cmd_async(session, cmd, lineno, done, NULL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct ipset_session *session;
+	struct epoll_event ev = { .events = EPOLLIN };
+	unsigned int inflight = 64;
+	enum ipset_cmd cmd;
+	char line[1024];
+	uint32_t lineno = 0;
+	bool eof = false;
+	int c, fd, efd;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			inflight = atoi(optarg) > 0 ? atoi(optarg) : 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind != 2)
+		goto usage;
+	if (STREQ(argv[optind], "add"))
+		cmd = IPSET_CMD_ADD;
+	else if (STREQ(argv[optind], "del"))
+		cmd = IPSET_CMD_DEL;
+	else if (STREQ(argv[optind], "test"))
+		cmd = IPSET_CMD_TEST;
+	else
+		goto usage;
+
+	ipset_load_types();
+	session = ipset_session_init(NULL, NULL);
+	if (session == NULL) {
+		fprintf(stderr, "Cannot initialize ipset session, aborting.\n");
+		exit(1);
+	}
+	fd = ipset_session_fd(session);
+	efd = epoll_create1(0);
+	if (fd < 0 || efd < 0 ||
+	    epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		goto error;
+
+	while (!eof || ipset_async_pending(session) > 0) {
+		/* Fill up the window */
+		while (!eof && ipset_async_pending(session) < inflight) {
+			if (fgets(line, sizeof(line), stdin) == NULL) {
+				eof = true;
+				break;
+			}
+			if (submit(session, cmd, argv[optind + 1],
+				   line, ++lineno) < 0)
+				goto error;
+		}
+		if (ipset_async_pending(session) == 0)
+			break;
+		if (epoll_wait(efd, &ev, 1, -1) < 0)
+			goto error;
+		if (ipset_async_process(session) < 0)
+			goto error;
+	}
+	close(efd);
+	ipset_session_fini(session);
+	return failed ? 1 : 0;
+
+error:
+	fprintf(stderr, "%s", ipset_session_report_msg(session));
+	ipset_session_fini(session);
+	return 1;
+
+usage:
+	fprintf(stderr, "Usage: %s [-n inflight] add|del|test SETNAME "
+		"< elements\n", argv[0]);
+	return 2;
+}
@@ -0,0 +1,179 @@
+/* Copyright 2007-2010 Jozsef Kadlecsik (kadlec@netfilter.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* The memory vs lookup cost trade-off of the cidr-quantize option of
+ * hash:net sets:
+ *
+ *	ipset_quantize [-s SETNAME] < restore-file
+ *
+ * The elements are read from the add lines of a restore file or from
+ * a plain list of networks, one per line. For every possible value of
+ * cidr-quantize, the chosen prefix lengths and the number of the
+ * networks the elements are expanded into are printed. A lookup in
+ * the set probes the hash once for every prefix length, the memory
+ * column is the size of the networks in the hash buckets. The elements
+ * with more words, like nomatch or extensions, are not expanded.
+ */
+#include <arpa/inet.h>			/* inet_pton */
+#include <errno.h>			/* ERANGE */
+#include <stdio.h>			/* fprintf */
+#include <stdlib.h>			/* strtoul */
+#include <string.h>			/* str* */
+#include <unistd.h>			/* getopt */
+
+#include <libipset/nfproto.h>		/* NFPROTO_* */
+#include <libipset/utils.h>		/* STREQ */
+#include <libipset/aggregate.h>		/* ipset_aggr_* */
+
+/* The size of the IPv4 and IPv6 hash:net elements in the kernel */
+#define ELEM_SIZE(family)	((family) == NFPROTO_IPV4 ? 8 : 20)
+
+static int
+count(const union nf_inet_addr *ip, uint8_t cidr, void *p)
+{
+	(*(uint64_t *) p)++;
+	return 0;
+}
+
+/* Add a network, a range or an address */
+static int
+parse_elem(struct ipset_aggr **aggr, uint8_t *family, char *elem,
+	   bool fixed)
+{
+	union nf_inet_addr ip = {}, ip_to = {};
+	char *to = NULL, *mask;
+	unsigned long cidr = 0;
+	uint8_t f = strchr(elem, ':') ? NFPROTO_IPV6 : NFPROTO_IPV4;
+
+	mask = strchr(elem, '/');
+	if (mask != NULL) {
+		*mask++ = '\0';
+		cidr = strtoul(mask, &mask, 10);
+		if (*mask != '\0' || cidr == 0 ||
+		    cidr > (f == NFPROTO_IPV4 ? 32 : 128))
+			return -1;
+	} else if (f == NFPROTO_IPV4 && (to = strchr(elem, '-')) != NULL) {
+		*to++ = '\0';
+		if (inet_pton(AF_INET, to, &ip_to) != 1)
+			return -1;
+	}
+	if (inet_pton(f == NFPROTO_IPV4 ? AF_INET : AF_INET6, elem, &ip) != 1)
+		return -1;
+	if (*aggr == NULL) {
+		*family = f;
+		*aggr = ipset_aggr_init(f);
+		if (*aggr == NULL)
+			return -ENOMEM;
+	} else if (f != *family) {
+		return -1;
+	}
+	return ipset_aggr_add(*aggr, &ip, to ? &ip_to : NULL, cidr, fixed) < 0
+	       ? -ENOMEM : 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct ipset_aggr *aggr = NULL;
+	const char *setname = NULL;
+	char line[1024], *w[4], *save;
+	uint32_t lineno = 0, ignored = 0;
+	uint8_t family = NFPROTO_IPV4, cidrs[129];
+	uint64_t cost, networks, elements = 0, fixed = 0;
+	unsigned int n, max, i, last = 0;
+	int c, k, ret;
+
+	while ((c = getopt(argc, argv, "s:")) != -1) {
+		switch (c) {
+		case 's':
+			setname = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc != optind)
+		goto usage;
+
+	while (fgets(line, sizeof(line), stdin) != NULL) {
+		lineno++;
+		for (k = 0; k < 4; k++)
+			w[k] = strtok_r(k ? NULL : line, " \t\r\n", &save);
+		if (w[0] == NULL || w[0][0] == '#')
+			continue;
+		if (STREQ(w[0], "add") || STREQ(w[0], "-A")) {
+			if (w[1] == NULL || w[2] == NULL)
+				goto error;
+			if (setname != NULL && !STREQ(w[1], setname))
+				continue;
+			ret = parse_elem(&aggr, &family, w[2], w[3] != NULL);
+			fixed += ret == 0 && w[3] != NULL;
+		} else if (strchr("0123456789abcdefABCDEF:", w[0][0]) &&
+			   !STREQ(w[0], "create")) {
+			ret = parse_elem(&aggr, &family, w[0], w[1] != NULL);
+			fixed += ret == 0 && w[1] != NULL;
+		} else {
+			/* Other restore commands */
+			continue;
+		}
+		if (ret == -ENOMEM)
+			goto nomem;
+		if (ret < 0) {
+			ignored++;
+			continue;
+		}
+		elements++;
+	}
+	if (aggr == NULL) {
+		fprintf(stderr, "No elements found.\n");
+		return 1;
+	}
+	if (ignored)
+		fprintf(stderr, "%u lines with invalid elements ignored.\n",
+			ignored);
+
+	/* All the lengths: the elements are added as they are */
+	max = ipset_aggr_quantize_plan(aggr, 129, cidrs, &cost);
+	printf("# %llu elements, %u prefix lengths\n",
+	       (unsigned long long) elements, max);
+	printf("# %7s %10s %12s  %s\n",
+	       "lengths", "networks", "memory", "prefix lengths");
+	for (n = 1; n <= max; n++) {
+		k = ipset_aggr_quantize_plan(aggr, n, cidrs, &cost);
+		/* The fixed lengths are chosen anyway */
+		if ((unsigned int) k == last)
+			continue;
+		last = k;
+		networks = fixed;
+		ret = ipset_aggr_quantize(aggr, n, count, &networks);
+		if (ret == -ERANGE) {
+			printf("  %7u %10s %12s ", k, "-", "-");
+		} else {
+			printf("  %7u %10llu %12llu ", k,
+			       (unsigned long long) networks,
+			       (unsigned long long) networks *
+			       ELEM_SIZE(family));
+		}
+		for (i = 0; i < (unsigned int) k; i++)
+			printf(" /%u", cidrs[i]);
+		printf("\n");
+	}
+	ipset_aggr_fini(aggr);
+	return 0;
+
+error:
+	fprintf(stderr, "Syntax error in line %u.\n", lineno);
+	return 1;
+
+nomem:
+	fprintf(stderr, "Cannot allocate memory.\n");
+	return 1;
+
+usage:
+	fprintf(stderr, "Usage: %s [-s SETNAME] < restore-file\n", argv[0]);
+	return 2;
+}